@@ -1,34 +1,94 @@
-#ifndef __ABSTRACT_HANDLER_H__
-#define __ABSTRACT_HANDLER_H__
-
-#include "../timers.h"
-
-/*!
- * \brief The AbstractHandler class is inherited by all handlers. It forms the basis of any handler, by having
- * a simple \a run function, called in main.cpp, and a \a setRequest function which is used to set a request
- * specific to the reimplemented class.
- */
-class AbstractHandler
-{
-public:
-    AbstractHandler(MyTimers *_timer) : m_timer(_timer) {}
-    ~AbstractHandler() {}
-
-    /*!
-     * \brief run is inherited by each Handler class. It is called from the main while loop in main.cpp.
-     * It runs through the state machine, specific to each Handler class.
-     */
-    virtual void run() = 0; // run the handler
-
-    /*!
-     * \brief setRequest sets a request that the handler will complete when it is able to
-     * \param request unique to the reimplemented class (an enum) that will be completed in the state machine
-     * \param message an optional array of information relevant to the \a request
-     */
-    virtual void setRequest(int request, void *data = 0) = 0;
-
-protected:
-    MyTimers *m_timer;  ///< Handler classes use timers to pause in the state machine, and continue after delay has finished
-};
-
-#endif // __ABSTRACT_HANDLER_H__
+#ifndef __ABSTRACT_HANDLER_H__
+#define __ABSTRACT_HANDLER_H__
+
+#include "../timers.h"
+
+/*!
+ * \brief The AbstractHandler class is inherited by all handlers. It forms the basis of any handler, by having
+ * a simple \a run function, called by the \a Scheduler, and a \a setRequest function which is used to set a request
+ * specific to the reimplemented class. Handlers whose requests carry data that must not be lost provide typed post
+ * functions backed by a \a MsgQueue instead, and leave \a setRequest as the default that ignores the request.
+ *
+ * A handler is runnable by default, so \a run is called on every pass of the main loop. When a handler has nothing to
+ * do it calls \a waitForEvent or \a waitForTimer at the end of \a run, and the \a Scheduler stops calling it until
+ * \a wake is called (a request, or data arriving in one of its buffers) or the timer elapses.
+ *
+ * None of the functions are virtual. The \a Scheduler is given the class of each handler at compile time, and calls
+ * them on that class, so they are direct calls that can be inlined. A handler class has to have its own:
+ *
+ *      void run()                      runs through the state machine, specific to each Handler class
+ *
+ * and hides the defaults below of \a name, \a currentMode, \a canDeepSleep and \a setRequest that do not suit it.
+ * As they are not virtual, they have to be called through the handler's own class, never through AbstractHandler.
+ */
+class AbstractHandler
+{
+public:
+    AbstractHandler(MyTimers *_timer) : m_timer(_timer), m_waitTimer(MyTimers::tmr_Invalid), m_waiting(false), m_pending(false) {}
+
+    /*!
+     * \brief setRequest sets a request that the handler will complete when it is able to
+     * \param request unique to the reimplemented class (an enum) that will be completed in the state machine
+     * \param message an optional array of information relevant to the \a request
+     */
+    void setRequest(int request, void *data = 0) {}
+
+    //! name identifies the handler in the profiler report
+    const char *name() const { return "handler"; }
+
+    //! currentMode is the state the state machine is in, so the profiler can time each state separately
+    uint8_t currentMode() const { return 0; }
+
+    //! canDeepSleep is false while the handler needs the clocks that deep sleep stops, e.g. for a peripheral in use
+    bool canDeepSleep() { return true; }
+
+    /*!
+     * \brief runnable checks if \a run has anything to do
+     * \return true if the handler has not asked to wait, has been woken, or the timer it is waiting on has elapsed
+     */
+    bool runnable()
+    {
+        if (m_pending || !m_waiting) {
+            return true;
+        }
+        return (m_waitTimer != MyTimers::tmr_Invalid) && !m_timer->GetTimer(m_waitTimer);
+    }
+
+    //! pending is true if \a wake has been called since \a run last started
+    bool pending() const { return m_pending; }
+
+    /*!
+     * \brief startRun is called by the \a Scheduler before it calls \a run
+     * \return true if the handler is runnable, so \a run is to be called
+     */
+    bool startRun()
+    {
+        if (!runnable()) {
+            return false;
+        }
+
+        // clear before running, so a wake during run is not lost
+        m_pending = false;
+        m_waiting = false;
+        return true;
+    }
+
+    //! wake makes the handler runnable again. Safe to call from an interrupt.
+    void wake() { m_pending = true; }
+
+protected:
+    MyTimers *m_timer;  ///< Handler classes use timers to pause in the state machine, and continue after delay has finished
+
+    //! waitForEvent stops \a run being called until \a wake is called
+    void waitForEvent() { m_waitTimer = MyTimers::tmr_Invalid; m_waiting = true; }
+
+    //! waitForTimer stops \a run being called until \a timer elapses or \a wake is called
+    void waitForTimer(MyTimers::timerid_t timer) { m_waitTimer = timer; m_waiting = true; }
+
+private:
+    MyTimers::timerid_t m_waitTimer;    ///< timer that makes the handler runnable again, if any
+    bool m_waiting;                     ///< set by the handler when it has nothing to do
+    volatile bool m_pending;            ///< set by \a wake, cleared when \a run starts
+};
+
+#endif // __ABSTRACT_HANDLER_H__
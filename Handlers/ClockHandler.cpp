@@ -0,0 +1,37 @@
+#include "ClockHandler.h"
+#include "rtc.h"
+
+ClockHandler::ClockHandler(MyTimers *_timer) : AbstractHandler(_timer)
+{
+    mode         = clk_Wait;
+    m_clockTimer = m_timer->registerTimer();
+}
+
+void ClockHandler::run()
+{
+    switch (mode)
+    {
+    case clk_Wait:
+    {
+        // the clock may have been set, or matched to an alarm, since the timer was set, so ask again each time
+        uint32_t start = my_rtc_resync_start();
+        if ((int32_t)(start - m_timer->now()) > 0) {
+            m_timer->SetDeadline(m_clockTimer, start);
+            waitForTimer(m_clockTimer);
+            break;
+        }
+        mode = clk_Poll;
+    }
+    // fall through - to the first read
+
+    case clk_Poll:
+        if (my_rtc_resync_poll()) {
+            mode = clk_Wait;                        // over, so find when the next one is due on the next pass
+        }
+        else {
+            m_timer->SetTimer(m_clockTimer, RTC_EDGE_POLL_MS);
+            waitForTimer(m_clockTimer);
+        }
+        break;
+    }
+}
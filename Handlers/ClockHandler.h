@@ -0,0 +1,36 @@
+#ifndef __CLOCK_HANDLER_H__
+#define __CLOCK_HANDLER_H__
+
+#include "mbed.h"
+#include "AbstractHandler.h"
+
+/*!
+ * \brief The ClockHandler class keeps the clock behind time() matched to the DS1337, without time() ever waiting
+ *
+ * time() is worked out from the ms time base (see \sa my_rtc_read). Every RTC_RESYNC_MS the clock has to be matched
+ * to the start of one of the DS1337's seconds again. This sleeps on a timer until just before the time base says the
+ * next second starts, then reads the DS1337 once a run, RTC_EDGE_POLL_MS apart, until it sees its seconds tick over,
+ * and hands that to \sa my_rtc_resync_poll. time() carries on from the time base in the meantime.
+ */
+class ClockHandler : public AbstractHandler
+{
+public:
+    ClockHandler(MyTimers *_timer);
+
+    void run();
+    const char *name() const { return "clock"; }
+    uint8_t currentMode() const { return mode; }
+    bool canDeepSleep() { return mode != clk_Poll; }   // the edge is timed by us_ticker
+
+private:
+    MyTimers::timerid_t m_clockTimer;   ///< for the next resync, then between reads
+
+    // state machine
+    enum mode_t {
+        clk_Wait,               ///< Sleep until the next resync is due
+        clk_Poll                ///< Read the DS1337 until its seconds tick over
+    };
+    mode_t mode;
+};
+
+#endif // __CLOCK_HANDLER_H__
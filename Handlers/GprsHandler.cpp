@@ -1,9 +1,11 @@
+#include "config.h"
 #ifdef ENABLE_GPRS_TESTING
 #include "GprsHandler.h"
 #include "mbed.h"
-#include "config.h"
 #include "UsbComms.h"
+#include "measurementhandler.h"
 #include "circbuff.h"
+#include <ctype.h>
 #define TX_GSM P1_27
 #define RX_GSM P1_26
 
@@ -17,42 +19,90 @@ extern DigitalOut myled3;
 #define PINPWR                  P1_2
 #define PINONOFF                P1_7
 
-#define REQ_SEND_SMS     0b00000001
 
-#define USB_BUFF_SIZE 256
+// UART line status register bits. Reading LSR clears the error bits
+#define UART_LSR_RDR            (1u << 0)   // receive data ready
+#define UART_LSR_OE             (1u << 1)   // overrun
+#define UART_LSR_FE             (1u << 3)   // framing error
+#define UART_LSR_THRE           (1u << 5)   // transmit FIFO empty
+#define UART_TX_FIFO            16u
 
-#define SIM900_SERIAL_TIMEOUT 10000
+#define GPRS_SEND_TIMEOUT_MS    60000   // AT+CMGS can take a long time on a poor network
+#define GPRS_LIST_TIMEOUT_MS    20000   // AT+CMGL lists the whole SIM, at startup
 
-GprsHandler::GprsHandler(MyTimers * _timer, UsbComms *_usb) : AbstractHandler(_timer)
+#define OUTBOX_FILE_NAME        "/sd/outbox.bin"
+#define OUTBOX_SAVE_DELAY_MS    500     // from the outbox changing to saving it, so a burst of changes is one save
+#define OUTBOX_SAVE_RETRY_MS    10000   // after a failed save
+
+GprsHandler::GprsHandler(MyTimers * _timer, UsbComms *_usb) : AbstractHandler(_timer),
+    m_serial(TX_GSM, RX_GSM),       // UART comms
+    m_at(this, _timer),
+    m_sim900_pwr(PINPWR),
+    m_sim900_on(PINONOFF)
 {
-    m_serial = new Serial(TX_GSM, RX_GSM);	// create object for UART comms
+    m_rxBytes       = 0;
+    m_overruns      = 0;
+    m_framingErrors = 0;
+    m_rxHighWater   = 0;
+
+    m_serial.baud(GPRS_BAUD);
+    m_serial.attach(this, &GprsHandler::onSerialRx, Serial::RxIrq);
+    m_serial.attach(this, &GprsHandler::onSerialTx, Serial::TxIrq);
+    m_at.setUrcClient(this);
     mode = gprs_Start;		// initialise state machine
 
-    m_sim900_pwr = new DigitalOut(PINPWR);		// create pin out for
-    m_sim900_on  = new DigitalOut(PINONOFF);
-    m_reqReg = 0;
-
     m_usb = _usb;
-    m_rxBuff = new CircBuff(USB_BUFF_SIZE);
-
-    m_atReq = atreq_Test;
-}
-
-GprsHandler::~GprsHandler()
-{
-    // TODO Auto-generated destructor stub
-    delete m_serial;
-    delete m_rxBuff;
-    delete m_sim900_pwr;
-    delete m_sim900_on;
+    m_measure = NULL;
+
+    m_lastRequest = gprsreq_GprsNone;
+    m_configured  = false;
+    m_sending     = false;
+    m_restart     = false;
+    m_saveDue     = false;
+    m_sweepDue    = false;
+    m_readIndex   = -1;
+    m_rxIndex     = -1;
+    m_rxSender[0] = 0;
+
+    m_powerTimer  = m_timer->registerTimer();
+    m_outboxTimer = m_timer->registerTimer();
+    m_saveTimer   = m_timer->registerTimer();
 }
 
 void GprsHandler::run()
 {
+    // hand whatever the SIM900 has sent to the AT engine, which calls back as each line completes
+    const unsigned char *p;
+    uint16_t len;
+    while ((len = m_rxBuff.peek(&p)) > 0) {
+        for (uint16_t i = 0; i < len; i++) {
+            m_at.rx(p[i]);
+        }
+        m_rxBuff.consume(len);
+    }
+    m_at.poll();
+
+    // save the outbox a little after it changes
+    if (m_outbox.dirty() && !m_saveDue) {
+        m_timer->SetTimer(m_saveTimer, OUTBOX_SAVE_DELAY_MS);
+        m_saveDue = true;
+    }
+    if (m_saveDue && !m_timer->GetTimer(m_saveTimer)) {
+        m_saveDue = !m_outbox.save(OUTBOX_FILE_NAME);
+        if (m_saveDue) {
+            m_timer->SetTimer(m_saveTimer, OUTBOX_SAVE_RETRY_MS);
+        }
+    }
+
     switch(mode)
     {
     case gprs_Start:
-
+        // pick up the SMS that were waiting when we last stopped
+        if (m_outbox.load(OUTBOX_FILE_NAME, m_timer->now()) && m_outbox.waiting()) {
+            char s[TX_USB_MSG_MAX];
+            snprintf(s, sizeof(s), "%u SMS waiting in the outbox", m_outbox.waiting());
+            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+        }
         mode = gprs_PowerOff;
         break;
 
@@ -60,201 +110,389 @@ void GprsHandler::run()
         // POWER HANDLERS
 
     case gprs_PowerOff:
-        m_sim900_pwr->write(1);				// turn power supply off
-        m_sim900_on->write(1);
-        m_timer->SetTimer(MyTimers::tmr_GprsPower, 500);	// wait to settle
+        m_at.flush();                      // nothing in flight survives the restart
+        myled3 = 0;
+        m_sim900_pwr.write(1);				// turn power supply off
+        m_sim900_on.write(1);
+        m_timer->SetTimer(m_powerTimer, 500);	// wait to settle
         mode = gprs_PowerOffWait;
         break;
 
     case gprs_PowerOffWait:
-        if (!m_timer->GetTimer(MyTimers::tmr_GprsPower))
+        if (!m_timer->GetTimer(m_powerTimer))
         {
             mode = gprs_PowerSupplyOn;		// timer has elapsed
         }
+        else
+        {
+            waitForTimer(m_powerTimer);
+        }
         break;
 
     case gprs_PowerSupplyOn:
-        m_sim900_pwr->write(0);		// turn power supply on
-        m_sim900_on->write(0);		// from the ref: "drive the PWRKEY to a low level for 1 second then release."
+        m_sim900_pwr.write(0);		// turn power supply on
+        m_sim900_on.write(0);		// from the ref: "drive the PWRKEY to a low level for 1 second then release."
 
 
-        m_timer->SetTimer(MyTimers::tmr_GprsPower, 1000);	// wait for one second
+        m_timer->SetTimer(m_powerTimer, 1000);	// wait for one second
         mode = gprs_PowerSupplyOnWait;						// go to wait state
         break;
 
     case gprs_PowerSupplyOnWait:
-        if (!m_timer->GetTimer(MyTimers::tmr_GprsPower))
+        if (!m_timer->GetTimer(m_powerTimer))
         {
             mode = gprs_PowerSwitchOn;		// timer has elapsed
         }
+        else
+        {
+            waitForTimer(m_powerTimer);
+        }
         break;
 
     case gprs_PowerSwitchOn:
-        m_sim900_on->write(1);		// release power key
-        m_timer->SetTimer(MyTimers::tmr_GprsPower, 500);	// wait to settle
+        m_sim900_on.write(1);		// release power key
+        m_timer->SetTimer(m_powerTimer, 500);	// wait to settle
         mode = gprs_PowerSwitchOnWait;
         break;
 
     case gprs_PowerSwitchOnWait:
-        if (!m_timer->GetTimer(MyTimers::tmr_GprsPower))
+        if (!m_timer->GetTimer(m_powerTimer))
+        {
+            mode = gprs_Configure;		// timer has elapsed
+        }
+        else
         {
-            mode = gprs_CheckATReqs;		// timer has elapsed
+            waitForTimer(m_powerTimer);
         }
         break;
 
 
         // REQUEST HANDLERS
 
-    case gprs_CheckATReqs:
-        switch (m_atReq) {
-        case atreq_Test:
-            sprintf((char*)txBuf, "AT\r\n");
-            txBufLen = 4;
-            mode = gprs_PostTx;
-            break;
+    case gprs_Configure:
+        // all queued at once, and written one after the other as each is answered
+        m_configured = false;
+        m_sending    = false;
+        m_restart    = false;
+        m_sweepDue   = true;                // anything that arrived while it was off was not announced
+        m_readIndex  = -1;
+        m_rxIndex    = -1;
+        while (m_readQueue.pop()) {}        // and will be found by the sweep
+        m_at.queue("AT", this, attag_Config);          // also sets the SIM900's baud rate
+        m_at.queue("ATE0", this, attag_Config);        // no echo
+        m_at.queue("AT+CNMI=2,1", this, attag_Config); // announce each SMS as it is stored, with +CMTI
+        m_at.queue("AT+CMGF=1", this, attag_ConfigLast);   // text mode SMS
+        mode = gprs_Ready;
+        break;
 
-        case atreq_CheckSMS:
-            sprintf((char*)txBuf, "AT+CMGL=\"ALL\"");
-            txBufLen = 13;
-            mode = gprs_PostTx;
+    case gprs_Ready:
+        if (m_restart) {
+            mode = gprs_PowerOff;
             break;
+        }
+
+        if (m_configured) {
+            // send the next SMS as soon as it is allowed to go
+            uint32_t wait;
+            if (!m_sending && !m_at.commandQueue().full() && !m_timer->GetTimer(m_outboxTimer)) {
+                if (m_outbox.begin(m_timer->now(), &m_sendItem, &wait)) {
+                    char cmd[AT_CMD_MAXLEN];
+                    snprintf(cmd, sizeof(cmd), "AT+CMGS=\"%s\"", m_sendItem.number);
+                    m_sending = m_at.queue(cmd, this, attag_SendSms, GPRS_SEND_TIMEOUT_MS, m_sendItem.text);
+                    if (!m_sending) {
+                        m_outbox.abort(m_sendItem.id);
+                    }
+                }
+                else if (wait != 0xFFFFFFFFu) {
+                    m_timer->SetTimer(m_outboxTimer, wait);
+                }
+            }
+
+            // read each SMS the SIM900 announces, one at a time, with room left behind it for its delete
+            uint8_t index;
+            if ((m_readIndex < 0) && (m_at.commandQueue().space() >= 2) && m_readQueue.pop(&index)) {
+                char cmd[AT_CMD_MAXLEN];
+                snprintf(cmd, sizeof(cmd), "AT+CMGR=%u", index);
+                m_readIndex = index;
+                m_at.queue(cmd, this, attag_ReadSms);
+            }
+
+            // pick up whatever is on the SIM that has not been announced, once after startup
+            if (m_sweepDue && (m_readIndex < 0) && (m_at.commandQueue().space() >= 2)) {
+                m_sweepDue = false;
+                m_at.queue("AT+CMGL=\"ALL\"", this, attag_ListSms, GPRS_LIST_TIMEOUT_MS);
+            }
+        }
 
-        default:
-            m_atReq = atreq_Test;
+        {
+            // the receive interrupt wakes us with the next line or a +CMTI, and a new SMS to send wakes us too
+            MyTimers::timerid_t t = m_at.pending() ? m_at.timer() : MyTimers::tmr_Invalid;
+            if (!m_sending && m_timer->GetTimer(m_outboxTimer)) {
+                t = earlier(t, m_outboxTimer);
+            }
+            if (m_saveDue) {
+                t = earlier(t, m_saveTimer);
+            }
+            if (t == MyTimers::tmr_Invalid) {
+                waitForEvent();
+            }
+            else {
+                waitForTimer(t);
+            }
         }
         break;
+    }
+}
 
+bool GprsHandler::sendSms(const GprsRequest &req)
+{
+    if (!m_outbox.post(req.message, req.recipients, m_timer->now())) {
+        return false;
+    }
+    // the outbox may have been waiting on a number that is rate limited, and this one may be able to go now
+    m_timer->SetTimer(m_outboxTimer, 0);
+    m_lastRequest = gprsreq_SmsSend;
+    wake();
+    return true;
+}
 
-        // TX/RX HANDLERS
+MyTimers::timerid_t GprsHandler::earlier(MyTimers::timerid_t a, MyTimers::timerid_t b)
+{
+    if (a == MyTimers::tmr_Invalid) {
+        return b;
+    }
+    return (m_timer->GetTimer(b) < m_timer->GetTimer(a)) ? b : a;
+}
 
-    case gprs_PostTx:
-        // use putc, other write functions in serial don't really seem to work
-        for (int i = 0; i < txBufLen; i++) {
-            m_serial->putc(txBuf[i]);
-        }
+void GprsHandler::atWrite(const char *data, uint16_t len)
+{
+    m_txBuff.write((const unsigned char*)data, len);
 
-        // make sure buffer is null terminated before printing to USB
-        txBuf[txBufLen+1] = 0;
-        m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, txBuf);
+    // start sending, if the transmit interrupt is not already. The interrupt is the other reader of m_txBuff
+    __disable_irq();
+    fillTxFifo();
+    __enable_irq();
+}
 
-        // clear the buffer
-        txBufLen = 0;
+GprsUartStats GprsHandler::uartStats() const
+{
+    GprsUartStats s;
+    s.rxBytes       = m_rxBytes;
+    s.overruns      = m_overruns;
+    s.framingErrors = m_framingErrors;
+    s.rxDropped     = m_rxBuff.overflows();
+    s.rxHighWater   = m_rxHighWater;
+    s.txDropped     = m_txBuff.overflows();
+    return s;
+}
 
-        // set timeout
-        m_timer->SetTimer(MyTimers::tmr_GprsRxTx, SIM900_SERIAL_TIMEOUT);
+uint32_t GprsHandler::lineStatus()
+{
+    // the error bits are cleared by reading, so both interrupts count them whenever they read LSR
+    uint32_t lsr = LPC_USART->LSR;
+    if (lsr & UART_LSR_OE) {
+        m_overruns++;
+    }
+    if (lsr & UART_LSR_FE) {
+        m_framingErrors++;
+    }
+    return lsr;
+}
 
-        // wait for a response
-        mode = gprs_WaitRx;
-        break;
+void GprsHandler::onSerialRx()
+{
+    // empty the FIFO, so the next burst has all of it
+    bool line = false;
+    while (lineStatus() & UART_LSR_RDR) {
+        unsigned char c = (unsigned char)LPC_USART->RBR;
+        m_rxBuff.putc(c);      // counted by its overflows if it is full
+        m_rxBytes++;
+        if ((c == '\n') || (c == '>')) {
+            line = true;
+        }
+    }
 
-    case gprs_WaitRx:
-        if (m_timer->GetTimer(MyTimers::tmr_GprsRxTx))
-        {
-            // we have not timed out yet
-            // we need a generic rx handler here.
-            while (m_serial->readable())
-            {
-                char ch = m_serial->getc();
+    uint16_t used = m_rxBuff.dataSize();
+    if (used > m_rxHighWater) {
+        m_rxHighWater = used;
+    }
 
-                // save this to our rx circular buffer
-                m_rxBuff->putc(ch);
+    // only run once there is a line for the AT engine, rather than for every character
+    if (line) {
+        wake();
+    }
+}
 
-                mode = gprs_CheckRx;
-    			wait(0.1);
-            }
-            // we have not timed out, and have not got anything back yet
-            // keep waiting in this state
+void GprsHandler::onSerialTx()
+{
+    fillTxFifo();
+}
+
+void GprsHandler::fillTxFifo()
+{
+    if (!(lineStatus() & UART_LSR_THRE)) {
+        return;     // still sending, the interrupt comes back when the FIFO is empty
+    }
+    unsigned char c;
+    for (uint8_t n = 0; (n < UART_TX_FIFO) && m_txBuff.read(&c, 1); n++) {
+        LPC_USART->THR = c;
+    }
+}
+
+// copy the \a n th (from 0) quoted field of an AT response line into \a dst
+static bool quotedField(const char *line, uint8_t n, char *dst, uint8_t len)
+{
+    const char *p = line;
+    for (uint8_t i = 0; i <= n; i++) {
+        p = strchr(p, '"');
+        if (p == NULL) {
+            return false;
         }
-        else {
-        	m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"SIM900 TIMEOUT!");
-            mode = gprs_RxTimeout;
+        p++;
+        const char *end = strchr(p, '"');
+        if (end == NULL) {
+            return false;
         }
-        break;
-
-    case gprs_CheckRx:
-        if (m_rxBuff->dataAvailable()) {
+        if (i == n) {
+            uint8_t copy = ((end - p) < (len - 1)) ? (uint8_t)(end - p) : (uint8_t)(len - 1);
+            memcpy(dst, p, copy);
+            dst[copy] = 0;
+            return true;
+        }
+        p = end + 1;
+    }
+    return false;
+}
 
-            // read out
-            unsigned char s[50];
-            uint16_t len = m_rxBuff->read(s, 50);
+// true if \a line starts with \a word, in any case
+static bool startsWithNoCase(const char *line, const char *word)
+{
+    for (; *word; line++, word++) {
+        if (tolower((unsigned char)*line) != *word) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            // write to USB
-            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+void GprsHandler::atLine(uint8_t tag, const char *line)
+{
+    // +CMGR: "<stat>","<sender>",... for the SMS at m_readIndex, followed by a line with the text
+    if ((tag == attag_ReadSms) && (strncmp(line, "+CMGR:", 6) == 0)) {
+        m_rxIndex = m_readIndex;
+        if (!quotedField(line, 1, m_rxSender, sizeof(m_rxSender))) {
+            m_rxSender[0] = 0;
+        }
+        return;
+    }
 
-            // process the reply
-            switch(m_atReq) {
-            case atreq_Test:
-                // should have just gotten an ok back
-                bool bOk = false;
-                for (int i = 0; i < (len - 1); i++) {
-                    if ((s[i] == 'O') && (s[i+1] == 'K')) {
-                        bOk = true;
-                    }
-                }
+    // +CMGL: <index>,"<stat>","<sender>",..., followed by a line with the text
+    if ((tag == attag_ListSms) && (strncmp(line, "+CMGL:", 6) == 0)) {
+        // only take it on if it can be deleted afterwards, otherwise it is left for another sweep to pick up
+        if (m_at.commandQueue().full()) {
+            m_rxIndex = -1;
+            m_sweepDue = true;
+            return;
+        }
+        m_rxIndex = atoi(line + 6);
+        if (!quotedField(line, 1, m_rxSender, sizeof(m_rxSender))) {
+            m_rxSender[0] = 0;
+        }
+        return;
+    }
+    if (m_rxIndex < 0) {
+        return;
+    }
 
-                if (bOk) {
-                    myled3 = 1;
-                    // so we know that comms are definitely OK.
-                    // now check to see what requests need to get fulfilled
+    char s[TX_USB_MSG_MAX];
+    snprintf(s, sizeof(s), "SMS from %s: %s", m_rxSender, line);
+    m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
 
-                    if (m_reqReg&REQ_SEND_SMS) {
-                        // we want to check what sms is
-                        m_atReq = atreq_SendSMS;
+    if (startsWithNoCase(line, "status") && m_measure) {
+        m_measure->postStatus(m_rxSender);
+    }
 
-                        m_reqReg &= ~REQ_SEND_SMS;
-                    }
-                    else {
-                        // no requests, but see if there are any received SMSs
-                        m_atReq = atreq_CheckSMS;
-                    }
-                }
-                else {
-                    // did not get the reply we were hoping for.
-                }
-                break;
+    // delete it, so it is only handled once
+    char cmd[AT_CMD_MAXLEN];
+    snprintf(cmd, sizeof(cmd), "AT+CMGD=%d", m_rxIndex);
+    m_at.queue(cmd, this, attag_DeleteSms);
+    m_rxIndex = -1;
+}
 
-            default:
-                // todo: handle replies for checking/sending SMSs
-                m_atReq = atreq_Test;
-                break;
-            }
+void GprsHandler::atDone(uint8_t tag, at_result_t result, int code)
+{
+    char s[TX_USB_MSG_MAX];
+
+    if (tag == attag_SendSms) {
+        // give the SMS back to the outbox, which retries it if it failed
+        m_sending = false;
+        if (result == at_Ok) {
+            snprintf(s, sizeof(s), "SMS sent to %s", m_sendItem.number);
+            m_outbox.sent(m_sendItem.id);
+        }
+        else if (result == at_Flushed) {
+            m_outbox.abort(m_sendItem.id);
         }
         else {
+            snprintf(s, sizeof(s), "SMS to %s failed, error %d", m_sendItem.number, code);
+            m_outbox.failed(m_sendItem.id, m_timer->now());
+        }
+        if (result != at_Flushed) {
+            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+        }
+    }
+
+    if (result == at_Flushed) {
+        return;
+    }
+    if (result == at_Timeout) {
+        m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"SIM900 TIMEOUT!");
+        m_restart = true;
+        wake();
+        return;
+    }
 
+    switch (tag) {
+    case attag_Config:
+    case attag_ConfigLast:
+        if (result != at_Ok) {
+            m_restart = true;
+        }
+        else if (tag == attag_ConfigLast) {
+            myled3 = 1;         // so we know that comms are definitely OK
+            m_configured = true;
         }
-        m_timer->SetTimer(MyTimers::tmr_GprsRxTx, 2000);
-        // now that we're done here, go check what needs to get sent to the SIM900 next
-        mode = gprs_WaitUntilNextRequest;
         break;
-        
-    case gprs_WaitUntilNextRequest:
-    	if (!m_timer->GetTimer(MyTimers::tmr_GprsRxTx)) {
-			mode = gprs_CheckATReqs;
-		}
-		break;
-    case gprs_RxTimeout:
-    case gprs_RxError:
-    default:
-        mode = gprs_Start;
+
+    case attag_ListSms:
+        m_rxIndex = -1;
         break;
 
+    case attag_ReadSms:
+        m_rxIndex   = -1;
+        m_readIndex = -1;
+        break;
 
+    default:
+        break;
     }
+    wake();     // come back and see what is next
 }
 
-void GprsHandler::setRequest(int request, void *data)
+void GprsHandler::atUrc(const char *line)
 {
-    m_lastRequest = (request_t)request;
-    switch(request) {
-    case gprsreq_SmsSend:
-        GprsRequest *req = (GprsRequest*)data;
-
-        // make a copy
-        m_lastMessage = *req;     // there are strings, do i have to copy these manually?
-
-        // set the request
-        m_reqReg |= REQ_SEND_SMS;
-        break;
+    // +CMTI: "SM",<index>, an SMS has arrived and been stored at index
+    if (strncmp(line, "+CMTI:", 6) == 0) {
+        const char *comma = strchr(line, ',');
+        if ((comma == NULL) || !m_readQueue.push((uint8_t)atoi(comma + 1))) {
+            m_sweepDue = true;      // too many at once, so list them all once the queue is clear
+        }
+        wake();
+        return;
     }
+
+    char s[TX_USB_MSG_MAX];
+    snprintf(s, sizeof(s), "SIM900: %s", line);
+    m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
 }
 #endif
@@ -11,35 +11,90 @@
 #include "USBDevice.h"	// need to include this, so that USBSerial has correct typedefs!
 #include "USBSerial.h"
 #include "AbstractHandler.h"
-
-#define GPRS_BUF_LEN 20
-
-#define GPRS_MESSAGE_MAXLEN 160
-#define GPRS_RECIPIENTS_MAXLEN 20
+#include "msgqueue.h"
+#include "atengine.h"
+#include "smsoutbox.h"
+#include "circbuff.h"
+
+#define GPRS_MESSAGE_MAXLEN SMS_TEXT_MAXLEN
+#define GPRS_RECIPIENTS_MAXLEN SMS_NUMBER_MAXLEN    // one number
+#define GPRS_RECIPIENT_LIST_MAXLEN 64               // comma separated numbers
+#define GPRS_BAUD 115200            // the SIM900 picks this up from the first "AT"
+#define GPRS_RX_BUFF 512            // received characters waiting for run(), 44 ms at GPRS_BAUD. A power of two
+#define GPRS_TX_BUFF 256            // room for the longest command, and an SMS with its Ctrl-Z. A power of two
+#define GPRS_READ_QUEUE_LEN 8       // received SMS announced with +CMTI, waiting to be read
 
 struct GprsRequest
 {
-    char message[GPRS_MESSAGE_MAXLEN];
-    char recipients[GPRS_RECIPIENTS_MAXLEN];
+    char message[GPRS_MESSAGE_MAXLEN + 1];
+    char recipients[GPRS_RECIPIENT_LIST_MAXLEN];   ///< comma separated, each is sent the message
 };
+/*!
+ * \brief The GprsUartStats struct counts what happened to the characters received from the SIM900
+ */
+struct GprsUartStats
+{
+    uint32_t rxBytes;           ///< characters read from the UART
+    uint32_t overruns;          ///< times the UART's receive FIFO overflowed, so at least one character was lost
+    uint32_t framingErrors;     ///< characters received without a valid stop bit
+    uint32_t rxDropped;         ///< times the receive buffer was full, so a character was lost
+    uint16_t rxHighWater;       ///< most characters waiting in the receive buffer
+    uint32_t txDropped;         ///< writes that did not fit in the transmit buffer
+};
+
 class UsbComms;
-class CircBuff;
+class MeasurementHandler;
 
 /*!
  * \brief The GprsHandler class saves recipients and looks after incoming and outgoing messages
  *
  * Options: save recipients internally to this class.
  * Or - request sends a struct that includes recipients list and message string
+ *
+ * SMS to send go into an \a SmsOutbox, which fans each one out to its recipients, rate limits them, retries them with
+ * backoff, and keeps them in /sd/outbox.bin so they survive a restart. It is saved shortly after each change.
+ *
+ * Once the SIM900 is powered up, everything said to it goes through an \a AtEngine: the set up commands are queued
+ * together, and the SMS in the outbox are sent one after another as they are allowed to go, with no wait between
+ * commands. The SIM900 announces each SMS it receives with +CMTI and the index it stored it at, and the SMS is read
+ * with AT+CMGR, so nothing is said to the SIM900 while nothing is happening. An SMS starting "status" is passed to
+ * \a MeasurementHandler for a reply, and every received SMS is then deleted, so the SIM stays empty. SMS that
+ * arrived while the SIM900 was off, or too many at once to queue, are found by listing the SIM with AT+CMGL, once
+ * after it is set up. If a command times out, the SIM900 is power cycled and set up again.
+ *
+ * The UART is driven by its interrupts in both directions, so the main loop never waits on the SIM900. The receive
+ * interrupt empties the UART's FIFO into a buffer, counting overruns and framing errors on the way, and wakes the
+ * handler when a line (or the "> " prompt) is complete. \a run then hands the characters to the AT engine, which
+ * splits them into lines. What is written goes into a buffer, which the transmit interrupt feeds to the UART's FIFO.
  */
-class GprsHandler : public AbstractHandler
+class GprsHandler : public AbstractHandler, public AtClient, public AtTransport
 {
 public:
 	GprsHandler(MyTimers * _timer, UsbComms *_usb);
-	virtual ~GprsHandler();
 
 	void run();
+	const char *name() const { return "gprs"; }
+	uint8_t currentMode() const { return mode; }
+	bool canDeepSleep() { return mode <= gprs_PowerOffWait; }   // the UART has to be clocked to hear the SIM900
+
+    //! setMeasurement sets where received status requests go. It is created after this handler
+    void setMeasurement(MeasurementHandler *_measure) { m_measure = _measure; }
+
+    /*!
+     * \brief sendSms queues an SMS to be sent to each of its recipients
+     * \param req is the message and recipients, copied into the outbox
+     * \return false if the outbox does not have room for all of the recipients, and the SMS was dropped
+     */
+    bool sendSms(const GprsRequest &req);
+
+    //! outboxStats gives the outbox statistics
+    const SmsOutboxStats &outboxStats() const { return m_outbox.stats(); }
 
-    void setRequest(int request, void *data = 0);
+    //! atStats gives the AT command statistics
+    const AtStats &atStats() const { return m_at.stats(); }
+
+    //! uartStats gives the UART statistics
+    GprsUartStats uartStats() const;
 
     enum request_t{
         gprsreq_GprsNone,       ///< No request (for tracking what the last request was, this is initial value for that)
@@ -47,6 +102,14 @@ public:
         gprsreq_SetRecipients   ///< got a string holding the number(s) we want to send
     };
 
+    // AtClient
+    void atLine(uint8_t tag, const char *line);
+    void atDone(uint8_t tag, at_result_t result, int code);
+    void atUrc(const char *line);
+
+    // AtTransport
+    void atWrite(const char *data, uint16_t len);
+
 private:
     enum mode_t{
         gprs_Start,          	///< Set up the state machine and the hardware
@@ -59,54 +122,67 @@ private:
         gprs_PowerSwitchOn,
         gprs_PowerSwitchOnWait,
 
-        gprs_CheckATReqs,       ///< Check was AT request is next
-
-        // read AT+CMGR=?
-        // write AT+CMGS=?
-        gprs_PostTx,            ///< Send the current buffer to SIM900 and setup timeouts
-        gprs_WaitRx,            ///< Wait for a response over serial
-        gprs_CheckRx,           ///< Check the response. Go back into state machine depending on response
-        
-        gprs_WaitUntilNextRequest, 
-
-        gprs_RxTimeout,         ///< no response
-        gprs_RxError            ///< wrong response
-
-
+        gprs_Configure,         ///< Queue the commands that set the SIM900 up
+        gprs_Ready              ///< Send SMS as they are queued, and read received ones as they are announced
     };
     mode_t mode;            ///< the current state in the state machine
-    mode_t returnMode;      ///< the state to go back to when the expected reply returns from the SIM900
 
     ///
-    /// \brief The at_req enum stores what AT command should be sent/was just sent to the SIM900
+    /// \brief The at_tag enum tells the commands apart when \a AtEngine reports back on them
     ///
-    enum at_req {
-        atreq_Test,         ///< Ping the SIM900
-        atreq_CheckSMS,     ///< Check if an SMS is available
-        atreq_SendSMS       ///< Send an SMS, according to m_lastRequest
+    enum at_tag {
+        attag_Config,       ///< Set up, any but the last
+        attag_ConfigLast,   ///< The last set up command. When this is OK the SIM900 is ready
+        attag_ListSms,      ///< AT+CMGL, list received SMS
+        attag_ReadSms,      ///< AT+CMGR, read the received SMS at m_readIndex
+        attag_DeleteSms,    ///< AT+CMGD, delete a received SMS
+        attag_SendSms       ///< AT+CMGS, send m_sendItem
     };
-    at_req m_atReq;
 
     request_t m_lastRequest;
-    GprsRequest m_lastMessage;
+    SmsOutbox m_outbox;             ///< SMS waiting to be sent
+    SmsOutboxItem m_sendItem;       ///< The SMS currently being sent. The AT engine sends its text from the outbox
 
-    Serial * m_serial; //!< Serial port for comms with SIM900
+    Serial m_serial; //!< Serial port for comms with SIM900
+    CircBuff<GPRS_RX_BUFF> m_rxBuff;    //!< Received by the interrupt, waiting for run() to parse it
+    CircBuff<GPRS_TX_BUFF> m_txBuff;    //!< Waiting for the transmit interrupt to send it
+    AtEngine m_at;     //!< Runs the AT commands and parses the responses
 
-    DigitalOut * m_sim900_pwr;	//!< pin used to enable the SIM900 power switch
-    DigitalOut * m_sim900_on;	//!< pin used to drive the power key
+    DigitalOut m_sim900_pwr;	//!< pin used to enable the SIM900 power switch
+    DigitalOut m_sim900_on;	//!< pin used to drive the power key
 
-    uint8_t m_reqReg;   ///< request register
+    MyTimers::timerid_t m_powerTimer;   ///< Used to power the SIM900 on and off
+    MyTimers::timerid_t m_outboxTimer;  ///< Time the next SMS in the outbox is allowed to go
+    MyTimers::timerid_t m_saveTimer;    ///< Time to save the outbox, after it has changed
+
+    bool m_configured;      ///< the set up commands have all succeeded
+    bool m_sending;         ///< an AT+CMGS is queued or in flight
+    bool m_restart;         ///< a command timed out, power cycle the SIM900
+    bool m_saveDue;         ///< the outbox has changed, and m_saveTimer is running
+    bool m_sweepDue;        ///< list the SIM with AT+CMGL, for SMS that were not announced
+
+    MsgQueue<uint8_t, GPRS_READ_QUEUE_LEN> m_readQueue; ///< indexes announced with +CMTI, waiting to be read
+    int  m_readIndex;                           ///< index of the AT+CMGR in flight, or -1
+    int  m_rxIndex;                             ///< index of the received SMS whose text comes next, or -1
+    char m_rxSender[GPRS_RECIPIENTS_MAXLEN];    ///< and who it is from
 
-    unsigned char txBuf[GPRS_BUF_LEN];
-    uint16_t txBufLen;
-    unsigned char rxBuf[GPRS_BUF_LEN];
-    
     UsbComms *m_usb;
-    CircBuff *m_rxBuff;
-    
+    MeasurementHandler *m_measure;  ///< Told about status requests, may be NULL
+
+    // counted by the UART interrupts
+    volatile uint32_t m_rxBytes;
+    volatile uint32_t m_overruns;
+    volatile uint32_t m_framingErrors;
+    volatile uint16_t m_rxHighWater;
+
+    void onSerialRx();          // UART receive interrupt
+    void onSerialTx();          // UART transmit interrupt, the FIFO is empty
+    uint32_t lineStatus();      // read LSR, counting the errors it reports
+    void fillTxFifo();          // move what is waiting in m_txBuff to the UART, as far as it will go
+
+    MyTimers::timerid_t earlier(MyTimers::timerid_t a, MyTimers::timerid_t b);   // the one that elapses first
 };
 
 #endif
 
 #endif /* GPRSHANDLER_H_ */
-
@@ -1,224 +1,464 @@
-#include "SdHandler.h"
-
-#include "GroveDht22.h" // for interpreting the result struct
-#include "circbuff.h"
-
-#define SD_BUFFER_LEN 256u   // length of circular buffers
-
-// define pins for communicating with SD card
-#define PIN_MOSI        P1_22
-#define PIN_MISO        P1_21
-#define PIN_SCK         P1_20
-#define PIN_CS          P1_23
-
-#define DATA_FILE_NAME   "/sd/data.csv"
-#define SYSLOG_FILE_NAME "/sd/log.txt"
-
-// declare led that will be used to express state of SD card
-extern DigitalOut myled2;
-
-SdHandler::SdHandler(MyTimers * _timer) : AbstractHandler(_timer)
-{
-    // init file system and files
-    m_sdfs = new SDFileSystem(PIN_MOSI, PIN_MISO, PIN_SCK, PIN_CS, "sd");
-    m_data = NULL;
-    m_syslog = NULL;
-
-    // initialise circular buffers
-    m_dataLogBuff = new CircBuff(SD_BUFFER_LEN);
-    m_sysLogBuff  = new CircBuff(SD_BUFFER_LEN);
-    
-    mode = sd_Start;
-    m_lastRequest = sdreq_SdNone;
-}
-
-SdHandler::~SdHandler()
-{
-    delete m_dataLogBuff;
-    delete m_sysLogBuff;
-}
-
-void SdHandler::run()
-{
-    uint16_t tempInt = 0, tempInt2 = 0;
-
-    unsigned char tempBuff[SD_BUFFER_LEN];
-
-    switch(mode)
-    {
-    case sd_Start:              /* Set up the state machine */
-        // check if card is inserted??
-        //m_sdfs->unmount();
-        // close both files if necessary
-        if (m_data != NULL)
-            fclose(m_data);
-        if (m_syslog != NULL)
-            fclose(m_syslog);
-
-        m_data = NULL;
-        m_syslog = NULL;
-
-        //mkdir("/sd", 0777);
-        //m_sdfs->mount();
-        m_data = fopen(DATA_FILE_NAME, "a");
-        m_syslog = fopen(SYSLOG_FILE_NAME, "a");
-
-        if ((m_data != NULL) && (m_syslog != NULL))
-        {
-            // both opened successfully
-            fprintf(m_syslog, "Unit booted OK\n");
-            fclose(m_syslog);
-            
-            // write the header in on startup
-            fprintf(m_data, "Timestamp, Temperature (degC), Humidity (pc), Dewpoint\n");            
-            fclose(m_data);
-            mode = sd_CheckSysLogBuffer;
-        }
-        break;
-
-    case sd_CheckSysLogBuffer:     /* See if any data should be written to the log file */
-        if (m_sysLogBuff->dataAvailable())
-        {
-            tempInt = m_sysLogBuff->read(tempBuff, SD_BUFFER_LEN);
-            tempInt2 = fprintf(m_syslog, (const char*)tempBuff);
-            if (tempInt == tempInt2)
-            {
-                // success
-                mode = sd_CheckDataLogBuffer;
-            }
-            else
-            {
-                // something went wrong
-                m_timer->SetTimer(MyTimers::tmr_SdWaitError, 2000);
-                mode = sd_WaitError;
-            }
-        }
-        else {
-            mode = sd_CheckDataLogBuffer;
-        }
-        break;
-
-    case sd_CheckDataLogBuffer:    /* See if any data should be written to the data file */
-        if (m_dataLogBuff->dataAvailable())
-        {            
-            m_data = fopen(DATA_FILE_NAME, "a");
-
-            if (m_data != NULL)
-            {
-                // opened successfully            
-                tempInt = m_dataLogBuff->read(tempBuff, SD_BUFFER_LEN);
-                tempInt2 = fprintf(m_data, (const char*)tempBuff);            
-                fclose(m_data);
-                if (tempInt == tempInt2)
-                {
-                    // success
-                    myled2 = 0;
-                    mode = sd_CheckSysLogBuffer;
-                }
-                else
-                {
-                    // something went wrong
-                    m_timer->SetTimer(MyTimers::tmr_SdWaitError, 2000);
-                    mode = sd_WaitError;
-                }
-            }            
-            else
-            {
-                // something went wrong
-                m_timer->SetTimer(MyTimers::tmr_SdWaitError, 2000);
-                mode = sd_WaitError;
-            }
-        }
-        else {
-            mode = sd_CheckSysLogBuffer;
-        }
-        break;
-
-    case sd_WaitError:     /* Many fails, much wow, wait for a while */
-        if (!m_timer->GetTimer(MyTimers::tmr_SdWaitError))
-        {
-            // timer has elapsed. go back to start.
-            mode = sd_Start;
-        }
-        break;
-    }
-}
-
-void SdHandler::setRequest(int request, void *data)
-{
-    request_t req = (request_t)request;
-    m_lastRequest = req;
-    switch(req) {
-    case sdreq_SdNone:
-    
-        break;
-    case sdreq_LogData:
-            
-        myled2 = 1;
-        // have received the data struct. cast it
-        Dht22Result *result = (Dht22Result*)data;
-        
-        // write things to sd card buffer
-        char s[50]; // buffer
-        int temp;   // length of buffer
-        csvStart(result->resultTime);
-        temp = sprintf(s, "%4.2f", result->lastCelcius);
-        csvData(s, temp);
-        temp = sprintf(s, "%4.2f",    result->lastHumidity);
-        csvData(s, temp);
-        temp = sprintf(s, "%4.2f",    result->lastDewpoint);
-        csvData(s, temp);
-        csvEnd();
-        break;
-    case sdreq_LogSystem:
-        char *str = (char*)data;
-        logEvent(str);
-        break;
-    }
-}
-
-void SdHandler::csvStart(time_t _time)
-{
-    unsigned char sTemp[17];
-    
-    
-    // extract time_t to time info struct
-    
-    struct tm * timeinfo = localtime(&_time);
-    
-    // print the formatted timestamp at the start of terminalBuffer, with comma
-    sprintf((char*)&sTemp[0], "%04d%02d%02d %02d%02d%02d,", (timeinfo->tm_year + 1900),
-                                                    (timeinfo->tm_mon + 1),
-                                                    timeinfo->tm_mday,
-                                                    timeinfo->tm_hour,
-                                                    timeinfo->tm_min,
-                                                    timeinfo->tm_sec);
-                      
-    sTemp[16] = 0;
-                          
-    m_dataLogBuff->add(sTemp);
-}
-
-void SdHandler::csvData(const char * s, int len)
-{
-    unsigned char sTemp[50];
-    int idx = 0;
-    // add a column to the buffer
-    sprintf((char*)&sTemp[idx], s);
-    idx += len;
-    sTemp[idx++] = ',';
-    sTemp[idx] = 0;
-    m_dataLogBuff->add(sTemp);
-}
-
-void SdHandler::csvEnd()
-{
-    unsigned char sTemp[2];
-    sTemp[0] = '\n';
-    sTemp[1] = 0;
-    m_dataLogBuff->add(sTemp);
-}
-
-void SdHandler::logEvent(const char * s)
-{
-}
+#include "SdHandler.h"
+
+#include "sensor.h"     // for interpreting the result struct
+
+#ifdef ENABLE_PROFILING
+#include "profiler.h"
+extern Profiler *profiler;
+#endif
+
+#define SD_CSV_LINE_MAX 64u  // longest line written to the data CSV file
+
+#if defined(SD_BINARY_LOG) && (BINLOG_BLOCK_MAX > SD_BUFFER_LEN)
+#error "a binary log block must fit in the data buffer"
+#endif
+
+// define pins for communicating with SD card
+#define PIN_MOSI        P1_22
+#define PIN_MISO        P1_21
+#define PIN_SCK         P1_20
+#define PIN_CS          P1_23
+
+#define SYSLOG_FILE_NAME "/sd/log.txt"
+
+// declare led that will be used to express state of SD card
+extern DigitalOut myled2;
+
+SdHandler::SdHandler(MyTimers * _timer) : AbstractHandler(_timer), m_sdfs(PIN_MOSI, PIN_MISO, PIN_SCK, PIN_CS, "sd")
+{
+    // init files
+    m_data = NULL;
+    m_syslog = NULL;
+
+    mode = sd_Start;
+    m_lastRequest = sdreq_SdNone;
+
+    m_errorTimer = m_timer->registerTimer();
+    m_flushTimer = m_timer->registerTimer();
+
+    // sector staging for the data file
+    m_sectorFill = 0;
+    m_fileSize = 0;
+    m_syncRequested = false;
+    memset(&m_writeStats, 0, sizeof(m_writeStats));
+
+#ifdef SD_BINARY_LOG
+    m_blockTimer = m_timer->registerTimer();
+#endif
+
+#ifdef ENABLE_PROFILING
+    m_profTimer = m_timer->registerTimer();
+    m_timer->SetTimer(m_profTimer, PROFILER_LOG_PERIOD_MS);
+    m_profDumping = false;
+    m_profCursor  = 0;
+#endif
+}
+
+void SdHandler::run()
+{
+    switch(mode)
+    {
+    case sd_Start:              /* Set up the state machine */
+        // check if card is inserted??
+        //m_sdfs.unmount();
+        // close both files if necessary
+        if (m_data != NULL)
+            fclose(m_data);
+        if (m_syslog != NULL)
+            fclose(m_syslog);
+
+        m_data = NULL;
+        m_syslog = NULL;
+
+        //mkdir("/sd", 0777);
+        //m_sdfs.mount();
+        m_data = fopen(DATA_FILE_NAME, "a");
+        m_syslog = fopen(SYSLOG_FILE_NAME, "a");
+
+        if ((m_data != NULL) && (m_syslog != NULL))
+        {
+            // both opened successfully
+            fprintf(m_syslog, "Unit booted OK\n");
+            fclose(m_syslog);
+            m_syslog = NULL;
+
+            // the data file stays open. Writes to it are staged a sector at a time, so stdio does not need to buffer them too
+            setvbuf(m_data, NULL, _IONBF, 0);
+            fseek(m_data, 0, SEEK_END);
+            m_fileSize = ftell(m_data);
+            
+#ifndef SD_BINARY_LOG
+            // write the header in on startup
+            int headerLen = fprintf(m_data, "Timestamp, Temperature (degC), Humidity (pc), Dewpoint\n");
+            if (headerLen > 0) {
+                m_fileSize += headerLen;
+            }
+#endif
+            mode = sd_CheckSysLogBuffer;
+        }
+        else
+        {
+            // card not there or not ready, try again in a while rather than on every pass
+            m_timer->SetTimer(m_errorTimer, 2000);
+            mode = sd_WaitError;
+        }
+        break;
+
+    case sd_CheckSysLogBuffer:     /* See if any data should be written to the log file */
+#ifdef ENABLE_PROFILING
+        if (!m_profDumping && !m_timer->GetTimer(m_profTimer)) {
+            // time to write the profiler report
+            m_timer->SetTimer(m_profTimer, PROFILER_LOG_PERIOD_MS);
+            m_profDumping = true;
+            m_profCursor  = 0;
+
+            char s[32];
+            snprintf(s, sizeof(s), "profile after %lu s", (unsigned long)(m_timer->now() / 1000));
+            logEvent(s);
+        }
+        if (m_profDumping) {
+            logProfile();
+        }
+#endif
+        if (m_sysLogBuff.dataAvailable())
+        {
+            m_syslog = fopen(SYSLOG_FILE_NAME, "a");
+            bool ok = (m_syslog != NULL) && drainToFile(&m_sysLogBuff, m_syslog);
+            if (m_syslog != NULL) {
+                fclose(m_syslog);
+                m_syslog = NULL;
+            }
+
+            if (ok)
+            {
+                // success
+                mode = sd_CheckDataLogBuffer;
+            }
+            else
+            {
+                // something went wrong
+                m_timer->SetTimer(m_errorTimer, 2000);
+                mode = sd_WaitError;
+            }
+        }
+        else {
+            mode = sd_CheckDataLogBuffer;
+        }
+        break;
+
+    case sd_CheckDataLogBuffer:    /* See if any data should be written to the data file */
+#ifdef SD_BINARY_LOG
+        if (m_binLog.count() && !m_timer->GetTimer(m_blockTimer)) {
+            // the block has waited long enough for more results
+            binFlush();
+        }
+#endif
+        if (m_dataLogBuff.dataAvailable() || m_syncRequested ||
+            (m_sectorFill && !m_timer->GetTimer(m_flushTimer)))
+        {
+            // stage everything waiting, writing out each sector as it fills. Then write out the part filled
+            // sector if it has waited long enough, or a sync was asked for
+            bool ok = (m_data != NULL) && stageData();
+            if (ok && m_sectorFill) {
+                if (m_syncRequested) {
+                    ok = writeSector(write_Sync);
+                }
+                else if (!m_timer->GetTimer(m_flushTimer)) {
+                    ok = writeSector(write_Age);
+                }
+            }
+
+            if (ok)
+            {
+                // success
+                m_syncRequested = false;
+                myled2 = (m_sectorFill != 0);
+                mode = sd_CheckSysLogBuffer;
+            }
+            else
+            {
+                // something went wrong
+                m_timer->SetTimer(m_errorTimer, 2000);
+                mode = sd_WaitError;
+            }
+        }
+        else {
+            mode = sd_CheckSysLogBuffer;
+
+            // both buffers are empty, nothing to do until another request comes in
+            if (!m_sysLogBuff.dataAvailable()) {
+                idle();
+            }
+        }
+        break;
+
+    case sd_WaitError:     /* Many fails, much wow, wait for a while */
+        if (!m_timer->GetTimer(m_errorTimer))
+        {
+            // timer has elapsed. go back to start.
+            mode = sd_Start;
+        }
+        else {
+            waitForTimer(m_errorTimer);
+        }
+        break;
+    }
+}
+
+void SdHandler::setRequest(int request, void *data)
+{
+    request_t req = (request_t)request;
+    m_lastRequest = req;
+    wake();
+    switch(req) {
+    case sdreq_SdNone:
+    
+        break;
+    case sdreq_LogData:
+        myled2 = 1;
+        // have received the data struct. cast it, and write it to the sd card buffer
+#ifdef SD_BINARY_LOG
+        binRecord((Measurement*)data);
+#else
+        csvLine((Measurement*)data);
+#endif
+        break;
+    case sdreq_LogSystem:
+        logEvent((char*)data);
+        break;
+    case sdreq_Sync:
+#ifdef SD_BINARY_LOG
+        binFlush();     // the block that is being collected goes too
+#endif
+        m_syncRequested = true;
+        break;
+    }
+}
+
+// write the whole line, YYYYMMDD HHMMSS,temp,humidity,dewpoint,[sensor]
+// straight into the data circular buffer
+void SdHandler::csvLine(const Measurement *result)
+{
+    // format in place if the free space does not wrap, otherwise format on the stack and copy it in
+    unsigned char *dst;
+    char line[SD_CSV_LINE_MAX];
+    uint16_t avail = m_dataLogBuff.reserve(&dst);
+    bool inPlace = (avail >= SD_CSV_LINE_MAX);
+
+    char *start = inPlace ? (char*)dst : line;
+    char *p = m_stamp.format(start, result->time);
+    for (uint8_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+        *p++ = ',';
+        p = fmtCenti(p, result->value[i]);
+    }
+    *p++ = ',';
+    if (result->sensor != 0) {
+        *p++ = '0' + result->sensor;        // one digit, as there are at most SAMPLER_MAX_SENSORS
+    }
+    *p++ = '\n';
+    int len = p - start;    // at most 44 characters, so always fits in a line
+
+    if (inPlace) {
+        m_dataLogBuff.commit(len);
+    } else if (len <= m_dataLogBuff.remainingSize()) {
+        m_dataLogBuff.write((unsigned char*)line, len);
+    } else {
+        m_dataLogBuff.overflow();
+    }
+}
+
+#ifdef SD_BINARY_LOG
+void SdHandler::binRecord(const Measurement *result)
+{
+    BinLogRecord record;
+    record.time          = (uint32_t)result->time;
+    record.sensor        = result->sensor;
+    record.centiCelcius  = result->value[0];
+    record.centiHumidity = (uint16_t)result->value[1];
+    record.centiDewpoint = result->value[2];
+
+    if (!m_binLog.add(record)) {
+        // full, or too long since the last result. Start a new block with it
+        binFlush();
+        m_binLog.add(record);
+    }
+
+    if (m_binLog.count() == 1) {
+        m_timer->SetTimer(m_blockTimer, SD_BINLOG_BLOCK_AGE_MS);
+    }
+    else if (m_binLog.count() == BINLOG_BLOCK_RECORDS) {
+        binFlush();
+    }
+}
+
+void SdHandler::binFlush()
+{
+    if (m_binLog.count() == 0) {
+        return;
+    }
+
+    uint16_t len = m_binLog.encodedSize();
+    if (len > m_dataLogBuff.remainingSize()) {
+        // the card has not kept up. The block is lost, but the next one starts afresh
+        m_dataLogBuff.overflow();
+        m_binLog.discard();
+        return;
+    }
+
+    // encode in place if the free space does not wrap, otherwise encode on the stack and copy it in
+    unsigned char *dst;
+    if (m_dataLogBuff.reserve(&dst) >= len) {
+        m_binLog.encode(dst);
+        m_dataLogBuff.commit(len);
+    }
+    else {
+        unsigned char block[BINLOG_BLOCK_MAX];
+        m_binLog.encode(block);
+        m_dataLogBuff.write(block, len);
+    }
+    myled2 = 1;
+}
+#endif
+
+void SdHandler::idle()
+{
+    // wait for a request, or for whichever of the timers that have something waiting on them is due first
+    MyTimers::timerid_t due[3];
+    int numDue = 0;
+    if (m_sectorFill) {
+        due[numDue++] = m_flushTimer;
+    }
+#ifdef SD_BINARY_LOG
+    if (m_binLog.count()) {
+        due[numDue++] = m_blockTimer;
+    }
+#endif
+#ifdef ENABLE_PROFILING
+    due[numDue++] = m_profTimer;
+#endif
+
+    if (numDue == 0) {
+        waitForEvent();
+        return;
+    }
+
+    MyTimers::timerid_t first = due[0];
+    for (int i = 1; i < numDue; i++) {
+        if (m_timer->GetTimer(due[i]) < m_timer->GetTimer(first)) {
+            first = due[i];
+        }
+    }
+    waitForTimer(first);
+}
+
+void SdHandler::logEvent(const char * s)
+{
+    // the line goes in whole, with its line ending, or not at all
+    uint16_t len = strlen(s);
+    if ((len + 1u) > m_sysLogBuff.remainingSize()) {
+        m_sysLogBuff.overflow();
+        return;
+    }
+    m_sysLogBuff.write((const unsigned char*)s, len);
+    m_sysLogBuff.putc('\n');
+}
+
+#ifdef ENABLE_PROFILING
+void SdHandler::logProfile()
+{
+    char line[PROFILER_LINE_MAX];
+
+    // copy in as many lines as there is room for, and carry on from there next time
+    while (m_sysLogBuff.remainingSize() > sizeof(line)) {
+        if (profiler->formatLine(&m_profCursor, line, sizeof(line)) == 0) {
+            m_profDumping = false;
+            return;
+        }
+        logEvent(line);
+    }
+}
+#endif
+
+bool SdHandler::drainToFile(CircBuffBase *buff, FILE *fp)
+{
+    // write straight from the buffer. The data can wrap, so there may be two contiguous regions
+    for (int region = 0; (region < 2) && buff->dataAvailable(); region++) {
+        const unsigned char *p;
+        uint16_t len = buff->peek(&p);
+        size_t written = fwrite(p, 1, len, fp);
+        buff->consume(written);
+        if (written != len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SdHandler::stageData()
+{
+    while (m_dataLogBuff.dataAvailable()) {
+        // fill up to the next sector boundary in the file, so each full write is exactly one sector. After the file
+        // is reopened the boundary may have moved under data that is already staged, which then goes out first.
+        uint16_t room = SD_SECTOR_LEN - (m_fileSize % SD_SECTOR_LEN);
+        if (m_sectorFill < room) {
+            const unsigned char *p;
+            uint16_t len = m_dataLogBuff.peek(&p);
+            if (len > (room - m_sectorFill)) {
+                len = room - m_sectorFill;
+            }
+            if (m_sectorFill == 0) {
+                m_timer->SetTimer(m_flushTimer, SD_FLUSH_AGE_MS);
+            }
+            memcpy(m_sector + m_sectorFill, p, len);
+            m_dataLogBuff.consume(len);
+            m_sectorFill += len;
+        }
+
+        if ((m_sectorFill >= room) && !writeSector(write_Full)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SdHandler::writeSector(write_t reason)
+{
+    uint32_t start = us_ticker_read();
+    size_t written = fwrite(m_sector, 1, m_sectorFill, m_data);
+    bool ok = (written == m_sectorFill);
+    if (ok && (reason != write_Full)) {
+        // a part sector is only safe once the file system has written it and updated the directory entry
+        ok = (fflush(m_data) == 0);
+    }
+    uint32_t elapsed = us_ticker_read() - start;
+
+    // keep anything that was not written, to go out next time
+    if (written > 0) {
+        memmove(m_sector, m_sector + written, m_sectorFill - written);
+        m_sectorFill -= written;
+        m_fileSize += written;
+    }
+
+    m_writeStats.bytes += written;
+    m_writeStats.sectors++;
+    m_writeStats.totalWriteUs += elapsed;
+    if (elapsed > m_writeStats.maxWriteUs) {
+        m_writeStats.maxWriteUs = elapsed;
+    }
+    if (!ok) {
+        m_writeStats.errors++;
+        return false;
+    }
+    switch (reason) {
+    case write_Full:
+        m_writeStats.fullWrites++;
+        break;
+    case write_Age:
+        m_writeStats.ageFlushes++;
+        break;
+    case write_Sync:
+        m_writeStats.syncFlushes++;
+        break;
+    }
+    return true;
+}
@@ -1,59 +1,154 @@
-#ifndef __SD_HANDLER_H__
-#define __SD_HANDLER_H__
-
-#include "SDFileSystem.h"
-#include "AbstractHandler.h"
-
-class CircBuff;
-
-/*!
- * \brief The SdHandler class writes messages to file and handles SD card status
- * 
- * A data CSV file is written with timestamps and the result from the GroveDht22.
- * A system log, not yet fully implemented, tracks system events for debugging purposes.
- */
-class SdHandler : public AbstractHandler
-{
-public:
-    SdHandler(MyTimers * _timer);
-    ~SdHandler();
-
-    void run();
-
-    void setRequest(int request, void *data = 0);
-
-    bool sdOk();
-
-    enum request_t {
-        sdreq_SdNone,       ///< to init
-        sdreq_LogData,      ///< Send struct containing a result and timestamp. This turns it into a line in a csv file
-        sdreq_LogSystem     ///< write raw string to system logging file (errors, events, etc)
-    };
-
-private:
-    SDFileSystem * m_sdfs;
-    FILE * m_data;
-    FILE * m_syslog;
-
-    enum mode_t{
-        sd_Start,                   ///< Set up the state machine
-        sd_CheckSysLogBuffer,       ///< See if any data should be written to the log file
-        sd_CheckDataLogBuffer,      ///< See if any data should be written to the data file
-
-        sd_WaitError                ///< Error. wait for a while
-    };
-    mode_t mode;
-
-    request_t m_lastRequest;
-    
-    // helpers
-    void csvStart(time_t time);
-    void csvData(const char * s, int len);
-    void csvEnd();
-    void logEvent(const char * s);
-    
-    CircBuff *m_dataLogBuff;        ///< Data waiting to be written to the data CSV file
-    CircBuff *m_sysLogBuff;         ///< Data waiting to be written to the system log file (not yet implemented)
-};
-
-#endif // __SD_HANDLER_H__
+#ifndef __SD_HANDLER_H__
+#define __SD_HANDLER_H__
+
+#include "SDFileSystem.h"
+#include "AbstractHandler.h"
+#include "config.h"
+#include "circbuff.h"
+#include "formatter.h"
+#ifdef SD_BINARY_LOG
+#include "binlog.h"
+#endif
+
+#ifdef SD_BINARY_LOG
+#define DATA_FILE_NAME   "/sd/data.bin"
+#else
+#define DATA_FILE_NAME   "/sd/data.csv"
+#endif
+
+#define SD_BUFFER_LEN 256u   // length of circular buffers, a power of two
+#define SD_SECTOR_LEN 512u   // data file writes are staged into whole sectors
+
+struct Measurement;
+
+/*!
+ * \brief The SdHandler class writes messages to file and handles SD card status
+ * 
+ * A data CSV file is written with timestamps and each \a Measurement. The last column is the index of the sensor it
+ * came from, left empty for the first, so a single sensor's file is as it always was. With SD_BINARY_LOG, the results are
+ * collected into \a BinLogBlock blocks and written to a binary file instead, which takes far less time and space.
+ * The data file is kept open. Data is staged into a sector buffer and written out a whole sector at a time, lined up
+ * with the sectors of the file, so a full sector never has to be merged with one already on the card. A part filled
+ * sector is written out and flushed to the card when it is SD_FLUSH_AGE_MS old, or when \a sdreq_Sync is requested.
+ * \a writeStats counts how well that is working.
+ *
+ * A system log, not yet fully implemented, tracks system events for debugging purposes.
+ * With ENABLE_PROFILING, the \a Profiler report is written to it every PROFILER_LOG_PERIOD_MS.
+ */
+/*!
+ * \brief The SdWriteStats struct counts the writes to the data file
+ *
+ * The write amplification is (sectors * 512) / bytes: 1 when every sector is written once, whole.
+ */
+struct SdWriteStats {
+    uint32_t bytes;             ///< bytes of data written to the file
+    uint32_t sectors;           ///< sector writes, so a sector written in two parts counts twice
+    uint32_t fullWrites;        ///< writes of a full sector
+    uint32_t ageFlushes;        ///< part sectors written and flushed because they were SD_FLUSH_AGE_MS old
+    uint32_t syncFlushes;       ///< part sectors written and flushed because of \a sdreq_Sync
+    uint32_t errors;            ///< writes or flushes that failed
+    uint32_t maxWriteUs;        ///< longest write, including the flush if there was one
+    uint64_t totalWriteUs;      ///< time spent in all writes, for the mean
+};
+
+class SdHandler : public AbstractHandler
+{
+public:
+    SdHandler(MyTimers * _timer);
+
+    void run();
+    const char *name() const { return "sd"; }
+    uint8_t currentMode() const { return mode; }
+
+    void setRequest(int request, void *data = 0);
+
+    bool sdOk();
+
+    enum request_t {
+        sdreq_SdNone,       ///< to init
+        sdreq_LogData,      ///< Send struct containing a result and timestamp. This turns it into a line in a csv file
+        sdreq_LogSystem,    ///< write raw string to system logging file (errors, events, etc)
+        sdreq_Sync          ///< write everything waiting to the card now, and flush it
+    };
+
+    const SdWriteStats &writeStats() const { return m_writeStats; }
+
+    //! syncPending is true from \a sdreq_Sync until what was waiting has been written and flushed, or the card has failed
+    bool syncPending() const { return m_syncRequested && (mode != sd_WaitError); }
+
+private:
+    SDFileSystem m_sdfs;
+    FILE * m_data;
+    FILE * m_syslog;
+
+    enum mode_t{
+        sd_Start,                   ///< Set up the state machine
+        sd_CheckSysLogBuffer,       ///< See if any data should be written to the log file
+        sd_CheckDataLogBuffer,      ///< See if any data should be written to the data file
+
+        sd_WaitError                ///< Error. wait for a while
+    };
+    mode_t mode;
+
+    request_t m_lastRequest;
+
+    MyTimers::timerid_t m_errorTimer;   ///< Sd card has hit an error, wait before retrying
+    MyTimers::timerid_t m_flushTimer;   ///< The part filled sector must be written by this deadline
+
+    unsigned char m_sector[SD_SECTOR_LEN];  ///< Data staged for the next write to the data file
+    uint16_t m_sectorFill;      ///< bytes in \a m_sector
+    uint32_t m_fileSize;        ///< bytes written to the data file, so where \a m_sector starts in it
+    bool m_syncRequested;       ///< \a sdreq_Sync has been requested
+    SdWriteStats m_writeStats;
+
+    enum write_t {
+        write_Full,             ///< the sector is full
+        write_Age,              ///< the part sector is SD_FLUSH_AGE_MS old
+        write_Sync              ///< \a sdreq_Sync
+    };
+
+#ifdef ENABLE_PROFILING
+    MyTimers::timerid_t m_profTimer;    ///< time to write the profiler report to the system log
+    bool m_profDumping;                 ///< the profiler report is being written
+    uint16_t m_profCursor;              ///< how far through the profiler report has been written
+
+    void logProfile();      // write as much of the profiler report as there is room for
+#endif
+    
+    // helpers
+    void csvLine(const Measurement *result);
+    void idle();            // wait for a request, or for whatever is due next
+    void logEvent(const char * s);
+
+    /*!
+     * \brief drainToFile writes everything waiting in \a buff directly to \a fp
+     * \return true if it was all written, false if the file write came up short
+     */
+    bool drainToFile(CircBuffBase *buff, FILE *fp);
+
+    /*!
+     * \brief stageData moves everything in \a m_dataLogBuff into \a m_sector, writing each sector as it fills
+     * \return false if a write failed
+     */
+    bool stageData();
+
+    /*!
+     * \brief writeSector writes \a m_sector to the data file, and flushes it to the card unless it is a full sector
+     * \return false if the write failed, in which case whatever was not written stays staged
+     */
+    bool writeSector(write_t reason);
+    
+    CircBuff<SD_BUFFER_LEN> m_dataLogBuff;  ///< Data waiting to be written to the data CSV file
+    CircBuff<SD_BUFFER_LEN> m_sysLogBuff;   ///< Data waiting to be written to the system log file (not yet implemented)
+    TimestampFormatter m_stamp;             ///< Formats the timestamps of the data CSV file
+
+#ifdef SD_BINARY_LOG
+    BinLogBlock m_binLog;               ///< Results waiting to be encoded into \a m_dataLogBuff as a block
+    MyTimers::timerid_t m_blockTimer;   ///< The block must be written by this deadline
+
+    void binRecord(const Measurement *result);  // add the result to the block, writing the block if it is full
+    void binFlush();                            // encode the block into the data buffer
+#endif
+};
+
+#endif // __SD_HANDLER_H__
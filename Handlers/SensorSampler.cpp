@@ -0,0 +1,127 @@
+#include "SensorSampler.h"
+#include "measurementhandler.h"
+#include "DHT.h"     // for ERROR_NONE
+#include "rtc.h"
+
+DigitalOut grovePwr(P1_3);          // if anything else is interfaced to uart/adc/i2c connectors, this will have to change, as they share this enable line
+
+SensorSampler::SensorSampler(MeasurementHandler *_measure, MyTimers *_timer) : AbstractHandler(_timer), m_measure(_measure)
+{
+    mode          = smp_PowerOff;
+    m_count       = 0;
+    m_reading     = 0;
+    m_sampleTimer = m_timer->registerTimer();
+}
+
+int SensorSampler::addSensor(Sensor *sensor, uint32_t periodMs)
+{
+    if (m_count >= SAMPLER_MAX_SENSORS) {
+        return -1;
+    }
+    Slot &slot    = m_slots[m_count];
+    slot.sensor   = sensor;
+    slot.periodMs = periodMs;
+    slot.due      = 0;
+    slot.retries  = 0;
+    return m_count++;
+}
+
+void SensorSampler::run()
+{
+    switch (mode)
+    {
+    case smp_PowerOff:
+        powerOn(false);
+        m_timer->SetTimer(m_sampleTimer, SAMPLER_POWER_OFF_MS);
+        mode = smp_PowerOffWait;
+        break;
+
+    case smp_PowerOffWait:
+        if (!m_timer->GetTimer(m_sampleTimer))      // wait until timer has elapsed
+            mode = smp_PowerOn;
+        else
+            waitForTimer(m_sampleTimer);            // come back here when it has
+        break;
+
+    case smp_PowerOn:
+        powerOn(true);
+        m_timer->SetTimer(m_sampleTimer, SAMPLER_POWER_ON_MS);
+        mode = smp_PowerOnWait;
+        break;
+
+    case smp_PowerOnWait:
+        if (m_timer->GetTimer(m_sampleTimer)) {
+            waitForTimer(m_sampleTimer);
+            break;
+        }
+        // spread the first readings over each sensor's period, so they do not all come at once
+        for (uint8_t i = 0; i < m_count; i++) {
+            m_slots[i].due     = m_timer->now() + ((m_slots[i].periodMs / m_count) * i);
+            m_slots[i].retries = 0;
+        }
+        mode = smp_WaitSensor;
+        break;
+
+    case smp_WaitSensor: {
+        if (m_count == 0) {
+            waitForEvent();                         // nothing to read
+            break;
+        }
+        // the sensor that is due first
+        uint8_t next = 0;
+        for (uint8_t i = 1; i < m_count; i++) {
+            if ((int32_t)(m_slots[i].due - m_slots[next].due) < 0) {
+                next = i;
+            }
+        }
+        m_timer->SetDeadline(m_sampleTimer, m_slots[next].due);
+        if (m_timer->GetTimer(m_sampleTimer)) {
+            waitForTimer(m_sampleTimer);            // come back here when it is due
+            break;
+        }
+        // the edges, or whatever the sensor reads, are recorded by interrupt from here
+        m_reading = next;
+        m_timer->SetTimer(m_sampleTimer, m_slots[next].sensor->start());
+        mode = smp_ReadSensor;
+        break;
+    }
+
+    case smp_ReadSensor: {
+        if (m_timer->GetTimer(m_sampleTimer)) {     // reading still going
+            waitForTimer(m_sampleTimer);
+            break;
+        }
+        Slot &slot = m_slots[m_reading];
+        Measurement m;
+        int error = slot.sensor->collect(m.value);
+        slot.due += slot.periodMs;
+        if ((int32_t)(slot.due - m_timer->now()) < 0) {
+            slot.due = m_timer->now() + slot.periodMs;  // fell behind, so carry on from now rather than catch up
+        }
+        mode = smp_WaitSensor;
+
+        if (error == ERROR_NONE) {
+            slot.retries = 0;
+            m.time   = my_rtc_time(&m.ms);
+            m.sensor = m_reading;
+            m.kind   = slot.sensor->kind();
+            m_measure->postResult(m);               // if the queue is full, the drop is counted there
+        }
+        else {
+            // there was an error. See if we have reached critical retries
+            if (++slot.retries >= SAMPLER_NUM_RETRIES) {
+                mode = smp_PowerOff;                // restart the sensors
+            }
+            m_measure->postError(m_reading, error);
+        }
+        break;
+    }
+    }
+}
+
+// turn the enable pin for the peripheral plugins on the Arch GPRS v2
+// it is active low and acts on Q1
+void SensorSampler::powerOn(bool on)
+{
+    grovePwr = on ? 0 : 1;
+}
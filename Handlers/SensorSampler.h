@@ -0,0 +1,83 @@
+#ifndef __SENSOR_SAMPLER_H__
+#define __SENSOR_SAMPLER_H__
+
+#include "mbed.h"
+#include "AbstractHandler.h"
+#include "sensor.h"
+
+#define SAMPLER_MAX_SENSORS     8u      // most sensors that can be added
+#define SAMPLER_NUM_RETRIES     10u     // failed readings in a row from one sensor before the Grove power is cycled
+#define SAMPLER_POWER_OFF_MS    1000u   // how long the Grove power is left off
+#define SAMPLER_POWER_ON_MS     1000u   // how long the sensors are left to settle after it is turned on
+
+class MeasurementHandler;
+
+/*!
+ * \brief The SensorSampler class reads any number of \a Sensor, each on its own schedule, and posts their readings
+ *
+ * Each sensor is added with \a addSensor and the period to read it at. Once the Grove power has been turned on and
+ * the sensors have settled, their first readings are staggered over their periods, so sensor i of n is first read
+ * i/n of the way through its period, and after that every period. Readings are taken one at a time: the sensor that
+ * is due first is started, and collected when it says it will be ready. A sensor that falls due while another is
+ * being read waits for it, which is no more than a few ms.
+ *
+ * One timer covers all of it, set for the end of the reading in progress or for the next sensor to fall due.
+ *
+ * Good readings go to \a MeasurementHandler as a \a Measurement tagged with the sensor's index, and failed ones with
+ * \a MeasurementHandler::postError. The sensors share the Grove power line, so when one of them fails
+ * SAMPLER_NUM_RETRIES times in a row, the power is cycled for all of them, and their schedules start again.
+ */
+class SensorSampler : public AbstractHandler
+{
+public:
+    SensorSampler(MeasurementHandler *_measure, MyTimers *_timer);
+
+    /*!
+     * \brief addSensor adds a sensor to be read. Sensors should all be added before the first \a run
+     * \param sensor is the sensor, which has to last as long as the sampler
+     * \param periodMs is how often to read it
+     * \return the index of the sensor, which tags its measurements, or -1 if SAMPLER_MAX_SENSORS have been added
+     */
+    int addSensor(Sensor *sensor, uint32_t periodMs);
+
+    //! sensorCount is the number of sensors added
+    uint8_t sensorCount() const { return m_count; }
+
+    void run();
+    const char *name() const { return "sampler"; }
+    uint8_t currentMode() const { return mode; }
+    bool canDeepSleep() { return mode != smp_ReadSensor; }     // the edges are timed by us_ticker
+
+private:
+    /*!
+     * \brief The Slot struct is a sensor and its schedule
+     */
+    struct Slot {
+        Sensor  *sensor;
+        uint32_t periodMs;
+        uint32_t due;           ///< \a MyTimers::now when it is next to be read
+        uint8_t  retries;       ///< failed readings in a row
+    };
+
+    Slot    m_slots[SAMPLER_MAX_SENSORS];
+    uint8_t m_count;
+    uint8_t m_reading;          ///< slot being read, while in smp_ReadSensor
+
+    MeasurementHandler *m_measure;      ///< Reference to send measurement results and errors to for handling
+    MyTimers::timerid_t m_sampleTimer;  ///< The one timer, for whatever is next
+
+    // state machine
+    enum mode_t {
+        smp_PowerOff,           ///< Begin by ensuring the sensors are switched off
+        smp_PowerOffWait,       ///< Allow them to power down completely
+        smp_PowerOn,            ///< Turn the sensors on
+        smp_PowerOnWait,        ///< Allow them to settle, then stagger their first readings
+        smp_WaitSensor,         ///< Wait for the next sensor to fall due, and start its reading
+        smp_ReadSensor          ///< Once the reading is over, collect it and post it
+    };
+    mode_t mode;
+
+    void powerOn(bool on);      // the Grove power line, shared by all the sensors
+};
+
+#endif // __SENSOR_SAMPLER_H__
@@ -1,125 +1,446 @@
-#include "UsbComms.h"
-#include "mbed.h"
-
-#include "USBDevice.h"
-#include "USBSerial.h"
-
-#include "circbuff.h"
-
-#define USB_CIRC_BUFF 256
-
-extern DigitalOut myled1; // this led is used to notify state of USB comms
-
-UsbComms::UsbComms(MyTimers *_timer) : AbstractHandler(_timer)
-{
-    mode = usb_Start;
-
-    m_circBuff = new CircBuff(USB_CIRC_BUFF);
-
-    // Declare serial port for communication with PC over USB
-    _serial = new USBSerial;
-}
-
-UsbComms::~UsbComms()
-{
-    delete _serial;
-    delete m_circBuff;
-}
-
-void UsbComms::run()
-{
-    unsigned char temp;
-    switch(mode) {
-    case usb_Start:
-        mode = usb_CheckInput;
-        break;
-    case usb_CheckInput:
-        if (_serial->readable()) {
-            _serial->getc();
-            // todo: do something with it! this is where config events are started
-            // uncomment to print a message confirming input
-            // _serial->writeBlock((unsigned char*)"getc\r\n", 6);
-            //mode = usb_WaitForInput;
-            mode = usb_CheckOutput;
-        } else {
-            mode = usb_CheckOutput;
-        }
-        break;
-    case usb_CheckOutput:
-        if (m_circBuff->dataAvailable() && _serial->writeable()) {
-            // ensure only 64 bytes or less are written at a time
-            unsigned char s[TX_USB_MSG_MAX];
-            int len = m_circBuff->read(s, TX_USB_MSG_MAX);
-            _serial->writeBlock((unsigned char*)s, len);
-            myled1 = 1;
-
-        } else {
-            myled1 = 0;
-        }
-        mode = usb_CheckInput;
-        break;
-    }
-}
-
-void UsbComms::setRequest(int request, void *data)
-{
-    request_t req = (request_t)request;
-
-    switch (req) {
-    case usbreq_PrintToTerminal:
-        printToTerminal((char*)data);
-        break;
-    case usbreq_PrintToTerminalTimestamp:
-        printToTerminalEx((char*)data);
-        break;
-    }
-}
-
-void UsbComms::printToTerminal(char *s)
-{
-    // simply add this string to the circular buffer
-    m_circBuff->add((unsigned char*)s);
-}
-
-// print the message, but prepend it with a standard timestamp
-// YYYYMMDD HHMMSS: 
-// 01234567890123456
-void UsbComms::printToTerminalEx(char *s)
-{
-    unsigned char tempBuff[TX_USB_BUFF_SIZE];
-    // this won't work! needs to be a circular buffer...
-    uint16_t sSize = 0, i = 0, j = 0;
-
-    // get the length of the passed array (it should be null terminated, but include max buffer size for caution)
-    for (sSize = 0; (sSize < TX_USB_BUFF_SIZE) && (s[sSize] != 0); sSize++);
-
-
-    time_t _time = time(NULL); // get the seconds since dawn of time
-
-    // extract time_t to time info struct
-    struct tm * timeinfo = localtime(&_time);
-
-    // print the formatted timestamp at the start of terminalBuffer
-    sprintf((char*)&tempBuff[0], "%04d%02d%02d %02d%02d%02d:", (timeinfo->tm_year + 1900),
-            (timeinfo->tm_mon + 1),
-            timeinfo->tm_mday,
-            timeinfo->tm_hour,
-            timeinfo->tm_min,
-            timeinfo->tm_sec);
-
-
-    // copy the string into the remainder of the terminal buffer
-    for (i = 16; i < (16 + sSize); i++) {
-        tempBuff[i] = s[j++];
-    }
-
-    // add a carriage return and new line to the output buffer
-    tempBuff[i++] = '\r';
-    tempBuff[i++] = '\n';
-    tempBuff[i++] = 0;
-
-    // add it to the circular buffer
-    m_circBuff->add(tempBuff);
-}
-
-
+#include "UsbComms.h"
+#include "mbed.h"
+
+#include "USBDevice.h"
+
+#include "SdHandler.h"
+#include "sensor.h"
+#include "rtc.h"
+
+#include <stdlib.h>
+
+#ifdef ENABLE_PROFILING
+#include "profiler.h"
+extern Profiler *profiler;
+#endif
+
+#ifdef ENABLE_LOW_POWER
+#include "power.h"
+extern PowerManager *power;
+#endif
+
+extern DigitalOut myled1; // this led is used to notify state of USB comms
+
+UsbComms::UsbComms(MyTimers *_timer) : AbstractHandler(_timer)
+{
+    mode = usb_Start;
+
+    m_sd = NULL;
+
+    m_lineLen      = 0;
+    m_exportFile   = NULL;
+    m_exportDue    = false;
+    m_exportFrom   = 0;
+    m_exportTo     = 0;
+    m_exportOffset = 0;
+    m_frame        = NULL;
+    m_frameLeft    = 0;
+    m_packetFill   = 0;
+    memset(&m_exportStats, 0, sizeof(m_exportStats));
+
+    m_machineMode  = false;
+
+#ifdef ENABLE_PROFILING
+    m_profDumping = false;
+    m_profCursor  = 0;
+#endif
+#ifdef ENABLE_LOW_POWER
+    m_powerDumping = false;
+    m_powerCursor  = 0;
+#endif
+
+    // run again as soon as anything is received from the PC
+    _serial.attach(this, &UsbComms::onSerialRx);
+}
+
+UsbComms::~UsbComms()
+{
+    if (m_exportFile) {
+        fclose(m_exportFile);
+    }
+}
+
+void UsbComms::run()
+{
+    switch(mode) {
+    case usb_Start:
+        mode = usb_CheckInput;
+        break;
+    case usb_CheckInput:
+        while (_serial.readable()) {
+            onInput((char)_serial.getc());
+        }
+        mode = usb_CheckOutput;
+        break;
+    case usb_CheckOutput:
+#ifdef ENABLE_PROFILING
+        if (m_profDumping) {
+            printProfile();
+        }
+#endif
+#ifdef ENABLE_LOW_POWER
+        if (m_powerDumping) {
+            printPower();
+        }
+#endif
+        if (m_exportDue && !(m_sd && m_sd->syncPending())) {
+            startExport();
+        }
+        if (exporting()) {
+            sendExport();
+        }
+#ifdef ENABLE_LOW_POWER
+        else if (m_circBuff.dataAvailable() && !_serial.connected()) {
+            // there is no host to send it to, so let it go rather than stay awake until there is
+            const unsigned char *s;
+            m_circBuff.consume(m_circBuff.peek(&s));
+        }
+#endif
+        else if (m_circBuff.dataAvailable() && _serial.writeable()) {
+            // send straight out of the circular buffer, ensuring only 64 bytes or less are written at a time
+            const unsigned char *s;
+            uint16_t len = m_circBuff.peek(&s);
+            if (len > TX_USB_MSG_MAX) {
+                len = TX_USB_MSG_MAX;
+            }
+            _serial.writeBlock((unsigned char*)s, len);
+            m_circBuff.consume(len);
+            myled1 = 1;
+
+        } else {
+            myled1 = 0;
+        }
+        mode = usb_CheckInput;
+
+        // nothing more to send or receive, wait until there is. An export waiting for SdHandler's sync is looked at
+        // again on the next pass, as SdHandler runs after this
+        if (!m_circBuff.dataAvailable() && !_serial.readable() && !exporting() && !m_exportDue) {
+            waitForEvent();
+        }
+        break;
+    }
+}
+
+bool UsbComms::canDeepSleep()
+{
+    // the USB clock stops in deep sleep, which the host would see as the device going away
+    return !_serial.connected();
+}
+
+void UsbComms::setRequest(int request, void *data)
+{
+    request_t req = (request_t)request;
+    wake();
+
+    switch (req) {
+    case usbreq_PrintToTerminal:
+        printToTerminal((char*)data);
+        break;
+    case usbreq_PrintToTerminalTimestamp:
+        printToTerminalEx((char*)data);
+        break;
+    case usbreq_TelemetrySample: {
+        unsigned char frame[TELEMETRY_FRAME_MAX];
+        sendRecord(frame, m_telemetry.sample(frame, *(const Measurement*)data));
+        break;
+    }
+    case usbreq_TelemetryError: {
+        const SensorError *error = (const SensorError*)data;
+        unsigned char frame[TELEMETRY_FRAME_MAX];
+        sendRecord(frame, m_telemetry.error(frame, (uint32_t)time(NULL), error->sensor, error->error));
+        break;
+    }
+    case usbreq_TelemetryCounters: {
+        TelemetryCounters *counters = (TelemetryCounters*)data;
+        counters->usbDrops = drops();
+        unsigned char frame[TELEMETRY_FRAME_MAX];
+        sendRecord(frame, m_telemetry.counters(frame, (uint32_t)time(NULL), *counters));
+        break;
+    }
+    }
+}
+
+uint32_t UsbComms::drops() const
+{
+    return m_circBuff.overflows();
+}
+
+void UsbComms::onSerialRx()
+{
+    wake();
+}
+
+void UsbComms::onInput(char c)
+{
+#ifdef ENABLE_PROFILING
+    if ((c == 'p') && (m_lineLen == 0)) {
+        // print the profiler report
+        m_profDumping = true;
+        m_profCursor  = 0;
+        return;
+    }
+#endif
+#ifdef ENABLE_LOW_POWER
+    if ((c == 'w') && (m_lineLen == 0)) {
+        // print where the time has gone
+        m_powerDumping = true;
+        m_powerCursor  = 0;
+        return;
+    }
+#endif
+    if ((c == '\r') || (c == '\n')) {
+        m_line[m_lineLen] = 0;
+        if (m_lineLen > 0) {
+            command(m_line);
+        }
+        m_lineLen = 0;
+    }
+    else if (m_lineLen < (RX_USB_LINE_MAX - 1)) {
+        m_line[m_lineLen++] = c;
+    }
+}
+
+void UsbComms::command(const char *line)
+{
+    // x <from> <to> [offset]
+    if ((line[0] == 'x') && (line[1] == ' ')) {
+        char *p, *end;
+        m_exportFrom   = strtoul(line + 2, &p, 10);
+        m_exportTo     = strtoul(p, &end, 10);
+        m_exportOffset = strtoul(end, NULL, 10);
+        if ((p == line + 2) || (end == p)) {
+            printToTerminal((char*)"usage: x <from> <to> [offset]\r\n");
+            return;
+        }
+        // get what is waiting to be written onto the card first, so it can be read back. The data file is opened once
+        // that is done, as a handle only sees the file as big as it was when it was opened
+        if (m_sd) {
+            m_sd->setRequest(SdHandler::sdreq_Sync);
+        }
+        m_exportDue = true;
+        m_exportStats.exports++;
+        m_exportStats.startedMs = m_timer->now();
+        return;
+    }
+    // m 0|1
+    if ((line[0] == 'm') && (line[1] == ' ') && ((line[2] == '0') || (line[2] == '1')) && (line[3] == 0)) {
+        m_machineMode = (line[2] == '1');
+        return;
+    }
+    // t
+    if ((line[0] == 't') && (line[1] == 0)) {
+        char s[RTC_LINE_MAX + 2];
+        int len = my_rtc_format_stats(s, RTC_LINE_MAX);
+        memcpy(s + len, "\r\n", 3);
+        printToTerminal(s);
+        return;
+    }
+    printToTerminal((char*)"?\r\n");
+}
+
+void UsbComms::startExport()
+{
+    m_exportDue = false;
+    if (m_exportFile) {
+        fclose(m_exportFile);
+    }
+    m_exportFile = fopen(DATA_FILE_NAME, "rb");
+#ifdef SD_BINARY_LOG
+    m_export.start(m_exportFile, true, m_exportFrom, m_exportTo, m_exportOffset);
+#else
+    m_export.start(m_exportFile, false, m_exportFrom, m_exportTo, m_exportOffset);
+#endif
+    m_frameLeft = 0;    // the rest of an export that was going already is dropped
+}
+
+bool UsbComms::exporting() const
+{
+    return m_export.active() || (m_frameLeft > 0) || (m_packetFill > 0);
+}
+
+void UsbComms::sendExport()
+{
+    uint8_t packets = 0;
+    while ((packets < TX_USB_EXPORT_PACKETS) && _serial.writeable()) {
+        if (m_frameLeft == 0) {
+            // terminal output goes between frames, never into the middle of one
+            if (m_circBuff.dataAvailable()) {
+                const unsigned char *s;
+                uint16_t len = m_circBuff.peek(&s);
+                if (len > (TX_USB_MSG_MAX - m_packetFill)) {
+                    len = TX_USB_MSG_MAX - m_packetFill;
+                }
+                memcpy(m_packet + m_packetFill, s, len);
+                m_circBuff.consume(len);
+                m_packetFill += len;
+            }
+            else {
+                m_frameLeft = m_export.next(&m_frame);
+                if (m_frameLeft == 0) {
+                    break;      // the next frame is not ready yet, or that was the last
+                }
+                m_exportStats.frames++;
+            }
+        }
+
+        if ((m_packetFill == 0) && (m_frameLeft >= TX_USB_MSG_MAX)) {
+            // a whole packet of the frame can go as it is
+            sendPacket(m_frame, TX_USB_MSG_MAX);
+            m_frame     += TX_USB_MSG_MAX;
+            m_frameLeft -= TX_USB_MSG_MAX;
+            packets++;
+            continue;
+        }
+        uint16_t len = TX_USB_MSG_MAX - m_packetFill;
+        if (len > m_frameLeft) {
+            len = m_frameLeft;
+        }
+        memcpy(m_packet + m_packetFill, m_frame, len);
+        m_frame      += len;
+        m_frameLeft  -= len;
+        m_packetFill += len;
+        if (m_packetFill == TX_USB_MSG_MAX) {
+            sendPacket(m_packet, TX_USB_MSG_MAX);
+            m_packetFill = 0;
+            packets++;
+        }
+    }
+
+    // once the end frame is in, the last packet goes as it is
+    if (!m_export.active() && (m_frameLeft == 0)) {
+        if ((m_packetFill > 0) && _serial.writeable()) {
+            sendPacket(m_packet, m_packetFill);
+            m_packetFill = 0;
+        }
+        if (m_exportFile) {
+            fclose(m_exportFile);
+            m_exportFile = NULL;
+        }
+    }
+}
+
+void UsbComms::sendPacket(const unsigned char *data, uint8_t len)
+{
+    _serial.writeBlock((uint8_t*)data, len);
+    m_exportStats.bytes += len;
+    m_exportStats.packets++;
+    if (len == TX_USB_MSG_MAX) {
+        m_exportStats.fullPackets++;
+    }
+    m_exportStats.finishedMs = m_timer->now();
+    myled1 = 1;
+}
+
+void UsbComms::printToTerminal(char *s)
+{
+    if (m_machineMode) {
+        sendText(0, s, strlen(s));
+        return;
+    }
+    // simply add this string to the circular buffer
+    m_circBuff.add((unsigned char*)s);
+}
+
+// print the message, but prepend it with a standard timestamp
+// YYYYMMDD HHMMSS: 
+// 01234567890123456
+void UsbComms::printToTerminalEx(char *s)
+{
+    uint16_t sSize = strlen(s);
+    if (m_machineMode) {
+        // the record has the time in it already
+        sendText((uint32_t)time(NULL), s, sSize);
+        return;
+    }
+
+    // the timestamp, the message and the line ending go in together or not at all
+    if ((TX_USB_TIMESTAMP_LEN + sSize + 2) > m_circBuff.remainingSize()) {
+        m_circBuff.overflow();
+        return;
+    }
+
+    time_t _time = time(NULL); // get the seconds since dawn of time
+
+    // print the formatted timestamp straight into the circular buffer if it fits before the wrap,
+    // otherwise format it on the stack and copy it in
+    unsigned char *dst;
+    char stamp[TX_USB_TIMESTAMP_LEN];
+    uint16_t avail = m_circBuff.reserve(&dst);
+    bool inPlace = (avail >= TX_USB_TIMESTAMP_LEN);
+    *m_stamp.format(inPlace ? (char*)dst : stamp, _time) = ':';
+    if (inPlace) {
+        m_circBuff.commit(TX_USB_TIMESTAMP_LEN);
+    } else {
+        m_circBuff.write((unsigned char*)stamp, TX_USB_TIMESTAMP_LEN);
+    }
+
+    // copy the string in after it, followed by a carriage return and new line
+    m_circBuff.write((unsigned char*)s, sSize);
+    m_circBuff.write((const unsigned char*)"\r\n", 2);
+}
+
+void UsbComms::sendRecord(const unsigned char *frame, uint8_t len)
+{
+    // the record's sequence number has gone up either way, so the PC can tell it was lost
+    if (len > m_circBuff.remainingSize()) {
+        m_circBuff.overflow();
+        return;
+    }
+    m_circBuff.write(frame, len);
+}
+
+void UsbComms::sendText(uint32_t time, const char *s, uint16_t len)
+{
+    while ((len > 0) && ((s[len - 1] == '\r') || (s[len - 1] == '\n'))) {
+        len--;
+    }
+    // longer text goes in as many records as it takes
+    do {
+        uint16_t part = (len > TELEMETRY_TEXT_MAX) ? TELEMETRY_TEXT_MAX : len;
+        unsigned char frame[TELEMETRY_FRAME_MAX];
+        sendRecord(frame, m_telemetry.text(frame, time, s, part));
+        s   += part;
+        len -= part;
+    } while (len > 0);
+}
+
+#ifdef ENABLE_PROFILING
+void UsbComms::printProfile()
+{
+    // copy in as many lines as there is room for, and carry on from there next time
+    char line[PROFILER_LINE_MAX + 2];
+    while (m_circBuff.remainingSize() >= sizeof(line)) {
+        int len = profiler->formatLine(&m_profCursor, line, PROFILER_LINE_MAX);
+        if (len == 0) {
+            m_profDumping = false;
+            return;
+        }
+        if (m_machineMode) {
+            sendText(0, line, len);
+            continue;
+        }
+        memcpy(line + len, "\r\n", 2);
+        m_circBuff.write((unsigned char*)line, len + 2);
+    }
+}
+#endif
+
+#ifdef ENABLE_LOW_POWER
+void UsbComms::printPower()
+{
+    char line[POWER_LINE_MAX + 2];
+    while (m_circBuff.remainingSize() >= sizeof(line)) {
+        int len = power->formatLine(&m_powerCursor, line, POWER_LINE_MAX);
+        if (len == 0) {
+            m_powerDumping = false;
+            return;
+        }
+        if (m_machineMode) {
+            sendText(0, line, len);
+            continue;
+        }
+        memcpy(line + len, "\r\n", 2);
+        m_circBuff.write((unsigned char*)line, len + 2);
+    }
+}
+#endif
@@ -1,51 +1,149 @@
-#ifndef __USB_COMMS_H__
-#define __USB_COMMS_H__
-#include "AbstractHandler.h"
-
-#define TX_USB_MSG_MAX 64u       // only send 64 bytes at a time
-#define TX_USB_BUFF_SIZE 256u    // the tx buffer can hold up to 256 bytes
-
-class USBSerial;
-class CircBuff;
-
-/*!
- * \brief The UsbComms class handles input and output for the serial port connected to a PC
- * The main run() function cycles through checking for input and copying to a buffer to be handled,
- * and checking the output buffer to see if there is anything to be sent out.
- *
- * Data can be queued for output by copying it to the circular buffer
- */
-class UsbComms : public AbstractHandler
-{
-public:
-    UsbComms(MyTimers *_timer);
-    ~UsbComms();
-
-    void run();
-
-    void setRequest(int request, void *data = 0);
-    
-    enum request_t{
-        usbreq_PrintToTerminal,         ///< Print to terminal normally
-        usbreq_PrintToTerminalTimestamp ///< Print to terminal, including the timestamp
-    };
-
-private:
-    USBSerial *_serial;         ///< Interface to the serial port
-    CircBuff *m_circBuff;       ///< Data waiting to be printed to the serial port
-
-    // state machine
-    enum mode_t{
-        usb_Start,          ///< Set up the state machine
-        usb_CheckInput,     ///< See if any data is waiting to be read in - currently does not process anything
-        usb_CheckOutput,    ///< See if any data should be sent over serial
-    };
-    mode_t mode;
-    
-    // helpers
-    void printToTerminal(char *s);  // raw
-    void printToTerminalEx(char *s); // add timestamp
-};
-
-
-#endif
+#ifndef __USB_COMMS_H__
+#define __USB_COMMS_H__
+#include "AbstractHandler.h"
+#include "config.h"
+#include "USBSerial.h"
+#include "circbuff.h"
+#include "formatter.h"
+#include "logexport.h"
+#include "telemetry.h"
+#include <stdio.h>
+
+#define TX_USB_MSG_MAX 64u       // only send 64 bytes at a time
+#define TX_USB_BUFF_SIZE 256u    // the tx buffer can hold up to 256 bytes, a power of two
+#define TX_USB_TIMESTAMP_LEN 16u // "YYYYMMDD HHMMSS:" prepended by usbreq_PrintToTerminalTimestamp
+#define TX_USB_EXPORT_PACKETS 8u // packets sent in one pass while exporting the data log
+#define RX_USB_LINE_MAX 48u      // longest command line from the PC
+
+class SdHandler;
+
+/*!
+ * \brief The UsbExportStats struct counts what has been sent by exports of the data log
+ */
+struct UsbExportStats {
+    uint32_t exports;           ///< exports started
+    uint32_t frames;
+    uint32_t bytes;             ///< sent while exporting, the frames and any terminal output between them
+    uint32_t packets;
+    uint32_t fullPackets;       ///< packets of TX_USB_MSG_MAX bytes
+    uint32_t startedMs;         ///< \a MyTimers::now when the last export was asked for
+    uint32_t finishedMs;        ///< and when its last packet was sent
+};
+
+/*!
+ * \brief The UsbComms class handles input and output for the serial port connected to a PC
+ * The main run() function cycles through checking for input and copying to a buffer to be handled,
+ * and checking the output buffer to see if there is anything to be sent out.
+ *
+ * Data can be queued for output by copying it to the circular buffer
+ *
+ * With ENABLE_PROFILING, receiving 'p' prints the \a Profiler report, a line at a time as the buffer empties.
+ * With ENABLE_LOW_POWER, 'w' prints the \a PowerManager report the same way.
+ *
+ * Other input is taken a line at a time. "x <from> <to> [offset]" exports the records of the SD data log from <from>
+ * to <to>, both in seconds since 1970, as the binary frames of \a LogExport, starting at <offset> in the file (to
+ * carry on from where an export that was cut short got to). While exporting, the frames are packed into whole USB
+ * packets, TX_USB_EXPORT_PACKETS of them in a pass, and terminal output is sent between frames. Tools/logexport.cpp
+ * is the PC end.
+ *
+ * "m 1" switches to machine mode, and "m 0" back. In machine mode everything sent, other than an export, is a
+ * \a TelemetryEncoder record: \a MeasurementHandler posts its results, errors and counters as binary records rather than
+ * lines of text, and terminal output goes as text records, so the stream is COBS frames all the way through.
+ * Tools/telemetry2csv.cpp turns it back into rows.
+ *
+ * "t" prints how many DS1337 reads the cached clock has saved, and the drift it has corrected.
+ */
+class UsbComms : public AbstractHandler
+{
+public:
+    UsbComms(MyTimers *_timer);
+    ~UsbComms();
+
+    void run();
+    const char *name() const { return "usb"; }
+    uint8_t currentMode() const { return mode; }
+    bool canDeepSleep();
+
+    void setRequest(int request, void *data = 0);
+
+    //! setSdHandler sets the SD handler, which is asked to write what it has to the card before an export
+    void setSdHandler(SdHandler *_sd) { m_sd = _sd; }
+
+    const UsbExportStats &exportStats() const { return m_exportStats; }
+
+    //! machineMode is true when results and errors should be posted as telemetry records, rather than printed
+    bool machineMode() const { return m_machineMode; }
+
+    //! drops is the number of messages and records lost because the buffer was full
+    uint32_t drops() const;
+    
+    enum request_t{
+        usbreq_PrintToTerminal,         ///< Print to terminal normally
+        usbreq_PrintToTerminalTimestamp,///< Print to terminal, including the timestamp
+        usbreq_TelemetrySample,         ///< Send a \a Measurement as a telemetry record
+        usbreq_TelemetryError,          ///< Send a \a SensorError as a telemetry record
+        usbreq_TelemetryCounters        ///< Send \a TelemetryCounters as a telemetry record. usbDrops is filled in here
+    };
+
+private:
+    USBSerial _serial;          ///< Interface to the serial port
+    CircBuff<TX_USB_BUFF_SIZE> m_circBuff;  ///< Data waiting to be printed to the serial port
+    TimestampFormatter m_stamp; ///< Formats the timestamps of \a usbreq_PrintToTerminalTimestamp
+    SdHandler *m_sd;
+
+    char    m_line[RX_USB_LINE_MAX];    ///< the command line being received
+    uint8_t m_lineLen;
+
+    LogExport  m_export;            ///< Frames the data log
+    FILE      *m_exportFile;        ///< the data file, open for reading while exporting
+    bool       m_exportDue;         ///< an export has been asked for, to start once SdHandler has synced
+    uint32_t   m_exportFrom;
+    uint32_t   m_exportTo;
+    uint32_t   m_exportOffset;
+    const unsigned char *m_frame;   ///< what is left to send of the frame being sent
+    uint16_t   m_frameLeft;
+    unsigned char m_packet[TX_USB_MSG_MAX];     ///< the next packet, while it is being filled
+    uint8_t    m_packetFill;
+    UsbExportStats m_exportStats;
+
+    bool       m_machineMode;       ///< output is telemetry records, not text
+    TelemetryEncoder m_telemetry;   ///< Makes the records, and numbers them
+
+    // state machine
+    enum mode_t{
+        usb_Start,          ///< Set up the state machine
+        usb_CheckInput,     ///< See if any data is waiting to be read in - currently does not process anything
+        usb_CheckOutput,    ///< See if any data should be sent over serial
+    };
+    mode_t mode;
+    
+    // helpers
+    void onSerialRx();              // called from the USB interrupt when data is received
+    void onInput(char c);           // a character from the PC
+    void command(const char *line); // a line from the PC
+    void startExport();             // open the data file and start the export that was asked for
+    void sendExport();              // send the frames of the export, as many packets as are allowed in a pass
+    void sendPacket(const unsigned char *data, uint8_t len);
+    bool exporting() const;         // frames are still being made or sent
+    void printToTerminal(char *s);  // raw
+    void printToTerminalEx(char *s); // add timestamp
+    void sendRecord(const unsigned char *frame, uint8_t len);   // a telemetry frame, whole or not at all
+    void sendText(uint32_t time, const char *s, uint16_t len);  // as a text record, without its line ending
+
+#ifdef ENABLE_PROFILING
+    bool m_profDumping;         ///< the profiler report is being printed
+    uint16_t m_profCursor;      ///< how far through the profiler report has been printed
+
+    void printProfile();        // print as much of the profiler report as there is room for
+#endif
+
+#ifdef ENABLE_LOW_POWER
+    bool m_powerDumping;        ///< the power report is being printed
+    uint16_t m_powerCursor;     ///< how far through the power report has been printed
+
+    void printPower();          // print as much of the power report as there is room for
+#endif
+};
+
+
+#endif
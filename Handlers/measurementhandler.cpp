@@ -2,17 +2,13 @@
 #include "mbed.h"
 #include "SdHandler.h"
 #include "UsbComms.h"
+#include "fixedpoint.h"
+#include "telemetry.h"
+#include "DHT.h"    // for the eError codes
 
 // declare led4 so we can flash it to reflect state of this handler
 extern DigitalOut myled4;
 
-// flags for the request register
-#define REQ_RESULT 0b00000001
-#define REQ_ERROR  0b00000010
-#ifdef ENABLE_GPRS_TESTING
-#define REQ_SMS    0b00000100
-#endif
-
 #ifdef ENABLE_GPRS_TESTING
 MeasurementHandler::MeasurementHandler(SdHandler *_sd, UsbComms *_usb, GprsHandler *_gprs, MyTimers *_timer)
     : AbstractHandler(_timer), m_sd(_sd), m_usb(_usb), m_gprs(_gprs)
@@ -21,17 +17,21 @@ MeasurementHandler::MeasurementHandler(SdHandler *_sd, UsbComms *_usb, MyTimers
     : AbstractHandler(_timer), m_sd(_sd), m_usb(_usb)
 #endif
 {
-    m_lastError         = ERROR_NONE;
+    memset(&m_result, 0, sizeof(m_result));
+    memset(&m_lastResult, 0, sizeof(m_lastResult));
+    m_lastError.sensor  = 0;
+    m_lastError.error   = ERROR_NONE;
     mode                = meas_Start;
     m_lastRequest       = measreq_MeasReqNone;
     m_flashOn           = false;
-    m_requestRegister   = 0;
-
 #ifdef ENABLE_GPRS_TESTING
-    for (int i = 0; i < GPRS_RECIPIENTS_MAXLEN; i++) {
-        m_lastSender[i] = 0;
-    }
+    m_smsRefused        = false;
 #endif
+    m_flashTimer        = m_timer->registerTimer();
+    m_resultsPosted     = 0;
+    m_errorsPosted      = 0;
+    m_countersTimer     = m_timer->registerTimer();
+    m_alertSmsDrops     = 0;
 }
 
 void MeasurementHandler::run()
@@ -39,34 +39,30 @@ void MeasurementHandler::run()
     switch(mode) {
     case meas_Start:
         // start here, and come back here if an error has been flushed out and waited
+        loadAlerts();
         mode = meas_CheckRequest;
         break;
 
     case meas_CheckRequest:
-        if (m_requestRegister) {
+        if (requestsPending()) {
             // check what has been requested, starting from most highest priority
             
 #ifdef ENABLE_GPRS_TESTING
-            if (m_requestRegister&REQ_SMS) {
+            if (!m_statusReqs.empty() && !m_smsRefused) {
                 // an SMS has been requested
                 mode = meas_PostStateSMS;
             }
-            else if (m_requestRegister&REQ_RESULT) {
+            else if (!m_results.empty()) {
 #else
-            if (m_requestRegister&REQ_RESULT) {
+            if (!m_results.empty()) {
 #endif
                 // a result has been sent, we need to post it
                 mode = meas_PostResult;
             }
-            else if (m_requestRegister&REQ_ERROR) {
+            else {
                 // an error has been sent, we need to post it
                 mode = meas_PostError;
             }
-            else {
-                // something went wrong, a flag was set that isn't defined
-                m_requestRegister = 0;
-                mode = meas_FlashTimer;
-            }
         }
         else {
             // no requests, check if running led needs to be flashed
@@ -76,43 +72,79 @@ void MeasurementHandler::run()
 
 #ifdef ENABLE_GPRS_TESTING
     case meas_PostStateSMS:
-        if (m_requestRegister&REQ_SMS) {
-            char s[64];
-            // usb print
-            sprintf(s, "Temperature is %4.2f degC\nHumidity is %4.2f pc\nDew point is %4.2f", m_lastResult.lastCelcius, m_lastResult.lastHumidity, m_lastResult.lastDewpoint);
-
+        if (!m_statusReqs.empty()) {
             GprsRequest req;
-            strcpy(req.message, s);
-            strcpy(req.recipients, m_lastSender);
-            m_gprs->setRequest(GprsHandler::gprsreq_SmsSend, &req);
+            int len = snprintf(req.message, GPRS_MESSAGE_MAXLEN, "Temperature is " CENTI_FMT " degC\nHumidity is " CENTI_FMT " pc\nDew point is " CENTI_FMT,
+                               CENTI_ARGS(m_lastResult.value[0]), CENTI_ARGS(m_lastResult.value[1]),
+                               CENTI_ARGS(m_lastResult.value[2]));
+
+            // add the range of humidity over the hour window, which is the hour of the last result and the 24 before
+            // it. After a boot or a clear it covers less, so it is said to be since the oldest hour that has results
+            MeasSummary hours, oldest;
+            if ((len > 0) && (len < (int)GPRS_MESSAGE_MAXLEN) && m_history.window(MeasHistory::hist_Hour, &hours)) {
+                uint8_t ago = MEASHIST_HOURS;
+                while ((ago > 0) && !m_history.bucket(MeasHistory::hist_Hour, ago, &oldest)) {
+                    ago--;
+                }
+                uint32_t hour  = (uint32_t)m_lastResult.time / 3600;
+                uint32_t since = hour - ago;
+                snprintf(req.message + len, GPRS_MESSAGE_MAXLEN - len, "\nHumidity since %02u:00 UTC%s " CENTI_FMT " to " CENTI_FMT " pc",
+                         (unsigned int)(since % 24), ((since / 24) != (hour / 24)) ? " yesterday" : "",
+                         CENTI_ARGS(hours.min[MeasHistory::hist_Humidity]), CENTI_ARGS(hours.max[MeasHistory::hist_Humidity]));
+            }
+            strcpy(req.recipients, m_statusReqs.front().sender);
 
-            // clear the request reqister's sms flag
-            m_requestRegister &= ~REQ_SMS;
+            // only take the request off the queue once GprsHandler has accepted it, otherwise
+            // get on with the other requests and try again at the next flash
+            if (m_gprs->sendSms(req)) {
+                m_statusReqs.pop();
+            }
+            else {
+                m_smsRefused = true;
+            }
         }
         mode = meas_CheckRequest;
         break;
 #endif
 
     case meas_PostResult:
-        if (m_requestRegister&REQ_RESULT) {
+        if (m_results.pop(&m_result)) {
             // we have a result, post it
 
             // TODO: check when the last result came in. if it has not been very long (< 5s? < 1s?) avoid posting, so we don't hammer it
+            m_resultsPosted++;
 
-            char s[50];
-            // usb print
-            sprintf(s, "Temperature is %4.2f degC", m_lastResult.lastCelcius);
-            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
-            sprintf(s, "Humidity is %4.2f pc",      m_lastResult.lastHumidity);
-            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
-            sprintf(s, "Dew point is %4.2f ",    m_lastResult.lastDewpoint);
-            m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+            if (m_usb->machineMode()) {
+                // one binary record, rather than a line of text for each value
+                m_usb->setRequest(UsbComms::usbreq_TelemetrySample, &m_result);
+            }
+            else {
+                // usb print, e.g. "Temperature is 20.00 degC", with the sensor in front if it is not the first
+                uint8_t count;
+                const SensorQuantity *quantity = sensorQuantities(m_result.kind, &count);
+                for (uint8_t i = 0; i < count; i++) {
+                    char s[50];
+                    int len = (m_result.sensor == 0) ? 0 : sprintf(s, "Sensor %u: ", m_result.sensor);
+                    sprintf(s + len, "%s is " CENTI_FMT " %s", quantity[i].name, CENTI_ARGS(m_result.value[i]), quantity[i].unit);
+                    m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+                }
+            }
             
             // post to SD card
-            m_sd->setRequest(SdHandler::sdreq_LogData, &m_lastResult);
+            m_sd->setRequest(SdHandler::sdreq_LogData, &m_result);
+
+            // check it against the alert rules, which calls alert() for anything raised or cleared
+            m_alerts.evaluate(m_result, this);
 
-            // clear the request
-            m_requestRegister &= ~REQ_RESULT;
+            // and keep the first sensor's in the history
+            if ((m_result.sensor == 0) && (m_result.kind == sensor_Dht22)) {
+                m_lastResult = m_result;
+                int16_t values[MEASHIST_QUANTITIES];
+                values[MeasHistory::hist_Celcius]  = m_lastResult.value[0];
+                values[MeasHistory::hist_Humidity] = m_lastResult.value[1];
+                values[MeasHistory::hist_Dewpoint] = m_lastResult.value[2];
+                m_history.add((uint32_t)m_lastResult.time, values);
+            }
         }
 
         // go back to check if there are more requests
@@ -121,39 +153,35 @@ void MeasurementHandler::run()
 
 
     case meas_PostError:
-        if (m_requestRegister&REQ_ERROR) {
+        if (m_errors.pop(&m_lastError)) {
+            m_errorsPosted++;
             // there is an error, check the value of it and post the corresponding string to USB
             // TODO: post to SD syslog
-            switch (m_lastError)
-            {
-            case BUS_BUSY:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"BUSY!");
-                break;
-            case ERROR_NOT_PRESENT:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"NOT PRESENT");
-                break;
-            case ERROR_ACK_TOO_LONG:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"TOO LONG");
-                break;
-            case ERROR_SYNC_TIMEOUT:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"SYNC TIMEOUTr\n");
-                break;
-            case ERROR_DATA_TIMEOUT:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"DATA TIMEOUT");
-                break;
-            case ERROR_CHECKSUM:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"CHECKSUM");
-                break;
-            case ERROR_NO_PATIENCE:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"NO PATIENCE!");
-                break;
-            default:
-                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, (char*)"UNKNOWN");
-                break;
+            if (m_usb->machineMode()) {
+                m_usb->setRequest(UsbComms::usbreq_TelemetryError, &m_lastError);
+            }
+            else {
+                const char *error;
+                switch (m_lastError.error)
+                {
+                case BUS_BUSY:              error = "BUSY!";            break;
+                case ERROR_NOT_PRESENT:     error = "NOT PRESENT";      break;
+                case ERROR_ACK_TOO_LONG:    error = "TOO LONG";         break;
+                case ERROR_SYNC_TIMEOUT:    error = "SYNC TIMEOUT";     break;
+                case ERROR_DATA_TIMEOUT:    error = "DATA TIMEOUT";     break;
+                case ERROR_CHECKSUM:        error = "CHECKSUM";         break;
+                case ERROR_NO_PATIENCE:     error = "NO PATIENCE!";     break;
+                default:                    error = "UNKNOWN";          break;
+                }
+                char s[32];
+                if (m_lastError.sensor == 0) {
+                    strcpy(s, error);
+                }
+                else {
+                    sprintf(s, "Sensor %u: %s", m_lastError.sensor, error);
+                }
+                m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
             }
-
-            // we have posted it, clear the flag
-            m_requestRegister &= ~REQ_ERROR;
         }
         // check if there are any more requests
         mode = meas_CheckRequest;
@@ -161,22 +189,39 @@ void MeasurementHandler::run()
         
     case meas_FlashTimer:
         // flash timer to know that we are still alive.        
-        if (!m_timer->GetTimer(MyTimers::tmr_MeasFlash)) {      // wait until timer has elapsed
+        if (!m_timer->GetTimer(m_flashTimer)) {      // wait until timer has elapsed
+#ifdef ENABLE_GPRS_TESTING
+            m_smsRefused = false;                   // give GprsHandler another go at any waiting SMS
+#endif
             if (m_flashOn) {
                 // turn off
                 myled4 = 0;
-                m_timer->SetTimer(MyTimers::tmr_MeasFlash, 2000); // stay off for 2 seconds
+                m_timer->SetTimer(m_flashTimer, MEAS_FLASH_OFF_MS);
                 m_flashOn = false;
             }
             else {
                 // turn on
                 myled4 = 1;
-                m_timer->SetTimer(MyTimers::tmr_MeasFlash, 1000); // stay on for 1 second
+                m_timer->SetTimer(m_flashTimer, MEAS_FLASH_ON_MS);
                 m_flashOn = true;
             }
-                
+
+            if (m_usb->machineMode() && !m_timer->GetTimer(m_countersTimer)) {
+                TelemetryCounters counters;
+                counters.results     = m_resultsPosted;
+                counters.errors      = m_errorsPosted;
+                counters.resultDrops = m_results.drops();
+                counters.errorDrops  = m_errors.drops();
+                m_usb->setRequest(UsbComms::usbreq_TelemetryCounters, &counters);
+                m_timer->SetTimer(m_countersTimer, MEAS_COUNTERS_MS);
+            }
         }
         mode = meas_CheckRequest;
+
+        // nothing else to do until the next flash, or until a request comes in
+        if (!requestsPending()) {
+            waitForTimer(m_flashTimer);
+        }
         break;
 
     case meas_WaitError:
@@ -186,49 +231,131 @@ void MeasurementHandler::run()
     }
 }
 
-void MeasurementHandler::setRequest(int request, void *data)
+bool MeasurementHandler::postResult(const Measurement &result)
+{
+    m_lastRequest = measreq_DhtResult;
+    wake();
+    return m_results.push(result);
+}
+
+bool MeasurementHandler::postError(uint8_t sensor, int error)
 {
-    m_lastRequest = (request_t)request;
-    switch(request) {
-    case measreq_DhtResult:
-        // this should contain time as well
-        Dht22Result *result = (Dht22Result*)data;
+    SensorError e;
+    e.sensor = sensor;
+    e.error  = (int8_t)error;
 
-        // copy the structure into our own structure
-        m_lastResult = *result;
+    m_lastRequest = measreq_DhtError;
+    wake();
+    return m_errors.push(e);
+}
 
-        // set the request
-        m_requestRegister |= REQ_RESULT;
+#ifdef ENABLE_GPRS_TESTING
+bool MeasurementHandler::postStatus(const char *sender)
+{
+    // need to send SMS of last result, to the sender's number
+    StatusRequest req;
+    strncpy(req.sender, sender, GPRS_RECIPIENTS_MAXLEN - 1);
+    req.sender[GPRS_RECIPIENTS_MAXLEN - 1] = 0;
 
-        break;
+    m_lastRequest = measreq_Status;
+    wake();
+    return m_statusReqs.push(req);
+}
+#endif
 
-    case measreq_DhtError:
-        int *iResult = (int*)data;
-        m_lastError = *iResult;
-        m_requestRegister |= REQ_ERROR;
+void MeasurementHandler::alert(const AlertEvent &event)
+{
+    // e.g. "Alert 0: Humidity is 81.20 pc, above 80.00" or "Alert 2: Sensor 1 Temperature rose 2.10 degC in 600 s"
+    const AlertRule &rule = *event.rule;
+    uint8_t count;
+    const SensorQuantity *quantity = sensorQuantities(m_result.kind, &count);
+    const char *name = (rule.quantity < count) ? quantity[rule.quantity].name : "Value";
+    const char *unit = (rule.quantity < count) ? quantity[rule.quantity].unit : "";
 
+    char s[MEAS_ALERT_TEXT_MAX];
+    int len = snprintf(s, sizeof(s), "Alert %u%s: ", event.index, (event.event == alert_Cleared) ? " cleared" : "");
+    if (rule.sensor != 0) {
+        len += snprintf(s + len, sizeof(s) - len, "Sensor %u ", rule.sensor);
+    }
+    switch (rule.type & ALERT_TYPE_MASK) {
+    case alert_Above:
+    case alert_Below:
+        len += snprintf(s + len, sizeof(s) - len, "%s is " CENTI_FMT " %s", name, CENTI_ARGS(event.value), unit);
+        if (event.event == alert_Raised) {
+            snprintf(s + len, sizeof(s) - len, ", %s " CENTI_FMT, ((rule.type & ALERT_TYPE_MASK) == alert_Above) ?
+                     "above" : "below", CENTI_ARGS(rule.level));
+        }
+        break;
+    default:
+        snprintf(s + len, sizeof(s) - len, "%s %s " CENTI_FMT " %s in %u s", name,
+                 ((rule.type & ALERT_TYPE_MASK) == alert_Rise) ? "rose" : "fell", CENTI_ARGS(event.value), unit,
+                 rule.window);
         break;
+    }
+    m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
 
 #ifdef ENABLE_GPRS_TESTING
-    case measreq_Status:
-        // need to send SMS of last result
-        // the sender's number is the sent data
-        char *sender = (char*)data;
-
-        int i = 0;
-        // copy the sender's number
-        for (i = 0; (i < GPRS_RECIPIENTS_MAXLEN) && (sender[i] != 0); i++) {
-            m_lastSender[i] = sender[i];
+    if (ALERT_RECIPIENTS[0] != 0) {
+        GprsRequest req;
+        strcpy(req.message, s);     // MEAS_ALERT_TEXT_MAX is well inside an SMS
+        strncpy(req.recipients, ALERT_RECIPIENTS, GPRS_RECIPIENT_LIST_MAXLEN - 1);
+        req.recipients[GPRS_RECIPIENT_LIST_MAXLEN - 1] = 0;
+        if (!m_gprs->sendSms(req)) {
+            m_alertSmsDrops++;
         }
+    }
+#endif
+}
 
-        // set the rest of the destination array to null
-        for (i; i < GPRS_RECIPIENTS_MAXLEN; i++) {
-            m_lastSender[i] = 0;
-        }
+bool MeasurementHandler::loadAlertsFile()
+{
+    FILE *fp = fopen(ALERT_RULES_FILE, "rb");
+    if (fp == NULL) {
+        return false;
+    }
 
-        // set the request
-        m_requestRegister |= REQ_SMS;
-        break;
-#endif
+    // the header says how long the rest is, which has to fit in the room there is for the rules
+    unsigned char table[ALERT_HEADER_LEN + (ALERT_RULE_SLOTS * ALERT_RULE_LEN) + 2];
+    uint16_t len = (fread(table, 1, ALERT_HEADER_LEN, fp) == ALERT_HEADER_LEN) ? AlertEngineBase::tableLength(table) : 0;
+    bool ok = false;
+    if (len && (len <= sizeof(table))) {
+        ok = (fread(table + ALERT_HEADER_LEN, 1, len - ALERT_HEADER_LEN, fp) == (size_t)(len - ALERT_HEADER_LEN)) &&
+             m_alerts.load(table, len);
+    }
+    fclose(fp);
+    return ok;
+}
+
+void MeasurementHandler::loadAlerts()
+{
+    char s[40];
+    if (loadAlertsFile()) {
+        snprintf(s, sizeof(s), "%u alert rules loaded", m_alerts.count());
     }
+    else {
+        AlertRule rule;
+        rule.type       = alert_Above | ALERT_FLAG_CLEAR;
+        rule.sensor     = 0;
+        rule.quantity   = MeasHistory::hist_Humidity;  // the same order as a DHT22's values
+        rule.level      = ALERT_HUMIDITY_CENTI;
+        rule.hysteresis = ALERT_HYSTERESIS_CENTI;
+        rule.window     = 0;
+        rule.sustain    = ALERT_SUSTAIN_S;
+        rule.quiet      = ALERT_QUIET_MIN;
+
+        unsigned char table[ALERT_HEADER_LEN + ALERT_RULE_LEN + 2];
+        m_alerts.load(table, AlertEngineBase::encode(&rule, 1, table));
+        snprintf(s, sizeof(s), "Default alert rule");
+    }
+    m_usb->setRequest(UsbComms::usbreq_PrintToTerminalTimestamp, s);
+}
+
+bool MeasurementHandler::requestsPending()
+{
+#ifdef ENABLE_GPRS_TESTING
+    if (!m_statusReqs.empty() && !m_smsRefused) {
+        return true;
+    }
+#endif
+    return !m_results.empty() || !m_errors.empty();
 }
@@ -2,8 +2,11 @@
 #define MEASUREMENTHANDLER_H
 
 #include "AbstractHandler.h"
-#include "GroveDht22.h"
+#include "sensor.h"
 #include "config.h"
+#include "msgqueue.h"
+#include "meashistory.h"
+#include "alerts.h"
 #ifdef ENABLE_GPRS_TESTING
 #include "GprsHandler.h"
 #endif
@@ -11,24 +14,48 @@
 class SdHandler;
 class UsbComms;
 
+#define MEAS_RESULT_QUEUE_LEN   4   // results waiting to be posted to USB and SD, from all the sensors
+#define MEAS_ERROR_QUEUE_LEN    4   // errors waiting to be posted to USB
+#define MEAS_STATUS_QUEUE_LEN   2   // status SMS replies waiting to be handed to GprsHandler
+#define MEAS_COUNTERS_MS        60000   // how often the counters are sent, in machine mode
+#define MEAS_ALERT_TEXT_MAX     80      // longest alert message, with its terminator
+#ifdef ENABLE_LOW_POWER
+#define MEAS_FLASH_ON_MS        20      // a blink, so the heartbeat neither costs much nor keeps the MCU out of deep sleep
+#define MEAS_FLASH_OFF_MS       9980
+#else
+#define MEAS_FLASH_ON_MS        1000
+#define MEAS_FLASH_OFF_MS       2000
+#endif
+
 
 /*!
  * \brief The MeasurementHandler class forms the link between data generation and data output, and stores settings.
  *
- * Receives requests from \a GroveDht22 when a new measurement has been taken or error has occurred. This handler then
+ * Receives requests from \a SensorSampler when a new measurement has been taken or error has occurred. This handler then
  * sends that information on to \a UsbComms for printing that information to terminal and \a SdHandler for printing
- * that information to the CSV data file.
+ * that information to the CSV data file. Measurements from any number of sensors come through here, each tagged with
+ * the sensor it came from; the SMS status and the history are about the first sensor.
  *
- * This handler also determines if the necessary conditions have been met to send an SMS. This is based on last measurement,
- * the set alert threshold, and time since last alert was sent. An SMS is sent using \a GprsHandler.
+ * Every result is checked against the alert rules by an \a AlertEngine, loaded from ALERT_RULES_FILE at startup, or
+ * the default humidity rule of config.h if there is no file. Each alert that is raised or cleared is printed over USB,
+ * and sent by SMS to ALERT_RECIPIENTS using \a GprsHandler.
  *
  * Other requests from inputs asking for current measurement states (such as the latest measurement) may come from \a UsbComms
  * or \a GprsHandler. The string inspection and matching is handled here, and responses sent to the data outputs.
  *
  *
+ * Results, errors and status requests are posted with \a postResult, \a postError and \a postStatus, and each go into their
+ * own fixed size queue until \a run gets to them. A full queue refuses the request, and the drop is counted.
+ *
+ * When \a UsbComms is in machine mode, results and errors go to it as telemetry records rather than lines of text, and
+ * the counts of results, errors and drops are sent every MEAS_COUNTERS_MS.
+ *
+ * Every result is also added to a \a MeasHistory, so the min, max and mean over the last minutes, hours and days can
+ * be given without reading the SD card.
+ *
  * Flashes LED4 constantly to inform that normal operation is occurring.
  */
-class MeasurementHandler : public AbstractHandler
+class MeasurementHandler : public AbstractHandler, public AlertSink
 {
 public:
 #ifdef ENABLE_GPRS_TESTING
@@ -38,15 +65,55 @@ public:
 #endif
 
     void run();
+    const char *name() const { return "measure"; }
+    uint8_t currentMode() const { return mode; }
+
+    /*!
+     * \brief postResult queues a result from a sensor to be posted to USB and SD
+     * \return false if the queue is full and the result was dropped
+     */
+    bool postResult(const Measurement &result);
+
+    /*!
+     * \brief postError queues an error from a sensor to be posted to USB
+     * \param sensor is the index of the sensor
+     * \param error is the eError from the sensor
+     * \return false if the queue is full and the error was dropped
+     */
+    bool postError(uint8_t sensor, int error);
+
+#ifdef ENABLE_GPRS_TESTING
+    /*!
+     * \brief postStatus queues an SMS reply with the last result
+     * \param sender is the number to reply to
+     * \return false if the queue is full and the request was dropped
+     */
+    bool postStatus(const char *sender);
+#endif
 
-    void setRequest(int request, void *data = 0);
+    //! lastResult is the last result from the first sensor
+    Measurement lastResult() const { return m_lastResult; }
 
-    Dht22Result lastResult() const { return m_lastResult; }
+    //! history has rollups of all the results posted so far
+    const MeasHistory &history() const { return m_history; }
+
+    //! alerts has the alert rules, and what they have done
+    const AlertEngineBase &alerts() const { return m_alerts; }
+
+    //! alertSmsDrops is the number of alert SMS GprsHandler had no room for
+    uint32_t alertSmsDrops() const { return m_alertSmsDrops; }
+
+    // AlertSink
+    void alert(const AlertEvent &event);
+
+    // queue statistics
+    const MsgQueue<Measurement, MEAS_RESULT_QUEUE_LEN> &resultQueue() const { return m_results; }
+    const MsgQueue<SensorError, MEAS_ERROR_QUEUE_LEN>  &errorQueue() const  { return m_errors; }
 
     enum request_t{
         measreq_MeasReqNone,        ///< No request (for tracking what the last request was, this is initial value for that)
-        measreq_DhtResult,          ///< Dht22 returned with a result
-        measreq_DhtError,           ///< Dht22 returned with an error
+        measreq_DhtResult,          ///< a sensor returned with a result
+        measreq_DhtError,           ///< a sensor returned with an error
 #ifdef ENABLE_GPRS_TESTING
         measreq_Status,             ///< We got an SMS asking for the status (time, last error, last result)
 #endif
@@ -60,14 +127,37 @@ private:
     GprsHandler *m_gprs;        ///< Reference to write to GPRS (SMS)
 #endif
 
-    Dht22Result m_lastResult;   ///< Copy of the last result that came from Dht22
-    int  m_lastError;           ///< Copy of the last error that came from Dht22
+    Measurement m_result;       ///< Copy of the last result that was posted, from any sensor
+    Measurement m_lastResult;   ///< Copy of the last result that was posted from the first sensor
+    SensorError m_lastError;    ///< Copy of the last error that was posted
+
+    MsgQueue<Measurement, MEAS_RESULT_QUEUE_LEN> m_results;    ///< Results waiting to be posted
+    MsgQueue<SensorError, MEAS_ERROR_QUEUE_LEN>  m_errors;     ///< Errors waiting to be posted
+
+    MeasHistory m_history;      ///< Rollups of the results, by minute, hour and day
+    AlertEngine<ALERT_RULE_SLOTS> m_alerts; ///< The alert rules, checked against every result
+    uint32_t m_alertSmsDrops;   ///< alert SMS refused by GprsHandler
+
+    void loadAlerts();          // read the alert rules, or fall back to the default rule
+    bool loadAlertsFile();      // read the alert rules from ALERT_RULES_FILE
 
 #ifdef ENABLE_GPRS_TESTING
-    char m_lastSender[GPRS_RECIPIENTS_MAXLEN];         ///< The last sender of an SMS
+    /*!
+     * \brief The StatusRequest struct is who asked for the status over SMS
+     */
+    struct StatusRequest {
+        char sender[GPRS_RECIPIENTS_MAXLEN];    ///< The sender of the SMS, to reply to
+    };
+    MsgQueue<StatusRequest, MEAS_STATUS_QUEUE_LEN> m_statusReqs;  ///< Status replies waiting to be sent
+    bool m_smsRefused;          ///< GprsHandler's queue was full, leave status replies until the next flash
 #endif
 
     bool m_flashOn;             ///< LED is currently on when true
+    MyTimers::timerid_t m_flashTimer;   ///< Heartbeat, on for MEAS_FLASH_ON_MS then off for MEAS_FLASH_OFF_MS
+
+    uint32_t m_resultsPosted;   ///< results taken off the queue and posted
+    uint32_t m_errorsPosted;    ///< errors taken off the queue and posted
+    MyTimers::timerid_t m_countersTimer;    ///< Next counters record, checked at each flash
 
     enum mode_t{
         meas_Start,             ///< Set up the state machine
@@ -76,8 +166,8 @@ private:
 #ifdef ENABLE_GPRS_TESTING
         meas_PostStateSMS,      ///< Send an SMS of the last result and state
 #endif
-        meas_PostResult,        ///< Write the last Grove result to SD and USB
-        meas_PostError,         ///< Write the last Grove error to USB (and in future, SD syslog)
+        meas_PostResult,        ///< Write the last sensor result to SD and USB
+        meas_PostError,         ///< Write the last sensor error to USB (and in future, SD syslog)
 
         meas_FlashTimer,        ///< Flash an LED on and off so user knows device is still running
 
@@ -87,7 +177,7 @@ private:
 
     request_t m_lastRequest;    ///< tracks if result or error was the last request
 
-    uint8_t m_requestRegister;  ///< contains the current pending requests as bitwise flags
+    bool requestsPending();     // true if any queue has something in it
 
 };
 
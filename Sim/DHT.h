@@ -0,0 +1,20 @@
+#ifndef DHT_H
+#define DHT_H
+
+/*
+ * Stand-in for the DHT library in the host simulation build. The firmware reads the sensor with Dht22Reader, and
+ * only uses the library's error codes. The sensor itself is modelled in sim_devices.cpp.
+ */
+
+enum eError {
+    ERROR_NONE = 0,
+    BUS_BUSY,
+    ERROR_NOT_PRESENT,
+    ERROR_ACK_TOO_LONG,
+    ERROR_SYNC_TIMEOUT,
+    ERROR_DATA_TIMEOUT,
+    ERROR_CHECKSUM,
+    ERROR_NO_PATIENCE
+};
+
+#endif // DHT_H
@@ -0,0 +1,40 @@
+#ifndef DS1337_H
+#define DS1337_H
+
+/*
+ * Stand-in for the DS1337 library in the host simulation build. The clock runs from the virtual clock, starting at
+ * SIM_START (seconds since the epoch). Every readTime/setTime is counted as an I2C transaction.
+ */
+
+#include "mbed.h"
+
+class DS1337 {
+public:
+    DS1337();
+
+    void readTime();
+    void setTime();
+    void start();
+    void stop();
+
+    int getSeconds()   { return m_tm.tm_sec; }
+    int getMinutes()   { return m_tm.tm_min; }
+    int getHours()     { return m_tm.tm_hour; }
+    int getDays()      { return m_tm.tm_mday; }
+    int getDayOfWeek() { return m_tm.tm_wday; }
+    int getMonths()    { return m_tm.tm_mon + 1; }
+    int getYears()     { return m_tm.tm_year + 1900; }
+
+    void setSeconds(int v)   { m_tm.tm_sec = v; }
+    void setMinutes(int v)   { m_tm.tm_min = v; }
+    void setHours(int v)     { m_tm.tm_hour = v; }
+    void setDays(int v)      { m_tm.tm_mday = v; }
+    void setDayOfWeek(int v) { m_tm.tm_wday = v; }
+    void setMonths(int v)    { m_tm.tm_mon = v - 1; }
+    void setYears(int v)     { m_tm.tm_year = v - 1900; }
+
+private:
+    struct tm m_tm;     ///< registers, as last read or about to be written
+};
+
+#endif // DS1337_H
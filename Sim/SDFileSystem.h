@@ -0,0 +1,17 @@
+#ifndef SDFILESYSTEM_H
+#define SDFILESYSTEM_H
+
+/*
+ * Stand-in for SDFileSystem in the host simulation build. The file functions themselves are redirected in mbed.h.
+ */
+
+#include "mbed.h"
+
+class SDFileSystem {
+public:
+    SDFileSystem(PinName mosi, PinName miso, PinName sclk, PinName cs, const char *name);
+    int mount()   { return 0; }
+    int unmount() { return 0; }
+};
+
+#endif // SDFILESYSTEM_H
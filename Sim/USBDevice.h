@@ -0,0 +1,8 @@
+#ifndef USBDEVICE_H
+#define USBDEVICE_H
+
+// Stand-in for the USBDevice library in the host simulation build, see USBSerial.h
+
+#include "mbed.h"
+
+#endif // USBDEVICE_H
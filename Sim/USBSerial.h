@@ -0,0 +1,40 @@
+#ifndef USBSERIAL_H
+#define USBSERIAL_H
+
+/*
+ * Stand-in for USBSerial in the host simulation build. What the firmware sends is written to the file in SIM_USB_OUT
+ * (discarded if not set). Input from the PC is scripted by SIM_USB_IN, a file of lines "<seconds> <text>", each
+ * line's text (followed by \r) arriving at that many virtual seconds into the run. SIM_USB_CONNECTED=0 has it
+ * report no host, as on battery, which lets the firmware deep-sleep.
+ */
+
+#include "USBDevice.h"
+
+class USBSerial {
+public:
+    USBSerial(uint16_t vendor_id = 0x1f00, uint16_t product_id = 0x2012, uint16_t product_release = 0x0001, bool connect_blocking = true);
+    ~USBSerial();
+
+    int     _putc(int c);
+    int     _getc();
+    int     putc(int c) { return _putc(c); }
+    int     getc() { return _getc(); }
+    int     readable();
+    uint8_t available();
+    bool    writeable();
+    bool    writeBlock(uint8_t *buf, uint16_t size);
+    bool    connected() { return sim::envInt("SIM_USB_CONNECTED", 1) != 0; }
+
+    template <typename T>
+    void attach(T *tptr, void (T::*mptr)(void)) { setRxCallback(new sim::MemberCallback<T>(tptr, mptr)); }
+    void attach(void (*fptr)(void)) { setRxCallback(new sim::FunctionCallback(fptr)); }
+
+    // used by the simulation to deliver input from the PC
+    void receive(const char *data, int len);
+
+private:
+    void setRxCallback(sim::Callback *cb);
+    sim::Callback *m_rxCallback;
+};
+
+#endif // USBSERIAL_H
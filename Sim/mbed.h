@@ -0,0 +1,286 @@
+#ifndef MBED_H
+#define MBED_H
+
+/*
+ * Stand-in for the mbed library in the host simulation build. Only the parts the firmware uses are provided,
+ * with the same names and signatures, driven by the virtual clock in sim.h.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <deque>
+
+#include "sim.h"
+
+typedef uint32_t timestamp_t;
+
+typedef enum {
+    LED1, LED2, LED3, LED4,
+    P0_4, P0_5, P0_6, P0_7, P0_11, P0_12, P0_13, P0_14, P0_16, P0_18, P0_19,
+    P1_2, P1_3, P1_7, P1_14, P1_20, P1_21, P1_22, P1_23, P1_26, P1_27,
+    NC = -1
+} PinName;
+
+typedef enum {
+    PullNone, PullUp, PullDown, OpenDrain,
+    PullDefault = PullUp
+} PinMode;
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : m_pin(pin), m_value(0) {}
+    void write(int value) { m_value = value; }
+    int  read() { return m_value; }
+    DigitalOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+private:
+    PinName m_pin;
+    int m_value;
+};
+
+class DigitalIn {
+public:
+    DigitalIn(PinName pin) : m_pin(pin) {}
+    int read() { return 1; }
+    operator int() { return read(); }
+private:
+    PinName m_pin;
+};
+
+/*!
+ * DigitalInOut tells the peripheral stand-ins when a pin is let go (switched from output to input), which is how the
+ * DHT22 knows its start signal is over
+ */
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin) : m_pin(pin), m_value(1), m_output(false) {}
+    void write(int value) { m_value = value; }
+    int  read() { return m_output ? m_value : 1; }
+    void output() { m_output = true; }
+    void input() { if (m_output) { m_output = false; sim::pinReleased(m_pin); } }
+    void mode(PinMode pull) {}
+    DigitalInOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+private:
+    PinName m_pin;
+    int m_value;
+    bool m_output;
+};
+
+/*!
+ * InterruptIn calls its fall callback when a stand-in calls sim::pinFall() for its pin
+ */
+class InterruptIn {
+public:
+    InterruptIn(PinName pin);
+    ~InterruptIn();
+
+    template <typename T>
+    void fall(T *tptr, void (T::*mptr)(void)) { setFall(new sim::MemberCallback<T>(tptr, mptr)); }
+    void fall(void (*fptr)(void)) { setFall(fptr ? new sim::FunctionCallback(fptr) : 0); }
+    void mode(PinMode pull) {}
+
+    void fireFall() { if (m_fall) m_fall->call(); }
+
+private:
+    void setFall(sim::Callback *cb) { delete m_fall; m_fall = cb; }
+    PinName m_pin;
+    sim::Callback *m_fall;
+};
+
+/*!
+ * I2C passes writes on to the stand-ins, of which the DS1337's alarm registers are the only one. Reads return nothing
+ */
+class I2C {
+public:
+    I2C(PinName sda, PinName scl) {}
+    void frequency(int hz) {}
+    int write(int address, const char *data, int length, bool repeated = false) { return sim::i2cWrite(address, data, length); }
+    int read(int address, char *data, int length, bool repeated = false) { return 0; }
+};
+
+/*!
+ * Ticker calls its callback periodically, from an event on the virtual clock
+ */
+class Ticker : public sim::Event {
+public:
+    Ticker() : m_cb(0), m_interval(0) {}
+    virtual ~Ticker() { detach(); }
+
+    template <typename T>
+    void attach(T *tptr, void (T::*mptr)(void), float t) { attach_us(tptr, mptr, (timestamp_t)(t * 1000000.0f)); }
+    void attach(void (*fptr)(void), float t) { setup(new sim::FunctionCallback(fptr), (timestamp_t)(t * 1000000.0f)); }
+
+    template <typename T>
+    void attach_us(T *tptr, void (T::*mptr)(void), timestamp_t t) { setup(new sim::MemberCallback<T>(tptr, mptr), t); }
+    void attach_us(void (*fptr)(void), timestamp_t t) { setup(new sim::FunctionCallback(fptr), t); }
+
+    void detach();
+
+    void fire();
+    bool stopsInDeepSleep() const { return true; }  // it counts us_ticker
+
+protected:
+    void setup(sim::Callback *cb, timestamp_t t);
+    virtual bool periodic() const { return true; }
+
+    sim::Callback *m_cb;
+    timestamp_t m_interval;
+};
+
+//! Timeout calls its callback once
+class Timeout : public Ticker {
+protected:
+    bool periodic() const { return false; }
+};
+
+class Timer {
+public:
+    Timer() : m_running(false), m_start(0), m_total(0) {}
+    void start() { if (!m_running) { m_start = sim::tickerNow(); m_running = true; } }
+    void stop()  { if (m_running) { m_total += sim::tickerNow() - m_start; m_running = false; } }
+    void reset() { m_start = sim::tickerNow(); m_total = 0; }
+    int  read_us() { return (int)(m_total + (m_running ? sim::tickerNow() - m_start : 0)); }
+    int  read_ms() { return read_us() / 1000; }
+    float read()   { return read_us() / 1000000.0f; }
+private:
+    bool m_running;
+    uint64_t m_start;
+    uint64_t m_total;
+};
+
+/*!
+ * Serial is a UART, connected to whatever sim::SerialDevice is registered for its TX pin. With nothing connected,
+ * nothing is ever received and everything sent is discarded.
+ *
+ * Characters take 10 bit times each way at the baud rate (9600 until \a baud is called), and each way has a 16 byte
+ * FIFO. \a putc blocks while the transmit FIFO is full. A character that arrives while the receive FIFO is full is
+ * lost, and sets the overrun bit in LSR. With SIM_UART_FE_PPM, that many characters in a million arrive corrupted,
+ * with the framing error bit set.
+ *
+ * The RX interrupt is called as each character arrives, and the TX interrupt when the transmit FIFO empties.
+ */
+class Serial : public sim::Event {
+public:
+    enum IrqType { RxIrq = 0, TxIrq };
+
+    Serial(PinName tx, PinName rx, const char *name = NULL);
+    ~Serial();
+    void baud(int baudrate) { m_baud = baudrate; }
+    int  readable() { return !m_rx.empty(); }
+    int  writeable() { return txFifoCount() < SIM_UART_FIFO; }
+    int  getc();
+    int  putc(int c);
+    int  puts(const char *s);
+    int  printf(const char *format, ...) { return 0; }
+
+    template <typename T>
+    void attach(T *tptr, void (T::*mptr)(void), IrqType type = RxIrq) { setIrq(type, new sim::MemberCallback<T>(tptr, mptr)); }
+    void attach(void (*fptr)(void), IrqType type = RxIrq) { setIrq(type, fptr ? new sim::FunctionCallback(fptr) : 0); }
+
+    //! deviceSend is how the device on the other end sends to the firmware
+    void deviceSend(const char *data, size_t len);
+
+    void fire();    // the next character has arrived
+
+    // the registers, for the LPC_USART stand-in
+    uint32_t lsr();                 // reading clears the error bits
+    uint32_t rbr();
+    void     thr(uint32_t c);       // the character is queued behind those in the FIFO, without waiting
+
+    enum { SIM_UART_FIFO = 16 };
+
+private:
+    class TxEmpty : public sim::Event {
+    public:
+        TxEmpty(Serial *serial) : m_serial(serial) {}
+        void fire() { m_serial->txEmpty(); }
+    private:
+        Serial *m_serial;
+    };
+
+    void setIrq(IrqType type, sim::Callback *cb);
+    uint64_t charUs() const { return 10000000ull / (uint64_t)m_baud; }
+    uint32_t txFifoCount() const;
+    void txEmpty();
+
+    sim::SerialDevice *m_device;
+    int m_baud;
+    uint64_t m_txFreeAt;            ///< when the transmit FIFO and shift register will have emptied
+    TxEmpty m_txEmpty;
+    std::deque<char> m_sending;     ///< sent by the device, still on the wire
+    std::deque<char> m_rx;          ///< received, in the receive FIFO
+    uint32_t m_errors;              ///< LSR error bits since LSR was last read
+    sim::Callback *m_rxIrq;
+    sim::Callback *m_txIrq;
+};
+
+/*
+ * The registers of the LPC11U37's UART, for firmware that reads the line status itself. The stand-in for each register
+ * works on the last Serial created, the target only having the one UART.
+ */
+namespace sim {
+struct UartRbr { operator uint32_t() const; };
+struct UartLsr { operator uint32_t() const; };
+struct UartThr { UartThr &operator=(uint32_t c); };
+struct UartRegs {
+    UartRbr RBR;
+    UartThr THR;
+    UartLsr LSR;
+};
+extern UartRegs uart0;
+}
+#define LPC_USART   (&sim::uart0)
+
+// wait_api.h
+void wait(float s);
+void wait_ms(int ms);
+void wait_us(int us);
+
+// us_ticker_api.h
+uint32_t us_ticker_read(void);
+
+// sleep_api.h
+void sleep(void);
+void deepsleep(void);
+
+// rtc_time.h
+void set_time(time_t t);
+void attach_rtc(time_t (*read_rtc)(void), void (*write_rtc)(time_t), void (*init_rtc)(void), int (*isenabled_rtc)(void));
+time_t sim_time(time_t *timer);
+#define time(t) sim_time(t)     // mbed retargets time() to the attached RTC
+
+// the profiler times handlers with sim::profileTicks() rather than us_ticker_read(), so it does not move time on
+#define PROFILER_TICKS()    sim::profileTicks()
+
+// CMSIS
+#define __disable_irq()
+#define __enable_irq()
+#define __WFI()         ::sleep()
+// the interrupts run on the main thread here, so a barrier only has to stop the compiler moving memory accesses across
+// it, which is all the in-order Cortex-M0 needs of a DMB too. A host fence would cost far more than the target's DMB
+#define __DMB()         __asm__ __volatile__("" ::: "memory")
+
+/*
+ * The SD card. mbed retargets the C file functions for paths under a mounted FileSystemLike, so the firmware calls
+ * fopen("/sd/...") directly. Here, paths under /sd/ are redirected to the directory in SIM_SD_DIR, and the time the
+ * card takes is modelled.
+ */
+FILE  *sim_fopen(const char *path, const char *mode);
+int    sim_fclose(FILE *fp);
+size_t sim_fwrite(const void *ptr, size_t size, size_t count, FILE *fp);
+size_t sim_fread(void *ptr, size_t size, size_t count, FILE *fp);
+int    sim_fprintf(FILE *fp, const char *format, ...);
+int    sim_fflush(FILE *fp);
+#define fopen   sim_fopen
+#define fclose  sim_fclose
+#define fwrite  sim_fwrite
+#define fread   sim_fread
+#define fprintf sim_fprintf
+#define fflush  sim_fflush
+
+#endif // MBED_H
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Flash and RAM of the firmware by subsystem, from the objects `make memmap` compiles.
+#
+# Flash is code, constants and the initial values of data. RAM is data and bss, the memory that is set aside before
+# main() runs; the heap comes on top, and the simulation's report shows what the firmware allocates. The objects are
+# not linked, so inline functions used in more than one file are counted in each, and the sizes are for i386 rather
+# than the Cortex-M0: a guide to where the memory goes and how a change moves it, not the figures for the target.
+#
+# The objects main() keeps as statics are counted in the subsystem they belong to, rather than in main.o.
+
+for obj in "$@"; do
+    name=$(basename "$obj" .o)
+    case $name in
+        main|scheduler|timers|rtc|ClockHandler|power|profiler)      part=core ;;
+        UsbComms|logexport|telemetry|formatter|circbuff)            part=usb ;;
+        SdHandler|binlog)                                           part=sd ;;
+        SensorSampler|sensor|dht22|fixedpoint)                      part=sensors ;;
+        measurementhandler|meashistory|alerts)                      part=measure ;;
+        GprsHandler|atengine|smsoutbox)                             part=gprs ;;
+        *)                                                          part=shared ;;
+    esac
+
+    # the sections, as "section size"
+    size -A "$obj" | awk -v part="$part" '
+        $1 ~ /^\.(text|rodata)/                 { print part, "flash", $2 }
+        $1 ~ /^\.(data|init_array|ctors)/       { print part, "flash", $2; print part, "ram", $2 }
+        $1 ~ /^\.bss/                           { print part, "ram", $2 }
+    '
+
+    # main()'s statics, moved from core to their own subsystem by name
+    if [ "$name" = main ]; then
+        nm -S -C --defined-only "$obj" | awk '
+            function hex(s,    i, n) {
+                n = 0
+                for (i = 1; i <= length(s); i++) {
+                    n = n * 16 + index("0123456789abcdef", tolower(substr(s, i, 1))) - 1
+                }
+                return n
+            }
+            NF >= 4 && $3 ~ /^[bBdD]$/ && $4 ~ /^main::/ {
+                part = "core"
+                if ($4 ~ /usbcomms/)            part = "usb"
+                else if ($4 ~ /sdhandler/)      part = "sd"
+                else if ($4 ~ /sampler|dht22/)  part = "sensors"
+                else if ($4 ~ /measure/)        part = "measure"
+                else if ($4 ~ /gprs/)           part = "gprs"
+                if (part != "core") {
+                    n = hex($2)
+                    print "core ram", -n
+                    print part, "ram", n
+                }
+            }
+        '
+    fi
+done | awk '
+    { total[$1 " " $2] += $3; subs[$1] = 1 }
+    END {
+        split("core usb sd sensors measure gprs shared", order, " ")
+        printf "%-10s %8s %8s\n", "subsystem", "flash", "ram"
+        for (i = 1; i in order; i++) {
+            s = order[i]
+            if (!(s in subs)) {
+                continue
+            }
+            printf "%-10s %8d %8d\n", s, total[s " flash"], total[s " ram"]
+            flash += total[s " flash"]
+            ram   += total[s " ram"]
+        }
+        printf "%-10s %8d %8d\n", "total", flash, ram
+    }
+'
@@ -0,0 +1,405 @@
+/*
+ * Virtual clock, event queue and end of run report for the host simulation build.
+ */
+
+#include "sim.h"
+
+#include <map>
+#include <vector>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "mbed.h"
+#include "../timers.h"
+#include "../scheduler.h"
+#include "../Handlers/measurementhandler.h"
+#include "../Handlers/SdHandler.h"
+#include "../Handlers/UsbComms.h"
+#include "../rtc.h"
+#ifdef ENABLE_PROFILING
+#include "../profiler.h"
+#endif
+#ifdef ENABLE_LOW_POWER
+#include "../power.h"
+#endif
+#ifdef ENABLE_GPRS_TESTING
+#include "../Handlers/GprsHandler.h"
+#endif
+
+// firmware globals from main.cpp, for the report
+extern MyTimers *mytimer;
+extern SchedulerBase *scheduler;
+extern MeasurementHandler *measure;
+extern SdHandler *sdhandler;
+extern UsbComms *usbcomms;
+#ifdef ENABLE_PROFILING
+extern Profiler *profiler;
+#endif
+#ifdef ENABLE_LOW_POWER
+extern PowerManager *power;
+#endif
+#ifdef ENABLE_GPRS_TESTING
+extern GprsHandler *gprs;
+#endif
+
+namespace sim {
+
+Stats stats;
+
+static uint64_t s_now = 0;          // virtual time, us
+static uint64_t s_limit = 0;        // end of the run, us
+static uint64_t s_tickerStopped = 0;    // us of deep sleep, which us_ticker has not counted
+static uint64_t s_inDeepSleepUs = 0;    // of a deep sleep the run ended in, which the firmware has not caught up on
+static uint32_t s_seed = 1;
+static bool     s_inEvent = false;  // events do not nest, just like the interrupt they stand in for
+static double   s_wallStart = 0;
+
+typedef std::multimap<uint64_t, Event*> EventQueue;
+static EventQueue &queue()
+{
+    static EventQueue q;
+    return q;
+}
+
+static double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report();
+
+static void finish(const char *why)
+{
+    // the report reads the firmware's time base, which moves the virtual clock on past the limit again
+    static bool finishing = false;
+    if (finishing) {
+        return;
+    }
+    finishing = true;
+    printf("\nsim: stopped at %.0f s of virtual time: %s\n", s_now / 1e6, why);
+    report();
+    exit(0);
+}
+
+int envInt(const char *name, int def)
+{
+    const char *v = getenv(name);
+    return v ? atoi(v) : def;
+}
+
+const char *envStr(const char *name, const char *def)
+{
+    const char *v = getenv(name);
+    return v ? v : def;
+}
+
+// set up before main() runs
+static struct Init {
+    Init()
+    {
+        // the target has no time zone, so localtime() is UTC
+        setenv("TZ", "UTC0", 1);
+        tzset();
+
+        s_limit = (uint64_t)envInt("SIM_SECONDS", 86400) * 1000000;
+        s_seed  = (uint32_t)envInt("SIM_SEED", 1);
+        s_wallStart = wallClock();
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        printf("sim: running %llu s of virtual time\n", (unsigned long long)(s_limit / 1000000));
+    }
+} s_init;
+
+Event::~Event()
+{
+    cancel(this);
+}
+
+uint64_t now()
+{
+    return s_now;
+}
+
+uint64_t tickerNow()
+{
+    return s_now - s_tickerStopped;
+}
+
+void schedule(Event *e, uint64_t at)
+{
+    cancel(e);
+    e->m_at = at;
+    e->m_queued = true;
+    queue().insert(std::make_pair(at, e));
+}
+
+void cancel(Event *e)
+{
+    if (!e->m_queued) {
+        return;
+    }
+    std::pair<EventQueue::iterator, EventQueue::iterator> range = queue().equal_range(e->m_at);
+    for (EventQueue::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == e) {
+            queue().erase(it);
+            break;
+        }
+    }
+    e->m_queued = false;
+}
+
+bool fireNext(uint64_t limit)
+{
+    if (s_inEvent || queue().empty() || (queue().begin()->first > limit)) {
+        return false;
+    }
+
+    Event *e = queue().begin()->second;
+    queue().erase(queue().begin());
+    e->m_queued = false;
+    if (e->m_at > s_now) {
+        s_now = e->m_at;
+    }
+
+    s_inEvent = true;
+    e->fire();
+    s_inEvent = false;
+    return true;
+}
+
+void advance(uint64_t us)
+{
+    uint64_t target = s_now + us;
+    while (fireNext(target)) {
+    }
+    if (target > s_now) {
+        s_now = target;
+    }
+    if (s_now >= s_limit) {
+        finish("reached SIM_SECONDS");
+    }
+}
+
+void sleepUntilEvent()
+{
+    stats.wfi++;
+    if (s_inEvent) {
+        return;
+    }
+    if (queue().empty()) {
+        finish("nothing left to wake up for");
+    }
+    if (queue().begin()->first >= s_limit) {
+        s_now = s_limit;
+        finish("reached SIM_SECONDS");
+    }
+    fireNext(queue().begin()->first);
+}
+
+void deepSleepUntilEvent()
+{
+    stats.wfi++;
+    if (s_inEvent) {
+        return;
+    }
+
+    // the first event that can happen with us_ticker stopped, such as the RTC alarm or a pin changing
+    EventQueue::iterator wake = queue().begin();
+    while ((wake != queue().end()) && wake->second->stopsInDeepSleep()) {
+        ++wake;
+    }
+    if (wake == queue().end()) {
+        finish("nothing left to wake up for from deep sleep");
+    }
+    uint64_t at = (wake->first < s_limit) ? wake->first : s_limit;
+    uint64_t slept = at - s_now;
+
+    // what us_ticker times happens that much later
+    std::vector<Event*> later;
+    for (EventQueue::iterator it = queue().begin(); it != queue().end(); ++it) {
+        if (it->second->stopsInDeepSleep()) {
+            later.push_back(it->second);
+        }
+    }
+    for (size_t i = 0; i < later.size(); i++) {
+        schedule(later[i], later[i]->at() + slept);
+    }
+    s_tickerStopped += slept;
+    stats.deepSleeps++;
+    stats.deepSleepUs += slept;
+
+    if (at >= s_limit) {
+        s_inDeepSleepUs = slept;
+        s_now = s_limit;
+        finish("reached SIM_SECONDS");
+    }
+    fireNext(at);
+}
+
+uint32_t profileTicks()
+{
+    // virtual time includes the modelled cost of the peripherals, which is what the target would see. The host
+    // clock shows what the firmware's own code costs, scaled by however much faster the host is.
+    static bool host = (strcmp(envStr("SIM_PROFILE_CLOCK", "virtual"), "host") == 0);
+    if (host) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+    }
+    return (uint32_t)s_now;
+}
+
+uint32_t random()
+{
+    // xorshift32, so runs are repeatable for a given SIM_SEED
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 17;
+    s_seed ^= s_seed << 5;
+    return s_seed;
+}
+
+static void report()
+{
+    double wall = wallClock() - s_wallStart;
+    double virt = s_now / 1e6;
+
+    printf("sim: %.0f s virtual in %.2f s wall, %.0fx real time\n", virt, wall, (wall > 0) ? virt / wall : 0.0);
+    printf("sim: WFI sleeps %llu, us_ticker reads %llu\n",
+           (unsigned long long)stats.wfi, (unsigned long long)stats.tickerReads);
+    printf("sim: firmware heap %llu allocations, %llu bytes, %llu freed; since starting up %llu allocations, %llu bytes\n",
+           (unsigned long long)stats.heapAllocs, (unsigned long long)stats.heapBytes, (unsigned long long)stats.heapFrees,
+           (unsigned long long)(stats.heapAllocs - stats.heapAllocsAtSleep),
+           (unsigned long long)(stats.heapBytes - stats.heapBytesAtSleep));
+    if (scheduler) {
+        printf("sim: scheduler passes %lu, sleeps %lu, handler runs %lu\n",
+               (unsigned long)scheduler->passes(), (unsigned long)scheduler->sleeps(), (unsigned long)scheduler->handlerRuns());
+    }
+    if (stats.deepSleeps) {
+        printf("sim: deep sleeps %llu, %.0f s (%.1f%%), RTC alarms %llu, I2C writes %llu\n",
+               (unsigned long long)stats.deepSleeps, stats.deepSleepUs / 1e6, (virt > 0) ? stats.deepSleepUs / 1e4 / virt : 0.0,
+               (unsigned long long)stats.rtcAlarms, (unsigned long long)stats.i2cWrites);
+    }
+    if (mytimer) {
+        // all of the compare interrupts, MyTimers' and the others' (the DHT22 start signal), against the 1 ms Ticker
+        // MyTimers had before, which took one every ms the clocks ran
+        double running = (virt > 0) ? (virt - stats.deepSleepUs / 1e6) / virt : 0.0;
+        printf("sim: timer interrupts %llu (%.1f per hour), MyTimers %lu (%.1f per hour), a 1 ms Ticker %.1f per hour\n",
+               (unsigned long long)stats.timerIrqs, (virt > 0) ? stats.timerIrqs * 3600.0 / virt : 0.0,
+               (unsigned long)mytimer->isrCount(), (virt > 0) ? mytimer->isrCount() * 3600.0 / virt : 0.0,
+               3600000.0 * running);
+        // how far the time base has drifted from virtual time, which is what deep sleep puts at risk
+        long long ms = (long long)((s_now - stats.firstTickerReadUs - s_inDeepSleepUs) / 1000);
+        printf("sim: time base %lu ms, %+lld ms from virtual time\n", (unsigned long)mytimer->now(), (long long)mytimer->now() - ms);
+    }
+    printf("sim: DHT reads %llu, good %llu, edges %llu; DS1337 reads %llu\n",
+           (unsigned long long)stats.dhtReads, (unsigned long long)stats.dhtOk, (unsigned long long)stats.dhtEdges,
+           (unsigned long long)stats.rtcReads);
+    if (stats.dhtIntervals) {
+        printf("sim: DHT read interval error mean %.3f ms, max %.3f ms\n",
+               stats.dhtIntervalErrUs / 1e3 / stats.dhtIntervals, stats.dhtIntervalErrMaxUs / 1e3);
+    }
+    if (mytimer) {
+        char line[RTC_LINE_MAX];
+        my_rtc_format_stats(line, sizeof(line));
+        printf("sim: %s\n", line);
+        // as with the time base, less any deep sleep the firmware has not caught up on
+        uint16_t ms;
+        time_t t = my_rtc_time(&ms);
+        printf("sim: clock %+.3f s from the DS1337\n", (double)t + (ms / 1e3) + (s_inDeepSleepUs / 1e6) - rtcTime());
+    }
+    if (measure) {
+        printf("sim: result queue high water %u/%u, dropped %lu; error queue high water %u/%u, dropped %lu\n",
+               measure->resultQueue().highWater(), measure->resultQueue().capacity(), (unsigned long)measure->resultQueue().drops(),
+               measure->errorQueue().highWater(), measure->errorQueue().capacity(), (unsigned long)measure->errorQueue().drops());
+
+        static const char *windows[] = { "minutes", "hours", "days" };
+        for (int r = 0; r < MeasHistory::hist_NumResolutions; r++) {
+            MeasSummary s;
+            if (measure->history().window((MeasHistory::resolution_t)r, &s)) {
+                printf("sim: history by %s: %lu results, degC %.2f/%.2f/%.2f, pc %.2f/%.2f/%.2f (min/mean/max)\n", windows[r],
+                       (unsigned long)s.count,
+                       s.min[MeasHistory::hist_Celcius] / 100.0, s.mean[MeasHistory::hist_Celcius] / 100.0,
+                       s.max[MeasHistory::hist_Celcius] / 100.0,
+                       s.min[MeasHistory::hist_Humidity] / 100.0, s.mean[MeasHistory::hist_Humidity] / 100.0,
+                       s.max[MeasHistory::hist_Humidity] / 100.0);
+            }
+        }
+    }
+    printf("sim: USB %llu bytes in %llu packets\n", (unsigned long long)stats.usbBytes, (unsigned long long)stats.usbPackets);
+    if (usbcomms && usbcomms->exportStats().exports) {
+        const UsbExportStats &x = usbcomms->exportStats();
+        uint32_t ms = x.finishedMs - x.startedMs;
+        printf("sim: USB export %lu started, %lu frames, %lu bytes in %lu packets (%lu full), last took %lu ms, %.1f KB/s\n",
+               (unsigned long)x.exports, (unsigned long)x.frames, (unsigned long)x.bytes, (unsigned long)x.packets,
+               (unsigned long)x.fullPackets, (unsigned long)ms, ms ? (x.bytes / 1024.0) / (ms / 1000.0) : 0.0);
+    }
+    printf("sim: SD %llu opens, %llu bytes written, %llu read, %llu data rows, %.1f s busy\n",
+           (unsigned long long)stats.sdOpens, (unsigned long long)stats.sdBytes, (unsigned long long)stats.sdReadBytes,
+           (unsigned long long)stats.sdRows, stats.sdBusyUs / 1e6);
+    if (sdhandler) {
+        const SdWriteStats &w = sdhandler->writeStats();
+        printf("sim: data file %lu bytes in %lu sector writes (%lu full, %lu age, %lu sync, %lu failed), "
+               "write amplification %.2f, write mean %.0f us max %lu us\n",
+               (unsigned long)w.bytes, (unsigned long)w.sectors, (unsigned long)w.fullWrites, (unsigned long)w.ageFlushes,
+               (unsigned long)w.syncFlushes, (unsigned long)w.errors,
+               w.bytes ? (w.sectors * 512.0) / w.bytes : 0.0,
+               w.sectors ? (double)w.totalWriteUs / w.sectors : 0.0, (unsigned long)w.maxWriteUs);
+    }
+    if (stats.sdBadBlocks) {
+        printf("sim: binary log bytes skipped as invalid: %llu\n", (unsigned long long)stats.sdBadBlocks);
+    }
+#ifdef ENABLE_GPRS_TESTING
+    if (gprs) {
+        const AtStats &a = gprs->atStats();
+        printf("sim: AT commands %lu (%lu ok, %lu error, %lu timed out), %.2f per second, URCs %lu, "
+               "latency mean %.0f ms max %lu ms\n",
+               (unsigned long)a.commands, (unsigned long)a.ok, (unsigned long)a.errors, (unsigned long)a.timeouts,
+               (virt > 0) ? a.commands / virt : 0.0, (unsigned long)a.urcs,
+               a.commands ? (double)a.latencyTotalMs / a.commands : 0.0, (unsigned long)a.latencyMaxMs);
+        GprsUartStats u = gprs->uartStats();
+        printf("sim: SIM900 UART received %lu of %llu bytes, %lu overruns, %lu framing errors (%llu injected), "
+               "%lu dropped, buffer high water %u/%u, %lu writes dropped\n",
+               (unsigned long)u.rxBytes, (unsigned long long)stats.uartRxBytes, (unsigned long)u.overruns,
+               (unsigned long)u.framingErrors, (unsigned long long)stats.uartFramingErrors, (unsigned long)u.rxDropped, u.rxHighWater, GPRS_RX_BUFF,
+               (unsigned long)u.txDropped);
+        const SmsOutboxStats &o = gprs->outboxStats();
+        printf("sim: outbox %lu posted, %lu refused, %lu sent, %lu failed attempts, %lu given up, "
+               "held by number %lu, by total %lu, %lu restored, %lu saves (%lu failed), high water %u/%u\n",
+               (unsigned long)o.posted, (unsigned long)o.refused, (unsigned long)o.sent, (unsigned long)o.failures,
+               (unsigned long)o.givenUp, (unsigned long)o.numberLimited, (unsigned long)o.globalLimited,
+               (unsigned long)o.restored, (unsigned long)o.saves, (unsigned long)o.saveErrors, o.highWater,
+               SMS_OUTBOX_ENTRIES);
+    }
+#endif
+    if (stats.modemBytesIn) {
+        printf("sim: SIM900 %llu commands, %llu bytes in, %llu bytes out, SMS %llu sent, %llu failed, %llu received\n",
+               (unsigned long long)stats.modemCmds, (unsigned long long)stats.modemBytesIn,
+               (unsigned long long)stats.modemBytesOut, (unsigned long long)stats.smsSent, (unsigned long long)stats.smsFailed,
+               (unsigned long long)stats.smsReceived);
+    }
+    long long lost = (long long)stats.dhtOk - (long long)stats.sdRows;
+    printf("sim: good readings not in the data file: %lld%s\n", lost, (lost > 0) ? " (some may still be buffered)" : "");
+
+#ifdef ENABLE_PROFILING
+    if (profiler) {
+        char line[PROFILER_LINE_MAX];
+        uint16_t cursor = 0;
+        while (profiler->formatLine(&cursor, line, sizeof(line))) {
+            printf("sim: %s\n", line);
+        }
+    }
+#endif
+#ifdef ENABLE_LOW_POWER
+    if (power) {
+        char line[POWER_LINE_MAX];
+        uint16_t cursor = 0;
+        while (power->formatLine(&cursor, line, sizeof(line))) {
+            printf("sim: %s\n", line);
+        }
+    }
+#endif
+}
+
+} // namespace sim
@@ -0,0 +1,149 @@
+#ifndef SIM_H
+#define SIM_H
+
+/*
+ * Virtual clock and event queue for the host simulation build.
+ *
+ * Time only moves when the firmware waits (wait(), WFI) or reads the time (us_ticker_read(), which costs a
+ * little virtual time, so polling loops still make progress). Sleeping jumps straight to the next event, which is
+ * why a month of operation runs in seconds.
+ *
+ * Events (Ticker/Timeout callbacks, USB input, etc) fire from inside those calls, which is where an interrupt
+ * would have been taken on the target.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+class Serial;
+
+namespace sim {
+
+//! Something that happens at a point in virtual time, like an interrupt
+class Event {
+public:
+    Event() : m_queued(false), m_at(0) {}
+    virtual ~Event();
+    virtual void fire() = 0;
+    virtual bool stopsInDeepSleep() const { return false; }    ///< true if it is timed by us_ticker
+
+    bool     queued() const { return m_queued; }
+    uint64_t at() const     { return m_at; }
+
+private:
+    friend void schedule(Event *e, uint64_t at);
+    friend void cancel(Event *e);
+    friend bool fireNext(uint64_t limit);
+    bool     m_queued;
+    uint64_t m_at;
+};
+
+//! Callable for attach() style APIs
+class Callback {
+public:
+    virtual ~Callback() {}
+    virtual void call() = 0;
+
+    // the mbed library keeps its callbacks in the object they are attached to. These are the stand-ins' own, so they
+    // are kept out of the firmware's heap count, which the Makefile hooks into the firmware's objects
+    static void *operator new(size_t size) { return malloc(size); }
+    static void operator delete(void *p) { free(p); }
+};
+
+template <class T>
+class MemberCallback : public Callback {
+public:
+    MemberCallback(T *obj, void (T::*method)()) : m_obj(obj), m_method(method) {}
+    void call() { (m_obj->*m_method)(); }
+private:
+    T *m_obj;
+    void (T::*m_method)();
+};
+
+class FunctionCallback : public Callback {
+public:
+    FunctionCallback(void (*fn)()) : m_fn(fn) {}
+    void call() { if (m_fn) m_fn(); }
+private:
+    void (*m_fn)();
+};
+
+/*!
+ * Something on the other end of a Serial port: the Serial calls \a fromMcu for every character the firmware sends,
+ * and the device replies through \a Serial::deviceSend
+ */
+class SerialDevice {
+public:
+    virtual ~SerialDevice() {}
+    virtual void connect(class ::Serial *serial) = 0;
+    virtual void fromMcu(char c) = 0;
+};
+
+void registerSerialDevice(int txPin, SerialDevice *device);   ///< connect \a device to the Serial on \a txPin
+SerialDevice *serialDevice(int txPin);
+
+uint64_t now();                     ///< virtual time, us since the simulation started
+uint64_t tickerNow();               ///< us_ticker, which is \a now less the time spent in deep sleep
+void     advance(uint64_t us);      ///< move time forward, firing any events that fall due
+void     sleepUntilEvent();         ///< jump to the next event and fire it (WFI)
+void     deepSleepUntilEvent();     ///< the same with us_ticker stopped, so the events it times are put back
+void     schedule(Event *e, uint64_t at);
+void     cancel(Event *e);
+bool     fireNext(uint64_t limit);  ///< fire the earliest event if it is due by \a limit
+
+void     pinReleased(int pin);      ///< a DigitalInOut has stopped driving \a pin (implemented by the stand-ins)
+void     pinFall(int pin);          ///< a falling edge on \a pin, for any InterruptIn on it
+int      i2cWrite(int address, const char *data, int length);  ///< an I2C write, 0 if it was acknowledged
+double   rtcTime();                 ///< the DS1337's time to the us, in seconds since 1970
+
+uint32_t profileTicks();            ///< profiler tick source: virtual us, or host us with SIM_PROFILE_CLOCK=host
+uint32_t random();                  ///< deterministic pseudo random numbers, seeded by SIM_SEED
+int      envInt(const char *name, int def);
+const char *envStr(const char *name, const char *def);
+
+//! Counters collected by the stand-ins, printed in the report at the end of the run
+struct Stats {
+    uint64_t wfi;               ///< times the firmware slept
+    uint64_t tickerReads;       ///< us_ticker_read calls
+    uint64_t timerIrqs;         ///< Ticker and Timeout callbacks, i.e. us_ticker compare interrupts
+    uint64_t firstTickerReadUs; ///< when the first was, which is when MyTimers' time base started
+    uint64_t dhtReads;          ///< DHT22 transactions started
+    uint64_t dhtOk;             ///< transactions whose edges decode, i.e. should each end up as a CSV row
+    uint64_t dhtEdges;          ///< falling edges sent by the DHT22
+    uint64_t dhtIntervals;          ///< times between one reading of a DHT22 and the next
+    uint64_t dhtIntervalErrUs;      ///< total of how far each was from SENSOR_PERIOD_MS
+    uint64_t dhtIntervalErrMaxUs;   ///< furthest any was
+    uint64_t rtcReads;          ///< DS1337 readTime transactions
+    uint64_t rtcAlarms;         ///< DS1337 alarms that went off
+    uint64_t i2cWrites;         ///< I2C write transactions, other than the DS1337 library's
+    uint64_t deepSleeps;        ///< times the firmware deep-slept
+    uint64_t deepSleepUs;       ///< time spent in deep sleep, with us_ticker stopped
+    uint64_t usbBytes;          ///< bytes sent to the PC
+    uint64_t usbPackets;        ///< writeBlock calls
+    uint64_t sdOpens;           ///< files opened on the SD card
+    uint64_t sdBytes;           ///< bytes written to the SD card
+    uint64_t sdReadBytes;       ///< bytes read from the SD card
+    uint64_t sdRows;            ///< lines written to the data file, or records in the binary log
+    uint64_t sdBadBlocks;       ///< bytes of the binary log skipped because they were not a valid block
+    uint64_t sdBusyUs;          ///< modelled time spent in SD card calls
+    uint64_t uartRxBytes;       ///< characters that arrived at the UART
+    uint64_t uartOverruns;      ///< characters lost because the receive FIFO was full
+    uint64_t uartFramingErrors; ///< characters corrupted by SIM_UART_FE_PPM
+    uint64_t modemCmds;         ///< command lines the SIM900 received
+    uint64_t modemBytesIn;      ///< bytes the SIM900 received
+    uint64_t modemBytesOut;     ///< bytes the SIM900 sent
+    uint64_t smsSent;           ///< SMS the SIM900 sent
+    uint64_t smsFailed;         ///< SMS the SIM900 failed to send, from SIM_MODEM_SEND_FAIL_PCT
+    uint64_t smsReceived;       ///< SMS that arrived at the SIM900
+    uint64_t heapAllocs;        ///< new, and new[], called by the firmware
+    uint64_t heapBytes;         ///< bytes they asked for, without the allocator's overhead
+    uint64_t heapFrees;         ///< delete, and delete[], called by the firmware
+    uint64_t heapAllocsAtSleep; ///< \a heapAllocs when the firmware first slept, which is when it has started up
+    uint64_t heapBytesAtSleep;
+};
+extern Stats stats;
+
+} // namespace sim
+
+#endif // SIM_H
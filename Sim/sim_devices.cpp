@@ -0,0 +1,458 @@
+/*
+ * Peripheral stand-ins for the host simulation build: the DHT22 sensor, the DS1337 RTC, the SD card and USB serial.
+ */
+
+#include "mbed.h"
+#include "config.h"
+#include "DHT.h"
+#include "../dht22.h"
+#include "DS1337.h"
+#include "SDFileSystem.h"
+#include "USBSerial.h"
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#undef fopen
+#undef fclose
+
+#define DHT_RESPONSE_US     30      // from the start signal being released to the sensor pulling the line low
+#define DHT_OFFSET_TENTHS_C 5       // each sensor after the first reads this much warmer than the one before
+
+/* DHT22 */
+
+/*!
+ * Each of SENSOR_DHT22_PINS has its own DHT22, which answers each start signal with a transaction of falling edges,
+ * as Dht22Reader sees them on the pin.
+ *
+ * With SIM_DHT_TRACE, the edges are replayed from a file, one transaction per line, in turn, starting again at the
+ * end. A line is the time of each falling edge in us after the start signal was released, and a line with just "-"
+ * is a transaction the sensor did not answer. Anything after a '#' is a comment.
+ *
+ * Otherwise the sensor follows a daily temperature and humidity cycle, and SIM_DHT_ERROR_PCT percent of the
+ * transactions are corrupted: a flipped bit, edges missing from the end, or no answer at all. Sensor i reads
+ * i * DHT_OFFSET_TENTHS_C tenths of a degC warmer than the first, so their rows can be told apart.
+ */
+class Dht22Model : public sim::Event {
+public:
+    Dht22Model() : m_pin(0), m_index(0), m_count(0), m_next(0), m_start(0), m_traceLine(0), m_traceLoaded(false) {}
+
+    int m_pin;
+    int m_index;                    // position in SENSOR_DHT22_PINS
+
+    void begin();
+    void fire();
+
+private:
+    uint32_t m_falls[64];           // edge times of this transaction, in us after the start was released
+    uint8_t  m_count;
+    uint8_t  m_next;                // next edge to send
+    uint64_t m_start;
+
+    std::vector<std::vector<uint32_t> > m_trace;
+    size_t m_traceLine;
+    bool   m_traceLoaded;
+
+    void loadTrace();
+    void synthesise();
+};
+
+static const PinName s_dhtPins[] = { SENSOR_DHT22_PINS };
+#define DHT_COUNT (sizeof(s_dhtPins) / sizeof(s_dhtPins[0]))
+static Dht22Model s_dht[DHT_COUNT];
+
+void sim::pinReleased(int pin)
+{
+    for (size_t i = 0; i < DHT_COUNT; i++) {
+        if (pin == s_dhtPins[i]) {
+            s_dht[i].m_pin   = pin;
+            s_dht[i].m_index = (int)i;
+            s_dht[i].begin();
+        }
+    }
+}
+
+void Dht22Model::begin()
+{
+    sim::cancel(this);      // a transaction that was cut short is abandoned
+    sim::stats.dhtReads++;
+
+    // how far the time since the last reading is from SENSOR_PERIOD_MS, i.e. how late or early the timers are
+    if (m_start) {
+        int64_t error = (int64_t)(sim::now() - m_start) - (int64_t)SENSOR_PERIOD_MS * 1000;
+        uint64_t magnitude = (error < 0) ? (uint64_t)-error : (uint64_t)error;
+        sim::stats.dhtIntervals++;
+        sim::stats.dhtIntervalErrUs += magnitude;
+        if (magnitude > sim::stats.dhtIntervalErrMaxUs) {
+            sim::stats.dhtIntervalErrMaxUs = magnitude;
+        }
+    }
+
+    loadTrace();
+    if (!m_trace.empty()) {
+        const std::vector<uint32_t> &line = m_trace[m_traceLine];
+        m_traceLine = (m_traceLine + 1) % m_trace.size();
+        m_count = 0;
+        for (size_t i = 0; (i < line.size()) && (m_count < sizeof(m_falls) / sizeof(m_falls[0])); i++) {
+            m_falls[m_count++] = line[i];
+        }
+    }
+    else {
+        synthesise();
+    }
+
+    // count the transactions the firmware should be able to decode
+    uint16_t h, t;
+    uint8_t n = (m_count < DHT22_EDGES) ? m_count : DHT22_EDGES;
+    if (dht22Decode(m_falls, n, &h, &t) == ERROR_NONE) {
+        sim::stats.dhtOk++;
+    }
+
+    m_start = sim::now();
+    m_next  = 0;
+    if (m_count > 0) {
+        sim::schedule(this, m_start + m_falls[0]);
+    }
+}
+
+void Dht22Model::fire()
+{
+    sim::stats.dhtEdges++;
+    sim::pinFall(m_pin);
+    if (++m_next < m_count) {
+        sim::schedule(this, m_start + m_falls[m_next]);
+    }
+}
+
+void Dht22Model::loadTrace()
+{
+    if (m_traceLoaded) {
+        return;
+    }
+    m_traceLoaded = true;
+
+    const char *path = sim::envStr("SIM_DHT_TRACE", NULL);
+    if (path == NULL) {
+        return;
+    }
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "sim: cannot open SIM_DHT_TRACE %s\n", path);
+        exit(1);
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        std::vector<uint32_t> falls;
+        bool silent = false;
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+            if (strcmp(tok, "-") == 0) {
+                silent = true;
+            } else {
+                falls.push_back((uint32_t)strtoul(tok, NULL, 10));
+            }
+        }
+        if (silent || !falls.empty()) {
+            m_trace.push_back(falls);
+        }
+    }
+    fclose(fp);
+}
+
+void Dht22Model::synthesise()
+{
+    // a daily cycle, with humidity falling as temperature rises, at the sensor's 0.1 resolution
+    double day = (sim::now() / 1e6) / 86400.0;
+    double phase = sin(2 * M_PI * day);
+    int tenthsC = (int)floor((20.0 + 6.0 * phase) * 10.0 + 0.5) + (m_index * DHT_OFFSET_TENTHS_C);
+    int tenthsH = (int)floor((65.0 - 15.0 * phase) * 10.0 + 0.5);
+    uint16_t temperature = (tenthsC < 0) ? (uint16_t)(0x8000 | -tenthsC) : (uint16_t)tenthsC;
+
+    uint8_t bytes[5];
+    bytes[0] = (uint8_t)(tenthsH >> 8);
+    bytes[1] = (uint8_t)tenthsH;
+    bytes[2] = (uint8_t)(temperature >> 8);
+    bytes[3] = (uint8_t)temperature;
+    bytes[4] = (uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]);
+
+    uint8_t bits = 40;
+    bool silent = false;
+    if ((int)(sim::random() % 100) < sim::envInt("SIM_DHT_ERROR_PCT", 0)) {
+        switch (sim::random() % 3) {
+        case 0:  bytes[sim::random() % 5] ^= (uint8_t)(1 << (sim::random() % 8)); break;    // checksum error
+        case 1:  bits = (uint8_t)(sim::random() % 40); break;                              // stops part way
+        default: silent = true; break;                                                      // no answer
+        }
+    }
+
+    m_count = 0;
+    if (silent) {
+        return;
+    }
+
+    // response: 80 us low, 80 us high. Each bit: 50 us low, then 26 us high for a 0, 70 us for a 1. A little jitter
+    uint32_t t = DHT_RESPONSE_US;
+    m_falls[m_count++] = t;
+    t += 160;
+    m_falls[m_count++] = t;
+    for (uint8_t i = 0; i < bits; i++) {
+        bool one = (bytes[i >> 3] >> (7 - (i & 7))) & 1;
+        t += 50 + (one ? 70 : 26) + (sim::random() % 5);
+        m_falls[m_count++] = t;
+    }
+}
+
+/* DS1337 */
+
+static time_t   s_rtcBase  = 0;  // RTC seconds at virtual time s_rtcZero
+static uint64_t s_rtcZero  = 0;  // virtual time the seconds were last written, which restarts the countdown
+static int64_t  s_rtcPpm   = 0;  // how fast its crystal runs, in parts per million
+
+// us the RTC has counted since s_rtcZero
+static int64_t rtcElapsedUs()
+{
+    int64_t us = (int64_t)(sim::now() - s_rtcZero);
+    return us + ((us * s_rtcPpm) / 1000000);
+}
+
+// the RTC's time, in whole seconds
+static time_t rtcSeconds()
+{
+    return s_rtcBase + (time_t)(rtcElapsedUs() / 1000000);
+}
+
+// the virtual time the RTC gets to second \a t
+static uint64_t rtcSecondStarts(time_t t)
+{
+    int64_t us = (int64_t)(t - s_rtcBase) * 1000000;
+    return s_rtcZero + (uint64_t)(((us * 1000000) + (1000000 + s_rtcPpm) - 1) / (1000000 + s_rtcPpm));
+}
+
+double sim::rtcTime()
+{
+    return (double)s_rtcBase + (rtcElapsedUs() / 1e6);
+}
+
+DS1337::DS1337()
+{
+    s_rtcBase = sim::envInt("SIM_START", 1460246400);   // 10/04/2016, the v0.0.1 release date
+    s_rtcZero = 0;
+    s_rtcPpm  = sim::envInt("SIM_RTC_PPM", 0);
+    memset(&m_tm, 0, sizeof(m_tm));
+}
+
+void DS1337::readTime()
+{
+    sim::stats.rtcReads++;
+    time_t t = rtcSeconds();
+    gmtime_r(&t, &m_tm);
+}
+
+void DS1337::setTime()
+{
+    struct tm tmp = m_tm;
+    s_rtcBase = timegm(&tmp);
+    s_rtcZero = sim::now();
+}
+
+void DS1337::start()
+{
+}
+
+void DS1337::stop()
+{
+}
+
+/*!
+ * The DS1337's alarm 1, which the firmware programs over I2C itself. When the RTC's time of day matches the alarm's
+ * seconds, minutes and hours (the day is always masked), the alarm flag is set and INTA pulled low, which is a falling
+ * edge on RTC_ALARM_PIN. It is only the registers from 0x07 on that are modelled.
+ */
+#define DS1337_I2C_ADDRESS  0xD0
+#define DS1337_REGS_FIRST   0x07
+#define DS1337_REGS_COUNT   9           // alarm 1 (4), alarm 2 (3), control, status
+
+static unsigned char s_rtcRegs[DS1337_REGS_COUNT];
+
+static int fromBcd(unsigned char v)
+{
+    return ((v >> 4) & 0x07) * 10 + (v & 0x0F);
+}
+
+class RtcAlarm : public sim::Event {
+public:
+    void fire()
+    {
+        sim::stats.rtcAlarms++;
+        s_rtcRegs[8] |= 0x01;           // A1F
+        sim::pinFall(RTC_ALARM_PIN);
+    }
+
+    // the next second the time of day matches, as an event
+    void reprogram()
+    {
+        sim::cancel(this);
+        if (!(s_rtcRegs[7] & 0x01) || (s_rtcRegs[8] & 0x01)) {
+            return;                     // A1IE clear, or INTA already low
+        }
+        int alarm = fromBcd(s_rtcRegs[0]) + (fromBcd(s_rtcRegs[1]) * 60) + (fromBcd(s_rtcRegs[2] & 0x3F) * 3600);
+        time_t now = rtcSeconds();
+        int today = (int)(now % 86400);
+        int wait = (alarm - today + 86400) % 86400;
+        if (wait == 0) {
+            wait = 86400;               // the second it is now has already started, so it is tomorrow's
+        }
+        sim::schedule(this, rtcSecondStarts(now + wait));
+    }
+};
+
+// never destroyed, as it would be after the event queue it is in
+static RtcAlarm *s_rtcAlarm = new RtcAlarm();
+
+int sim::i2cWrite(int address, const char *data, int length)
+{
+    sim::stats.i2cWrites++;
+    if ((address != DS1337_I2C_ADDRESS) || (length < 1)) {
+        return 1;                       // nothing there to acknowledge it
+    }
+    // the first byte is the register pointer, and it moves on with each byte written
+    for (int i = 1; i < length; i++) {
+        int reg = (unsigned char)data[0] + i - 1 - DS1337_REGS_FIRST;
+        if ((reg >= 0) && (reg < DS1337_REGS_COUNT)) {
+            s_rtcRegs[reg] = (unsigned char)data[i];
+        }
+    }
+    s_rtcAlarm->reprogram();
+    // a byte of address and each byte of data at 100 kHz
+    sim::advance((uint64_t)(length + 1) * 90);
+    return 0;
+}
+
+/* SDFileSystem */
+
+SDFileSystem::SDFileSystem(PinName mosi, PinName miso, PinName sclk, PinName cs, const char *name)
+{
+}
+
+/* USBSerial */
+
+#define USB_PACKET_BYTES 64
+
+static FILE *s_usbOut = NULL;
+static std::deque<char> s_usbIn;
+
+// a line of scripted input from the PC
+class UsbInput : public sim::Event {
+public:
+    UsbInput(USBSerial *serial, const std::string &text) : m_serial(serial), m_text(text) {}
+    void fire()
+    {
+        m_serial->receive(m_text.data(), (int)m_text.size());
+        delete this;
+    }
+private:
+    USBSerial *m_serial;
+    std::string m_text;
+};
+
+USBSerial::USBSerial(uint16_t vendor_id, uint16_t product_id, uint16_t product_release, bool connect_blocking)
+    : m_rxCallback(0)
+{
+    const char *out = getenv("SIM_USB_OUT");
+    if (out) {
+        s_usbOut = fopen(out, "w");
+    }
+
+    const char *in = getenv("SIM_USB_IN");
+    FILE *script = in ? fopen(in, "r") : NULL;
+    if (script) {
+        char line[256];
+        while (fgets(line, sizeof(line), script)) {
+            char *text;
+            double seconds = strtod(line, &text);
+            if (text == line) {
+                continue;
+            }
+            while (*text == ' ') {
+                text++;
+            }
+            std::string s(text);
+            while (!s.empty() && ((s[s.size() - 1] == '\n') || (s[s.size() - 1] == '\r'))) {
+                s.erase(s.size() - 1);
+            }
+            s += '\r';
+            sim::schedule(new UsbInput(this, s), (uint64_t)(seconds * 1e6));
+        }
+        fclose(script);
+    }
+}
+
+USBSerial::~USBSerial()
+{
+    delete m_rxCallback;
+}
+
+int USBSerial::_putc(int c)
+{
+    uint8_t b = (uint8_t)c;
+    writeBlock(&b, 1);
+    return c;
+}
+
+int USBSerial::_getc()
+{
+    if (s_usbIn.empty()) {
+        return -1;
+    }
+    char c = s_usbIn.front();
+    s_usbIn.pop_front();
+    return (uint8_t)c;
+}
+
+int USBSerial::readable()
+{
+    return !s_usbIn.empty();
+}
+
+uint8_t USBSerial::available()
+{
+    return (s_usbIn.size() > 255) ? 255 : (uint8_t)s_usbIn.size();
+}
+
+bool USBSerial::writeable()
+{
+    return connected();
+}
+
+bool USBSerial::writeBlock(uint8_t *buf, uint16_t size)
+{
+    // each packet waits for the host to poll the endpoint
+    uint16_t packets = (size + USB_PACKET_BYTES - 1) / USB_PACKET_BYTES;
+    sim::advance((uint64_t)packets * sim::envInt("SIM_USB_PACKET_US", 1000));
+
+    sim::stats.usbBytes += size;
+    sim::stats.usbPackets += packets;
+    if (s_usbOut) {
+        fwrite(buf, 1, size, s_usbOut);
+        fflush(s_usbOut);
+    }
+    return true;
+}
+
+void USBSerial::receive(const char *data, int len)
+{
+    s_usbIn.insert(s_usbIn.end(), data, data + len);
+    if (m_rxCallback) {
+        m_rxCallback->call();
+    }
+}
+
+void USBSerial::setRxCallback(sim::Callback *cb)
+{
+    delete m_rxCallback;
+    m_rxCallback = cb;
+}
@@ -0,0 +1,573 @@
+/*
+ * mbed library functions for the host simulation build: timing, sleep, the RTC hooks and the SD card files.
+ */
+
+#include "mbed.h"
+#include "../binlog.h"
+
+#include <map>
+#include <string>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+// the real C library functions are needed here
+#undef fopen
+#undef fclose
+#undef fwrite
+#undef fread
+#undef fprintf
+#undef fflush
+#undef time
+
+// modelled SD card timing. FatFs walks the cluster chain to find the end of a file when it is opened to append,
+// and writes the directory entry and FAT back on close. Partial sectors are read, modified and written back.
+#define SD_OPEN_US          3000    // directory lookup
+#define SD_CLUSTER_WALK_US  20      // per cluster in the file, when opened to append
+#define SD_CLUSTER_BYTES    32768
+#define SD_CLOSE_US         3000    // directory entry and FAT update
+#define SD_SECTOR_US        1000    // per 512 byte sector written
+#define SD_READ_SECTOR_US   1000    // per 512 byte sector read, that is not the one read last
+#define SD_FLUSH_US         3000    // same as close, without releasing the file
+
+/* Ticker */
+
+void Ticker::setup(sim::Callback *cb, timestamp_t t)
+{
+    detach();
+    m_cb = cb;
+    m_interval = (t > 0) ? t : 1;
+    sim::schedule(this, sim::now() + m_interval);
+}
+
+void Ticker::detach()
+{
+    sim::cancel(this);
+    delete m_cb;
+    m_cb = 0;
+}
+
+void Ticker::fire()
+{
+    sim::stats.timerIrqs++;
+    if (periodic()) {
+        sim::schedule(this, at() + m_interval);
+    }
+    if (m_cb) {
+        m_cb->call();
+    }
+}
+
+/* InterruptIn */
+
+static std::map<int, InterruptIn*> s_interruptIns;
+
+InterruptIn::InterruptIn(PinName pin) : m_pin(pin), m_fall(0)
+{
+    s_interruptIns[pin] = this;
+}
+
+InterruptIn::~InterruptIn()
+{
+    s_interruptIns.erase(m_pin);
+    delete m_fall;
+}
+
+void sim::pinFall(int pin)
+{
+    std::map<int, InterruptIn*>::iterator it = s_interruptIns.find(pin);
+    if (it != s_interruptIns.end()) {
+        it->second->fireFall();
+    }
+}
+
+/* Serial */
+
+#define LSR_RDR     0x01u       // receive data ready
+#define LSR_OE      0x02u       // overrun
+#define LSR_FE      0x08u       // framing error
+#define LSR_THRE    0x20u       // transmit FIFO empty
+
+static Serial *s_uart = NULL;   // the one the register stand-ins work on
+
+static std::map<int, sim::SerialDevice*> &serialDevices()
+{
+    static std::map<int, sim::SerialDevice*> devices;  // devices register from static constructors
+    return devices;
+}
+
+void sim::registerSerialDevice(int txPin, SerialDevice *device)
+{
+    serialDevices()[txPin] = device;
+}
+
+sim::SerialDevice *sim::serialDevice(int txPin)
+{
+    std::map<int, SerialDevice*>::iterator it = serialDevices().find(txPin);
+    return (it != serialDevices().end()) ? it->second : NULL;
+}
+
+Serial::Serial(PinName tx, PinName rx, const char *name)
+    : m_baud(9600), m_txFreeAt(0), m_txEmpty(this), m_errors(0), m_rxIrq(0), m_txIrq(0)
+{
+    m_device = sim::serialDevice(tx);
+    if (m_device) {
+        m_device->connect(this);
+    }
+    s_uart = this;
+}
+
+Serial::~Serial()
+{
+    if (m_device) {
+        m_device->connect(NULL);
+    }
+    if (s_uart == this) {
+        s_uart = NULL;
+    }
+    delete m_rxIrq;
+    delete m_txIrq;
+}
+
+void Serial::setIrq(IrqType type, sim::Callback *cb)
+{
+    sim::Callback *&irq = (type == RxIrq) ? m_rxIrq : m_txIrq;
+    delete irq;
+    irq = cb;
+}
+
+uint32_t Serial::txFifoCount() const
+{
+    // the character in the shift register has left the FIFO
+    uint64_t now = sim::now();
+    if (m_txFreeAt <= now + charUs()) {
+        return 0;
+    }
+    return (uint32_t)((m_txFreeAt - now - 1) / charUs());
+}
+
+int Serial::getc()
+{
+    if (m_rx.empty()) {
+        return -1;
+    }
+    return (unsigned char)rbr();
+}
+
+int Serial::putc(int c)
+{
+    // wait for room in the FIFO
+    while (!writeable()) {
+        sim::advance(charUs());
+    }
+    thr(c);
+    return c;
+}
+
+int Serial::puts(const char *s)
+{
+    int n = 0;
+    while (*s) {
+        putc(*s++);
+        n++;
+    }
+    return n;
+}
+
+void Serial::thr(uint32_t c)
+{
+    if (txFifoCount() >= SIM_UART_FIFO) {
+        return;     // the FIFO is full, and the character is lost
+    }
+    uint64_t now = sim::now();
+    if (m_txFreeAt < now) {
+        m_txFreeAt = now;
+    }
+    m_txFreeAt += charUs();
+
+    // THRE is raised as the last character moves to the shift register
+    if (m_txIrq) {
+        sim::schedule(&m_txEmpty, m_txFreeAt - charUs());
+    }
+
+    // the device sees it as it is written, which is close enough for a device that takes milliseconds to answer
+    if (m_device) {
+        m_device->fromMcu((char)c);
+    }
+}
+
+void Serial::txEmpty()
+{
+    if (m_txIrq) {
+        m_txIrq->call();
+    }
+}
+
+uint32_t Serial::lsr()
+{
+    uint32_t v = m_errors;
+    m_errors = 0;
+    if (!m_rx.empty()) {
+        v |= LSR_RDR;
+    }
+    if (txFifoCount() == 0) {
+        v |= LSR_THRE;
+    }
+    return v;
+}
+
+uint32_t Serial::rbr()
+{
+    if (m_rx.empty()) {
+        return 0;
+    }
+    char c = m_rx.front();
+    m_rx.pop_front();
+    return (unsigned char)c;
+}
+
+void Serial::deviceSend(const char *data, size_t len)
+{
+    m_sending.insert(m_sending.end(), data, data + len);
+    if (!queued() && !m_sending.empty()) {
+        sim::schedule(this, sim::now() + charUs());
+    }
+}
+
+void Serial::fire()
+{
+    static const uint32_t fePpm = (uint32_t)sim::envInt("SIM_UART_FE_PPM", 0);
+
+    char c = m_sending.front();
+    m_sending.pop_front();
+    if (!m_sending.empty()) {
+        sim::schedule(this, at() + charUs());
+    }
+
+    sim::stats.uartRxBytes++;
+    if (fePpm && ((sim::random() % 1000000) < fePpm)) {
+        c ^= 0x80;
+        m_errors |= LSR_FE;
+        sim::stats.uartFramingErrors++;
+    }
+    if (m_rx.size() >= SIM_UART_FIFO) {
+        m_errors |= LSR_OE;
+        sim::stats.uartOverruns++;
+    }
+    else {
+        m_rx.push_back(c);
+    }
+
+    if (m_rxIrq) {
+        m_rxIrq->call();
+    }
+}
+
+sim::UartRegs sim::uart0;
+
+sim::UartRbr::operator uint32_t() const
+{
+    return s_uart ? s_uart->rbr() : 0;
+}
+
+sim::UartLsr::operator uint32_t() const
+{
+    return s_uart ? s_uart->lsr() : LSR_THRE;
+}
+
+sim::UartThr &sim::UartThr::operator=(uint32_t c)
+{
+    if (s_uart) {
+        s_uart->thr(c);
+    }
+    return *this;
+}
+
+/* wait_api.h, us_ticker_api.h, sleep_api.h */
+
+void wait(float s)
+{
+    sim::advance((uint64_t)(s * 1000000.0f));
+}
+
+void wait_ms(int ms)
+{
+    sim::advance((uint64_t)ms * 1000);
+}
+
+void wait_us(int us)
+{
+    sim::advance((uint64_t)us);
+}
+
+uint32_t us_ticker_read(void)
+{
+    // reading the time costs a little time, so that anything polling it still sees time pass
+    if (sim::stats.tickerReads++ == 0) {
+        sim::stats.firstTickerReadUs = sim::now();
+    }
+    sim::advance(1);
+    return (uint32_t)sim::tickerNow();
+}
+
+// the firmware has started up by the time it first sleeps, so whatever it allocates after that is at run time
+static void firstSleep()
+{
+    if (sim::stats.wfi == 0) {
+        sim::stats.heapAllocsAtSleep = sim::stats.heapAllocs;
+        sim::stats.heapBytesAtSleep  = sim::stats.heapBytes;
+    }
+}
+
+void sleep(void)
+{
+    firstSleep();
+    sim::sleepUntilEvent();
+}
+
+void deepsleep(void)
+{
+    firstSleep();
+    sim::deepSleepUntilEvent();
+}
+
+/* rtc_time.h, behaving as mbed's rtc_time.c does */
+
+static time_t (*_rtc_read)(void) = NULL;
+static void (*_rtc_write)(time_t) = NULL;
+static void (*_rtc_init)(void) = NULL;
+static int (*_rtc_isenabled)(void) = NULL;
+
+void attach_rtc(time_t (*read_rtc)(void), void (*write_rtc)(time_t), void (*init_rtc)(void), int (*isenabled_rtc)(void))
+{
+    _rtc_read = read_rtc;
+    _rtc_write = write_rtc;
+    _rtc_init = init_rtc;
+    _rtc_isenabled = isenabled_rtc;
+}
+
+void set_time(time_t t)
+{
+    if (_rtc_init != NULL) {
+        _rtc_init();
+    }
+    if (_rtc_write != NULL) {
+        _rtc_write(t);
+    }
+}
+
+time_t sim_time(time_t *timer)
+{
+    if (_rtc_isenabled != NULL) {
+        if (!(_rtc_isenabled())) {
+            set_time(0);
+        }
+    }
+
+    time_t t = 0;
+    if (_rtc_read != NULL) {
+        t = _rtc_read();
+    }
+    if (timer != NULL) {
+        *timer = t;
+    }
+    return t;
+}
+
+/* SD card files */
+
+struct SdFile {
+    bool   isData;      // the data file, whose rows or records are counted
+    bool   isBinary;    // the data file is the binary log
+    size_t size;        // bytes in the file, for the cluster walk and sector accounting
+    bool   isRead;      // opened to read, so it only sees the file as big as it was when it was opened, as in FatFs
+    long   readSector;  // the sector last read, which the file system still has in its buffer
+};
+static std::map<FILE*, SdFile> s_sdFiles;
+static std::string s_binPending;    // binary log written so far that does not make up a whole block yet
+
+// count the records in each whole block of the binary log, as it is written
+static void countBinary(const unsigned char *p, size_t bytes)
+{
+    s_binPending.append((const char*)p, bytes);
+
+    BinLogRecord records[BINLOG_BLOCK_RECORDS];
+    uint8_t count;
+    uint16_t sequence;
+    for (;;) {
+        int len = binLogDecodeBlock((const unsigned char*)s_binPending.data(), s_binPending.size(), records, &count, &sequence);
+        if (len == 0) {
+            break;
+        }
+        if (len < 0) {
+            // not a valid block, find the next one
+            sim::stats.sdBadBlocks++;
+            s_binPending.erase(0, 1);
+            continue;
+        }
+        sim::stats.sdRows += count;
+        s_binPending.erase(0, len);
+    }
+}
+
+static void sdBusy(uint64_t us)
+{
+    sim::stats.sdBusyUs += us;
+    sim::advance(us);
+}
+
+FILE *sim_fopen(const char *path, const char *mode)
+{
+    if (strncmp(path, "/sd/", 4) != 0) {
+        return fopen(path, mode);
+    }
+
+    std::string dir = sim::envStr("SIM_SD_DIR", "sim_sd");
+    mkdir(dir.c_str(), 0777);
+    std::string hostPath = dir + "/" + (path + 4);
+
+    FILE *fp = fopen(hostPath.c_str(), mode);
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    SdFile f;
+    f.isData = (strstr(path, "data") != NULL);
+    f.isBinary = (strstr(path, ".bin") != NULL);
+    f.isRead = (mode[0] == 'r') && (strchr(mode, '+') == NULL);
+    f.readSector = -1;
+    fseek(fp, 0, SEEK_END);
+    f.size = ftell(fp);
+    if (mode[0] != 'a') {
+        rewind(fp);         // reads start at the beginning
+    }
+    s_sdFiles[fp] = f;
+
+    sim::stats.sdOpens++;
+    sdBusy(SD_OPEN_US + ((mode[0] == 'a') ? (f.size / SD_CLUSTER_BYTES) * SD_CLUSTER_WALK_US : 0));
+    return fp;
+}
+
+int sim_fclose(FILE *fp)
+{
+    if (s_sdFiles.erase(fp)) {
+        sdBusy(SD_CLOSE_US);
+    }
+    return fclose(fp);
+}
+
+// write to a file, accounting for the time the card takes if it is on the SD card
+static size_t sdWrite(const void *ptr, size_t size, size_t count, FILE *fp, bool countRows)
+{
+    size_t written = fwrite(ptr, size, count, fp);
+
+    std::map<FILE*, SdFile>::iterator it = s_sdFiles.find(fp);
+    if (it != s_sdFiles.end()) {
+        size_t bytes = written * size;
+        size_t firstSector = it->second.size / 512;
+        size_t lastSector  = (it->second.size + bytes + 511) / 512;
+        it->second.size += bytes;
+
+        sim::stats.sdBytes += bytes;
+        if (countRows && it->second.isData && it->second.isBinary) {
+            countBinary((const unsigned char*)ptr, bytes);
+        }
+        else if (countRows && it->second.isData) {
+            const char *p = (const char*)ptr;
+            for (size_t i = 0; i < bytes; i++) {
+                if (p[i] == '\n') {
+                    sim::stats.sdRows++;
+                }
+            }
+        }
+        sdBusy((lastSector - firstSector) * SD_SECTOR_US);
+    }
+    return written;
+}
+
+size_t sim_fwrite(const void *ptr, size_t size, size_t count, FILE *fp)
+{
+    return sdWrite(ptr, size, count, fp, true);
+}
+
+size_t sim_fread(void *ptr, size_t size, size_t count, FILE *fp)
+{
+    long pos = ftell(fp);
+    std::map<FILE*, SdFile>::iterator it = s_sdFiles.find(fp);
+    if ((it != s_sdFiles.end()) && it->second.isRead && (pos >= 0) && (size > 0)) {
+        size_t left = ((size_t)pos < it->second.size) ? (it->second.size - (size_t)pos) : 0;
+        if (count > left / size) {
+            count = left / size;
+        }
+    }
+    size_t n = fread(ptr, size, count, fp);
+
+    if ((it != s_sdFiles.end()) && (pos >= 0) && (n > 0)) {
+        // each sector is read from the card once, however many reads it takes
+        long first = pos / 512;
+        long last  = (pos + (long)(n * size) - 1) / 512;
+        long sectors = last - first + ((first == it->second.readSector) ? 0 : 1);
+        it->second.readSector = last;
+        sim::stats.sdReadBytes += n * size;
+        sdBusy(sectors * SD_READ_SECTOR_US);
+    }
+    return n;
+}
+
+int sim_fprintf(FILE *fp, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return len;
+    }
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+
+    // the firmware only uses fprintf for headers and log lines, not data rows
+    return (int)sdWrite(buf, 1, len, fp, false);
+}
+
+int sim_fflush(FILE *fp)
+{
+    if ((fp != NULL) && s_sdFiles.count(fp)) {
+        sdBusy(SD_FLUSH_US);
+    }
+    return fflush(fp);
+}
+
+/* Heap. The Makefile renames operator new and delete in the firmware's objects to these, so only its own are counted */
+
+extern "C" void *sim_fw_new(size_t size)
+{
+    sim::stats.heapAllocs++;
+    sim::stats.heapBytes += size;
+    return ::operator new(size);
+}
+
+extern "C" void *sim_fw_new_array(size_t size)
+{
+    sim::stats.heapAllocs++;
+    sim::stats.heapBytes += size;
+    return ::operator new[](size);
+}
+
+extern "C" void sim_fw_delete(void *p)
+{
+    if (p) {
+        sim::stats.heapFrees++;
+    }
+    ::operator delete(p);
+}
+
+extern "C" void sim_fw_delete_array(void *p)
+{
+    if (p) {
+        sim::stats.heapFrees++;
+    }
+    ::operator delete[](p);
+}
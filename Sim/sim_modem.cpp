@@ -0,0 +1,309 @@
+/*
+ * SIM900 stand-in for the host simulation build: enough of its AT command set to configure it, and send and receive
+ * SMS in text mode.
+ */
+
+#include "mbed.h"
+
+#include <ctype.h>
+#include <map>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODEM_TX_PIN        P1_27   // the firmware's TX to the SIM900
+#define MODEM_MAX_SMS       30      // messages the SIM card holds
+#define MODEM_LINE_MAX      200     // longest command line kept
+
+/*!
+ * The SIM900 echoes what it is sent (until ATE0), and answers each command line SIM_MODEM_REPLY_MS (default 20)
+ * after its "\r". AT+CMGS prompts with "> ", takes the text up to Ctrl-Z, and answers SIM_MODEM_SEND_MS (default
+ * 3000) later, as the network would, failing with +CMS ERROR: 500 SIM_MODEM_SEND_FAIL_PCT percent of the time.
+ * Sent messages are appended to SIM_MODEM_OUT, if set, one per line as
+ * "<seconds> <number> <text>".
+ *
+ * Received messages are scripted with SIM_MODEM_SMS, a file of "<seconds> <number> <text>" lines, each arriving on
+ * the SIM card at that many seconds of virtual time. Once AT+CNMI=2,1 (or any mode above 0) has been sent, each
+ * arrival is also announced with +CMTI.
+ *
+ * Anything it does not understand is answered with ERROR.
+ */
+class Sim900 : public sim::SerialDevice {
+public:
+    Sim900() : m_serial(NULL), m_echo(true), m_cnmi(false), m_textMode(false), m_mr(0), m_loaded(false)
+    {
+        sim::registerSerialDevice(MODEM_TX_PIN, this);
+    }
+
+    void connect(Serial *serial);
+    void fromMcu(char c);
+
+    //! send \a s to the firmware \a delayMs from now
+    void reply(const std::string &s, uint32_t delayMs);
+
+    //! a scripted message has arrived
+    void receive(const std::string &number, const std::string &text);
+
+private:
+    struct Sms {
+        std::string number;
+        std::string text;
+        bool        read;
+    };
+
+    Serial *m_serial;
+    bool m_echo;
+    bool m_cnmi;                    // announce new messages with +CMTI
+    bool m_textMode;                // collecting the text of an AT+CMGS
+    std::string m_line;
+    std::string m_sendTo;           // number of the AT+CMGS in progress
+    std::string m_text;
+    int m_mr;                       // message reference of the last SMS sent
+    std::map<int, Sms> m_inbox;     // by index on the SIM card
+    bool m_loaded;
+
+    void command(const std::string &cmd);
+    void loadScript();
+    static std::string stamp();
+};
+
+static Sim900 s_modem;
+
+/*!
+ * A reply on its way to the firmware, which deletes itself once sent
+ */
+class ModemReply : public sim::Event {
+public:
+    ModemReply(Serial *serial, const std::string &s) : m_serial(serial), m_s(s) {}
+    void fire()
+    {
+        m_serial->deviceSend(m_s.data(), m_s.size());
+        delete this;
+    }
+private:
+    Serial *m_serial;
+    std::string m_s;
+};
+
+/*!
+ * A scripted message, arriving at the SIM card
+ */
+class ModemArrival : public sim::Event {
+public:
+    ModemArrival(const std::string &number, const std::string &text) : m_number(number), m_text(text) {}
+    void fire()
+    {
+        s_modem.receive(m_number, m_text);
+        delete this;
+    }
+private:
+    std::string m_number;
+    std::string m_text;
+};
+
+void Sim900::connect(Serial *serial)
+{
+    m_serial = serial;
+    if (serial) {
+        loadScript();
+    }
+}
+
+void Sim900::reply(const std::string &s, uint32_t delayMs)
+{
+    if (!m_serial) {
+        return;
+    }
+    sim::stats.modemBytesOut += s.size();
+    if (delayMs == 0) {
+        m_serial->deviceSend(s.data(), s.size());
+        return;
+    }
+    sim::schedule(new ModemReply(m_serial, s), sim::now() + (uint64_t)delayMs * 1000);
+}
+
+void Sim900::fromMcu(char c)
+{
+    static const uint32_t replyMs = (uint32_t)sim::envInt("SIM_MODEM_REPLY_MS", 20);
+    static const uint32_t sendMs  = (uint32_t)sim::envInt("SIM_MODEM_SEND_MS", 3000);
+
+    sim::stats.modemBytesIn++;
+
+    if (m_textMode) {
+        if (c == 0x1A) {        // Ctrl-Z sends it
+            static const uint32_t failPct = (uint32_t)sim::envInt("SIM_MODEM_SEND_FAIL_PCT", 0);
+            m_textMode = false;
+            if ((sim::random() % 100) < failPct) {
+                sim::stats.smsFailed++;
+                reply("\r\n+CMS ERROR: 500\r\n", sendMs);
+                return;
+            }
+            sim::stats.smsSent++;
+            m_mr = (m_mr + 1) & 0xFF;
+
+            const char *path = sim::envStr("SIM_MODEM_OUT", NULL);
+            FILE *f = path ? fopen(path, "a") : NULL;
+            if (f) {
+                fprintf(f, "%.0f %s %s\n", sim::now() / 1e6, m_sendTo.c_str(), m_text.c_str());
+                fclose(f);
+            }
+
+            char s[32];
+            snprintf(s, sizeof(s), "\r\n+CMGS: %d\r\n\r\nOK\r\n", m_mr);
+            reply(s, sendMs);
+        }
+        else if (c == 0x1B) {   // Esc abandons it
+            m_textMode = false;
+            reply("\r\nOK\r\n", replyMs);
+        }
+        else {
+            m_text += c;
+            if (m_echo) {
+                reply(std::string(1, c), 0);
+            }
+        }
+        return;
+    }
+
+    if (m_echo) {
+        reply(std::string(1, c), 0);
+    }
+    if (c == '\r') {
+        std::string cmd = m_line;
+        m_line.clear();
+        if (!cmd.empty()) {
+            sim::stats.modemCmds++;
+            command(cmd);
+        }
+    }
+    else if ((c != '\n') && (m_line.size() < MODEM_LINE_MAX)) {
+        m_line += c;
+    }
+}
+
+void Sim900::command(const std::string &line)
+{
+    static const uint32_t replyMs = (uint32_t)sim::envInt("SIM_MODEM_REPLY_MS", 20);
+    const std::string ok = "\r\nOK\r\n";
+
+    std::string cmd = line;
+    for (size_t i = 0; (i < cmd.size()) && (cmd[i] != '"'); i++) {
+        cmd[i] = toupper((unsigned char)cmd[i]);
+    }
+
+    if ((cmd == "AT") || (cmd == "AT+CMGF=1")) {
+        reply(ok, replyMs);
+    }
+    else if ((cmd == "ATE0") || (cmd == "ATE1")) {
+        m_echo = (cmd == "ATE1");
+        reply(ok, replyMs);
+    }
+    else if (cmd.compare(0, 8, "AT+CNMI=") == 0) {
+        m_cnmi = (atoi(cmd.c_str() + 8) > 0);
+        reply(ok, replyMs);
+    }
+    else if (cmd == "AT+CSQ") {
+        reply("\r\n+CSQ: 20,0\r\n" + ok, replyMs);
+    }
+    else if (cmd.compare(0, 8, "AT+CMGL=") == 0) {
+        bool unreadOnly = (cmd.find("REC UNREAD") != std::string::npos);
+        std::string s;
+        for (std::map<int, Sms>::iterator it = m_inbox.begin(); it != m_inbox.end(); ++it) {
+            if (unreadOnly && it->second.read) {
+                continue;
+            }
+            char head[120];
+            snprintf(head, sizeof(head), "\r\n+CMGL: %d,\"%s\",\"%s\",\"\",\"%s\"\r\n", it->first,
+                     it->second.read ? "REC READ" : "REC UNREAD", it->second.number.c_str(), stamp().c_str());
+            s += head + it->second.text;
+            it->second.read = true;
+        }
+        reply(s + "\r\n" + ok, replyMs);
+    }
+    else if (cmd.compare(0, 8, "AT+CMGR=") == 0) {
+        std::map<int, Sms>::iterator it = m_inbox.find(atoi(cmd.c_str() + 8));
+        std::string s;
+        if (it != m_inbox.end()) {
+            char head[120];
+            snprintf(head, sizeof(head), "\r\n+CMGR: \"%s\",\"%s\",\"\",\"%s\"\r\n",
+                     it->second.read ? "REC READ" : "REC UNREAD", it->second.number.c_str(), stamp().c_str());
+            s = head + it->second.text + "\r\n";
+            it->second.read = true;
+        }
+        reply(s + ok, replyMs);     // an empty slot is just OK
+    }
+    else if (cmd.compare(0, 8, "AT+CMGD=") == 0) {
+        m_inbox.erase(atoi(cmd.c_str() + 8));
+        reply(ok, replyMs);
+    }
+    else if ((cmd.compare(0, 9, "AT+CMGS=\"") == 0) && (cmd[cmd.size() - 1] == '"')) {
+        m_sendTo   = cmd.substr(9, cmd.size() - 10);
+        m_text.clear();
+        m_textMode = true;
+        reply("\r\n> ", replyMs);
+    }
+    else {
+        reply("\r\nERROR\r\n", replyMs);
+    }
+}
+
+void Sim900::receive(const std::string &number, const std::string &text)
+{
+    sim::stats.smsReceived++;
+
+    int index = 1;
+    while (m_inbox.count(index)) {
+        index++;
+    }
+    if (index > MODEM_MAX_SMS) {
+        return;                 // the SIM card is full, so it is lost
+    }
+    Sms sms = { number, text, false };
+    m_inbox[index] = sms;
+
+    if (m_cnmi) {
+        char s[32];
+        snprintf(s, sizeof(s), "\r\n+CMTI: \"SM\",%d\r\n", index);
+        reply(s, 0);
+    }
+}
+
+void Sim900::loadScript()
+{
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+
+    const char *path = sim::envStr("SIM_MODEM_SMS", NULL);
+    if (!path) {
+        return;
+    }
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "sim: cannot open SIM_MODEM_SMS %s\n", path);
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char number[32];
+        int  n = 0;
+        double seconds;
+        if ((line[0] == '#') || (sscanf(line, "%lf %31s %n", &seconds, number, &n) < 2) || (n == 0)) {
+            continue;
+        }
+        sim::schedule(new ModemArrival(number, line + n), (uint64_t)(seconds * 1e6));
+    }
+    fclose(f);
+}
+
+std::string Sim900::stamp()
+{
+    // the network's time stamp, from the RTC
+    time_t t = time(NULL);
+    struct tm *tm = gmtime(&t);
+    char s[24];
+    strftime(s, sizeof(s), "%y/%m/%d,%H:%M:%S+00", tm);
+    return s;
+}
@@ -0,0 +1,253 @@
+/*
+ * alertrules writes the alert rule table that MeasurementHandler reads from /sd/alerts.bin, and reads it back.
+ *
+ *   alertrules rules.txt alerts.bin     write the table from a list of rules
+ *   alertrules -d alerts.bin            print the rules in a table
+ *   alertrules -b                       time AlertEngine::evaluate for 1 to 64 rules
+ *
+ * Each line of rules.txt is a rule, and anything after a '#' is a comment:
+ *
+ *   <sensor> <quantity> above|below|rise|fall <level> [hyst=<h>] [window=<s>] [for=<s>] [quiet=<min>] [clear]
+ *
+ * The quantity is temperature, humidity or dewpoint, or the index of the value in the sensor's readings. The level
+ * and hysteresis are in units, e.g. 80 or 2.5, and for rise and fall are the change over the window, which is
+ * needed for them. "for" is how long the condition has to hold before the alert is raised, "quiet" is how long after
+ * one alert the rule raises no other, and "clear" reports the alert clearing as well. See alerts.h.
+ *
+ * Build with "make -C Sim alertrules".
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alerts.h"
+#include "config.h"
+
+static const char *s_types[] = { "", "above", "below", "rise", "fall" };
+static const char *s_quantities[] = { "temperature", "humidity", "dewpoint" };
+
+class CountingSink : public AlertSink
+{
+public:
+    CountingSink() : events(0) {}
+    void alert(const AlertEvent &event) { events++; }
+    unsigned long events;
+};
+
+static bool parseCenti(const char *s, int32_t *centi)
+{
+    char *end;
+    double v = strtod(s, &end);
+    *centi = (int32_t)floor(v * 100.0 + 0.5);
+    return (*end == 0) && (end != s);
+}
+
+static bool parseRule(char *line, AlertRule *rule)
+{
+    memset(rule, 0, sizeof(*rule));
+    char *tok[16];
+    int n = 0;
+    for (char *t = strtok(line, " \t\r\n"); t && (n < 16); t = strtok(NULL, " \t\r\n")) {
+        tok[n++] = t;
+    }
+    if (n < 4) {
+        return false;
+    }
+
+    rule->sensor = (uint8_t)atoi(tok[0]);
+    rule->quantity = 0xFF;
+    for (uint8_t q = 0; q < 3; q++) {
+        if (strcmp(tok[1], s_quantities[q]) == 0) {
+            rule->quantity = q;
+        }
+    }
+    if (rule->quantity == 0xFF) {
+        rule->quantity = (uint8_t)atoi(tok[1]);
+    }
+    for (uint8_t t = alert_Above; t <= alert_Fall; t++) {
+        if (strcmp(tok[2], s_types[t]) == 0) {
+            rule->type = t;
+        }
+    }
+    int32_t centi;
+    if ((rule->type == 0) || !parseCenti(tok[3], &centi) || (centi < -32768) || (centi > 32767)) {
+        return false;
+    }
+    rule->level = (int16_t)centi;
+
+    for (int i = 4; i < n; i++) {
+        if (strncmp(tok[i], "hyst=", 5) == 0) {
+            if (!parseCenti(tok[i] + 5, &centi) || (centi < 0) || (centi > 65535)) {
+                return false;
+            }
+            rule->hysteresis = (uint16_t)centi;
+        }
+        else if (strncmp(tok[i], "window=", 7) == 0) {
+            rule->window = (uint16_t)atoi(tok[i] + 7);
+        }
+        else if (strncmp(tok[i], "for=", 4) == 0) {
+            rule->sustain = (uint16_t)atoi(tok[i] + 4);
+        }
+        else if (strncmp(tok[i], "quiet=", 6) == 0) {
+            rule->quiet = (uint16_t)atoi(tok[i] + 6);
+        }
+        else if (strcmp(tok[i], "clear") == 0) {
+            rule->type |= ALERT_FLAG_CLEAR;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int writeTable(const char *in, const char *out)
+{
+    FILE *fp = fopen(in, "r");
+    if (fp == NULL) {
+        perror(in);
+        return 1;
+    }
+    AlertRule rules[ALERT_MAX_RULES];
+    uint8_t count = 0;
+    char line[256];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineNo++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        if (count == ALERT_MAX_RULES) {
+            fprintf(stderr, "%s:%d: more than %u rules\n", in, lineNo, ALERT_MAX_RULES);
+            return 1;
+        }
+        if (!parseRule(line, &rules[count])) {
+            fprintf(stderr, "%s:%d: not a rule\n", in, lineNo);
+            return 1;
+        }
+        count++;
+    }
+    fclose(fp);
+
+    unsigned char table[ALERT_HEADER_LEN + (ALERT_MAX_RULES * ALERT_RULE_LEN) + 2];
+    uint16_t len = AlertEngineBase::encode(rules, count, table);
+    AlertEngine<ALERT_MAX_RULES> check;
+    if (!check.load(table, len)) {
+        fprintf(stderr, "%s: a rise or fall rule needs a window of at least %u s, and a quantity under %u\n",
+                in, ALERT_WINDOW_BUCKETS, SENSOR_MAX_VALUES);
+        return 1;
+    }
+
+    fp = fopen(out, "wb");
+    if ((fp == NULL) || (fwrite(table, 1, len, fp) != len) || (fclose(fp) != 0)) {
+        perror(out);
+        return 1;
+    }
+    fprintf(stderr, "alertrules: %u rules, %u bytes\n", count, len);
+    if (count > ALERT_RULE_SLOTS) {
+        fprintf(stderr, "alertrules: the firmware has room for %u rules, and will not load more\n", ALERT_RULE_SLOTS);
+    }
+    return 0;
+}
+
+static int dumpTable(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return 1;
+    }
+    unsigned char table[ALERT_HEADER_LEN + (ALERT_MAX_RULES * ALERT_RULE_LEN) + 2];
+    size_t len = fread(table, 1, sizeof(table), fp);
+    fclose(fp);
+
+    AlertEngine<ALERT_MAX_RULES> engine;
+    if (!engine.load(table, (uint16_t)len)) {
+        fprintf(stderr, "%s: not a valid rule table\n", path);
+        return 1;
+    }
+    for (uint8_t i = 0; i < engine.count(); i++) {
+        const AlertRule &r = engine.rule(i);
+        printf("%u %s %s %.2f hyst=%.2f window=%u for=%u quiet=%u%s\n", r.sensor,
+               (r.quantity < 3) ? s_quantities[r.quantity] : "?", s_types[r.type & ALERT_TYPE_MASK],
+               r.level / 100.0, r.hysteresis / 100.0, r.window, r.sustain, r.quiet,
+               (r.type & ALERT_FLAG_CLEAR) ? " clear" : "");
+    }
+    return 0;
+}
+
+static int benchmark()
+{
+    // a day and a half of readings every 3 s, wandering about enough to raise and clear the alerts now and then
+    const unsigned long samples = 1000000;
+    Measurement *m = new Measurement[samples];
+    srand(1);
+    int32_t h = 6500, t = 2000;
+    for (unsigned long i = 0; i < samples; i++) {
+        h += (rand() % 41) - 20;
+        t += (rand() % 21) - 10;
+        h = (h < 3000) ? 3000 : ((h > 9900) ? 9900 : h);
+        t = (t < 0) ? 0 : ((t > 4000) ? 4000 : t);
+        m[i].time = 1460246400 + (time_t)(i * 3);
+        m[i].sensor = 0;
+        m[i].kind = sensor_Dht22;
+        m[i].value[0] = (int16_t)t;
+        m[i].value[1] = (int16_t)h;
+        m[i].value[2] = (int16_t)(t - 500);
+    }
+
+    printf("rules  ns/reading  ns/rule  alerts\n");
+    for (uint8_t n = 1; n <= ALERT_MAX_RULES; n *= 2) {
+        // a mix of all four kinds, on all three quantities
+        AlertRule rules[ALERT_MAX_RULES];
+        for (uint8_t i = 0; i < n; i++) {
+            AlertRule &r = rules[i];
+            r.type       = (uint8_t)((i % 4) + alert_Above) | ALERT_FLAG_CLEAR;
+            r.sensor     = 0;
+            r.quantity   = i % 3;
+            r.level      = (r.type & ALERT_TYPE_MASK) == alert_Above ? 7000 + (i * 50) :
+                           (r.type & ALERT_TYPE_MASK) == alert_Below ? 2000 - (i * 50) : 300 + (i * 10);
+            r.hysteresis = 200;
+            r.window     = 600;
+            r.sustain    = 60;
+            r.quiet      = 30;
+        }
+        unsigned char table[ALERT_HEADER_LEN + (ALERT_MAX_RULES * ALERT_RULE_LEN) + 2];
+        AlertEngine<ALERT_MAX_RULES> engine;
+        engine.load(table, AlertEngineBase::encode(rules, n, table));
+        CountingSink sink;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (unsigned long i = 0; i < samples; i++) {
+            engine.evaluate(m[i], &sink);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / samples;
+        printf("%5u  %10.1f  %7.2f  %6lu\n", n, ns, ns / n, sink.events);
+    }
+    delete [] m;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc == 2) && (strcmp(argv[1], "-b") == 0)) {
+        return benchmark();
+    }
+    if ((argc == 3) && (strcmp(argv[1], "-d") == 0)) {
+        return dumpTable(argv[2]);
+    }
+    if ((argc == 3) && (argv[1][0] != '-')) {
+        return writeTable(argv[1], argv[2]);
+    }
+    fprintf(stderr, "usage: %s rules.txt alerts.bin | -d alerts.bin | -b\n", argv[0]);
+    return 2;
+}
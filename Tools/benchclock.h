@@ -0,0 +1,35 @@
+/*
+ * benchclock.h is the clock the host benchmarks in this directory time themselves with.
+ *
+ * bench_ns is wall time. bench_cycles is the x86 time stamp counter, which runs at a fixed rate near the CPU's
+ * clock, so figures per cycle can be compared between runs and builds on one host. It is 0 on other hosts, and the
+ * benchmarks then leave the per cycle figures out. Neither says what the Cortex-M0 would take, only how a change
+ * moves the cost.
+ */
+
+#ifndef __BENCHCLOCK_H__
+#define __BENCHCLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline double bench_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec * 1e9) + t.tv_nsec;
+}
+
+static inline uint64_t bench_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#endif // __BENCHCLOCK_H__
@@ -0,0 +1,101 @@
+/*
+ * binlog2csv turns the binary data log (data.bin, written with SD_BINARY_LOG) back into the same CSV layout that
+ * SdHandler writes to data.csv.
+ *
+ *   binlog2csv data.bin [data.csv]
+ *
+ * The CSV goes to standard output if no output file is given. Invalid bytes are skipped until the next valid block,
+ * and gaps in the block sequence numbers are reported, both on standard error.
+ *
+ * Build with "make -C Sim binlog2csv".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "binlog.h"
+
+int main(int argc, char *argv[])
+{
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "usage: %s data.bin [data.csv]\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    std::vector<unsigned char> data;
+    unsigned char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(in);
+
+    FILE *out = (argc == 3) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    fprintf(out, "Timestamp, Temperature (degC), Humidity (pc), Dewpoint\n");
+
+    unsigned long blocks = 0, records = 0, skipped = 0, lostBlocks = 0;
+    bool haveSequence = false;
+    uint16_t expected = 0;
+
+    size_t pos = 0;
+    while (pos < data.size()) {
+        BinLogRecord rec[BINLOG_BLOCK_RECORDS];
+        uint8_t count;
+        uint16_t sequence;
+        int len = binLogDecodeBlock(&data[pos], data.size() - pos, rec, &count, &sequence);
+        if (len <= 0) {
+            // not a block, or a block cut short at the end of the file
+            skipped++;
+            pos++;
+            continue;
+        }
+
+        if (haveSequence && (sequence != expected)) {
+            lostBlocks += (uint16_t)(sequence - expected);
+            fprintf(stderr, "binlog2csv: blocks %u to %u missing before offset %lu\n",
+                    expected, (uint16_t)(sequence - 1), (unsigned long)pos);
+        }
+        haveSequence = true;
+        expected = sequence + 1;
+
+        for (uint8_t i = 0; i < count; i++) {
+            time_t t = (time_t)rec[i].time;
+            struct tm *timeinfo = gmtime(&t);   // the target's localtime() is UTC
+            fprintf(out, "%04d%02d%02d %02d%02d%02d,%4.2f,%4.2f,%4.2f,",
+                    (timeinfo->tm_year + 1900),
+                    (timeinfo->tm_mon + 1),
+                    timeinfo->tm_mday,
+                    timeinfo->tm_hour,
+                    timeinfo->tm_min,
+                    timeinfo->tm_sec,
+                    rec[i].centiCelcius / 100.0,
+                    rec[i].centiHumidity / 100.0,
+                    rec[i].centiDewpoint / 100.0);
+            if (rec[i].sensor != 0) {
+                fprintf(out, "%u", rec[i].sensor);
+            }
+            fprintf(out, "\n");
+        }
+        blocks++;
+        records += count;
+        pos += len;
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "binlog2csv: %lu records in %lu blocks, %lu blocks missing, %lu bytes skipped\n",
+            records, blocks, lostBlocks, skipped);
+    return 0;
+}
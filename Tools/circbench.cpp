@@ -0,0 +1,226 @@
+/*
+ * circbench times CircBuff against the ring it replaced, which moved a byte at a time, on the ways the firmware
+ * uses it, and prints the throughput of each in MB/s and bytes per cycle (see benchclock.h).
+ *
+ *   message     add() a NUL terminated line, then read() it out, as UsbComms and SdHandler do
+ *   byte        putc() a byte at a time, then read() in blocks, as the UART receive interrupt does
+ *   bulk        write() and read() in blocks, which the old ring did not have, so only the new one is timed
+ *
+ * Every test pushes the same data through a 256 byte ring, in messages of 16, 48 and 128 bytes.
+ *
+ * Build with "make -C Sim circbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "circbuff.h"
+#include "benchclock.h"
+
+#define BENCH_RING      256u
+#define BENCH_BYTES     (64ul * 1024ul * 1024ul)    // pushed through each test
+
+// the old ring's functions were in circbuff.cpp, so were called rather than inlined, as the new ones are
+#define OLD_CALL __attribute__((noinline))
+
+/*
+ * OldCircBuff is the ring as it was, kept here to be timed against
+ */
+class OldCircBuff {
+public:
+    OldCircBuff(uint16_t buffSize = 256)
+    {
+        m_buffSize = buffSize;
+        m_buf = new unsigned char [m_buffSize];
+        memset(m_buf, 0, m_buffSize);
+        m_start = 0;
+        m_end   = 0;
+    }
+    ~OldCircBuff() { delete [] m_buf; }
+
+    OLD_CALL void putc(unsigned char c)
+    {
+        if (remainingSize() == 0) {
+            return;
+        }
+        m_buf[m_end++] = c;
+        if (m_end == m_buffSize) {
+            m_end = 0;
+        }
+    }
+
+    OLD_CALL void add(const unsigned char *s)
+    {
+        uint16_t sSize = 0, i = 0;
+        for (sSize = 0; (sSize < m_buffSize) && (s[sSize] != 0); sSize++);
+        if (sSize > remainingSize()) {
+            return;
+        }
+        for (i = 0; i < sSize; i++) {
+            m_buf[m_end++] = s[i];
+            if (m_end == m_buffSize) {
+                m_end = 0;
+            }
+        }
+    }
+
+    // as before, this writes a NUL one past what it copies, so s has to have room for len + 1
+    OLD_CALL uint16_t read(unsigned char *s, uint16_t len)
+    {
+        if (m_start == m_end) {
+            return 0;
+        }
+        for (int i = 0; i < len; i++) {
+            s[i] = m_buf[m_start++];
+            if (m_start == m_buffSize) {
+                m_start = 0;
+            }
+            if (m_start == m_end) {
+                s[++i] = 0;
+                return (i);
+            }
+        }
+        return len;
+    }
+
+private:
+    uint16_t m_start;
+    uint16_t m_end;
+    unsigned char *m_buf;
+    uint16_t m_buffSize;
+
+    uint16_t remainingSize()
+    {
+        if (m_start == m_end) {
+            return m_buffSize;
+        }
+        else if (m_start < m_end) {
+            return m_buffSize - (m_end - m_start);
+        }
+        return m_start - m_end;
+    }
+};
+
+struct Result {
+    double   ns;
+    uint64_t cycles;
+    uint32_t sum;       // of the bytes read out, so the copies are not optimised away, and to check the rings agree
+};
+
+static unsigned char s_msg[BENCH_RING];
+static unsigned char s_out[BENCH_RING + 1];
+
+template <class Ring>
+static Result messages(Ring &ring, uint16_t len)
+{
+    Result r;
+    r.sum = 0;
+    s_msg[len] = 0;
+    unsigned long n = BENCH_BYTES / len;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (unsigned long i = 0; i < n; i++) {
+        ring.add(s_msg);
+        uint16_t got = ring.read(s_out, len);
+        r.sum += s_out[got - 1];
+    }
+    r.cycles = bench_cycles() - cycles;
+    r.ns = bench_ns() - ns;
+    return r;
+}
+
+template <class Ring>
+static Result bytes(Ring &ring, uint16_t len)
+{
+    Result r;
+    r.sum = 0;
+    unsigned long n = BENCH_BYTES / len;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (unsigned long i = 0; i < n; i++) {
+        for (uint16_t j = 0; j < len; j++) {
+            ring.putc(s_msg[j]);
+        }
+        uint16_t got = ring.read(s_out, len);
+        r.sum += s_out[got - 1];
+    }
+    r.cycles = bench_cycles() - cycles;
+    r.ns = bench_ns() - ns;
+    return r;
+}
+
+static Result bulk(CircBuff<BENCH_RING> &ring, uint16_t len)
+{
+    Result r;
+    r.sum = 0;
+    unsigned long n = BENCH_BYTES / len;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (unsigned long i = 0; i < n; i++) {
+        ring.write(s_msg, len);
+        uint16_t got = ring.read(s_out, len);
+        r.sum += s_out[got - 1];
+    }
+    r.cycles = bench_cycles() - cycles;
+    r.ns = bench_ns() - ns;
+    return r;
+}
+
+static void print(const char *test, uint16_t len, const Result *old, const Result &now)
+{
+    unsigned long total = (BENCH_BYTES / len) * len;
+    printf("%-8s %5u", test, (unsigned int)len);
+    if (old) {
+        printf("  %8.1f", total * 1e3 / old->ns);
+        if (old->cycles) {
+            printf("  %8.3f", (double)total / old->cycles);
+        }
+        else {
+            printf("  %8s", "-");
+        }
+    }
+    else {
+        printf("  %8s  %8s", "-", "-");
+    }
+    printf("  %8.1f", total * 1e3 / now.ns);
+    if (now.cycles) {
+        printf("  %8.3f", (double)total / now.cycles);
+    }
+    else {
+        printf("  %8s", "-");
+    }
+    if (old) {
+        printf("  %6.1fx%s", old->ns / now.ns, (old->sum == now.sum) ? "" : "  (rings disagree)");
+    }
+    printf("\n");
+}
+
+int main()
+{
+    for (unsigned int i = 0; i < sizeof(s_msg); i++) {
+        s_msg[i] = (unsigned char)('a' + (i % 26));
+    }
+
+    static const uint16_t lens[] = { 16, 48, 128 };
+    printf("test       len  old MB/s  old B/cyc  new MB/s  new B/cyc  speedup\n");
+    for (unsigned int i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        OldCircBuff old(BENCH_RING);
+        CircBuff<BENCH_RING> now;
+        Result o = messages(old, lens[i]);
+        Result n = messages(now, lens[i]);
+        print("message", lens[i], &o, n);
+    }
+    for (unsigned int i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        OldCircBuff old(BENCH_RING);
+        CircBuff<BENCH_RING> now;
+        Result o = bytes(old, lens[i]);
+        Result n = bytes(now, lens[i]);
+        print("byte", lens[i], &o, n);
+    }
+    for (unsigned int i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        CircBuff<BENCH_RING> now;
+        print("bulk", lens[i], NULL, bulk(now, lens[i]));
+    }
+    return 0;
+}
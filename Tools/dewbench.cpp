@@ -0,0 +1,183 @@
+/*
+ * dewbench checks the integer lnQ16 and dewpointCenti in fixedpoint.cpp against the floating point they replaced,
+ * and times them, on the host.
+ *
+ *   ln          lnQ16 against log(), for every centi humidity (1 to 10000) and a sweep of the rest of 32 bits
+ *   dewpoint    dewpointCenti against the same Magnus formula in float, and against the DHT library's CalcdewPoint
+ *               (the NOAA formula), which the firmware called before, over -40 to 80 degC and 1 to 100 pc in 0.1 steps.
+ *               Against CalcdewPoint it is also given for 0 to 50 degC and 20 to 100 pc, where the two formulas agree
+ *   time        each dewpoint over the same grid, in ns and cycles a call (see benchclock.h). The host has an FPU, so
+ *               this flatters the float paths, which the M0 does in software
+ *
+ * Build with "make -C Sim dewbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "fixedpoint.h"
+#include "benchclock.h"
+
+#define GRID_MIN_CELCIUS    -4000   // in hundredths
+#define GRID_MAX_CELCIUS    8000
+#define GRID_MIN_HUMIDITY   100
+#define GRID_MAX_HUMIDITY   10000
+#define GRID_STEP           10      // 0.1 of a unit
+#define TIME_PASSES         10      // over the grid, for each dewpoint timed
+
+// the float paths were called from other files, so are not inlined into the timing loops here either
+#define FLOAT_CALL __attribute__((noinline))
+
+// the Magnus formula with the constants dewpointCenti uses, in float as the M0 would have done it in software
+FLOAT_CALL static float magnusDewpoint(float celcius, float humidity)
+{
+    const float b = 17.62f, c = 243.12f;
+    float gamma = logf(humidity / 100.0f) + ((b * celcius) / (c + celcius));
+    return (c * gamma) / (b - gamma);
+}
+
+// CalcdewPoint as the DHT library has it
+FLOAT_CALL static float calcDewPoint(float celsius, float humidity)
+{
+    float A0 = 373.15f / (273.15f + celsius);
+    float SUM = -7.90298f * (A0 - 1);
+    SUM += 5.02808f * log10f(A0);
+    SUM += -1.3816e-7f * (powf(10, (11.344f * (1 - 1 / A0))) - 1);
+    SUM += 8.1328e-3f * (powf(10, (-3.49149f * (A0 - 1))) - 1);
+    SUM += log10f(1013.246f);
+    float VP = powf(10, SUM - 3) * humidity;
+    float T = logf(VP / 0.61078f);
+    return (241.88f * T) / (17.558f - T);
+}
+
+static void checkLn()
+{
+    double worst = 0;
+    uint32_t worstX = 1;
+    for (uint32_t x = 1; x <= GRID_MAX_HUMIDITY; x++) {
+        double e = fabs((lnQ16(x) / 65536.0) - log((double)x));
+        if (e > worst) {
+            worst  = e;
+            worstX = x;
+        }
+    }
+    for (uint64_t x = GRID_MAX_HUMIDITY; x <= 0xFFFFFFFFull; x += 1 + (x / 1024)) {
+        double e = fabs((lnQ16((uint32_t)x) / 65536.0) - log((double)x));
+        if (e > worst) {
+            worst  = e;
+            worstX = (uint32_t)x;
+        }
+    }
+    printf("ln        %-32s  max error %.6f (at %lu)\n", "lnQ16 against log()", worst, (unsigned long)worstX);
+}
+
+/*
+ * Error is the difference of dewpointCenti from a float dewpoint, over part of the grid
+ */
+struct Error {
+    double   max;
+    double   sum;
+    uint32_t n;
+    int16_t  maxCelcius;     ///< where the max was, in hundredths
+    int16_t  maxHumidity;
+};
+
+static void addError(Error *err, double e, int16_t celcius, int16_t humidity)
+{
+    e = fabs(e);
+    if (e > err->max) {
+        err->max = e;
+        err->maxCelcius  = celcius;
+        err->maxHumidity = humidity;
+    }
+    err->sum += e;
+    err->n++;
+}
+
+static void printError(const char *against, const Error &err)
+{
+    printf("dewpoint  %-32s  max %.3f degC (at " CENTI_FMT " degC " CENTI_FMT " pc), mean %.4f degC\n", against,
+           err.max, CENTI_ARGS(err.maxCelcius), CENTI_ARGS(err.maxHumidity), err.sum / err.n);
+}
+
+static void checkDewpoint()
+{
+    Error magnus = { 0, 0, 0, 0, 0 }, noaa = { 0, 0, 0, 0, 0 }, noaaMid = { 0, 0, 0, 0, 0 };
+    for (int t = GRID_MIN_CELCIUS; t <= GRID_MAX_CELCIUS; t += GRID_STEP) {
+        for (int h = GRID_MIN_HUMIDITY; h <= GRID_MAX_HUMIDITY; h += GRID_STEP) {
+            double fixed = dewpointCenti((int16_t)t, (int16_t)h) / 100.0;
+            addError(&magnus, fixed - magnusDewpoint(t / 100.0f, h / 100.0f), (int16_t)t, (int16_t)h);
+            double e = fixed - calcDewPoint(t / 100.0f, h / 100.0f);
+            addError(&noaa, e, (int16_t)t, (int16_t)h);
+            if ((t >= 0) && (t <= 5000) && (h >= 2000)) {
+                addError(&noaaMid, e, (int16_t)t, (int16_t)h);
+            }
+        }
+    }
+    printError("against float Magnus", magnus);
+    printError("against CalcdewPoint", noaa);
+    printError("against it, 0-50 degC 20-100 pc", noaaMid);
+}
+
+static void printTime(const char *name, double ns, uint64_t cycles, uint32_t calls)
+{
+    printf("time      %-32s  %8.1f ns", name, ns / calls);
+    if (cycles) {
+        printf("  %8.1f cycles", (double)cycles / calls);
+    }
+    printf("\n");
+}
+
+static void timeDewpoints()
+{
+    uint32_t calls = 0;
+    int32_t fixedSum = 0;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (int pass = 0; pass < TIME_PASSES; pass++) {
+        for (int t = GRID_MIN_CELCIUS; t <= GRID_MAX_CELCIUS; t += GRID_STEP) {
+            for (int h = GRID_MIN_HUMIDITY; h <= GRID_MAX_HUMIDITY; h += GRID_STEP) {
+                fixedSum += dewpointCenti((int16_t)t, (int16_t)h);
+                calls++;
+            }
+        }
+    }
+    printTime("dewpointCenti", bench_ns() - ns, bench_cycles() - cycles, calls);
+
+    float floatSum = 0;
+    ns = bench_ns();
+    cycles = bench_cycles();
+    for (int pass = 0; pass < TIME_PASSES; pass++) {
+        for (int t = GRID_MIN_CELCIUS; t <= GRID_MAX_CELCIUS; t += GRID_STEP) {
+            for (int h = GRID_MIN_HUMIDITY; h <= GRID_MAX_HUMIDITY; h += GRID_STEP) {
+                floatSum += magnusDewpoint(t / 100.0f, h / 100.0f);
+            }
+        }
+    }
+    printTime("float Magnus", bench_ns() - ns, bench_cycles() - cycles, calls);
+
+    ns = bench_ns();
+    cycles = bench_cycles();
+    for (int pass = 0; pass < TIME_PASSES; pass++) {
+        for (int t = GRID_MIN_CELCIUS; t <= GRID_MAX_CELCIUS; t += GRID_STEP) {
+            for (int h = GRID_MIN_HUMIDITY; h <= GRID_MAX_HUMIDITY; h += GRID_STEP) {
+                floatSum += calcDewPoint(t / 100.0f, h / 100.0f);
+            }
+        }
+    }
+    printTime("CalcdewPoint", bench_ns() - ns, bench_cycles() - cycles, calls);
+
+    // so the sums are used, and the calls not optimised away
+    if ((fixedSum == 1) && (floatSum == 1)) {
+        printf("\n");
+    }
+}
+
+int main()
+{
+    checkLn();
+    checkDewpoint();
+    timeDewpoints();
+    return 0;
+}
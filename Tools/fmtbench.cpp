@@ -0,0 +1,171 @@
+/*
+ * fmtbench checks TimestampFormatter and fmtCenti in formatter.cpp against the localtime() and sprintf() they replaced,
+ * and times a line of each, on the host.
+ *
+ *   check       every fmtCenti value against "%4.2f", and a timestamp every 7 s over 800 days against localtime()
+ *   csv         a data.csv line, "YYYYMMDD HHMMSS,t,h,d,", as SdHandler writes it, with localtime() and snprintf(), and
+ *               with the formatters
+ *   usb         the "YYYYMMDD HHMMSS:" stamp UsbComms puts before each message, with localtime() and sprintf(), and
+ *               with TimestampFormatter
+ *
+ * The lines are timed a sample period apart, so the formatter redoes its date once a day, as it would on the target.
+ * The figures are in ns and cycles a line (see benchclock.h). TZ is set to UTC, as the target has no time zone.
+ *
+ * Build with "make -C Sim fmtbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "formatter.h"
+#include "fixedpoint.h"
+#include "benchclock.h"
+
+#define BENCH_LINES     2000000ul   // timed for each way of writing a line
+#define BENCH_PERIOD_S  10          // between the lines' times, as SENSOR_PERIOD_MS
+#define BENCH_VALUES    1024u       // measurements cycled through by the timed lines
+#define CHECK_PERIOD_S  7           // between the checked timestamps
+#define CHECK_DAYS      800u
+#define START_TIME      1500000000  // seconds since 1970
+#define LINE_MAX        64u
+
+// the old lines were written in other files, so are not inlined into the timing loops here either
+#define OLD_CALL __attribute__((noinline))
+
+static int16_t s_values[BENCH_VALUES][3];
+
+static void checkCenti()
+{
+    char mine[FMT_CENTI_MAX + 1], theirs[32];
+    for (int32_t v = -32768; v <= 32767; v++) {
+        *fmtCenti(mine, (int16_t)v) = 0;
+        snprintf(theirs, sizeof(theirs), "%4.2f", v / 100.0);
+        if (strcmp(mine, theirs) != 0) {
+            printf("check    fmtCenti(%ld) is \"%s\", %%4.2f is \"%s\"\n", (long)v, mine, theirs);
+            exit(1);
+        }
+    }
+    printf("check    fmtCenti matches %%4.2f for all 65536 values\n");
+}
+
+static void checkTimestamps()
+{
+    TimestampFormatter stamp;
+    char mine[FMT_TIMESTAMP_LEN + 1], theirs[32];
+    unsigned long n = 0;
+    for (time_t t = START_TIME; t < START_TIME + (time_t)(CHECK_DAYS * 86400u); t += CHECK_PERIOD_S) {
+        *stamp.format(mine, t) = 0;
+        struct tm *timeinfo = localtime(&t);
+        snprintf(theirs, sizeof(theirs), "%04d%02d%02d %02d%02d%02d", (timeinfo->tm_year + 1900),
+                 (timeinfo->tm_mon + 1), timeinfo->tm_mday, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+        if (strcmp(mine, theirs) != 0) {
+            printf("check    %ld is \"%s\", localtime() is \"%s\"\n", (long)t, mine, theirs);
+            exit(1);
+        }
+        n++;
+    }
+    printf("check    %lu timestamps, %d s apart over %u days, match localtime()\n", n, CHECK_PERIOD_S, CHECK_DAYS);
+}
+
+OLD_CALL static int oldCsvLine(char *line, time_t t, const int16_t *v)
+{
+    struct tm *timeinfo = localtime(&t);
+    return snprintf(line, LINE_MAX, "%04d%02d%02d %02d%02d%02d," CENTI_FMT "," CENTI_FMT "," CENTI_FMT ",\n",
+                    (timeinfo->tm_year + 1900), (timeinfo->tm_mon + 1), timeinfo->tm_mday, timeinfo->tm_hour,
+                    timeinfo->tm_min, timeinfo->tm_sec, CENTI_ARGS(v[0]), CENTI_ARGS(v[1]), CENTI_ARGS(v[2]));
+}
+
+static int newCsvLine(TimestampFormatter *stamp, char *line, time_t t, const int16_t *v)
+{
+    char *p = stamp->format(line, t);
+    *p++ = ',';
+    p = fmtCenti(p, v[0]);
+    *p++ = ',';
+    p = fmtCenti(p, v[1]);
+    *p++ = ',';
+    p = fmtCenti(p, v[2]);
+    *p++ = ',';
+    *p++ = '\n';
+    return p - line;
+}
+
+OLD_CALL static int oldUsbStamp(char *line, time_t t)
+{
+    struct tm *timeinfo = localtime(&t);
+    return sprintf(line, "%04d%02d%02d %02d%02d%02d:", (timeinfo->tm_year + 1900), (timeinfo->tm_mon + 1),
+                   timeinfo->tm_mday, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+}
+
+static int newUsbStamp(TimestampFormatter *stamp, char *line, time_t t)
+{
+    char *p = stamp->format(line, t);
+    *p++ = ':';
+    return p - line;
+}
+
+/*
+ * Result is the time taken to write \a BENCH_LINES lines one way
+ */
+struct Result {
+    double   ns;
+    uint64_t cycles;
+    uint32_t sum;       // of the lengths and last characters, so the lines are not optimised away, and to compare
+};
+
+static void print(const char *test, const Result &old, const Result &now)
+{
+    printf("%-8s old %8.1f ns", test, old.ns / BENCH_LINES);
+    if (old.cycles) {
+        printf(" %8.1f cycles", (double)old.cycles / BENCH_LINES);
+    }
+    printf("   new %8.1f ns", now.ns / BENCH_LINES);
+    if (now.cycles) {
+        printf(" %8.1f cycles", (double)now.cycles / BENCH_LINES);
+    }
+    printf("   %6.1fx%s\n", old.ns / now.ns, (old.sum == now.sum) ? "" : "  (lines disagree)");
+}
+
+// times \a BENCH_LINES lines, written by \a line, which is given the line's number
+#define TIME_LINES(result, line)                                        \
+    do {                                                                \
+        char buf[LINE_MAX];                                             \
+        (result).sum = 0;                                               \
+        double ns_ = bench_ns();                                        \
+        uint64_t cycles_ = bench_cycles();                              \
+        for (unsigned long i = 0; i < BENCH_LINES; i++) {               \
+            time_t t = START_TIME + (time_t)(i * BENCH_PERIOD_S);       \
+            int len = (line);                                           \
+            (result).sum += len + buf[len - 1] + buf[len - 2];          \
+        }                                                               \
+        (result).cycles = bench_cycles() - cycles_;                     \
+        (result).ns = bench_ns() - ns_;                                 \
+    } while (0)
+
+int main()
+{
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    checkCenti();
+    checkTimestamps();
+
+    srand(1);
+    for (unsigned int i = 0; i < BENCH_VALUES; i++) {
+        s_values[i][0] = (int16_t)((rand() % 12000) - 4000);
+        s_values[i][1] = (int16_t)(rand() % 10001);
+        s_values[i][2] = (int16_t)((rand() % 12000) - 4000);
+    }
+
+    Result old, now;
+    TimestampFormatter stamp;
+    TIME_LINES(old, oldCsvLine(buf, t, s_values[i % BENCH_VALUES]));
+    TIME_LINES(now, newCsvLine(&stamp, buf, t, s_values[i % BENCH_VALUES]));
+    print("csv", old, now);
+
+    TimestampFormatter usbStamp;
+    TIME_LINES(old, oldUsbStamp(buf, t));
+    TIME_LINES(now, newUsbStamp(&usbStamp, buf, t));
+    print("usb", old, now);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * histbench times MeasHistory, which MeasurementHandler adds every measurement to, and checks its windows against a
+ * scan of every measurement they cover.
+ *
+ *   add         the mean cost of add() over a run of measurements, a sample period apart, with the bucket rollovers
+ *               that period brings. Shorter periods are more adds per rollover
+ *   window      the cost of window() at each resolution, which is the same however full the history is
+ *   check       measurements at random gaps, and after each, every window's min, max and mean against a scan of the
+ *               measurements in it. The min and max are packed to half a unit, and the means weighted by packed
+ *               counts, so the worst difference of each is printed, in hundredths of a unit
+ *
+ * Build with "make -C Sim histbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meashistory.h"
+#include "benchclock.h"
+
+#define BENCH_ADDS      10000000ul  // timed per sample period
+#define BENCH_WINDOWS   10000000ul  // timed per resolution
+#define BENCH_VALUES    1024u       // measurements cycled through by the timed adds
+#define CHECK_ADDS      300000ul    // checked against a scan
+#define CHECK_MAX_GAP   120u        // most seconds between the checked measurements
+#define START_TIME      1500000000u // seconds since 1970
+
+static uint32_t s_seed = 1;
+
+static uint32_t random32()
+{
+    s_seed = (s_seed * 1103515245u) + 12345u;
+    return s_seed >> 8;
+}
+
+// a random walk of temperature and humidity, in hundredths, inside what the packing covers, and a dewpoint below it
+static void nextValues(int16_t values[MEASHIST_QUANTITIES])
+{
+    static int16_t celcius = 2000, humidity = 5000;
+    celcius  += (int16_t)((int32_t)(random32() % 41u) - 20);
+    humidity += (int16_t)((int32_t)(random32() % 81u) - 40);
+    if (celcius < -3000) celcius = -3000;
+    if (celcius > 7000) celcius = 7000;
+    if (humidity < 0) humidity = 0;
+    if (humidity > 10000) humidity = 10000;
+    values[MeasHistory::hist_Celcius]  = celcius;
+    values[MeasHistory::hist_Humidity] = humidity;
+    values[MeasHistory::hist_Dewpoint] = (int16_t)(celcius - ((10000 - humidity) / 5));
+}
+
+static MeasHistory s_history;
+
+static void timeAdd(uint32_t periodS)
+{
+    static int16_t values[BENCH_VALUES][MEASHIST_QUANTITIES];
+    for (unsigned int i = 0; i < BENCH_VALUES; i++) {
+        nextValues(values[i]);
+    }
+
+    s_history.clear();
+    uint32_t t = START_TIME;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (unsigned long i = 0; i < BENCH_ADDS; i++) {
+        s_history.add(t, values[i % BENCH_VALUES]);
+        t += periodS;
+    }
+    cycles = bench_cycles() - cycles;
+    ns = bench_ns() - ns;
+
+    printf("add      %5lu s  %8.1f ns", (unsigned long)periodS, ns / BENCH_ADDS);
+    if (cycles) {
+        printf("  %8.1f cycles", (double)cycles / BENCH_ADDS);
+    }
+    printf("\n");
+}
+
+static void timeWindow(MeasHistory::resolution_t res, const char *name)
+{
+    MeasSummary summary;
+    uint32_t count = 0;
+    double ns = bench_ns();
+    uint64_t cycles = bench_cycles();
+    for (unsigned long i = 0; i < BENCH_WINDOWS; i++) {
+        s_history.window(res, &summary);
+        count += summary.count;
+        __asm__ __volatile__("" ::: "memory");  // so the calls are not hoisted out of the loop
+    }
+    cycles = bench_cycles() - cycles;
+    ns = bench_ns() - ns;
+
+    printf("window   %-7s  %8.1f ns", name, ns / BENCH_WINDOWS);
+    if (cycles) {
+        printf("  %8.1f cycles", (double)cycles / BENCH_WINDOWS);
+    }
+    printf("%s\n", count ? "" : "  (empty)");
+}
+
+/*
+ * Worst is the worst difference of a window from the scan, in hundredths, over every quantity
+ */
+struct Worst {
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+};
+
+static uint32_t s_times[CHECK_ADDS];
+static int16_t  s_values[CHECK_ADDS][MEASHIST_QUANTITIES];
+
+static int32_t diff(int32_t a, int32_t b)
+{
+    return (a > b) ? (a - b) : (b - a);
+}
+
+static void checkWindow(MeasHistory::resolution_t res, uint32_t period, uint32_t kept, unsigned long last, Worst *worst)
+{
+    MeasSummary summary;
+    if (!s_history.window(res, &summary)) {
+        printf("check    window %u empty after %lu measurements\n", (unsigned int)res, last + 1);
+        exit(1);
+    }
+
+    // the window is the open bucket and the kept closed ones before it
+    uint32_t first = ((s_times[last] / period) - kept) * period;
+    int32_t min[MEASHIST_QUANTITIES], max[MEASHIST_QUANTITIES];
+    int64_t sum[MEASHIST_QUANTITIES];
+    uint32_t count = 0;
+    for (unsigned long i = last + 1; i-- > 0 && s_times[i] >= first; ) {
+        for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+            if (!count || s_values[i][q] < min[q]) min[q] = s_values[i][q];
+            if (!count || s_values[i][q] > max[q]) max[q] = s_values[i][q];
+            sum[q] = (count ? sum[q] : 0) + s_values[i][q];
+        }
+        count++;
+    }
+
+    for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+        int32_t d = diff(summary.min[q], min[q]);
+        if (d > worst->min) worst->min = d;
+        d = diff(summary.max[q], max[q]);
+        if (d > worst->max) worst->max = d;
+        d = diff(summary.mean[q], (int32_t)(sum[q] / (int64_t)count));
+        if (d > worst->mean) worst->mean = d;
+    }
+}
+
+static void check()
+{
+    Worst worst[MeasHistory::hist_NumResolutions];
+    memset(worst, 0, sizeof(worst));
+
+    s_history.clear();
+    uint32_t t = START_TIME;
+    for (unsigned long i = 0; i < CHECK_ADDS; i++) {
+        t += 1 + (random32() % CHECK_MAX_GAP);
+        s_times[i] = t;
+        nextValues(s_values[i]);
+        s_history.add(t, s_values[i]);
+
+        checkWindow(MeasHistory::hist_Minute, 60u, MEASHIST_MINUTES, i, &worst[MeasHistory::hist_Minute]);
+        // the longer windows are scanned less often, or the scans would take minutes
+        if ((i % 16u) == 0) {
+            checkWindow(MeasHistory::hist_Hour, 3600u, MEASHIST_HOURS, i, &worst[MeasHistory::hist_Hour]);
+        }
+        if ((i % 256u) == 0) {
+            checkWindow(MeasHistory::hist_Day, 86400u, MEASHIST_DAYS, i, &worst[MeasHistory::hist_Day]);
+        }
+    }
+
+    static const char *names[MeasHistory::hist_NumResolutions] = { "minute", "hour", "day" };
+    printf("check    %lu measurements, 1 to %u s apart, worst difference from a scan in hundredths:\n",
+           CHECK_ADDS, CHECK_MAX_GAP);
+    for (unsigned int r = 0; r < MeasHistory::hist_NumResolutions; r++) {
+        printf("         %-7s  min %3ld  max %3ld  mean %3ld\n", names[r], (long)worst[r].min, (long)worst[r].max,
+               (long)worst[r].mean);
+    }
+}
+
+int main()
+{
+    printf("sizeof(MeasHistory) %u bytes\n", (unsigned int)sizeof(MeasHistory));
+
+    static const uint32_t periods[] = { 1, 10, 60 };
+    for (unsigned int i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        timeAdd(periods[i]);
+    }
+
+    // the history is full from the last run of adds
+    timeWindow(MeasHistory::hist_Minute, "minute");
+    timeWindow(MeasHistory::hist_Hour, "hour");
+    timeWindow(MeasHistory::hist_Day, "day");
+
+    check();
+    return 0;
+}
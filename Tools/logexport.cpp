@@ -0,0 +1,388 @@
+/*
+ * logexport fetches a time range of the data log from the logger over its USB serial port, with the "x" command of
+ * UsbComms, and writes the records to a file, byte for byte as they are in the data file on the SD card.
+ *
+ *   logexport <port> <from> <to> <out>     fetch from the logger, e.g. logexport /dev/ttyACM0 20240301 20240331 march.csv
+ *   logexport -c <capture> <out>           decode a capture of what the logger sent, e.g. the sim's SIM_USB_OUT
+ *
+ * <from> and <to> are YYYYMMDD or YYYYMMDDHHMMSS, in UTC. A date on its own for <to> means the end of that day.
+ *
+ * If the stream is cut short, by a bad frame, or the port going away when the logger is unplugged or restarts, the
+ * export is carried on from the end of the last good frame once the port is back. The offset reached is kept in
+ * <out>.next until the range is complete, so running it again with the same arguments carries on from there too.
+ * Anything else the logger prints goes to standard error.
+ *
+ * Build with "make -C Sim logexport".
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "logexport.h"
+#include "crc16.h"
+#include "byteorder.h"
+
+#define IDLE_TIMEOUT_MS     5000    // with nothing received for this long, ask again
+#define REOPEN_WAIT_MS      1000    // between attempts to open the port again
+#define REOPEN_TRIES        60
+
+static double nowSeconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1e6);
+}
+
+// YYYYMMDD or YYYYMMDDHHMMSS, UTC. A date on its own is the start of the day, or its end if endOfDay
+static bool parseTime(const char *s, bool endOfDay, uint32_t *t)
+{
+    size_t len = strlen(s);
+    if (((len != 8) && (len != 14)) || (strspn(s, "0123456789") != len)) {
+        return false;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int year, month;
+    sscanf(s, "%4d%2d%2d", &year, &month, &tm.tm_mday);
+    tm.tm_year = year - 1900;
+    tm.tm_mon  = month - 1;
+    if (len == 14) {
+        sscanf(s + 8, "%2d%2d%2d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    }
+    else if (endOfDay) {
+        tm.tm_hour = 23;
+        tm.tm_min  = 59;
+        tm.tm_sec  = 59;
+    }
+    *t = (uint32_t)timegm(&tm);
+    return true;
+}
+
+/*
+ * Picks the frames out of what the logger sends, checks them, and writes the data to the output file in order
+ */
+class Receiver {
+public:
+    Receiver(FILE *out, uint32_t first, uint32_t next)
+        : m_out(out), m_first(first), m_next(next), m_haveFirst(next != 0), m_synced(false), m_done(false),
+          m_end(lxend_Done), m_seq(0), m_frames(0), m_bytes(0), m_badFrames(0), m_breaks(0) {}
+
+    // feed what has been received. Returns false if the stream broke, and the export needs to be asked for again
+    bool feed(const unsigned char *data, size_t len);
+
+    uint32_t first() const { return m_first; }
+    uint32_t next() const { return m_next; }
+    bool done() const { return m_done; }
+    uint8_t endReason() const { return m_end; }
+    void report(const char *what, double seconds) const;
+
+private:
+    FILE    *m_out;
+    std::vector<unsigned char> m_buf;
+    uint32_t m_first;       // file offset of the first byte written to m_out
+    uint32_t m_next;        // file offset of the next byte expected
+    bool     m_haveFirst;
+    bool     m_synced;      // a start frame for m_next has been seen, and nothing has gone wrong since
+    bool     m_done;
+    uint8_t  m_end;
+    uint16_t m_seq;         // sequence number of the next frame expected
+    unsigned long m_frames, m_bytes, m_badFrames, m_breaks;
+
+    bool frame(const unsigned char *f);
+    void text(const unsigned char *data, size_t len) { fwrite(data, 1, len, stderr); }
+};
+
+bool Receiver::feed(const unsigned char *data, size_t len)
+{
+    m_buf.insert(m_buf.end(), data, data + len);
+
+    bool ok = true;
+    size_t pos = 0;
+    while (pos < m_buf.size()) {
+        // anything that is not a frame is the logger's terminal output
+        size_t magic = pos;
+        while ((magic < m_buf.size()) && ((m_buf[magic] != (LOGEXPORT_MAGIC & 0xFF)) ||
+               ((magic + 1 < m_buf.size()) && (m_buf[magic + 1] != (LOGEXPORT_MAGIC >> 8))))) {
+            magic++;
+        }
+        text(&m_buf[pos], magic - pos);
+        pos = magic;
+        if (m_buf.size() - pos < LOGEXPORT_HEADER_LEN) {
+            break;
+        }
+        size_t frameLen = LOGEXPORT_HEADER_LEN + m_buf[pos + 3] + 2;
+        if (m_buf.size() - pos < frameLen) {
+            break;
+        }
+        const unsigned char *f = &m_buf[pos];
+        if (crc16(f, frameLen - 2) != get16(f + frameLen - 2)) {
+            // not a frame after all, or a damaged one
+            if (m_synced && (f[2] == lxframe_Data)) {
+                m_badFrames++;
+            }
+            text(f, 1);
+            pos++;
+            continue;
+        }
+        ok = frame(f) && ok;
+        pos += frameLen;
+    }
+    m_buf.erase(m_buf.begin(), m_buf.begin() + pos);
+    return ok;
+}
+
+bool Receiver::frame(const unsigned char *f)
+{
+    uint8_t  type   = f[2];
+    uint8_t  len    = f[3];
+    uint16_t seq    = get16(f + 4);
+    uint32_t offset = get32(f + 6);
+    const unsigned char *payload = f + LOGEXPORT_HEADER_LEN;
+
+    if (type == lxframe_Start) {
+        // only the start of the export that was asked for, not one that was already going
+        if ((len == LOGEXPORT_START_LEN) && (!m_haveFirst || (offset == m_next))) {
+            m_next   = offset;
+            m_synced = true;
+            m_seq = seq + 1;
+            fprintf(stderr, "logexport: exporting from offset %lu of %lu bytes\n",
+                    (unsigned long)offset, (unsigned long)get32(payload + 9));
+        }
+        return true;
+    }
+    if (!m_synced) {
+        return true;    // the rest of an export that has been given up on
+    }
+
+    if (seq != m_seq) {
+        fprintf(stderr, "logexport: frames %u to %u lost, carrying on from offset %lu\n",
+                m_seq, (uint16_t)(seq - 1), (unsigned long)m_next);
+        m_synced = false;
+        m_breaks++;
+        return false;
+    }
+    m_seq++;
+
+    if (type == lxframe_Data) {
+        if (!m_haveFirst && (offset >= m_next)) {
+            // the logger skipped the records before the range
+            m_first = m_next = offset;
+            m_haveFirst = true;
+        }
+        if (offset != m_next) {
+            fprintf(stderr, "logexport: data from offset %lu, expected %lu\n", (unsigned long)offset, (unsigned long)m_next);
+            m_synced = false;
+            m_breaks++;
+            return false;
+        }
+        fwrite(payload, 1, len, m_out);
+        m_next += len;
+        m_frames++;
+        m_bytes += len;
+    }
+    else if (type == lxframe_End) {
+        m_done = true;
+        m_end  = (len > 0) ? payload[0] : lxend_Error;
+        if (!m_haveFirst) {
+            m_first = m_next = offset;
+        }
+    }
+    return true;
+}
+
+void Receiver::report(const char *what, double seconds) const
+{
+    static const char * const reasons[] = { "end of range", "end of file", "error reading the file" };
+    fprintf(stderr, "logexport: %s: %lu bytes (offsets %lu to %lu) in %lu frames, %lu damaged, %lu breaks, %s",
+            what, m_bytes, (unsigned long)m_first, (unsigned long)m_next, m_frames, m_badFrames, m_breaks,
+            !m_done ? "not finished" : (m_end <= lxend_Error) ? reasons[m_end] : "unknown end");
+    if (seconds > 0) {
+        fprintf(stderr, ", %.1f s, %.1f KB/s", seconds, (m_bytes / 1024.0) / seconds);
+    }
+    fprintf(stderr, "\n");
+}
+
+static int decodeCapture(const char *capturePath, const char *outPath)
+{
+    FILE *in = fopen(capturePath, "rb");
+    if (in == NULL) {
+        perror(capturePath);
+        return 1;
+    }
+    FILE *out = fopen(outPath, "wb");
+    if (out == NULL) {
+        perror(outPath);
+        return 1;
+    }
+
+    // a capture can have several exports in it, each carrying on from where the one before it broke
+    Receiver rx(out, 0, 0);
+    unsigned char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        rx.feed(chunk, n);
+    }
+    fclose(in);
+    fclose(out);
+    rx.report("decoded", 0);
+    if (!rx.done()) {
+        fprintf(stderr, "logexport: to carry on, export from offset %lu\n", (unsigned long)rx.next());
+    }
+    return rx.done() ? 0 : 1;
+}
+
+static int openPort(const char *path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B115200);      // USB CDC, so the speed does not matter
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static bool sendCommand(int fd, uint32_t from, uint32_t to, uint32_t offset)
+{
+    char cmd[64];
+    int len = snprintf(cmd, sizeof(cmd), "x %lu %lu %lu\r", (unsigned long)from, (unsigned long)to, (unsigned long)offset);
+    return write(fd, cmd, len) == len;
+}
+
+static void saveNext(const std::string &path, uint32_t from, uint32_t to, uint32_t first, uint32_t next)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (f) {
+        fprintf(f, "%lu %lu %lu %lu\n", (unsigned long)from, (unsigned long)to, (unsigned long)first, (unsigned long)next);
+        fclose(f);
+    }
+}
+
+static int fetch(const char *port, uint32_t from, uint32_t to, const char *outPath)
+{
+    // carry on from an earlier run of the same range, if there was one
+    std::string nextPath = std::string(outPath) + ".next";
+    unsigned long savedFrom, savedTo, first = 0, next = 0;
+    FILE *f = fopen(nextPath.c_str(), "r");
+    bool resume = f && (fscanf(f, "%lu %lu %lu %lu", &savedFrom, &savedTo, &first, &next) == 4) &&
+                  (savedFrom == from) && (savedTo == to) && (next >= first);
+    if (f) {
+        fclose(f);
+    }
+
+    FILE *out = fopen(outPath, resume ? "r+b" : "wb");
+    if (out == NULL) {
+        perror(outPath);
+        return 1;
+    }
+    if (resume) {
+        // anything after the offset reached was not known to be good
+        if ((ftruncate(fileno(out), next - first) != 0) || (fseek(out, 0, SEEK_END) != 0)) {
+            perror(outPath);
+            return 1;
+        }
+        fprintf(stderr, "logexport: carrying on from offset %lu\n", next);
+    }
+    else {
+        first = next = 0;
+    }
+
+    Receiver rx(out, (uint32_t)first, (uint32_t)next);
+    int fd = -1;
+    bool ask = true;
+    double started = nowSeconds();
+    double lastData = started;
+
+    while (!rx.done()) {
+        if (fd < 0) {
+            for (int tries = 0; (fd = openPort(port)) < 0; tries++) {
+                if (tries == REOPEN_TRIES) {
+                    perror(port);
+                    fclose(out);
+                    return 1;
+                }
+                usleep(REOPEN_WAIT_MS * 1000);
+            }
+            ask = true;
+        }
+        if (ask) {
+            fflush(out);
+            saveNext(nextPath, from, to, rx.first(), rx.next());
+            if (!sendCommand(fd, from, to, rx.next())) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            ask = false;
+            lastData = nowSeconds();
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 500);
+        if (ready > 0) {
+            unsigned char chunk[4096];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                // unplugged, or the logger restarted
+                fprintf(stderr, "logexport: %s went away, carrying on from offset %lu once it is back\n",
+                        port, (unsigned long)rx.next());
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            lastData = nowSeconds();
+            ask = !rx.feed(chunk, (size_t)n);
+        }
+        else if ((ready < 0) && (errno != EINTR)) {
+            close(fd);
+            fd = -1;
+        }
+        else if ((nowSeconds() - lastData) * 1000 > IDLE_TIMEOUT_MS) {
+            fprintf(stderr, "logexport: nothing received, asking again from offset %lu\n", (unsigned long)rx.next());
+            ask = true;
+        }
+    }
+
+    close(fd);
+    fclose(out);
+    rx.report("fetched", nowSeconds() - started);
+    if (rx.endReason() == lxend_EndOfFile) {
+        // newer records can be fetched later, from here
+        saveNext(nextPath, from, to, rx.first(), rx.next());
+    }
+    else {
+        remove(nextPath.c_str());
+    }
+    return (rx.endReason() == lxend_Error) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc == 4) && (strcmp(argv[1], "-c") == 0)) {
+        return decodeCapture(argv[2], argv[3]);
+    }
+
+    uint32_t from, to;
+    if ((argc != 5) || !parseTime(argv[2], false, &from) || !parseTime(argv[3], true, &to)) {
+        fprintf(stderr, "usage: %s <port> <from> <to> <out>\n"
+                        "       %s -c <capture> <out>\n"
+                        "<from> and <to> are YYYYMMDD or YYYYMMDDHHMMSS, UTC\n", argv[0], argv[0]);
+        return 2;
+    }
+    return fetch(argv[1], from, to, argv[4]);
+}
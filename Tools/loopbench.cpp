@@ -0,0 +1,142 @@
+/*
+ * loopbench times a pass of the main loop: the Scheduler in scheduler.h, which calls each handler through its own
+ * class, against the loop it replaced, which called them through an AbstractHandler* array and the vtable.
+ *
+ *   static      Scheduler<...> over five handlers, each with a run() that is not inlined, as in the firmware, where
+ *               each is defined in its own .cpp
+ *   inline      the same, with run() defined in the class, so the compiler can inline the whole pass
+ *   virtual     the old loop, over five handlers whose run() is virtual, and called through dispatch()
+ *
+ * Every handler is always runnable and its run() only counts, so a pass is all loop overhead, and the MCU never
+ * sleeps. The figures are in ns and cycles a pass (see benchclock.h), and passes a second. The host predicts the
+ * indirect calls of the old loop well, which the M0, with no branch prediction, does not.
+ *
+ * Build with "make -C Sim loopbench", without PROFILE or LOWPOWER, which would time the accounting as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scheduler.h"
+#include "benchclock.h"
+
+#define BENCH_PASSES    100000000ul     // timed for each loop
+
+// the handlers' run()s are in other files in the firmware, so are not inlined into the pass here either
+#define OTHER_FILE __attribute__((noinline))
+
+// the handlers are always runnable, so the scheduler never looks at a timer or sleeps
+bool MyTimers::nextExpiry(uint32_t *deadline) { abort(); }
+unsigned long MyTimers::GetTimer(timerid_t timertype) { abort(); }
+void sleep() { abort(); }
+
+static uint32_t s_runs;
+
+template <int N>
+class CalledHandler : public AbstractHandler
+{
+public:
+    CalledHandler() : AbstractHandler(NULL) {}
+    OTHER_FILE void run() { s_runs++; }
+};
+
+template <int N>
+class InlineHandler : public AbstractHandler
+{
+public:
+    InlineHandler() : AbstractHandler(NULL) {}
+    void run() { s_runs++; }
+};
+
+/*
+ * VirtualHandler is AbstractHandler as it was, with run() virtual, and dispatch() in place of startRun()
+ */
+class VirtualHandler : public AbstractHandler
+{
+public:
+    VirtualHandler() : AbstractHandler(NULL) {}
+    virtual ~VirtualHandler() {}
+    virtual void run() = 0;
+
+    bool dispatch()
+    {
+        if (!startRun()) {
+            return false;
+        }
+        run();
+        return true;
+    }
+};
+
+template <int N>
+class OldHandler : public VirtualHandler
+{
+public:
+    OTHER_FILE void run() { s_runs++; }
+};
+
+// the old Scheduler::run, which was in scheduler.cpp
+OTHER_FILE static bool oldPass(VirtualHandler **handlers, int numHandlers, uint32_t *handlerRuns)
+{
+    bool ran = false;
+    for (int i = 0; i < numHandlers; i++) {
+        if (handlers[i]->dispatch()) {
+            (*handlerRuns)++;
+            ran = true;
+        }
+    }
+    return ran;
+}
+
+static void print(const char *name, double ns, uint64_t cycles)
+{
+    printf("%-8s %6.2f ns", name, ns / BENCH_PASSES);
+    if (cycles) {
+        printf("  %6.2f cycles", (double)cycles / BENCH_PASSES);
+    }
+    printf("  %6.1fM passes/s  (%lu runs)\n", BENCH_PASSES / ns * 1e3, (unsigned long)s_runs);
+}
+
+// times \a BENCH_PASSES passes of \a pass
+#define TIME_PASSES(name, pass)                                         \
+    do {                                                                \
+        s_runs = 0;                                                     \
+        double ns_ = bench_ns();                                        \
+        uint64_t cycles_ = bench_cycles();                              \
+        for (unsigned long i = 0; i < BENCH_PASSES; i++) {              \
+            pass;                                                       \
+        }                                                               \
+        uint64_t cycles = bench_cycles() - cycles_;                     \
+        print(name, bench_ns() - ns_, cycles);                          \
+    } while (0)
+
+int main()
+{
+    CalledHandler<1> c1;
+    CalledHandler<2> c2;
+    CalledHandler<3> c3;
+    CalledHandler<4> c4;
+    CalledHandler<5> c5;
+    Scheduler<CalledHandler<1>, CalledHandler<2>, CalledHandler<3>, CalledHandler<4>, CalledHandler<5> >
+        called(NULL, c1, c2, c3, c4, c5);
+    TIME_PASSES("static", called.run());
+
+    InlineHandler<1> i1;
+    InlineHandler<2> i2;
+    InlineHandler<3> i3;
+    InlineHandler<4> i4;
+    InlineHandler<5> i5;
+    Scheduler<InlineHandler<1>, InlineHandler<2>, InlineHandler<3>, InlineHandler<4>, InlineHandler<5> >
+        inlined(NULL, i1, i2, i3, i4, i5);
+    TIME_PASSES("inline", inlined.run());
+
+    OldHandler<1> o1;
+    OldHandler<2> o2;
+    OldHandler<3> o3;
+    OldHandler<4> o4;
+    OldHandler<5> o5;
+    VirtualHandler *handlers[] = { &o1, &o2, &o3, &o4, &o5 };
+    uint32_t handlerRuns = 0;
+    TIME_PASSES("virtual", oldPass(handlers, 5, &handlerRuns));
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * telemetry2csv turns the live telemetry stream that UsbComms sends in machine mode ("m 1") back into rows.
+ *
+ *   telemetry2csv <capture|-> [samples.csv]
+ *
+ * The capture is what was read from the logger's USB serial port, or - to read it as it comes from standard input,
+ * e.g. "cat /dev/ttyACM0 | telemetry2csv - samples.csv". Samples are written in the same CSV layout that SdHandler
+ * writes to data.csv, to standard output if no output file is given. Errors, counters and terminal output are written
+ * to standard error as they come, and at the end, how many records were lost (gaps in the sequence numbers) and how
+ * many frames were damaged.
+ *
+ * Build with "make -C Sim telemetry2csv".
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+static void formatTime(uint32_t t, char *s, size_t len)
+{
+    if (t == 0) {
+        snprintf(s, len, "-");
+        return;
+    }
+    time_t tt = (time_t)t;
+    strftime(s, len, "%Y%m%d %H%M%S", gmtime(&tt));    // the target's localtime() is UTC
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "usage: %s <capture|-> [samples.csv]\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = (strcmp(argv[1], "-") == 0) ? stdin : fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE *out = (argc == 3) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    fprintf(out, "Timestamp, Temperature (degC), Humidity (pc), Dewpoint\n");
+
+    unsigned long records = 0, samples = 0, lost = 0, damaged = 0, skipped = 0;
+    bool haveSequence = false;
+    uint8_t expected = 0;
+
+    // frames are collected up to their 0 delimiter. Anything longer than a frame can be is not one
+    unsigned char frame[TELEMETRY_FRAME_MAX];
+    uint16_t len = 0;
+    bool tooLong = false;
+    int c;
+    while ((c = getc(in)) != EOF) {
+        if (c != 0) {
+            if (len < sizeof(frame)) {
+                frame[len++] = (unsigned char)c;
+            }
+            else {
+                tooLong = true;
+            }
+            continue;
+        }
+
+        TelemetryRecord rec;
+        if (tooLong || (len == 0) || !telemetryDecode(frame, len, &rec)) {
+            // before the switch to machine mode, or damaged
+            if (haveSequence) {
+                damaged++;
+            }
+            else {
+                skipped += len + 1;
+            }
+            len = 0;
+            tooLong = false;
+            continue;
+        }
+        len = 0;
+
+        if (haveSequence && (rec.sequence != expected)) {
+            lost += (uint8_t)(rec.sequence - expected);
+            fprintf(stderr, "telemetry2csv: records %u to %u lost\n", expected, (uint8_t)(rec.sequence - 1));
+        }
+        haveSequence = true;
+        expected = rec.sequence + 1;
+        records++;
+
+        char stamp[20];
+        formatTime(rec.time, stamp, sizeof(stamp));
+        switch (rec.type) {
+        case tlm_Sample:
+            fprintf(out, "%s,%4.2f,%4.2f,%4.2f,", stamp,
+                    rec.value[0] / 100.0, rec.value[1] / 100.0, rec.value[2] / 100.0);
+            if (rec.sensor != 0) {
+                fprintf(out, "%u", rec.sensor);
+            }
+            fprintf(out, "\n");
+            fflush(out);
+            samples++;
+            break;
+        case tlm_Error:
+            fprintf(stderr, "%s sensor %u error %d\n", stamp, rec.sensor, rec.error);
+            break;
+        case tlm_Counters:
+            fprintf(stderr, "%s counters: %lu results, %lu errors, %lu results dropped, %lu errors dropped, "
+                            "%lu dropped on USB\n", stamp,
+                    (unsigned long)rec.counters.results, (unsigned long)rec.counters.errors,
+                    (unsigned long)rec.counters.resultDrops, (unsigned long)rec.counters.errorDrops,
+                    (unsigned long)rec.counters.usbDrops);
+            break;
+        case tlm_Text:
+            fprintf(stderr, "%s %s\n", stamp, rec.text);
+            break;
+        }
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "telemetry2csv: %lu records, %lu samples, %lu records lost, %lu frames damaged, "
+                    "%lu bytes before the first record\n", records, samples, lost, damaged, skipped);
+    return 0;
+}
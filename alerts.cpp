@@ -0,0 +1,220 @@
+#include "alerts.h"
+#include "crc16.h"
+#include "byteorder.h"
+
+#include <string.h>
+
+AlertEngineBase::AlertEngineBase(Rule *rules, uint8_t capacity)
+{
+    m_rules    = rules;
+    m_capacity = capacity;
+    m_count    = 0;
+    m_lastTime = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void AlertEngineBase::restart()
+{
+    for (uint8_t i = 0; i < m_count; i++) {
+        Rule &r = m_rules[i];
+        r.state      = rule_Clear;
+        r.since      = 0;
+        r.lastRaised = 0;
+        memset(&r.window, 0, sizeof(r.window));
+    }
+}
+
+bool AlertEngineBase::load(const unsigned char *table, uint16_t len)
+{
+    m_count = 0;
+    if ((len < ALERT_HEADER_LEN) || (tableLength(table) != len) || (crc16(table, len - 2) != get16(table + len - 2)) ||
+        (table[3] > m_capacity)) {
+        return false;
+    }
+    uint8_t count = table[3];
+
+    for (uint8_t i = 0; i < count; i++) {
+        const unsigned char *p = table + ALERT_HEADER_LEN + (i * ALERT_RULE_LEN);
+        AlertRule &rule = m_rules[i].rule;
+        rule.type       = p[0];
+        rule.sensor     = p[1];
+        rule.quantity   = p[2];
+        rule.level      = (int16_t)get16(p + 3);
+        rule.hysteresis = get16(p + 5);
+        rule.window     = get16(p + 7);
+        rule.sustain    = get16(p + 9);
+        rule.quiet      = get16(p + 11);
+
+        uint8_t type = rule.type & ALERT_TYPE_MASK;
+        bool rate = (type == alert_Rise) || (type == alert_Fall);
+        if ((type < alert_Above) || (type > alert_Fall) || (rule.quantity >= SENSOR_MAX_VALUES) ||
+            (rate && (rule.window < ALERT_WINDOW_BUCKETS))) {
+            return false;
+        }
+        m_rules[i].bucketLen = rule.window / ALERT_WINDOW_BUCKETS;
+    }
+
+    m_count = count;
+    restart();
+    return true;
+}
+
+uint16_t AlertEngineBase::tableLength(const unsigned char *header)
+{
+    if ((get16(header) != ALERT_MAGIC) || (header[2] != ALERT_VERSION) || (header[3] > ALERT_MAX_RULES)) {
+        return 0;
+    }
+    return ALERT_HEADER_LEN + (header[3] * ALERT_RULE_LEN) + 2;
+}
+
+uint16_t AlertEngineBase::encode(const AlertRule *rules, uint8_t count, unsigned char *dst)
+{
+    put16(dst, ALERT_MAGIC);
+    dst[2] = ALERT_VERSION;
+    dst[3] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        unsigned char *p = dst + ALERT_HEADER_LEN + (i * ALERT_RULE_LEN);
+        p[0] = rules[i].type;
+        p[1] = rules[i].sensor;
+        p[2] = rules[i].quantity;
+        put16(p + 3,  (uint16_t)rules[i].level);
+        put16(p + 5,  rules[i].hysteresis);
+        put16(p + 7,  rules[i].window);
+        put16(p + 9,  rules[i].sustain);
+        put16(p + 11, rules[i].quiet);
+    }
+    uint16_t len = ALERT_HEADER_LEN + (count * ALERT_RULE_LEN);
+    put16(dst + len, crc16(dst, len));
+    return len + 2;
+}
+
+void AlertEngineBase::evaluate(const Measurement &m, AlertSink *sink)
+{
+    uint32_t time = (uint32_t)m.time;
+    if ((int32_t)(time - m_lastTime) < 0) {
+        restart();          // the clock has gone backwards, so the windows and sustain times no longer mean anything
+    }
+    m_lastTime = time;
+
+    for (uint8_t i = 0; i < m_count; i++) {
+        if (m_rules[i].rule.sensor == m.sensor) {
+            step(i, time, m.value[m_rules[i].rule.quantity], sink);
+        }
+    }
+}
+
+bool AlertEngineBase::change(Rule &r, uint32_t time, int16_t value, int16_t *delta)
+{
+    Window &w = r.window;
+    if (w.count == 0) {
+        w.start = time;     // the first reading since the window was emptied
+    }
+    else if ((time - w.start) >= r.bucketLen) {
+        // close the open bucket. Any buckets with no readings in them carry its mean on
+        uint32_t buckets = (time - w.start) / r.bucketLen;
+        if (buckets > ALERT_WINDOW_BUCKETS) {
+            w.filled = 0;   // a gap longer than the window
+            w.head   = 0;
+        }
+        else {
+            int16_t mean = (int16_t)(w.sum / w.count);
+            for (uint8_t b = 0; b < buckets; b++) {
+                if (w.filled < ALERT_WINDOW_BUCKETS) {
+                    w.mean[(w.head + w.filled) % ALERT_WINDOW_BUCKETS] = mean;
+                    w.filled++;
+                }
+                else {
+                    w.mean[w.head] = mean;
+                    w.head = (w.head + 1) % ALERT_WINDOW_BUCKETS;
+                }
+            }
+        }
+        w.start += buckets * r.bucketLen;
+        w.sum    = 0;
+        w.count  = 0;
+    }
+
+    if (w.count < 0xFFFFu) {
+        w.sum += value;
+        w.count++;
+    }
+    if (w.filled < ALERT_WINDOW_BUCKETS) {
+        return false;       // not a whole window yet
+    }
+    *delta = (int16_t)(value - w.mean[w.head]);
+    return true;
+}
+
+void AlertEngineBase::step(uint8_t index, uint32_t time, int16_t value, AlertSink *sink)
+{
+    Rule &r = m_rules[index];
+    m_stats.evaluations++;
+
+    // what is compared with the level: the value, or how far it has risen or fallen over the window
+    int32_t x = value;
+    uint8_t type = r.rule.type & ALERT_TYPE_MASK;
+    if ((type == alert_Rise) || (type == alert_Fall)) {
+        int16_t delta;
+        if (!change(r, time, value, &delta)) {
+            return;
+        }
+        x = (type == alert_Rise) ? delta : -delta;
+    }
+
+    bool on, off;
+    if (type == alert_Below) {
+        on  = (x <= r.rule.level);
+        off = (x > (int32_t)r.rule.level + r.rule.hysteresis);
+    }
+    else {
+        on  = (x >= r.rule.level);
+        off = (x < (int32_t)r.rule.level - r.rule.hysteresis);
+    }
+
+    AlertEvent e;
+    e.index = index;
+    e.rule  = &r.rule;
+    e.time  = time;
+    e.value = (int16_t)x;
+
+    switch (r.state) {
+    case rule_Clear:
+        if (!on) {
+            break;
+        }
+        r.since = time;
+        r.state = rule_Pending;
+        // fall through - it may not need to be sustained
+    case rule_Pending:
+        if (off) {
+            r.state = rule_Clear;
+        }
+        else if ((time - r.since) >= r.rule.sustain) {
+            r.state = rule_Raised;
+            if (r.lastRaised && ((time - r.lastRaised) < ((uint32_t)r.rule.quiet * 60u))) {
+                r.state = rule_Quiet;
+                m_stats.suppressed++;
+            }
+            else {
+                r.lastRaised = time;
+                m_stats.raised++;
+                e.event = alert_Raised;
+                sink->alert(e);
+            }
+        }
+        break;
+
+    case rule_Raised:
+    case rule_Quiet:
+        if (off) {
+            // only say it has cleared if it was said it was raised
+            if ((r.state == rule_Raised) && (r.rule.type & ALERT_FLAG_CLEAR)) {
+                m_stats.cleared++;
+                e.event = alert_Cleared;
+                sink->alert(e);
+            }
+            r.state = rule_Clear;
+        }
+        break;
+    }
+}
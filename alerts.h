@@ -0,0 +1,216 @@
+#ifndef __ALERTS_H__
+#define __ALERTS_H__
+
+#include <stdint.h>
+#include "sensor.h"
+
+#define ALERT_MAGIC             0x5241u     // "AR", the first two bytes of a rule table
+#define ALERT_VERSION           1u
+#define ALERT_HEADER_LEN        4u          // magic (2), version (1), count (1)
+#define ALERT_RULE_LEN          13u
+#define ALERT_MAX_RULES         64u         // most rules in a table
+#define ALERT_WINDOW_BUCKETS    4u          // a rate of change window is kept as this many bucket means
+
+/*!
+ * \brief The alert_type_t enum is what a rule looks for, in the low nibble of \a AlertRule::type
+ */
+enum alert_type_t {
+    alert_Above = 1,        ///< the value is at or above \a AlertRule::level
+    alert_Below = 2,        ///< the value is at or below \a AlertRule::level
+    alert_Rise  = 3,        ///< the value has risen by \a AlertRule::level or more over \a AlertRule::window
+    alert_Fall  = 4         ///< the value has fallen by \a AlertRule::level or more over \a AlertRule::window
+};
+
+#define ALERT_TYPE_MASK         0x0Fu
+#define ALERT_FLAG_CLEAR        0x80u       // report when the alert clears, as well as when it is raised
+
+/*!
+ * \brief The AlertRule struct is one rule of the table, as it is in the table
+ */
+struct AlertRule {
+    uint8_t  type;          ///< \a alert_type_t, and the ALERT_FLAG_ bits
+    uint8_t  sensor;        ///< index of the sensor whose readings it looks at
+    uint8_t  quantity;      ///< which of the reading's values, an index into \a Measurement::value
+    int16_t  level;         ///< threshold, or change over \a window, in hundredths of a unit
+    uint16_t hysteresis;    ///< how far back past \a level the value has to go for the alert to clear
+    uint16_t window;        ///< s, the time the change of \a alert_Rise and \a alert_Fall is measured over
+    uint16_t sustain;       ///< s, how long the condition has to hold before the alert is raised
+    uint16_t quiet;         ///< minutes after an alert is raised that this rule raises no other
+};
+
+/*!
+ * \brief The alert_event_t enum is what happened to a rule's alert
+ */
+enum alert_event_t {
+    alert_Raised,           ///< the condition has held for the rule's sustain time
+    alert_Cleared           ///< the value has gone back past the hysteresis (only with ALERT_FLAG_CLEAR)
+};
+
+/*!
+ * \brief The AlertEvent struct is an alert being raised or cleared, passed to an \a AlertSink
+ */
+struct AlertEvent {
+    uint8_t          index;     ///< of the rule in the table
+    alert_event_t    event;
+    const AlertRule *rule;
+    uint32_t         time;      ///< of the reading that raised or cleared it
+    int16_t          value;     ///< the reading's value, or for a rate rule, its change over the window
+};
+
+/*!
+ * \brief The AlertSink class is told about the alerts an \a AlertEngine raises and clears
+ */
+class AlertSink
+{
+public:
+    virtual ~AlertSink() {}
+    virtual void alert(const AlertEvent &event) = 0;
+};
+
+/*!
+ * \brief The AlertStats struct counts what an \a AlertEngine has done
+ */
+struct AlertStats {
+    uint32_t evaluations;   ///< rules evaluated against a reading
+    uint32_t raised;
+    uint32_t cleared;
+    uint32_t suppressed;    ///< alerts not raised because the rule was in its quiet period
+};
+
+/*!
+ * \brief The AlertEngineBase class checks each reading against a table of rules, and raises alerts as they are met
+ *
+ * The rules are loaded with \sa load from a binary table: a header of magic (2), version (1) and count (1), then
+ * each rule in \a AlertRule order, ALERT_RULE_LEN bytes, then a CRC-16 of all of it. All values are little endian.
+ *
+ * Each reading goes through \sa evaluate, which updates only the rules for its sensor. A rule is clear, pending or
+ * raised. It goes pending when its condition is met, and raised once the condition has held for its sustain time;
+ * while pending, it goes back to clear if the value goes back past the hysteresis. A raised rule clears once the
+ * value goes back past the hysteresis, which stops it flapping around the level. Raising an alert within the quiet
+ * period of the last one from the same rule is counted, but not reported, and the rule stays raised until it clears.
+ *
+ * \a alert_Rise and \a alert_Fall compare the reading with the mean of the readings one window ago. The window is
+ * kept as ALERT_WINDOW_BUCKETS bucket means, so it slides a bucket at a time and the change is measured over the
+ * window to within a bucket, and no history is rescanned. Until the window has filled, there is no change to
+ * measure. A gap in the readings longer than the window empties it.
+ *
+ * All the state of a rule is a fixed size, so the cost of a reading is constant per rule, with no divides except
+ * when a bucket closes. If time goes backwards (the clock is set), every rule starts again from clear.
+ *
+ * The rules are kept in \a AlertEngine, which has room for a number fixed at compile time. This class is the code,
+ * and what a function that works on an engine of any size takes.
+ */
+class AlertEngineBase
+{
+public:
+    /*!
+     * \brief load replaces the rules with the ones in a rule table
+     * \param table is the table, as described above
+     * \param len is its length
+     * \return false if the table is not valid, or has more rules than there is room for, in which case there are none
+     */
+    bool load(const unsigned char *table, uint16_t len);
+
+    /*!
+     * \brief tableLength is the length of a rule table, from its header
+     * \param header is the first ALERT_HEADER_LEN bytes of the table
+     * \return the length of the whole table, or 0 if \a header is not the start of one
+     */
+    static uint16_t tableLength(const unsigned char *header);
+
+    /*!
+     * \brief encode writes a rule table, in the layout \sa load reads
+     * \param dst has room for ALERT_HEADER_LEN + (\a count * ALERT_RULE_LEN) + 2 bytes
+     * \return the number of bytes written
+     */
+    static uint16_t encode(const AlertRule *rules, uint8_t count, unsigned char *dst);
+
+    /*!
+     * \brief evaluate checks a reading against the rules for its sensor
+     * \param sink is told about each alert that is raised or cleared
+     */
+    void evaluate(const Measurement &m, AlertSink *sink);
+
+    //! count is the number of rules
+    uint8_t count() const { return m_count; }
+
+    //! rule is one of the rules
+    const AlertRule &rule(uint8_t index) const { return m_rules[index].rule; }
+
+    //! raised is true while a rule's alert is raised
+    bool raised(uint8_t index) const { return m_rules[index].state >= rule_Raised; }
+
+    //! capacity is the most rules a table can have to be loaded
+    uint8_t capacity() const { return m_capacity; }
+
+    const AlertStats &stats() const { return m_stats; }
+
+protected:
+    /*!
+     * \brief The Window struct is the sliding window of a rate of change rule
+     */
+    struct Window {
+        int16_t  mean[ALERT_WINDOW_BUCKETS];   ///< closed buckets, a ring
+        uint8_t  head;          ///< the oldest closed bucket, when the ring is full
+        uint8_t  filled;        ///< closed buckets in the ring
+        uint16_t count;         ///< readings in the open bucket
+        int32_t  sum;           ///< of the readings in the open bucket
+        uint32_t start;         ///< time the open bucket started
+    };
+
+    /*!
+     * \brief The Rule struct is a rule and its state
+     */
+    struct Rule {
+        AlertRule rule;
+        uint16_t  bucketLen;    ///< s, the window divided into buckets
+        uint8_t   state;        ///< \a state_t
+        uint32_t  since;        ///< time the condition was first met, while pending
+        uint32_t  lastRaised;   ///< time the last alert was raised, 0 for never
+        Window    window;
+    };
+
+    /*!
+     * \param rules is the storage for the rules, which is not copied
+     * \param capacity is the number of rules it has room for
+     */
+    AlertEngineBase(Rule *rules, uint8_t capacity);
+
+private:
+    enum state_t {
+        rule_Clear,
+        rule_Pending,           ///< the condition is met, waiting for it to be sustained
+        rule_Raised,
+        rule_Quiet              ///< raised within the quiet period, so not reported
+    };
+
+    Rule    *m_rules;
+    uint8_t  m_capacity;
+    uint8_t  m_count;
+    uint32_t m_lastTime;        ///< time of the last reading, to notice the clock going backwards
+    AlertStats m_stats;
+
+    void restart();                             // put every rule back to clear, and empty its window
+    bool change(Rule &r, uint32_t time, int16_t value, int16_t *delta);    // slide the window on, and measure the change
+    void step(uint8_t index, uint32_t time, int16_t value, AlertSink *sink);
+};
+
+/*!
+ * \brief The AlertEngine class is an \a AlertEngineBase with room for its rules in the object, so it needs no allocation
+ *
+ * \tparam N is the most rules a table can have, up to ALERT_MAX_RULES
+ */
+template <uint8_t N>
+class AlertEngine : public AlertEngineBase
+{
+public:
+    AlertEngine() : AlertEngineBase(m_storage, N) {}
+
+private:
+    // an array of negative size, if N will not do
+    typedef char CapacityInRange[((N > 0) && (N <= ALERT_MAX_RULES)) ? 1 : -1];
+
+    Rule m_storage[N];
+};
+
+#endif // __ALERTS_H__
@@ -0,0 +1,213 @@
+#include "atengine.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define AT_CTRL_Z   "\x1A"      // ends the text of an SMS
+
+// lines the SIM900 sends by itself, that can turn up in the middle of another command's response
+static const char * const urcPrefixes[] = {
+    "+CMTI:", "+CMT:", "+CDS:", "RING", "+CRING:", "+CLIP:", "NO CARRIER", "RDY", "Call Ready", "SMS Ready",
+    "+CPIN:", "+CFUN:", "NORMAL POWER DOWN", "UNDER-VOLTAGE", "OVER-VOLTAGE"
+};
+
+AtEngine::AtEngine(AtTransport *_port, MyTimers *_timer) : m_port(_port), m_timer(_timer)
+{
+    m_cmdTimer  = m_timer->registerTimer();
+    m_busy      = false;
+    m_prompted  = false;
+    m_textDue   = false;
+    m_sentAt    = 0;
+    m_lineLen   = 0;
+    m_urcClient = NULL;
+    memset(&m_current, 0, sizeof(m_current));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool AtEngine::queue(const char *cmd, AtClient *client, uint8_t tag, uint32_t timeoutMs, const char *payload)
+{
+    AtCommand c;
+    if (strlen(cmd) >= AT_CMD_MAXLEN) {
+        return false;
+    }
+    strcpy(c.cmd, cmd);
+    c.payload   = payload;
+    c.client    = client;
+    c.tag       = tag;
+    c.timeoutMs = timeoutMs;
+
+    if (!m_queue.push(c)) {
+        return false;
+    }
+    startNext();
+    return true;
+}
+
+void AtEngine::rx(char c)
+{
+    if (c == '\n') {
+        m_line[m_lineLen] = 0;
+        m_lineLen = 0;
+        processLine();
+        return;
+    }
+    if (c == '\r') {
+        return;     // lines end with "\r\n", and the echo of a command with "\r"
+    }
+
+    // the prompt for an SMS's text is "> " with no line ending, so act on it as soon as it starts
+    if ((c == '>') && (m_lineLen == 0) && m_busy && (m_current.payload != NULL) && !m_prompted) {
+        m_prompted = true;
+        m_port->atWrite(m_current.payload, strlen(m_current.payload));
+        m_port->atWrite(AT_CTRL_Z, 1);
+        return;
+    }
+
+    if (m_lineLen < AT_LINE_MAXLEN) {
+        m_line[m_lineLen++] = c;
+    }
+}
+
+void AtEngine::poll()
+{
+    if (m_busy && !m_timer->GetTimer(m_cmdTimer)) {
+        finish(at_Timeout, 0);
+    }
+    startNext();
+}
+
+void AtEngine::flush()
+{
+    m_lineLen = 0;
+    m_textDue = false;
+    if (m_busy) {
+        m_busy = false;
+        m_stats.commands++;
+        if (m_current.client) {
+            m_current.client->atDone(m_current.tag, at_Flushed, 0);
+        }
+    }
+
+    // a client may queue more as it is told, so only flush what was there to start with
+    AtCommand c;
+    for (uint8_t n = m_queue.count(); (n > 0) && m_queue.pop(&c); n--) {
+        if (c.client) {
+            c.client->atDone(c.tag, at_Flushed, 0);
+        }
+    }
+}
+
+void AtEngine::startNext()
+{
+    if (m_busy || !m_queue.pop(&m_current)) {
+        return;
+    }
+    m_busy     = true;
+    m_prompted = false;
+    m_textDue  = false;
+    m_sentAt   = m_timer->now();
+    m_timer->SetTimer(m_cmdTimer, m_current.timeoutMs);
+
+    m_port->atWrite(m_current.cmd, strlen(m_current.cmd));
+    m_port->atWrite("\r", 1);
+}
+
+void AtEngine::finish(at_result_t result, int code)
+{
+    uint32_t latency = m_timer->now() - m_sentAt;
+    m_stats.commands++;
+    m_stats.latencyTotalMs += latency;
+    if (latency > m_stats.latencyMaxMs) {
+        m_stats.latencyMaxMs = latency;
+    }
+    switch (result) {
+    case at_Ok:         m_stats.ok++;       break;
+    case at_Timeout:    m_stats.timeouts++; break;
+    default:            m_stats.errors++;   break;
+    }
+
+    // finished before the client is told, so it can queue its next command from the callback
+    m_busy = false;
+    if (m_current.client) {
+        m_current.client->atDone(m_current.tag, result, code);
+    }
+    startNext();
+}
+
+void AtEngine::processLine()
+{
+    // the line after an SMS's +CMGR: or +CMGL: line is its text, whatever it starts with, and even if it is empty
+    if (m_busy && m_textDue) {
+        m_textDue = false;
+        if (m_current.client) {
+            m_current.client->atLine(m_current.tag, m_line);
+        }
+        return;
+    }
+
+    const char *line = m_line;
+    while (*line == ' ') {
+        line++;
+    }
+    if (*line == 0) {
+        return;     // the blank lines around every response, and what is left of the prompt
+    }
+
+    if (m_busy) {
+        if (strcmp(line, m_current.cmd) == 0) {
+            return;     // echo
+        }
+        if (strcmp(line, "OK") == 0) {
+            finish(at_Ok, 0);
+            return;
+        }
+        if (strcmp(line, "ERROR") == 0) {
+            finish(at_Error, 0);
+            return;
+        }
+        if (strncmp(line, "+CMS ERROR:", 11) == 0) {
+            finish(at_CmsError, atoi(line + 11));
+            return;
+        }
+        if (strncmp(line, "+CME ERROR:", 11) == 0) {
+            finish(at_CmeError, atoi(line + 11));
+            return;
+        }
+        if (isResponse(line) || !isUrc(line)) {
+            m_textDue = (strncmp(line, "+CMGR:", 6) == 0) || (strncmp(line, "+CMGL:", 6) == 0);
+            if (m_current.client) {
+                m_current.client->atLine(m_current.tag, line);
+            }
+            return;
+        }
+    }
+
+    m_stats.urcs++;
+    if (m_urcClient) {
+        m_urcClient->atUrc(line);
+    }
+}
+
+bool AtEngine::isResponse(const char *line) const
+{
+    // "AT+CMGR=3" is answered with "+CMGR: ...", so compare up to the '=' or '?'
+    const char *cmd = m_current.cmd + 2;
+    if (*cmd != '+') {
+        return false;
+    }
+    uint8_t len = 0;
+    while ((cmd[len] != 0) && (cmd[len] != '=') && (cmd[len] != '?')) {
+        len++;
+    }
+    return (strncmp(line, cmd, len) == 0) && (line[len] == ':');
+}
+
+bool AtEngine::isUrc(const char *line)
+{
+    for (unsigned int i = 0; i < sizeof(urcPrefixes) / sizeof(urcPrefixes[0]); i++) {
+        if (strncmp(line, urcPrefixes[i], strlen(urcPrefixes[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,170 @@
+#ifndef __AT_ENGINE_H__
+#define __AT_ENGINE_H__
+
+#include "mbed.h"
+#include "timers.h"
+#include "msgqueue.h"
+
+#define AT_QUEUE_LEN        8u      // commands waiting behind the one in flight
+#define AT_CMD_MAXLEN       40u     // longest command, e.g. AT+CMGS="+61400000000"
+#define AT_LINE_MAXLEN      180u    // longest response line kept, a 160 character SMS and some room. The rest is cut off
+#define AT_TIMEOUT_MS       2000u   // default time for a command to get its final result
+
+/*!
+ * \brief The at_result_t enum is how a command finished
+ */
+enum at_result_t {
+    at_Ok,              ///< OK
+    at_Error,           ///< ERROR
+    at_CmsError,        ///< +CMS ERROR: <code>, a message service error
+    at_CmeError,        ///< +CME ERROR: <code>, an equipment error
+    at_Timeout,         ///< no final result in time
+    at_Flushed          ///< thrown away by \sa AtEngine::flush before it finished
+};
+
+/*!
+ * \brief The AtClient class is told about the progress of the commands it queued, and unsolicited result codes
+ */
+class AtClient
+{
+public:
+    virtual ~AtClient() {}
+
+    /*!
+     * \brief atLine is an information line in the response to a command, e.g. "+CSQ: 20,0", or an SMS body
+     * \param tag is what the command was queued with
+     */
+    virtual void atLine(uint8_t tag, const char *line) {}
+
+    /*!
+     * \brief atDone is called as soon as the command's final result arrives, or it times out
+     * \param tag is what the command was queued with
+     * \param code is the error code of \a at_CmsError and \a at_CmeError, otherwise 0
+     */
+    virtual void atDone(uint8_t tag, at_result_t result, int code) = 0;
+
+    //! atUrc is an unsolicited result code, e.g. "+CMTI: "SM",3", given to the client set with \sa AtEngine::setUrcClient
+    virtual void atUrc(const char *line) {}
+};
+
+/*!
+ * \brief The AtTransport class is where \a AtEngine writes commands, i.e. the modem's serial port
+ */
+class AtTransport
+{
+public:
+    virtual ~AtTransport() {}
+    virtual void atWrite(const char *data, uint16_t len) = 0;
+};
+
+/*!
+ * \brief The AtCommand struct is a queued command
+ */
+struct AtCommand {
+    char        cmd[AT_CMD_MAXLEN];
+    const char *payload;        ///< written at the "> " prompt, or NULL
+    AtClient   *client;
+    uint8_t     tag;
+    uint32_t    timeoutMs;
+};
+
+/*!
+ * \brief The AtStats struct counts the commands an \a AtEngine has run, and how long they took
+ */
+struct AtStats {
+    uint32_t commands;          ///< commands that finished, however they finished
+    uint32_t ok;
+    uint32_t errors;            ///< ERROR, +CMS ERROR and +CME ERROR
+    uint32_t timeouts;
+    uint32_t urcs;              ///< unsolicited result codes
+    uint32_t latencyTotalMs;    ///< from sending each command to its final result
+    uint32_t latencyMaxMs;
+};
+
+/*!
+ * \brief The AtEngine class runs AT commands on the SIM900 one after another, and parses the responses as they arrive
+ *
+ * Commands are queued with \sa queue, each with its own timeout, and an optional payload to send at the "> " prompt
+ * (the text of AT+CMGS, which is ended with Ctrl-Z). The modem only takes one command at a time, so the next is
+ * written as soon as the one before it gets its final result, with no fixed gap in between.
+ *
+ * Received characters are fed in with \sa rx, and split into lines as they come. A line in response to the command
+ * in flight is either its echo (ignored), a final result (OK, ERROR, +CMS ERROR: n, +CME ERROR: n), which finishes
+ * the command and calls \sa AtClient::atDone straight away, or an information line for \sa AtClient::atLine.
+ * A line that starts like an unsolicited result code, and does not have the command's own "+XXX:" prefix, goes to
+ * the URC client instead, as does any line while no command is in flight. The exception is the line after a +CMGR:
+ * or +CMGL: line, which is the text of an SMS, so always goes to \sa AtClient::atLine, even if it is empty.
+ *
+ * The engine has a timer of its own for the command in flight. \sa poll checks it, so should be called whenever the
+ * owner runs, and the owner can wait on \sa timer.
+ */
+class AtEngine
+{
+public:
+    AtEngine(AtTransport *_port, MyTimers *_timer);
+
+    /*!
+     * \brief queue adds a command to the queue, and writes it straight away if nothing is in flight
+     * \param cmd is the command without the line ending, e.g. "AT+CMGF=1". Copied
+     * \param client is told when it finishes. May be NULL
+     * \param tag is passed back to \a client, to tell its commands apart
+     * \param timeoutMs is how long to wait for the final result
+     * \param payload is written after the "> " prompt, followed by Ctrl-Z. Not copied, so must stay valid until
+     * the command finishes. NULL if the command has no prompt
+     * \return false if the queue is full, or \a cmd is too long
+     */
+    bool queue(const char *cmd, AtClient *client, uint8_t tag, uint32_t timeoutMs = AT_TIMEOUT_MS, const char *payload = NULL);
+
+    //! rx parses a received character. Completion callbacks are called from here
+    void rx(char c);
+
+    //! poll times out the command in flight if its time is up
+    void poll();
+
+    /*!
+     * \brief flush finishes the command in flight and everything queued with \a at_Flushed, e.g. when the modem is
+     * restarted, and throws away any part line
+     */
+    void flush();
+
+    //! setUrcClient sets who is given unsolicited result codes
+    void setUrcClient(AtClient *client) { m_urcClient = client; }
+
+    //! busy is true while a command is in flight
+    bool busy() const { return m_busy; }
+
+    //! pending is the number of commands in flight or queued
+    uint8_t pending() const { return m_queue.count() + (m_busy ? 1 : 0); }
+
+    //! timer elapses when the command in flight times out
+    MyTimers::timerid_t timer() const { return m_cmdTimer; }
+
+    const AtStats &stats() const { return m_stats; }
+    const MsgQueue<AtCommand, AT_QUEUE_LEN> &commandQueue() const { return m_queue; }
+
+private:
+    AtTransport *m_port;
+    MyTimers *m_timer;
+    MyTimers::timerid_t m_cmdTimer;     ///< times out the command in flight
+
+    MsgQueue<AtCommand, AT_QUEUE_LEN> m_queue;  ///< commands waiting to be written
+    AtCommand m_current;                ///< the command in flight, valid while \a m_busy
+    bool     m_busy;                    ///< a command has been written and has not finished
+    bool     m_prompted;                ///< the payload of the command in flight has been written
+    bool     m_textDue;                 ///< the next line is the text of the SMS in a +CMGR: or +CMGL: line
+    uint32_t m_sentAt;                  ///< \a MyTimers::now when the command in flight was written
+
+    char     m_line[AT_LINE_MAXLEN + 1];    ///< the line being received
+    uint16_t m_lineLen;
+
+    AtClient *m_urcClient;
+    AtStats   m_stats;
+
+    void startNext();                   // write the next queued command, if nothing is in flight
+    void finish(at_result_t result, int code);
+    void processLine();                 // a whole line has been received into m_line
+    bool isResponse(const char *line) const;    // the line has the command in flight's "+XXX" prefix
+    static bool isUrc(const char *line);
+};
+
+#endif // __AT_ENGINE_H__
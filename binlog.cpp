@@ -0,0 +1,165 @@
+#include "binlog.h"
+#include "crc16.h"
+#include "byteorder.h"
+
+#include <string.h>
+
+BinLogBlock::BinLogBlock()
+{
+    m_count    = 0;
+    m_tagged   = false;
+    m_baseTime = 0;
+    m_lastTime = 0;
+    m_sequence = 0;
+}
+
+bool BinLogBlock::add(const BinLogRecord &record)
+{
+    if (m_count >= BINLOG_BLOCK_RECORDS) {
+        return false;
+    }
+
+    uint32_t delta = 0;
+    if (m_count == 0) {
+        m_baseTime = record.time;
+    }
+    else {
+        // time can only go forwards within a block
+        if ((int32_t)(record.time - m_lastTime) < 0) {
+            return false;
+        }
+        delta = record.time - m_lastTime;
+        if (delta > 0xFFFFu) {
+            return false;
+        }
+    }
+
+    unsigned char *p = &m_records[m_count * BINLOG_TAGGED_RECORD_LEN];
+    put16(p,     (uint16_t)delta);
+    p[2] = record.sensor;
+    put16(p + 3, (uint16_t)record.centiCelcius);
+    put16(p + 5, record.centiHumidity);
+    put16(p + 7, (uint16_t)record.centiDewpoint);
+
+    m_tagged   = m_tagged || (record.sensor != 0);
+    m_lastTime = record.time;
+    m_count++;
+    return true;
+}
+
+uint16_t BinLogBlock::encodedSize() const
+{
+    return BINLOG_HEADER_LEN + (m_count * (m_tagged ? BINLOG_TAGGED_RECORD_LEN : BINLOG_RECORD_LEN));
+}
+
+uint16_t BinLogBlock::encode(unsigned char *dst)
+{
+    uint16_t len = encodedSize();
+
+    put16(dst, BINLOG_MAGIC);
+    dst[2] = m_tagged ? BINLOG_VERSION_TAGGED : BINLOG_VERSION;
+    dst[3] = m_count;
+    put32(dst + 4, m_baseTime);
+    put16(dst + 8, m_sequence);
+    if (m_tagged) {
+        memcpy(dst + BINLOG_HEADER_LEN, m_records, len - BINLOG_HEADER_LEN);
+    }
+    else {
+        // leave the sensor out of each record
+        unsigned char *p = dst + BINLOG_HEADER_LEN;
+        for (uint8_t i = 0; i < m_count; i++) {
+            const unsigned char *r = &m_records[i * BINLOG_TAGGED_RECORD_LEN];
+            p[0] = r[0];
+            p[1] = r[1];
+            memcpy(p + 2, r + 3, BINLOG_RECORD_LEN - 2);
+            p += BINLOG_RECORD_LEN;
+        }
+    }
+    uint16_t crc = crc16(dst, BINLOG_HEADER_LEN - 2);
+    crc = crc16(dst + BINLOG_HEADER_LEN, len - BINLOG_HEADER_LEN, crc);
+    put16(dst + 10, crc);
+
+    // ready for the next block
+    discard();
+    return len;
+}
+
+void BinLogBlock::discard()
+{
+    m_count  = 0;
+    m_tagged = false;
+    m_sequence++;
+}
+
+// the length of each record in a block of \a version
+static uint8_t recordLen(uint8_t version)
+{
+    return (version == BINLOG_VERSION_TAGGED) ? BINLOG_TAGGED_RECORD_LEN : BINLOG_RECORD_LEN;
+}
+
+// the length of the block at \a src, 0 if more than \a len bytes are needed to tell, or -1 if it is not a valid block
+static int checkBlock(const unsigned char *src, uint32_t len)
+{
+    if (len < BINLOG_HEADER_LEN) {
+        return 0;
+    }
+    if ((get16(src) != BINLOG_MAGIC) || ((src[2] != BINLOG_VERSION) && (src[2] != BINLOG_VERSION_TAGGED)) ||
+        (src[3] > BINLOG_BLOCK_RECORDS)) {
+        return -1;
+    }
+
+    uint32_t blockLen = BINLOG_HEADER_LEN + (src[3] * recordLen(src[2]));
+    if (len < blockLen) {
+        return 0;
+    }
+
+    uint16_t crc = crc16(src, BINLOG_HEADER_LEN - 2);
+    crc = crc16(src + BINLOG_HEADER_LEN, blockLen - BINLOG_HEADER_LEN, crc);
+    if (crc != get16(src + 10)) {
+        return -1;
+    }
+    return (int)blockLen;
+}
+
+int binLogDecodeBlock(const unsigned char *src, uint32_t len, BinLogRecord *records, uint8_t *count, uint16_t *sequence)
+{
+    int blockLen = checkBlock(src, len);
+    if (blockLen <= 0) {
+        return blockLen;
+    }
+
+    *count    = src[3];
+    *sequence = get16(src + 8);
+
+    bool tagged = (src[2] == BINLOG_VERSION_TAGGED);
+    uint8_t size = recordLen(src[2]);
+    uint32_t t = get32(src + 4);
+    for (uint8_t i = 0; i < *count; i++) {
+        const unsigned char *p = src + BINLOG_HEADER_LEN + (i * size);
+        t += get16(p);
+        records[i].time   = t;
+        records[i].sensor = tagged ? p[2] : 0;
+        p += size - 6;          // the values are the last 6 bytes of either layout
+        records[i].centiCelcius  = (int16_t)get16(p);
+        records[i].centiHumidity = get16(p + 2);
+        records[i].centiDewpoint = (int16_t)get16(p + 4);
+    }
+    return blockLen;
+}
+
+int binLogBlockTimes(const unsigned char *src, uint32_t len, uint32_t *first, uint32_t *last)
+{
+    int blockLen = checkBlock(src, len);
+    if (blockLen <= 0) {
+        return blockLen;
+    }
+
+    uint32_t t = get32(src + 4);
+    *first = t;
+    uint8_t size = recordLen(src[2]);
+    for (uint8_t i = 0; i < src[3]; i++) {
+        t += get16(src + BINLOG_HEADER_LEN + (i * size));
+    }
+    *last = t;
+    return blockLen;
+}
@@ -0,0 +1,97 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <stdint.h>
+
+#define BINLOG_MAGIC            0x4842u     // "BH", the first two bytes of every block
+#define BINLOG_VERSION          1u          // records all from sensor 0
+#define BINLOG_VERSION_TAGGED   2u          // records tagged with their sensor
+#define BINLOG_HEADER_LEN       12u
+#define BINLOG_RECORD_LEN       8u
+#define BINLOG_TAGGED_RECORD_LEN 9u
+#define BINLOG_BLOCK_RECORDS    24u         // most records in a block, so a block fits in the SD data buffer
+#define BINLOG_BLOCK_MAX        (BINLOG_HEADER_LEN + (BINLOG_BLOCK_RECORDS * BINLOG_TAGGED_RECORD_LEN))
+
+/*!
+ * \brief The BinLogRecord struct is one measurement, with its values in hundredths of a unit
+ */
+struct BinLogRecord {
+    uint32_t time;          ///< seconds since 1970
+    uint8_t  sensor;        ///< index of the sensor it came from
+    int16_t  centiCelcius;  ///< temperature, in hundredths of a degC
+    uint16_t centiHumidity; ///< relative humidity, in hundredths of a percent
+    int16_t  centiDewpoint; ///< dewpoint, in hundredths of a degC
+};
+
+/*!
+ * \brief The BinLogBlock class collects measurements into a block of the binary data log
+ *
+ * A block is a header followed by up to \a BINLOG_BLOCK_RECORDS fixed size records. All values are little endian.
+ *
+ *   header:  magic (2), version (1), count (1), base time (4), sequence (2), CRC-16 (2)
+ *   record:  seconds since the previous record (2), temperature (2), humidity (2), dewpoint (2)
+ *
+ * A block with a record from any sensor but the first is written as version \a BINLOG_VERSION_TAGGED instead, with
+ * the sensor's index (1) after the delta in every record. Logs from a single sensor stay as compact as ever.
+ *
+ * The first record's time is the base time, so its delta is 0. The CRC covers the first ten bytes of the header and
+ * all of the records. The sequence number goes up by one for each block, so a decoder can tell when blocks are lost.
+ * A record that is more than 65535 s after the previous one, or does not fit, needs a new block.
+ */
+class BinLogBlock
+{
+public:
+    BinLogBlock();
+
+    /*!
+     * \brief add appends a record to the block
+     * \return false if the block is full, or \a record is too far from the last record to be delta encoded.
+     * Encode the block with \sa encode, then add the record again.
+     */
+    bool add(const BinLogRecord &record);
+
+    //! count is the number of records in the block
+    uint8_t count() const { return m_count; }
+
+    //! encodedSize is the number of bytes \sa encode will write
+    uint16_t encodedSize() const;
+
+    /*!
+     * \brief encode writes the block, and empties it ready for the next one
+     * \param dst is where the block is written, with room for \sa encodedSize bytes
+     * \return the number of bytes written
+     */
+    uint16_t encode(unsigned char *dst);
+
+    //! discard empties the block without encoding it. The sequence number still goes up, so the loss shows up.
+    void discard();
+
+private:
+    unsigned char m_records[BINLOG_BLOCK_RECORDS * BINLOG_TAGGED_RECORD_LEN];  ///< records, always tagged until \sa encode
+    uint8_t  m_count;       ///< records in \a m_records
+    bool     m_tagged;      ///< a record is from a sensor other than 0, so the block has to be tagged
+    uint32_t m_baseTime;    ///< time of the first record
+    uint32_t m_lastTime;    ///< time of the last record
+    uint16_t m_sequence;    ///< sequence number of this block
+};
+
+/*!
+ * \brief binLogDecodeBlock decodes a block of the binary data log
+ * \param src is the start of the block
+ * \param len is the number of bytes available at \a src
+ * \param records is filled in with the block's records, so needs room for \a BINLOG_BLOCK_RECORDS
+ * \param count is set to the number of records
+ * \param sequence is set to the block's sequence number
+ * \return the length of the block, 0 if more than \a len bytes are needed to tell, or -1 if \a src is not the start
+ * of a valid block (no magic, wrong version, or bad CRC)
+ */
+int binLogDecodeBlock(const unsigned char *src, uint32_t len, BinLogRecord *records, uint8_t *count, uint16_t *sequence);
+
+/*!
+ * \brief binLogBlockTimes finds the times of the first and last records of a block, without decoding the records
+ * \param first and \a last are set to the times. Both are the base time if the block has no records
+ * \return as \sa binLogDecodeBlock
+ */
+int binLogBlockTimes(const unsigned char *src, uint32_t len, uint32_t *first, uint32_t *last);
+
+#endif // __BINLOG_H__
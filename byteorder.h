@@ -0,0 +1,37 @@
+#ifndef __BYTEORDER_H__
+#define __BYTEORDER_H__
+
+#include <stdint.h>
+
+/*
+ * Little endian helpers for the binary log, telemetry, alert rules and log export, so their layouts do not depend on
+ * the compiler's struct packing, and read the same on the PC
+ */
+
+//! put16 writes \a v to \a p, low byte first
+inline void put16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+//! put32 writes \a v to \a p, low byte first
+inline void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+//! get16 reads what \sa put16 wrote
+inline uint16_t get16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+//! get32 reads what \sa put32 wrote
+inline uint32_t get32(const unsigned char *p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+#endif // __BYTEORDER_H__
@@ -1,106 +1,139 @@
-#include "circbuff.h"
-
-CircBuff::CircBuff(uint16_t buffSize)
-{
-    // set up the buffer with parsed size
-    m_buffSize = buffSize;
-    m_buf = new unsigned char [m_buffSize];
-    for (int i = 0; i < m_buffSize; i++) {
-        m_buf[i] = 0;
-    }
-
-    // init indexes
-    m_start = 0;
-    m_end   = 0;
-}
-
-CircBuff::~CircBuff()
-{
-    delete m_buf;
-}
-
-void CircBuff::putc(unsigned char c)
-{
-    // get the remaining space left in the buffer by checking end and start idx
-    uint16_t remSize = remainingSize();
-
-    // check we have enough room for the new array passed in
-    if (remSize == 0) {
-        return;
-    }
-
-    // else copy the byte in
-    m_buf[m_end++] = c;
-    if (m_end == m_buffSize) {
-        m_end = 0;  // wrap around
-    }
-
-}
-
-void CircBuff::add(unsigned char *s)
-{
-    // check if can write? How to check if we have connected.
-    uint16_t sSize = 0, i = 0, j = 0;
-
-    // get the length of the passed array (it should be null terminated, but include max buffer size for caution)
-    for (sSize = 0; (sSize < m_buffSize) && (s[sSize] != 0); sSize++);
-
-    // get the remaining space left in the buffer by checking end and start idx
-    uint16_t remSize = remainingSize();
-
-    // check we have enough room for the new array passed in
-    if (sSize > remSize) {
-        return;
-    }
-
-    // copy the array in
-    for (i = 0; i < sSize; i++) {
-        m_buf[m_end++] = s[i];
-        if (m_end == m_buffSize) {
-            m_end = 0;  // wrap around
-        }
-    }
-}
-
-uint16_t CircBuff::remainingSize()
-{
-    // get the remaining space left in the buffer by checking end and start idx
-    uint16_t retval = 0;
-    if (m_start == m_end) {
-        retval = m_buffSize;
-    }
-    else if (m_start < m_end) {
-        // the distance between the start and end point
-        // subtract that from the total length of the buffer
-        retval = m_buffSize - (m_end - m_start);
-    }
-    else {
-        // the amount of space left is whatever is between the end point and the start point
-        retval = m_start - m_end;
-    }
-    return retval;
-}
-
-uint16_t CircBuff::read(unsigned char *s, uint16_t len)
-{
-    if (m_start == m_end) {
-        return 0; // there is nothing stored in the circular buffer
-    }
-
-    // start copying the desired amount over
-    for (int i = 0; i < len; i++) {
-        s[i] = m_buf[m_start++];
-        
-        if (m_start == m_buffSize) {
-            m_start = 0;    // wrap start pointer
-        }
-
-        if (m_start == m_end) {
-            s[++i] = 0;
-            return (i); // we have reached the end of the buffer
-        }
-    }
-    return len;
-}
-
-
+#include "circbuff.h"
+
+CircBuffBase::CircBuffBase(unsigned char *buf, uint16_t size)
+{
+    // the size is a power of two, so that indexes can be masked rather than compared
+    m_buf  = buf;
+    m_mask = (uint16_t)(size - 1);
+    memset(m_buf, 0, size);
+
+    // init indexes
+    m_start = 0;
+    m_end   = 0;
+
+    m_overflows = 0;
+}
+
+bool CircBuffBase::putc(unsigned char c)
+{
+    uint16_t end = m_end;
+
+    // check there is room for the byte (m_start may be moved by the consumer at any time)
+    if ((uint16_t)(end - m_start) > m_mask) {
+        m_overflows++;
+        return false;
+    }
+
+    m_buf[end & m_mask] = c;
+
+    // make sure the byte is in memory before the consumer can see the new end index
+    __DMB();
+    m_end = end + 1;
+    return true;
+}
+
+bool CircBuffBase::add(const unsigned char *s)
+{
+    size_t sSize = strlen((const char*)s);
+
+    // check we have enough room for the whole array passed in
+    if (sSize > remainingSize()) {
+        m_overflows++;
+        return false;
+    }
+
+    write(s, (uint16_t)sSize);
+    return true;
+}
+
+uint16_t CircBuffBase::write(const unsigned char *s, uint16_t len)
+{
+    uint16_t end = m_end;
+    uint16_t space = (uint16_t)(m_mask + 1 - (uint16_t)(end - m_start));
+
+    if (len > space) {
+        len = space;
+        m_overflows++;
+    }
+
+    // copy up to the end of the array, then whatever is left to the start of it
+    uint16_t idx = end & m_mask;
+    uint16_t first = (uint16_t)(m_mask + 1 - idx);
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&m_buf[idx], s, first);
+    memcpy(&m_buf[0], s + first, len - first);
+
+    // publish the data to the consumer only once it has all been copied
+    __DMB();
+    m_end = end + len;
+    return len;
+}
+
+uint16_t CircBuffBase::read(unsigned char *s, uint16_t len)
+{
+    uint16_t start = m_start;
+    uint16_t avail = (uint16_t)(m_end - start);
+
+    if (len > avail) {
+        len = avail;
+    }
+
+    // make sure the data is not read before the end index that covers it
+    __DMB();
+
+    uint16_t idx = start & m_mask;
+    uint16_t first = (uint16_t)(m_mask + 1 - idx);
+    if (first > len) {
+        first = len;
+    }
+    memcpy(s, &m_buf[idx], first);
+    memcpy(s + first, &m_buf[0], len - first);
+
+    // only hand the space back to the producer once it has been copied out
+    __DMB();
+    m_start = start + len;
+    return len;
+}
+
+uint16_t CircBuffBase::peek(const unsigned char **p) const
+{
+    uint16_t start = m_start;
+    uint16_t avail = (uint16_t)(m_end - start);
+
+    // make sure the data is not read before the end index that covers it
+    __DMB();
+
+    // only the run up to the end of the array is contiguous
+    uint16_t idx = start & m_mask;
+    uint16_t first = (uint16_t)(m_mask + 1 - idx);
+    *p = &m_buf[idx];
+    return (avail < first) ? avail : first;
+}
+
+void CircBuffBase::consume(uint16_t len)
+{
+    // only hand the space back to the producer once the caller is finished with it
+    __DMB();
+    m_start = m_start + len;
+}
+
+uint16_t CircBuffBase::reserve(unsigned char **p)
+{
+    uint16_t end = m_end;
+    uint16_t space = (uint16_t)(m_mask + 1 - (uint16_t)(end - m_start));
+
+    // only the free run up to the end of the array is contiguous
+    uint16_t idx = end & m_mask;
+    uint16_t first = (uint16_t)(m_mask + 1 - idx);
+    *p = &m_buf[idx];
+    return (space < first) ? space : first;
+}
+
+void CircBuffBase::commit(uint16_t len)
+{
+    // publish the data to the consumer only once it has all been written
+    __DMB();
+    m_end = m_end + len;
+}
@@ -1,46 +1,132 @@
-#ifndef __CIRC_BUFF_H__
-#define __CIRC_BUFF_H__
-
-#include "mbed.h"
-
-/*!
- * \brief The CircBuff class writes in and reads out byte arrays into a circular buffer
- */
-class CircBuff {
-public:
-    CircBuff(uint16_t buffSize = 256);
-    ~CircBuff();
-
-    /*!
-     * \brief putc adds a single byte, \a c, into the array
-     * \param c is the byte copied into the circular buffer.
-     */
-    void putc(unsigned char c);
-
-    /*!
-     * \brief add adds \a s into the buffer, up until the NULL byte
-     * \param s is the byte array copied into the buffer
-     */
-    void add(unsigned char *s);
-
-    /*!
-     * \brief read puts the current data from the buffer into \a s
-     * \param s is the reference buffer to copy current data into. Caller's responsibility to make it the correct size
-     * \param len is the number of bytes to copy into \a s
-     * \return the number of bytes copied into \a s. Will be less than \a len if there was less data in the buffer.
-     */
-    uint16_t read(unsigned char *s, uint16_t len);
-    bool dataAvailable() { return (m_start != m_end); }
-    
-
-private:
-    uint16_t m_start;       ///< The start index of the circular buffer, where the current data starts
-    uint16_t m_end;         ///< The end index, where the current data goes to
-    unsigned char *m_buf;   ///< the byte array
-    uint16_t m_buffSize;    ///< size of \a m_buf
-    
-    // helper
-    uint16_t remainingSize();
-};
-
-#endif // __CIRC_BUFF_H__
+#ifndef __CIRC_BUFF_H__
+#define __CIRC_BUFF_H__
+
+#include "mbed.h"
+
+#define CIRCBUFF_MAX_SIZE 32768u    // largest capacity the free running 16 bit indexes can address
+
+/*!
+ * \brief The CircBuffBase class writes in and reads out byte arrays into a circular buffer
+ *
+ * The buffer is a single producer, single consumer ring. One context (e.g. a UART or USB receive interrupt)
+ * may write into it while another context (e.g. a handler's \a run function) reads out of it, without
+ * disabling interrupts. Only the producer moves \a m_end and only the consumer moves \a m_start.
+ *
+ * The capacity is always a power of two, so the indexes run freely and are masked on access. This means the
+ * whole capacity is usable and the fill level is simply the difference between the two indexes.
+ *
+ * The storage belongs to \a CircBuff, which is sized at compile time. This class is the code, which is shared by
+ * buffers of every size, and is what a function that works on any of them takes.
+ */
+class CircBuffBase {
+public:
+
+    /*!
+     * \brief putc adds a single byte, \a c, into the array
+     * \param c is the byte copied into the circular buffer.
+     * \return true if the byte was added, false if the buffer was full and the byte was dropped
+     */
+    bool putc(unsigned char c);
+
+    /*!
+     * \brief add adds \a s into the buffer, up until the NULL byte
+     * The string is only added if all of it fits, so that messages are never split.
+     * \param s is the byte array copied into the buffer
+     * \return true if the string was added, false if there was not enough room and it was dropped
+     */
+    bool add(const unsigned char *s);
+
+    /*!
+     * \brief write copies up to \a len bytes from \a s into the buffer, using at most two block copies
+     * \param s is the data to copy in
+     * \param len is the number of bytes in \a s
+     * \return the number of bytes copied in. Will be less than \a len if the buffer filled up.
+     */
+    uint16_t write(const unsigned char *s, uint16_t len);
+
+    /*!
+     * \brief read copies the current data from the buffer into \a s, using at most two block copies
+     * \param s is the reference buffer to copy current data into. Caller's responsibility to make it the correct size
+     * \param len is the number of bytes to copy into \a s
+     * \return the number of bytes copied into \a s. Will be less than \a len if there was less data in the buffer.
+     * \a s is not NULL terminated.
+     */
+    uint16_t read(unsigned char *s, uint16_t len);
+
+    /*!
+     * \brief peek gives the consumer direct access to the oldest contiguous run of data, without copying it
+     * \param p is set to the start of the readable region
+     * \return the number of bytes readable at \a p. This may be less than \a dataSize when the data wraps,
+     * in which case the rest is available from a second peek after \a consume.
+     */
+    uint16_t peek(const unsigned char **p) const;
+
+    /*!
+     * \brief consume releases \a len bytes that have been used directly from \a peek
+     * \param len is the number of bytes to release, must not be more than \a peek returned
+     */
+    void consume(uint16_t len);
+
+    /*!
+     * \brief reserve gives the producer direct access to the contiguous free region, so data can be formatted in place
+     * \param p is set to the start of the writable region
+     * \return the number of bytes writable at \a p. This may be less than \a remainingSize when the free space wraps.
+     */
+    uint16_t reserve(unsigned char **p);
+
+    /*!
+     * \brief commit publishes \a len bytes that have been written directly into the region from \a reserve
+     * \param len is the number of bytes to publish, must not be more than \a reserve returned
+     */
+    void commit(uint16_t len);
+
+    bool dataAvailable() const { return (m_start != m_end); }
+
+    //! dataSize is the number of bytes waiting to be read
+    uint16_t dataSize() const { return (uint16_t)(m_end - m_start); }
+
+    //! remainingSize is the number of bytes that can be written before the buffer is full
+    uint16_t remainingSize() const { return (uint16_t)(m_mask + 1 - dataSize()); }
+
+    //! size is the capacity of the buffer
+    uint16_t size() const { return (uint16_t)(m_mask + 1); }
+
+    //! overflows is the number of \a putc, \a add and \a write calls that could not fit all of their data in
+    uint32_t overflows() const { return m_overflows; }
+
+    //! overflow counts data the producer dropped itself, because it checked \a remainingSize and it would not fit
+    void overflow() { m_overflows++; }
+
+protected:
+    /*!
+     * \param buf is the storage, which is not copied
+     * \param size is its length, a power of two up to \a CIRCBUFF_MAX_SIZE
+     */
+    CircBuffBase(unsigned char *buf, uint16_t size);
+
+private:
+    volatile uint16_t m_start;  ///< Free running read index, only moved by the consumer
+    volatile uint16_t m_end;    ///< Free running write index, only moved by the producer
+    unsigned char *m_buf;       ///< the byte array
+    uint16_t m_mask;            ///< capacity of \a m_buf minus one, used to wrap the indexes
+    uint32_t m_overflows;       ///< producer side count of data that did not fit
+};
+
+/*!
+ * \brief The CircBuff class is a \a CircBuffBase with its storage in the object, so it needs no allocation
+ *
+ * \tparam N is the capacity in bytes, which has to be a power of two up to \a CIRCBUFF_MAX_SIZE, or it does not compile
+ */
+template <uint16_t N>
+class CircBuff : public CircBuffBase {
+public:
+    CircBuff() : CircBuffBase(m_storage, N) {}
+
+private:
+    // an array of negative size, if N will not do
+    typedef char SizeIsPowerOfTwo[((N > 0) && ((N & (N - 1)) == 0) && (N <= CIRCBUFF_MAX_SIZE)) ? 1 : -1];
+
+    unsigned char m_storage[N];
+};
+
+#endif // __CIRC_BUFF_H__
@@ -1,11 +1,69 @@
-#ifndef CONFIG_H_
-#define CONFIG_H_
-
-/*
- * This file contains global definitions to configure the program
- */
-
-// uncomment this to continue development and testing with GPRS
-// #define ENABLE_GPRS_TESTING
-
-#endif /* CONFIG_H_ */
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+/*
+ * This file contains global definitions to configure the program
+ */
+
+// uncomment this to continue development and testing with GPRS
+// #define ENABLE_GPRS_TESTING
+
+// uncomment this to time every handler's run function. The report is printed over USB when 'p' is received,
+// and written to the SD syslog every PROFILER_LOG_PERIOD_MS. Costs about 1.3 KB of RAM.
+// #define ENABLE_PROFILING
+#define PROFILER_LOG_PERIOD_MS  3600000u    // one hour
+
+// uncomment this to sleep the MCU between samples. When nothing is due for at least LOWPOWER_DEEPSLEEP_MIN_MS and no
+// handler needs its clocks kept running (USB connected, SIM900 powered, a sensor being read), the MCU deep-sleeps
+// until an alarm of the DS1337 on RTC_ALARM_PIN, otherwise it sleeps until the next interrupt. The alarm is to the
+// second, so a deadline may be met up to LOWPOWER_LATE_MS late, by deep-sleeping to the second after it rather than
+// sleeping with the clocks running from the second before. The heartbeat LED becomes a short blink. 'w' over USB
+// prints how long each handler has kept the MCU awake.
+// #define ENABLE_LOW_POWER
+#define LOWPOWER_DEEPSLEEP_MIN_MS   500u    // shorter waits are not worth the I2C to program the alarm
+#ifndef LOWPOWER_LATE_MS
+#define LOWPOWER_LATE_MS        1000u       // 0 to meet every deadline to the ms
+#endif
+#ifndef RTC_ALARM_PIN
+#define RTC_ALARM_PIN           P0_7        // the DS1337's INTA, open drain, active low
+#endif
+
+// the DS1337 is read when time() is first called, and ClockHandler matches time() to the start of one of its seconds
+// then and every RTC_RESYNC_MS after that. time() is worked out from the ms time base in between. Each resync corrects
+// the time base for the drift of its crystal against the DS1337's. 't' over USB prints how many reads have been saved,
+// and the drift
+#define RTC_RESYNC_MS           3600000u    // one hour
+
+// uncomment this to log measurements to /sd/data.bin in the binary format described in binlog.h, instead of
+// /sd/data.csv. Tools/binlog2csv turns it back into the CSV. A block is written when it is full, or
+// SD_BINLOG_BLOCK_AGE_MS after its first measurement, so that is the most that can be lost on power down.
+// #define SD_BINARY_LOG
+#define SD_BINLOG_BLOCK_AGE_MS  60000u      // one minute
+
+// the data file is written a 512 byte sector at a time. A part filled sector is written out this long after its
+// first byte came in, so this is the most data that can be lost on power down
+#define SD_FLUSH_AGE_MS         60000u      // one minute
+
+// the pins a DHT22 is connected to, one for each sensor, up to SAMPLER_MAX_SENSORS of them. They all share the
+// Grove power line. Sensor 0 is the one the alerts, history and status SMS are about; the others are logged, tagged
+// with their index. Each is read every SENSOR_PERIOD_MS, their readings spread out over the period
+#ifndef SENSOR_DHT22_PINS
+#define SENSOR_DHT22_PINS       P1_14
+#endif
+#define SENSOR_PERIOD_MS        3000u       // three seconds
+
+// the alert rules are read from ALERT_RULES_FILE at startup, a table written by Tools/alertrules.cpp. If it is not
+// there, the one rule is sensor 0's humidity at or above ALERT_HUMIDITY_CENTI for ALERT_SUSTAIN_S, clearing once
+// it is ALERT_HYSTERESIS_CENTI below that, and raised no more than once every ALERT_QUIET_MIN. Alerts are printed
+// over USB, and with ENABLE_GPRS_TESTING sent by SMS to each of the comma separated ALERT_RECIPIENTS
+#define ALERT_RULES_FILE        "/sd/alerts.bin"
+#define ALERT_HUMIDITY_CENTI    8000        // 80 pc
+#define ALERT_HYSTERESIS_CENTI  500u        // 5 pc
+#define ALERT_SUSTAIN_S         300u        // five minutes
+#define ALERT_QUIET_MIN         60u         // one hour
+#define ALERT_RULE_SLOTS        8u          // most rules in the table at ALERT_RULES_FILE, a longer one is not loaded
+#ifndef ALERT_RECIPIENTS
+#define ALERT_RECIPIENTS        ""
+#endif
+
+#endif /* CONFIG_H_ */
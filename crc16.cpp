@@ -0,0 +1,17 @@
+#include "crc16.h"
+
+// CRC of each nibble value, for polynomial 0x1021
+static const uint16_t crcTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t crc16(const unsigned char *data, uint32_t len, uint16_t crc)
+{
+    while (len--) {
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
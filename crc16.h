@@ -0,0 +1,21 @@
+#ifndef __CRC16_H__
+#define __CRC16_H__
+
+#include <stdint.h>
+
+#define CRC16_INIT  0xFFFFu     // initial value for \sa crc16
+
+/*!
+ * \brief crc16 computes the CRC-16/CCITT-FALSE (polynomial 0x1021) of a block of data
+ *
+ * It uses a 16 entry table, a nibble at a time, which is a fair trade between flash and speed on the M0.
+ * To checksum data in pieces, pass the result of one call as \a crc to the next.
+ *
+ * \param data is the data to checksum
+ * \param len is the number of bytes in \a data
+ * \param crc is \a CRC16_INIT to start a new checksum, or the result so far
+ * \return the updated CRC
+ */
+uint16_t crc16(const unsigned char *data, uint32_t len, uint16_t crc = CRC16_INIT);
+
+#endif // __CRC16_H__
@@ -0,0 +1,96 @@
+#include "dht22.h"
+#include "fixedpoint.h"
+
+uint32_t Dht22Reader::s_falls[DHT22_EDGES];
+
+eError dht22Decode(const uint32_t *falls, uint8_t count, uint16_t *humidityWord, uint16_t *temperatureWord)
+{
+    if (count == 0) {
+        return ERROR_NOT_PRESENT;
+    }
+    if ((count > 1) && ((falls[1] - falls[0]) > DHT22_RESPONSE_MAX)) {
+        return ERROR_ACK_TOO_LONG;
+    }
+    if (count < DHT22_EDGES) {
+        return ERROR_DATA_TIMEOUT;
+    }
+
+    // each bit is from one falling edge to the next
+    uint8_t bytes[5] = {0, 0, 0, 0, 0};
+    for (uint8_t i = 0; i < 40; i++) {
+        uint32_t period = falls[i + 2] - falls[i + 1];
+        if ((period < DHT22_BIT_MIN) || (period > DHT22_BIT_MAX)) {
+            return ERROR_DATA_TIMEOUT;
+        }
+        bytes[i >> 3] = (uint8_t)((bytes[i >> 3] << 1) | ((period >= DHT22_BIT_ONE) ? 1 : 0));
+    }
+
+    if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4]) {
+        return ERROR_CHECKSUM;
+    }
+
+    *humidityWord    = (uint16_t)((bytes[0] << 8) | bytes[1]);
+    *temperatureWord = (uint16_t)((bytes[2] << 8) | bytes[3]);
+    return ERROR_NONE;
+}
+
+Dht22Reader::Dht22Reader(PinName pin) : m_pin(pin), m_edges(pin)
+{
+    m_capturing = false;
+    m_count     = 0;
+
+    m_pin.mode(PullUp);
+    m_pin.input();          // the line idles high
+    m_edges.fall(this, &Dht22Reader::onFall);
+}
+
+void Dht22Reader::start()
+{
+    m_capturing = false;
+    m_count     = 0;
+
+    // the start signal: hold the line low, then let it go and let the sensor answer
+    m_pin.output();
+    m_pin.write(0);
+    m_release.attach_us(this, &Dht22Reader::onRelease, DHT22_START_US);
+}
+
+eError Dht22Reader::result(uint16_t *humidityWord, uint16_t *temperatureWord)
+{
+    m_release.detach();
+    m_capturing = false;
+    m_pin.input();          // in case the release never happened
+    return dht22Decode(s_falls, m_count, humidityWord, temperatureWord);
+}
+
+void Dht22Reader::onRelease()
+{
+    m_capturing = true;
+    m_pin.input();
+}
+
+void Dht22Reader::onFall()
+{
+    if (m_capturing && (m_count < DHT22_EDGES)) {
+        s_falls[m_count] = us_ticker_read();
+        m_count = m_count + 1;
+    }
+}
+
+uint16_t Dht22Sensor::start()
+{
+    m_reader.start();
+    return DHT22_READ_MS;
+}
+
+int Dht22Sensor::collect(int16_t *value)
+{
+    uint16_t humidityWord, temperatureWord;
+    eError error = m_reader.result(&humidityWord, &temperatureWord);
+    if (error == ERROR_NONE) {
+        value[0] = dht22CentiCelcius(temperatureWord);
+        value[1] = dht22CentiHumidity(humidityWord);
+        value[2] = dewpointCenti(value[0], value[1]);
+    }
+    return (int)error;
+}
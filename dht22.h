@@ -0,0 +1,89 @@
+#ifndef __DHT22_H__
+#define __DHT22_H__
+
+#include "mbed.h"
+#include "DHT.h"    // for the eError codes, so errors are reported the same as the DHT library reported them
+#include "sensor.h"
+
+#define DHT22_EDGES         42u     // falling edges in a transaction: the response, 40 data bits, and the end
+#define DHT22_START_US      1100u   // how long the start signal holds the line low (at least 1 ms)
+#define DHT22_READ_MS       10u     // the whole transaction is over well within this
+#define DHT22_RESPONSE_MAX  200u    // longest from the response's falling edge to the first bit's (80 + 80 us)
+#define DHT22_BIT_MIN       60u     // shortest falling edge to falling edge for a bit (50 us low, 26 us high)
+#define DHT22_BIT_MAX       160u    // longest (50 us low, 70 us high)
+#define DHT22_BIT_ONE       100u    // a bit at least this long is a 1
+
+/*!
+ * \brief dht22Decode decodes the falling edges of a DHT22 transaction
+ *
+ * After the start signal is released, the sensor pulls the line low for 80 us and high for 80 us, then sends 40
+ * bits, each 50 us low followed by 26 us high for a 0 or 70 us high for a 1, and finally pulls the line low to end.
+ * So the time from each falling edge to the next, from the second edge on, is a bit: about 77 us for a 0 and 120 us
+ * for a 1. The bits are the humidity word, the temperature word, and a checksum byte, high bit first.
+ *
+ * \param falls are the us_ticker_read() times of the falling edges, from the first one after the start was released
+ * \param count is the number of edges in \a falls
+ * \param humidityWord is set to the humidity word, for \sa dht22CentiHumidity
+ * \param temperatureWord is set to the temperature word, for \sa dht22CentiCelcius
+ * \return ERROR_NONE, ERROR_NOT_PRESENT if there were no edges, ERROR_ACK_TOO_LONG if the response was too long,
+ * ERROR_DATA_TIMEOUT if there were too few edges or a bit was out of range, or ERROR_CHECKSUM
+ */
+eError dht22Decode(const uint32_t *falls, uint8_t count, uint16_t *humidityWord, uint16_t *temperatureWord);
+
+/*!
+ * \brief The Dht22Reader class reads the DHT22 without blocking
+ *
+ * \sa start pulls the line low for the start signal, and a Timeout releases it. From then on an interrupt timestamps
+ * every falling edge, which is all the CPU time the transaction takes. \sa result is called once the transaction is
+ * over, \a DHT22_READ_MS after the start, and decodes the edges with \sa dht22Decode.
+ *
+ * An edge that is held up by another interrupt for more than about 20 us can be misread, which shows up as a
+ * checksum error, so the reading is retried like any other error.
+ *
+ * The edge times are kept in one buffer shared by all the readers, as only one transaction is read at a time (see
+ * \a Sensor), which saves 168 bytes of RAM for each DHT22 after the first.
+ */
+class Dht22Reader
+{
+public:
+    Dht22Reader(PinName pin);
+
+    //! start begins a transaction
+    void start();
+
+    /*!
+     * \brief result ends the transaction and decodes it
+     * \return as \sa dht22Decode
+     */
+    eError result(uint16_t *humidityWord, uint16_t *temperatureWord);
+
+private:
+    DigitalInOut m_pin;         ///< drives the start signal
+    InterruptIn  m_edges;       ///< the same pin, timestamping the sensor's falling edges
+    Timeout      m_release;     ///< ends the start signal
+
+    volatile bool    m_capturing;           ///< edges are being recorded
+    volatile uint8_t m_count;               ///< edges in \a s_falls
+    static uint32_t  s_falls[DHT22_EDGES];  ///< when each falling edge came in, from us_ticker_read()
+
+    void onRelease();           // Timeout: release the line and start recording
+    void onFall();              // interrupt: record a falling edge
+};
+
+/*!
+ * \brief The Dht22Sensor class is a DHT22 on a pin, as a \a Sensor of kind sensor_Dht22
+ */
+class Dht22Sensor : public Sensor
+{
+public:
+    Dht22Sensor(PinName pin) : m_reader(pin) {}
+
+    uint8_t kind() const { return sensor_Dht22; }
+    uint16_t start();
+    int collect(int16_t *value);
+
+private:
+    Dht22Reader m_reader;
+};
+
+#endif // __DHT22_H__
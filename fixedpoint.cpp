@@ -0,0 +1,73 @@
+#include "fixedpoint.h"
+
+#define LN2_Q16             45426       // ln(2) in Q16
+#define LN_10000_Q16        603609      // ln(10000) in Q16, to take centi humidity to a fraction
+#define MAGNUS_B_X100       1762        // b, times 100
+#define MAGNUS_B_Q12        72172       // b, in Q12
+#define MAGNUS_C_CENTI      24312       // c, in hundredths of a degC
+
+// ln(1 + i/32) in Q16, for i = 0 to 32
+static const uint16_t lnTable[33] = {
+    0,     2017,  3973,  5873,  7719,  9515,  11262, 12965, 14624, 16242, 17821,
+    19364, 20870, 22343, 23783, 25193, 26573, 27924, 29248, 30546, 31818, 33067,
+    34292, 35494, 36675, 37835, 38975, 40095, 41196, 42280, 43345, 44394, 45426
+};
+
+int16_t dht22CentiCelcius(uint16_t word)
+{
+    int16_t tenths = (int16_t)(word & 0x7FFF);
+    return (word & 0x8000) ? (int16_t)(-tenths * 10) : (int16_t)(tenths * 10);
+}
+
+int16_t dht22CentiHumidity(uint16_t word)
+{
+    return (int16_t)(word * 10);
+}
+
+int32_t lnQ16(uint32_t x)
+{
+    // scale x into [2^14, 2^15), so that x = m * 2^(14 + exponent) with m in [1, 2)
+    int32_t exponent = 0;
+    while (x >= (1u << 15)) {
+        x >>= 1;
+        exponent++;
+    }
+    while (x < (1u << 14)) {
+        x <<= 1;
+        exponent--;
+    }
+
+    // ln(m) from the table, interpolating with the 9 bits below the index
+    uint32_t offset = x - (1u << 14);
+    uint32_t i    = offset >> 9;
+    uint32_t frac = offset & 0x1FF;
+    int32_t lnm = lnTable[i] + (int32_t)(((lnTable[i + 1] - lnTable[i]) * frac) >> 9);
+
+    return lnm + (14 + exponent) * LN2_Q16;
+}
+
+int16_t dewpointCenti(int16_t centiCelcius, int16_t centiHumidity)
+{
+    if (centiHumidity < 1) {
+        centiHumidity = 1;
+    }
+    int32_t den = MAGNUS_C_CENTI + centiCelcius;    // c + T, in hundredths
+    if (den <= 0) {
+        return centiCelcius;                        // far below anything the sensor can measure
+    }
+
+    // gamma = ln(RH) + b.T / (c + T), in Q12. ln(RH) is the log of the fraction, so ln(centi) - ln(10000)
+    int32_t gamma = (lnQ16(centiHumidity) - LN_10000_Q16) / 16;
+
+    // 100.b.T / (c + T) is taken to Q12 a part at a time, so it does not overflow 32 bits: the whole part, then the
+    // remainder. Both have the sign of T.
+    int32_t n = MAGNUS_B_X100 * centiCelcius;
+    int32_t q = n / den;
+    int32_t r = n % den;
+    gamma += ((q * 4096) + ((r * 4096) / den)) / 100;
+
+    // dewpoint = c.gamma / (b - gamma), rounded to the nearest hundredth
+    int32_t num = MAGNUS_C_CENTI * gamma;
+    int32_t d   = MAGNUS_B_Q12 - gamma;
+    return (int16_t)((num + ((num < 0) ? -(d / 2) : (d / 2))) / d);
+}
@@ -0,0 +1,47 @@
+#ifndef __FIXED_POINT_H__
+#define __FIXED_POINT_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Integer arithmetic for measurements, so nothing on the measurement path needs the soft-float library.
+ * The M0 has no FPU, and no divide instruction either, so divisions are kept to one or two per calculation.
+ *
+ * Measurements are held in hundredths of a unit ("centi"): 2345 is 23.45 degC or 23.45 pc.
+ */
+
+// print a centi value with printf as if it were %4.2f, e.g. printf("T " CENTI_FMT, CENTI_ARGS(t)). Evaluates v three times
+#define CENTI_FMT       "%s%d.%02d"
+#define CENTI_ARGS(v)   (((v) < 0) ? "-" : ""), (abs(v) / 100), (abs(v) % 100)
+
+/*!
+ * \brief dht22CentiCelcius decodes the temperature word sent by the DHT22: tenths of a degC, with the top bit as the sign
+ * \param word is the two temperature bytes, high byte first
+ * \return the temperature in hundredths of a degC
+ */
+int16_t dht22CentiCelcius(uint16_t word);
+
+/*!
+ * \brief dht22CentiHumidity decodes the humidity word sent by the DHT22: tenths of a percent
+ * \param word is the two humidity bytes, high byte first
+ * \return the relative humidity in hundredths of a percent
+ */
+int16_t dht22CentiHumidity(uint16_t word);
+
+/*!
+ * \brief lnQ16 is the natural log of \a x, from a 33 entry table with linear interpolation
+ * \param x must be greater than 0
+ * \return ln(x) in Q16 (65536 is 1.0). Within 2e-4 of the exact value
+ */
+int32_t lnQ16(uint32_t x);
+
+/*!
+ * \brief dewpointCenti calculates the dewpoint with the Magnus formula (b = 17.62, c = 243.12 degC), in integers
+ * \param centiCelcius is the temperature, in hundredths of a degC
+ * \param centiHumidity is the relative humidity, in hundredths of a percent. Anything below 0.01 pc is taken as 0.01 pc
+ * \return the dewpoint, in hundredths of a degC
+ */
+int16_t dewpointCenti(int16_t centiCelcius, int16_t centiHumidity);
+
+#endif // __FIXED_POINT_H__
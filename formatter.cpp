@@ -0,0 +1,131 @@
+#include "formatter.h"
+
+#include <string.h>
+
+#define SECONDS_PER_DAY 86400
+
+// "00" to "99", so two digits are one lookup
+static const char twoDigits[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+char *fmtTwoDigits(char *dst, uint8_t value)
+{
+    dst[0] = twoDigits[value * 2];
+    dst[1] = twoDigits[(value * 2) + 1];
+    return dst + 2;
+}
+
+char *fmtCenti(char *dst, int16_t centi)
+{
+    uint32_t v = (uint32_t)centi;
+    if (centi < 0) {
+        *dst++ = '-';
+        v = (uint32_t)(-(int32_t)centi);
+    }
+
+    // v / 100 as a multiply and shift, exact for v up to 43698
+    uint32_t whole = (v * 5243u) >> 19;
+    uint32_t frac  = v - (whole * 100u);
+
+    if (whole >= 100u) {
+        uint32_t hundreds = (whole * 41u) >> 12;    // whole / 100, exact for whole up to 999
+        *dst++ = (char)('0' + hundreds);
+        dst = fmtTwoDigits(dst, (uint8_t)(whole - (hundreds * 100u)));
+    }
+    else if (whole >= 10u) {
+        dst = fmtTwoDigits(dst, (uint8_t)whole);
+    }
+    else {
+        *dst++ = (char)('0' + whole);
+    }
+    *dst++ = '.';
+    return fmtTwoDigits(dst, (uint8_t)frac);
+}
+
+TimestampFormatter::TimestampFormatter()
+{
+    m_dayStart = 0;
+    m_valid    = false;
+    memset(m_date, '0', sizeof(m_date));
+}
+
+char *TimestampFormatter::format(char *dst, time_t t)
+{
+    if (!m_valid || (t < m_dayStart) || ((t - m_dayStart) >= SECONDS_PER_DAY)) {
+        newDay(t);
+    }
+
+    // split the seconds into the day with multiplies and shifts: secs / 3600 is exact for secs below 86400,
+    // and r / 60 for r below 3600
+    uint32_t secs    = (uint32_t)(t - m_dayStart);
+    uint32_t hours   = (secs * 37283u) >> 27;
+    uint32_t r       = secs - (hours * 3600u);
+    uint32_t minutes = (r * 2185u) >> 17;
+
+    memcpy(dst, m_date, sizeof(m_date));
+    dst[8] = ' ';
+    dst = fmtTwoDigits(dst + 9, (uint8_t)hours);
+    dst = fmtTwoDigits(dst, (uint8_t)minutes);
+    return fmtTwoDigits(dst, (uint8_t)(r - (minutes * 60u)));
+}
+
+void TimestampFormatter::newDay(time_t t)
+{
+    struct tm *timeinfo = localtime(&t);
+
+    int year = timeinfo->tm_year + 1900;
+    fmtTwoDigits(m_date,     (uint8_t)(year / 100));
+    fmtTwoDigits(m_date + 2, (uint8_t)(year % 100));
+    fmtTwoDigits(m_date + 4, (uint8_t)(timeinfo->tm_mon + 1));
+    fmtTwoDigits(m_date + 6, (uint8_t)timeinfo->tm_mday);
+
+    m_dayStart = t - ((timeinfo->tm_hour * 3600) + (timeinfo->tm_min * 60) + timeinfo->tm_sec);
+    m_valid    = true;
+}
+
+// the number \a n digits long at \a src, or -1 if they are not all digits
+static int32_t digits(const char *src, uint8_t n)
+{
+    int32_t v = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        if ((src[i] < '0') || (src[i] > '9')) {
+            return -1;
+        }
+        v = (v * 10) + (src[i] - '0');
+    }
+    return v;
+}
+
+bool parseTimestamp(const char *src, uint32_t *t)
+{
+    int32_t year   = digits(src, 4);
+    int32_t month  = digits(src + 4, 2);
+    int32_t day    = digits(src + 6, 2);
+    int32_t hour   = digits(src + 9, 2);
+    int32_t minute = digits(src + 11, 2);
+    int32_t second = digits(src + 13, 2);
+    if ((src[8] != ' ') || (year < 1970) || (month < 1) || (month > 12) || (day < 1) || (day > 31) ||
+        (hour < 0) || (hour > 23) || (minute < 0) || (minute > 59) || (second < 0) || (second > 59)) {
+        return false;
+    }
+
+    // days since 1970 of the date, counting years from March so the leap day is the last day of the year
+    int32_t y   = year - ((month <= 2) ? 1 : 0);
+    int32_t era = y / 400;
+    int32_t yoe = y - (era * 400);
+    int32_t doy = ((153 * (month + ((month > 2) ? -3 : 9))) + 2) / 5 + day - 1;
+    int32_t doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+    int32_t days = (era * 146097) + doe - 719468;
+
+    *t = ((uint32_t)days * SECONDS_PER_DAY) + (uint32_t)((hour * 3600) + (minute * 60) + second);
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef __FORMATTER_H__
+#define __FORMATTER_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define FMT_TIMESTAMP_LEN   15u     // "YYYYMMDD HHMMSS"
+#define FMT_CENTI_MAX       7u      // "-327.68", the longest \sa fmtCenti writes
+
+/*!
+ * \brief The TimestampFormatter class writes "YYYYMMDD HHMMSS" timestamps without localtime() or sprintf()
+ *
+ * The date part only changes once a day, so it is kept already formatted, along with the time the day started.
+ * Within that day the time of day is the seconds since the start of the day, split into hours, minutes and seconds
+ * with multiplies and shifts (the M0 has no divide instruction), and written two digits at a time from a table.
+ * localtime() is only called when the day changes, or time goes backwards.
+ */
+class TimestampFormatter
+{
+public:
+    TimestampFormatter();
+
+    /*!
+     * \brief format writes the timestamp of \a t
+     * \param dst has room for \a FMT_TIMESTAMP_LEN characters. No terminator is written
+     * \return the character after the timestamp
+     */
+    char *format(char *dst, time_t t);
+
+private:
+    time_t m_dayStart;      ///< the start of the day in \a m_date
+    bool   m_valid;         ///< \a m_date and \a m_dayStart have been set
+    char   m_date[8];       ///< YYYYMMDD of that day
+
+    void newDay(time_t t);  // format the date of \a t and find the start of its day
+};
+
+/*!
+ * \brief fmtTwoDigits writes \a value (0 to 99) as two digits
+ * \return the character after them
+ */
+char *fmtTwoDigits(char *dst, uint8_t value);
+
+/*!
+ * \brief fmtCenti writes a value in hundredths of a unit with two decimal places, the same as printf's %4.2f would
+ * with the value in units, e.g. -5 is "-0.05" and 2345 is "23.45"
+ * \param dst has room for \a FMT_CENTI_MAX characters. No terminator is written
+ * \return the character after the value
+ */
+char *fmtCenti(char *dst, int16_t centi);
+
+/*!
+ * \brief parseTimestamp reads back a "YYYYMMDD HHMMSS" timestamp written by \a TimestampFormatter
+ * \param t is set to its seconds since 1970. The target has no time zone, so it is taken as UTC
+ * \return false if \a src does not start with a timestamp
+ */
+bool parseTimestamp(const char *src, uint32_t *t);
+
+#endif // __FORMATTER_H__
@@ -0,0 +1,195 @@
+#include "mbed.h"
+#include "logexport.h"
+#include "binlog.h"
+#include "crc16.h"
+#include "byteorder.h"
+#include "formatter.h"
+
+#include <string.h>
+
+LogExport::LogExport()
+{
+    m_fp          = NULL;
+    m_binary      = false;
+    m_state       = lx_Idle;
+    m_end         = lxend_Done;
+    m_from        = 0;
+    m_to          = 0;
+    m_offset      = 0;
+    m_startOffset = 0;
+    m_fill        = 0;
+    m_taken       = 0;
+    m_seq         = 0;
+}
+
+void LogExport::start(FILE *fp, bool binary, uint32_t from, uint32_t to, uint32_t offset)
+{
+    m_fp          = fp;
+    m_binary      = binary;
+    m_state       = lx_Start;
+    m_end         = lxend_Done;
+    m_from        = from;
+    m_to          = to;
+    m_offset      = offset;
+    m_startOffset = offset;
+    m_fill        = 0;
+    m_taken       = 0;
+    m_seq         = 0;
+}
+
+uint16_t LogExport::next(const unsigned char **frame)
+{
+    unsigned char *payload = m_frame + LOGEXPORT_HEADER_LEN;
+    *frame = m_frame;
+
+    switch (m_state) {
+    case lx_Idle:
+        return 0;
+
+    case lx_Start: {
+        // the file size is only a guide for the PC, to show progress
+        uint32_t size = 0;
+        if (m_fp && (fseek(m_fp, 0, SEEK_END) == 0)) {
+            long end = ftell(m_fp);
+            size = (end > 0) ? (uint32_t)end : 0;
+        }
+        put32(payload, m_from);
+        put32(payload + 4, m_to);
+        payload[8] = m_binary ? 1 : 0;
+        put32(payload + 9, size);
+        if (m_fp) {
+            m_state = lx_Seek;
+        }
+        else {
+            m_end   = lxend_Error;
+            m_state = lx_End;
+        }
+        return seal(lxframe_Start, LOGEXPORT_START_LEN, m_startOffset);
+    }
+
+    case lx_Seek:
+    case lx_Send:
+        for (uint8_t reads = 0; reads < LOGEXPORT_READS_PER_CALL; reads++) {
+            bool more = read();
+
+            // take the whole records that have been read, as far as the end of the range
+            while ((m_taken < m_fill) && (m_state != lx_End)) {
+                uint32_t first, last;
+                bool timed;
+                int len = record(payload + m_taken, m_fill - m_taken, &first, &last, &timed);
+                if (len == 0) {
+                    break;      // the rest of it has not been read yet
+                }
+                if (m_state == lx_Seek) {
+                    // a record without a time counts as older than any, so only an export from 0 has the heading
+                    if ((timed ? last : 0) >= m_from) {
+                        // the range starts at this record, so the payload does too
+                        m_offset += m_taken;
+                        m_fill   -= m_taken;
+                        memmove(payload, payload + m_taken, m_fill);
+                        m_taken = 0;
+                        m_state = lx_Send;
+                        continue;
+                    }
+                }
+                else if (timed && (first > m_to)) {
+                    m_end   = lxend_Done;
+                    m_state = lx_End;
+                    break;
+                }
+                m_taken += len;
+            }
+
+            if (m_state == lx_Seek) {
+                // nothing read so far is in the range, so read on from the first record not skipped yet
+                m_offset += m_taken;
+                m_fill   -= m_taken;
+                memmove(payload, payload + m_taken, m_fill);
+                m_taken = 0;
+                if (!more) {
+                    m_state = lx_End;
+                    return next(frame);
+                }
+                continue;
+            }
+
+            if (!more && (m_state != lx_End)) {
+                m_state = lx_End;   // m_end says why, from read()
+            }
+            if ((m_fill == LOGEXPORT_PAYLOAD_MAX) || (m_state == lx_End)) {
+                if (m_taken == 0) {
+                    return (m_state == lx_End) ? next(frame) : 0;
+                }
+                // the part record after the frame is read again for the next one
+                uint16_t len = seal(lxframe_Data, (uint8_t)m_taken, m_offset);
+                m_offset += m_taken;
+                m_fill  = 0;
+                m_taken = 0;
+                return len;
+            }
+        }
+        return 0;
+
+    case lx_End:
+        payload[0] = m_end;
+        m_state = lx_Idle;
+        return seal(lxframe_End, 1, m_offset);
+    }
+    return 0;
+}
+
+bool LogExport::read()
+{
+    unsigned char *payload = m_frame + LOGEXPORT_HEADER_LEN;
+    if (fseek(m_fp, m_offset + m_fill, SEEK_SET) != 0) {
+        m_end = lxend_Error;
+        return false;
+    }
+    m_fill += fread(payload + m_fill, 1, LOGEXPORT_PAYLOAD_MAX - m_fill, m_fp);
+    if (m_fill < LOGEXPORT_PAYLOAD_MAX) {
+        m_end = ferror(m_fp) ? lxend_Error : lxend_EndOfFile;
+        return false;
+    }
+    return true;
+}
+
+uint16_t LogExport::seal(uint8_t type, uint8_t len, uint32_t offset)
+{
+    put16(m_frame, LOGEXPORT_MAGIC);
+    m_frame[2] = type;
+    m_frame[3] = len;
+    put16(m_frame + 4, m_seq++);
+    put32(m_frame + 6, offset);
+    put16(m_frame + LOGEXPORT_HEADER_LEN + len, crc16(m_frame, LOGEXPORT_HEADER_LEN + len));
+    return LOGEXPORT_HEADER_LEN + len + 2;
+}
+
+/*
+ * The length of the record at p, or 0 if it goes on past the len bytes read so far. timed is set if it has a time,
+ * in which case first and last are set to the times of its first and last measurements. A line without a timestamp
+ * (the CSV heading), or a byte that does not start a block of the binary log, is a record without a time.
+ */
+int LogExport::record(const unsigned char *p, uint16_t len, uint32_t *first, uint32_t *last, bool *timed)
+{
+    *timed = false;
+    if (m_binary) {
+        int blockLen = binLogBlockTimes(p, len, first, last);
+        if (blockLen < 0) {
+            return 1;
+        }
+        *timed = (blockLen > 0);
+        return blockLen;
+    }
+
+    const unsigned char *nl = (const unsigned char*)memchr(p, '\n', len);
+    if (nl == NULL) {
+        // a line longer than a whole payload is not one of ours, so send it on as it is
+        return (len == LOGEXPORT_PAYLOAD_MAX) ? len : 0;
+    }
+    int lineLen = (nl - p) + 1;
+    if ((lineLen > (int)FMT_TIMESTAMP_LEN) && parseTimestamp((const char*)p, first)) {
+        *last  = *first;
+        *timed = true;
+    }
+    return lineLen;
+}
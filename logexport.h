@@ -0,0 +1,104 @@
+#ifndef __LOG_EXPORT_H__
+#define __LOG_EXPORT_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOGEXPORT_MAGIC         0x584Cu     // "LX", the first two bytes of every frame
+#define LOGEXPORT_HEADER_LEN    10u
+#define LOGEXPORT_FRAME_MAX     256u        // four full USB packets
+#define LOGEXPORT_PAYLOAD_MAX   (LOGEXPORT_FRAME_MAX - LOGEXPORT_HEADER_LEN - 2u)
+#define LOGEXPORT_START_LEN     13u         // payload of a start frame
+#define LOGEXPORT_READS_PER_CALL 2u         // file reads in one call of next, so the main loop is not held up
+
+/*!
+ * \brief The logexport_frame_t enum is the type of a frame, its third byte
+ */
+enum logexport_frame_t {
+    lxframe_Start = 'S',    ///< the export has started. Payload: from (4), to (4), binary (1), file size (4)
+    lxframe_Data  = 'D',    ///< whole records of the data file, from the frame's offset in the file
+    lxframe_End   = 'E'     ///< the export has finished. Payload: \a logexport_end_t (1)
+};
+
+/*!
+ * \brief The logexport_end_t enum is why an export finished, the payload of its end frame
+ */
+enum logexport_end_t {
+    lxend_Done,             ///< a record after the end of the range was reached
+    lxend_EndOfFile,        ///< the end of the file was reached. Newer records can be fetched from the end frame's offset
+    lxend_Error             ///< the file could not be opened or read
+};
+
+/*!
+ * \brief The LogExport class cuts a time range of the SD data log into frames, to be streamed to the PC
+ *
+ * The data file is read a payload at a time straight into the frame, and only whole records are sent (CSV lines, or
+ * \a BinLogBlock blocks with SD_BINARY_LOG), so each frame's payload is a run of the file that starts and ends on a
+ * record. The part record left at the end of a read is read again for the next frame, which costs little as it is
+ * still in the file system's sector buffer. Records before the start of the range are read and skipped, the first
+ * record after its end finishes the export, as does the end of the file.
+ *
+ * A frame is, little endian:
+ *
+ *   header:   magic "LX" (2), type (1), payload length (1), sequence (2), file offset (4)
+ *   payload:  up to LOGEXPORT_PAYLOAD_MAX bytes
+ *   trailer:  CRC-16 of the header and payload (2)
+ *
+ * The sequence number starts from 0 with the start frame of each export. A data frame's offset is where its payload
+ * came from in the file, and an end frame's is where the next record would have come from. As a data frame always
+ * ends on a record, a stream that is cut short can be carried on from the offset after the last good frame, by
+ * starting a new export with that offset. The start frame's offset is the offset the export was asked to start from.
+ */
+class LogExport
+{
+public:
+    LogExport();
+
+    /*!
+     * \brief start begins an export, which \sa next then frames. An export in progress is dropped
+     * \param fp is the data file, open for reading, or NULL if it could not be opened. Not closed by \a LogExport
+     * \param binary is true if it is a binary log, otherwise it is CSV
+     * \param from is the time of the first record to send, seconds since 1970
+     * \param to is the time of the last record to send
+     * \param offset is where to start reading the file, 0 or the offset a cut short export got to
+     */
+    void start(FILE *fp, bool binary, uint32_t from, uint32_t to, uint32_t offset);
+
+    /*!
+     * \brief next makes the next frame
+     * \param frame is set to the frame, which stays valid until the next call
+     * \return the length of the frame, or 0 if it is not ready yet, in which case call again later
+     */
+    uint16_t next(const unsigned char **frame);
+
+    //! active is true from \sa start until the end frame has been taken with \sa next
+    bool active() const { return m_state != lx_Idle; }
+
+private:
+    enum state_t {
+        lx_Idle,
+        lx_Start,               ///< the start frame is next
+        lx_Seek,                ///< skipping records before the range
+        lx_Send,                ///< framing records
+        lx_End                  ///< the end frame is next
+    };
+
+    unsigned char m_frame[LOGEXPORT_FRAME_MAX];     ///< the payload is read into place, after the header
+    FILE    *m_fp;
+    bool     m_binary;
+    uint8_t  m_state;           ///< \a state_t
+    uint8_t  m_end;             ///< \a logexport_end_t, once known
+    uint32_t m_from;
+    uint32_t m_to;
+    uint32_t m_offset;          ///< where the first byte of the payload came from in the file
+    uint32_t m_startOffset;     ///< asked for in \a start
+    uint16_t m_fill;            ///< bytes read into the payload
+    uint16_t m_taken;           ///< bytes of whole records at the start of the payload, that are going in the frame
+    uint16_t m_seq;
+
+    bool read();                // read as much of the file as fits after m_fill, false at the end of the file
+    uint16_t seal(uint8_t type, uint8_t len, uint32_t offset);      // put the header and CRC around the payload
+    int record(const unsigned char *p, uint16_t len, uint32_t *first, uint32_t *last, bool *timed);
+};
+
+#endif // __LOG_EXPORT_H__
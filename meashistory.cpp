@@ -0,0 +1,214 @@
+#include "meashistory.h"
+
+#include <string.h>
+
+const uint8_t  MeasHistory::countShift[hist_NumResolutions] = { 0, 4, 9 };
+const uint32_t MeasHistory::period[hist_NumResolutions]     = { 60, 3600, 86400 };
+
+MeasHistory::MeasHistory()
+{
+    clear();
+}
+
+void MeasHistory::clear()
+{
+    memset(m_minutes, 0, sizeof(m_minutes));
+    memset(m_hours, 0, sizeof(m_hours));
+    memset(m_days, 0, sizeof(m_days));
+    memset(m_open, 0, sizeof(m_open));
+    m_started = false;
+}
+
+void MeasHistory::add(uint32_t time, const int16_t values[MEASHIST_QUANTITIES])
+{
+    if (!m_started) {
+        for (int r = 0; r < hist_NumResolutions; r++) {
+            m_open[r].index = time / period[r];
+        }
+        m_started = true;
+    }
+    else if ((time / period[hist_Minute]) < m_open[hist_Minute].index) {
+        // the clock has gone backwards, so the buckets no longer mean anything
+        clear();
+        add(time, values);
+        return;
+    }
+
+    for (int r = 0; r < hist_NumResolutions; r++) {
+        Open &o = m_open[r];
+        uint32_t index = time / period[r];
+        if (index != o.index) {
+            roll((resolution_t)r, index);
+        }
+
+        for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+            if ((o.count == 0) || (values[q] < o.min[q])) {
+                o.min[q] = values[q];
+            }
+            if ((o.count == 0) || (values[q] > o.max[q])) {
+                o.max[q] = values[q];
+            }
+            o.sum[q] += values[q];
+        }
+        o.count++;
+    }
+}
+
+bool MeasHistory::window(resolution_t res, MeasSummary *summary) const
+{
+    const Open &o = m_open[res];
+    *summary = o.closed;
+    if (o.count == 0) {
+        return (summary->count != 0);
+    }
+
+    // combine the open bucket with the summary of the closed ones
+    uint32_t total = summary->count + o.count;
+    for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+        if ((summary->count == 0) || (o.min[q] < summary->min[q])) {
+            summary->min[q] = o.min[q];
+        }
+        if ((summary->count == 0) || (o.max[q] > summary->max[q])) {
+            summary->max[q] = o.max[q];
+        }
+        int64_t sum = (int64_t)summary->mean[q] * summary->count + o.sum[q];
+        summary->mean[q] = (int16_t)(sum / (int64_t)total);
+    }
+    summary->count = total;
+    return true;
+}
+
+bool MeasHistory::bucket(resolution_t res, uint8_t ago, MeasSummary *summary) const
+{
+    const Open &o = m_open[res];
+    if (ago == 0) {
+        if (o.count == 0) {
+            return false;
+        }
+        for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+            summary->min[q]  = o.min[q];
+            summary->max[q]  = o.max[q];
+            summary->mean[q] = (int16_t)(o.sum[q] / (int32_t)o.count);
+        }
+        summary->count = o.count;
+        return true;
+    }
+
+    uint8_t size;
+    const Packed *r = ring(res, &size);
+    if ((ago > size) || (o.index < ago)) {
+        return false;
+    }
+    const Packed &p = r[(o.index - ago) % size];
+    if (p.count == 0) {
+        return false;
+    }
+    for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+        summary->min[q]  = unpack((quantity_t)q, p.min[q]);
+        summary->max[q]  = unpack((quantity_t)q, p.max[q]);
+        summary->mean[q] = unpack((quantity_t)q, p.mean[q]);
+    }
+    summary->count = unpackCount(res, p.count);
+    return true;
+}
+
+MeasHistory::Packed *MeasHistory::ring(resolution_t res, uint8_t *size)
+{
+    return const_cast<Packed*>(static_cast<const MeasHistory*>(this)->ring(res, size));
+}
+
+const MeasHistory::Packed *MeasHistory::ring(resolution_t res, uint8_t *size) const
+{
+    switch (res) {
+    case hist_Minute:
+        *size = MEASHIST_MINUTES;
+        return m_minutes;
+    case hist_Hour:
+        *size = MEASHIST_HOURS;
+        return m_hours;
+    default:
+        *size = MEASHIST_DAYS;
+        return m_days;
+    }
+}
+
+void MeasHistory::roll(resolution_t res, uint32_t index)
+{
+    Open &o = m_open[res];
+    uint8_t size;
+    Packed *r = ring(res, &size);
+
+    // close the open bucket into its slot, and empty the slots of any buckets that were skipped over.
+    // Only the last \a size of them are still in the ring.
+    uint32_t first = ((index - o.index) > size) ? (index - size) : o.index;
+    for (uint32_t i = first; i < index; i++) {
+        Packed &p = r[i % size];
+        if ((i != o.index) || (o.count == 0)) {
+            memset(&p, 0, sizeof(Packed));
+            continue;
+        }
+
+        uint32_t count = (o.count + (1u << countShift[res]) - 1) >> countShift[res];
+        p.count = (count > 255) ? 255 : (uint8_t)count;
+        for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+            p.min[q]  = pack((quantity_t)q, o.min[q]);
+            p.max[q]  = pack((quantity_t)q, o.max[q]);
+            p.mean[q] = pack((quantity_t)q, (int16_t)(o.sum[q] / (int32_t)o.count));
+        }
+    }
+
+    o.index = index;
+    o.count = 0;
+    memset(o.sum, 0, sizeof(o.sum));
+    summariseClosed(res);
+}
+
+void MeasHistory::summariseClosed(resolution_t res)
+{
+    uint8_t size;
+    const Packed *r = ring(res, &size);
+    MeasSummary &s = m_open[res].closed;
+    int64_t sum[MEASHIST_QUANTITIES] = { 0, 0, 0 };
+
+    s.count = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        const Packed &p = r[i];
+        if (p.count == 0) {
+            continue;
+        }
+        uint32_t weight = unpackCount(res, p.count);
+        for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+            int16_t lo = unpack((quantity_t)q, p.min[q]);
+            int16_t hi = unpack((quantity_t)q, p.max[q]);
+            if ((s.count == 0) || (lo < s.min[q])) {
+                s.min[q] = lo;
+            }
+            if ((s.count == 0) || (hi > s.max[q])) {
+                s.max[q] = hi;
+            }
+            sum[q] += (int64_t)unpack((quantity_t)q, p.mean[q]) * weight;
+        }
+        s.count += weight;
+    }
+
+    for (unsigned int q = 0; q < MEASHIST_QUANTITIES; q++) {
+        s.mean[q] = s.count ? (int16_t)(sum[q] / (int64_t)s.count) : 0;
+    }
+}
+
+uint8_t MeasHistory::pack(quantity_t q, int16_t centi)
+{
+    // half units, rounded, with temperatures offset so -40 degC is 0
+    int32_t v = (q == hist_Humidity) ? centi : (centi + 4000);
+    v = (v + 25) / 50;
+    if (v < 0) {
+        return 0;
+    }
+    return (v > 255) ? 255 : (uint8_t)v;
+}
+
+int16_t MeasHistory::unpack(quantity_t q, uint8_t packed)
+{
+    int16_t v = (int16_t)packed * 50;
+    return (q == hist_Humidity) ? v : (v - 4000);
+}
@@ -0,0 +1,121 @@
+#ifndef __MEAS_HISTORY_H__
+#define __MEAS_HISTORY_H__
+
+#include <stdint.h>
+
+#define MEASHIST_MINUTES    15u     // closed one minute buckets kept
+#define MEASHIST_HOURS      24u     // closed one hour buckets kept
+#define MEASHIST_DAYS       7u      // closed one day buckets kept
+#define MEASHIST_QUANTITIES 3u      // temperature, humidity and dewpoint
+
+/*!
+ * \brief The MeasSummary struct is the min, max and mean of each quantity over some time, in hundredths of a unit
+ */
+struct MeasSummary {
+    int16_t  min[MEASHIST_QUANTITIES];
+    int16_t  max[MEASHIST_QUANTITIES];
+    int16_t  mean[MEASHIST_QUANTITIES];
+    uint32_t count;     ///< number of measurements (approximate for a window). The rest is only valid if this is not 0
+};
+
+/*!
+ * \brief The MeasHistory class keeps rollups of recent measurements at three resolutions in a fixed amount of RAM
+ *
+ * Each resolution has an open bucket that is being added to, and a ring of the buckets closed before it, so the
+ * minute window is the current minute and the 15 before it, and so on. An open bucket keeps exact running totals.
+ * When it closes, it is packed into 10 bytes: the min, max and mean of each quantity to half a unit in one byte each
+ * (temperature and dewpoint from -40 to 87.5 degC, humidity from 0 to 127.5 pc), and the count, in units of
+ * 1, 16 or 512 measurements for minute, hour and day buckets. The count is mostly used to weight the means, so it
+ * does not need to be exact, but it does make the counts of windows approximate.
+ *
+ * When a bucket closes, the closed part of its window is summarised again, so \sa window only has to combine that
+ * with the open bucket, and is O(1). \sa add is O(1) except at a rollover, which costs one pass over that ring.
+ *
+ * Time is in seconds since 1970, and buckets line up with UTC minutes, hours and days. If time goes backwards
+ * (the clock is set) the history is cleared.
+ */
+class MeasHistory
+{
+public:
+    MeasHistory();
+
+    enum quantity_t {
+        hist_Celcius,       ///< temperature
+        hist_Humidity,      ///< relative humidity
+        hist_Dewpoint       ///< dewpoint
+    };
+
+    enum resolution_t {
+        hist_Minute,        ///< one minute buckets
+        hist_Hour,          ///< one hour buckets
+        hist_Day,           ///< one day buckets
+        hist_NumResolutions
+    };
+
+    /*!
+     * \brief add a measurement to every resolution
+     * \param time is when it was measured
+     * \param values are the temperature, humidity and dewpoint, in hundredths of a unit, in \a quantity_t order
+     */
+    void add(uint32_t time, const int16_t values[MEASHIST_QUANTITIES]);
+
+    /*!
+     * \brief window summarises the whole history kept at a resolution: the open bucket and all the closed ones
+     * \return false if there are no measurements in the window
+     */
+    bool window(resolution_t res, MeasSummary *summary) const;
+
+    /*!
+     * \brief bucket summarises a single bucket
+     * \param ago is 0 for the open bucket, 1 for the last one closed, and so on
+     * \return false if the bucket is out of range, or has no measurements
+     */
+    bool bucket(resolution_t res, uint8_t ago, MeasSummary *summary) const;
+
+    //! clear empties every bucket
+    void clear();
+
+private:
+    /*!
+     * \brief The Packed struct is a closed bucket
+     */
+    struct Packed {
+        uint8_t count;                          ///< measurements, scaled down by \a countShift
+        uint8_t min[MEASHIST_QUANTITIES];       ///< in half units, offset as \sa pack
+        uint8_t max[MEASHIST_QUANTITIES];
+        uint8_t mean[MEASHIST_QUANTITIES];
+    };
+
+    /*!
+     * \brief The Open struct is a bucket that is still being added to, and the summary of the closed buckets
+     */
+    struct Open {
+        uint32_t index;                         ///< time / period of the bucket
+        uint32_t count;
+        int16_t  min[MEASHIST_QUANTITIES];
+        int16_t  max[MEASHIST_QUANTITIES];
+        int32_t  sum[MEASHIST_QUANTITIES];
+        MeasSummary closed;                     ///< summary of the closed buckets in the window
+    };
+
+    Packed m_minutes[MEASHIST_MINUTES];
+    Packed m_hours[MEASHIST_HOURS];
+    Packed m_days[MEASHIST_DAYS];
+    Open   m_open[hist_NumResolutions];
+    bool   m_started;       ///< false until the first measurement sets the open buckets' indexes
+
+    Packed *ring(resolution_t res, uint8_t *size);
+    const Packed *ring(resolution_t res, uint8_t *size) const;
+
+    void roll(resolution_t res, uint32_t index);    // close the open bucket, and open the one for \a index
+    void summariseClosed(resolution_t res);         // summarise the closed buckets into the open bucket's \a closed
+
+    static const uint8_t countShift[hist_NumResolutions];
+    static const uint32_t period[hist_NumResolutions];
+
+    static uint8_t pack(quantity_t q, int16_t centi);
+    static int16_t unpack(quantity_t q, uint8_t packed);
+    static uint32_t unpackCount(resolution_t res, uint8_t packed) { return (uint32_t)packed << countShift[res]; }
+};
+
+#endif // __MEAS_HISTORY_H__
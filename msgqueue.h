@@ -0,0 +1,83 @@
+#ifndef __MSG_QUEUE_H__
+#define __MSG_QUEUE_H__
+
+#include "mbed.h"
+
+/*!
+ * \brief The MsgQueue class is a fixed capacity FIFO of typed messages, used to pass requests between handlers
+ *
+ * The storage is part of the object, so there is no allocation. When the queue is full, \a push refuses the message
+ * and counts it as dropped, so the producer can see the backpressure and nothing is lost without being accounted for.
+ * The high water mark shows how close the queue has come to filling up, to help size \a N.
+ *
+ * Messages are copied in and out, so \a T should be a plain struct. Not safe to use from an interrupt, as
+ * handlers only post to each other from their \a run functions.
+ *
+ * \tparam T is the message type
+ * \tparam N is the maximum number of messages waiting at once
+ */
+template <typename T, uint8_t N>
+class MsgQueue
+{
+public:
+    MsgQueue() : m_head(0), m_count(0), m_highWater(0), m_drops(0) {}
+
+    /*!
+     * \brief push copies \a msg onto the back of the queue
+     * \return true if it was queued, false if the queue was full and the message was dropped
+     */
+    bool push(const T &msg)
+    {
+        if (m_count >= N) {
+            m_drops++;
+            return false;
+        }
+        m_items[(m_head + m_count) % N] = msg;
+        m_count++;
+        if (m_count > m_highWater) {
+            m_highWater = m_count;
+        }
+        return true;
+    }
+
+    /*!
+     * \brief front gives access to the oldest message without removing it, so it can be passed on before it is popped
+     * \return the oldest message. Only valid when the queue is not \a empty
+     */
+    T &front() { return m_items[m_head]; }
+
+    /*!
+     * \brief pop removes the oldest message
+     * \param msg is set to the removed message, if not NULL
+     * \return true if a message was removed, false if the queue was empty
+     */
+    bool pop(T *msg = 0)
+    {
+        if (m_count == 0) {
+            return false;
+        }
+        if (msg) {
+            *msg = m_items[m_head];
+        }
+        m_head = (m_head + 1) % N;
+        m_count--;
+        return true;
+    }
+
+    bool    empty() const     { return m_count == 0; }
+    bool    full() const      { return m_count >= N; }
+    uint8_t count() const     { return m_count; }
+    uint8_t space() const     { return N - m_count; }
+    uint8_t capacity() const  { return N; }
+    uint8_t highWater() const { return m_highWater; }   ///< most messages that have been waiting at once
+    uint32_t drops() const    { return m_drops; }       ///< number of messages refused because the queue was full
+
+private:
+    T        m_items[N];    ///< the messages, oldest at \a m_head
+    uint8_t  m_head;        ///< index of the oldest message
+    uint8_t  m_count;       ///< number of messages waiting
+    uint8_t  m_highWater;   ///< largest \a m_count seen
+    uint32_t m_drops;       ///< number of refused messages
+};
+
+#endif // __MSG_QUEUE_H__
@@ -0,0 +1,180 @@
+#include "power.h"
+#include "rtc.h"
+
+PowerManager::PowerManager(MyTimers *_timer) : m_timer(_timer), m_alarm(RTC_ALARM_PIN)
+{
+    m_alarmFired = false;
+    m_startMs    = 0;
+    m_startRtc   = 0;
+    m_startPhase = 0;
+    m_alarmRtc   = 0;
+    m_anchored   = false;
+    m_anchorMs   = 0;
+    m_anchorRtc  = 0;
+
+    for (unsigned int i = 0; i < POWER_MAX_SLOTS; i++) {
+        m_names[i]   = NULL;
+        m_awakeUs[i] = 0;
+    }
+    m_numSlots    = 0;
+    m_sleepUs     = 0;
+    m_deepSleepUs = 0;
+    m_deepSleeps  = 0;
+    m_earlyWakes  = 0;
+    m_startedMs   = m_timer->now();
+
+    // INTA is open drain, and stays low until the alarm flag is cleared
+    m_alarm.mode(PullUp);
+    m_alarm.fall(this, &PowerManager::onAlarm);
+#ifdef TARGET_LPC11UXX
+    // pin interrupts only wake the MCU from deep sleep through the start logic. Only the alarm's channel is let
+    // through, so the DHT22 edges cannot wake it. InterruptIn takes the first free channel, so find the one PINTSEL
+    // gives the pin (port 0 pins are 0 to 23, port 1 pins 24 to 55)
+    uint32_t pin = (((uint32_t)RTC_ALARM_PIN >> PORT_SHIFT) * 24u) + ((uint32_t)RTC_ALARM_PIN & 0x1Fu);
+    for (unsigned int ch = 0; ch < 8; ch++) {
+        if (LPC_SYSCON->PINTSEL[ch] == pin) {
+            LPC_SYSCON->STARTERP0 |= (1u << ch);
+            break;
+        }
+    }
+#endif
+    my_rtc_clear_alarm();
+}
+
+int8_t PowerManager::addSlot(const char *name)
+{
+    if (m_numSlots >= POWER_MAX_SLOTS) {
+        return -1;
+    }
+    m_names[m_numSlots] = name;
+    return (int8_t)m_numSlots++;
+}
+
+void PowerManager::charge(int8_t slot, uint32_t us)
+{
+    if ((slot >= 0) && (slot < m_numSlots)) {
+        m_awakeUs[slot] += us;
+    }
+}
+
+bool PowerManager::prepareDeepSleep(uint32_t deadline)
+{
+    uint32_t remaining = deadline - m_timer->now();
+    if ((int32_t)remaining < (int32_t)LOWPOWER_DEEPSLEEP_MIN_MS) {
+        return false;
+    }
+
+    // where the DS1337 is. Anchored, that is known without reading it. Without an anchor, take it as the start of the
+    // second for setting the alarm, so it is never late, and as the middle for working out the time slept. The
+    // DS1337 is read rather than time(), which runs from the time base that is to be corrected
+    m_startMs = m_timer->now();
+    remaining = deadline - m_startMs;
+    uint32_t phase = 0;
+    if (m_anchored) {
+        m_startRtc   = m_anchorRtc + (time_t)((m_startMs - m_anchorMs) / 1000u);
+        phase        = (m_startMs - m_anchorMs) % 1000u;
+        m_startPhase = (uint16_t)phase;
+    }
+    else {
+        m_startRtc   = my_rtc_read_ds1337();
+        m_startPhase = 500u;
+    }
+
+    uint32_t seconds = (phase + remaining) / 1000u;
+    uint32_t past    = (phase + remaining) % 1000u;
+    if (m_anchored && (past > 0) && ((1000u - past) <= LOWPOWER_LATE_MS)) {
+        seconds++;      // wake on the boundary after the deadline, rather than sleep up to it with the clocks running
+    }
+    // the alarm has to be far enough off that it cannot pass while it is being programmed. Without an anchor, the
+    // phase could be out by up to a second
+    uint32_t margin = m_anchored ? POWER_MIN_ALARM_MS : 1000u + POWER_MIN_ALARM_MS;
+    if ((seconds * 1000u) < (phase + margin)) {
+        return false;
+    }
+    if (seconds > POWER_MAX_ALARM_S) {
+        seconds = POWER_MAX_ALARM_S;
+    }
+    m_alarmRtc   = m_startRtc + (time_t)seconds;
+    m_alarmFired = false;
+    my_rtc_set_alarm(m_alarmRtc);
+    return true;
+}
+
+void PowerManager::deepSleep()
+{
+    m_deepSleeps++;
+    ::deepsleep();
+}
+
+void PowerManager::sleep()
+{
+    // mbed's sleep, rather than a bare WFI, as it clears the deep sleep bit that deepsleep leaves set
+    uint32_t start = us_ticker_read();
+    ::sleep();
+    m_sleepUs += us_ticker_read() - start;
+}
+
+void PowerManager::resume()
+{
+    // the time base has only counted what the ticker saw, the time up to deep sleep and since waking
+    uint32_t counted = m_timer->now();
+
+    // an alarm wakes on the second boundary it was set for. Anything else could be anywhere in the second
+    time_t   wakeRtc   = m_alarmFired ? m_alarmRtc : my_rtc_read_ds1337();
+    uint32_t wakePhase = m_alarmFired ? 0 : 500u;
+    if (!m_alarmFired) {
+        m_earlyWakes++;
+    }
+    my_rtc_clear_alarm();
+
+    int32_t slept = (int32_t)((wakeRtc - m_startRtc) * 1000 + wakePhase) - m_startPhase;
+    uint32_t actual = m_startMs + ((slept > 0) ? (uint32_t)slept : 0);
+    int32_t stopped = (int32_t)(actual - counted);
+    if (stopped > 0) {
+        // never backwards, the time base is monotonic
+        m_timer->skip((uint32_t)stopped);
+        m_deepSleepUs += (uint64_t)stopped * 1000u;
+    }
+    // only an alarm says where the second boundaries are. After anything else, the time base is a guess until the next
+    m_anchored  = m_alarmFired;
+    m_anchorMs  = actual;
+    m_anchorRtc = wakeRtc;
+    if (m_alarmFired) {
+        my_rtc_second_started(wakeRtc, actual);     // which saves time() reading the DS1337 to stay in step
+    }
+}
+
+void PowerManager::onAlarm()
+{
+    m_alarmFired = true;
+}
+
+int PowerManager::formatLine(uint16_t *cursor, char *s, int len) const
+{
+    uint64_t totalUs = (uint64_t)(m_timer->now() - m_startedMs) * 1000u;
+    if (totalUs == 0) {
+        totalUs = 1;
+    }
+
+    if (*cursor == 0) {
+        (*cursor)++;
+        uint64_t asleepUs = m_sleepUs + m_deepSleepUs;
+        uint64_t awakeUs  = (asleepUs < totalUs) ? totalUs - asleepUs : 0;
+        // hundredths of a percent
+        unsigned long awake = (unsigned long)(awakeUs * 10000u / totalUs);
+        unsigned long sleep = (unsigned long)(m_sleepUs * 10000u / totalUs);
+        unsigned long deep  = (unsigned long)(m_deepSleepUs * 10000u / totalUs);
+        return snprintf(s, len, "power %lu s: awake %lu.%02lu%%, sleep %lu.%02lu%%, deep sleep %lu.%02lu%% in %lu (%lu early)",
+                        (unsigned long)(totalUs / 1000000u), awake / 100, awake % 100, sleep / 100, sleep % 100,
+                        deep / 100, deep % 100, (unsigned long)m_deepSleeps, (unsigned long)m_earlyWakes);
+    }
+
+    uint8_t slot = (uint8_t)(*cursor - 1);
+    if (slot >= m_numSlots) {
+        return 0;
+    }
+    (*cursor)++;
+    // parts per million of the time, so a handler that is awake for a few ms in every few s still shows
+    return snprintf(s, len, "power %s awake %lu ms, %lu ppm", m_names[slot],
+                    (unsigned long)(m_awakeUs[slot] / 1000u), (unsigned long)(m_awakeUs[slot] * 1000000u / totalUs));
+}
@@ -0,0 +1,104 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include "mbed.h"
+#include "config.h"
+#include "timers.h"
+
+#define POWER_MAX_SLOTS         6u      // handlers whose awake time is accounted for
+#define POWER_LINE_MAX          96u     // longest line \sa formatLine writes, including the terminator
+#define POWER_MIN_ALARM_MS      100u    // least time to the alarm, so it cannot pass while it is being programmed
+#define POWER_MAX_ALARM_S       3600u   // longest deep sleep, well inside the day the DS1337's alarm can see
+
+/*!
+ * \brief The PowerManager class puts the MCU into deep sleep until the next deadline, and keeps track of where the
+ * time goes
+ *
+ * In deep sleep the clocks stop, us_ticker with them, so the wake up is an alarm of the DS1337, which keeps running
+ * from its own crystal. The alarm has a resolution of a second, so \sa prepareDeepSleep sets it for the last second
+ * boundary before the deadline, and whatever is left of the wait after it is slept normally. If the boundary after
+ * the deadline is no more than LOWPOWER_LATE_MS after it, the alarm is set for that instead.
+ *
+ * On waking, \sa resume works out how long the ticker was stopped from the DS1337, and moves \a MyTimers on by that
+ * much. An alarm wakes the MCU on a second boundary, so from the first alarm on the time base is anchored to them, and
+ * both where the next alarm falls and the time slept are known to a ms or so, without reading the DS1337. Before that,
+ * or after being woken by anything else, it is read, and the part of a second is a guess of half of one.
+ *
+ * Each handler's awake time is charged to its slot by \a Scheduler. The time asleep and in deep sleep are counted
+ * here, and the rest of the awake time is the scheduler itself and the interrupts. \sa formatLine reports it all.
+ */
+class PowerManager
+{
+public:
+    PowerManager(MyTimers *_timer);
+
+    /*!
+     * \brief addSlot starts accounting for a handler's awake time
+     * \param name is printed in the report. It is not copied, so must be a string literal
+     * \return the slot to pass to \sa charge, or -1 if \a POWER_MAX_SLOTS are in use
+     */
+    int8_t addSlot(const char *name);
+
+    //! charge adds \a us of awake time to \a slot
+    void charge(int8_t slot, uint32_t us);
+
+    /*!
+     * \brief prepareDeepSleep sets the DS1337's alarm for a second boundary around \a deadline, as described above
+     * \param deadline is the earliest deadline in \a MyTimers, as a tick of \a MyTimers::now
+     * \return false if the deadline is too close for deep sleep to be worth it, in which case no alarm is set
+     */
+    bool prepareDeepSleep(uint32_t deadline);
+
+    //! deepSleep stops the clocks until an interrupt. Called with interrupts disabled, after \sa prepareDeepSleep
+    void deepSleep();
+
+    //! sleep waits for an interrupt with the clocks running. Called with interrupts disabled
+    void sleep();
+
+    //! resume corrects the time base for the deep sleep that has just ended, and turns the alarm off
+    void resume();
+
+    /*!
+     * \brief formatLine writes the next line of the report: the totals, then a line for each slot
+     * \param cursor is where the report is up to. Start it at 0, it is moved on past the line written
+     * \param s is where the line is written, without a line ending
+     * \param len is the size of \a s, which should be \a POWER_LINE_MAX
+     * \return the length of the line, or 0 when the report is complete
+     */
+    int formatLine(uint16_t *cursor, char *s, int len) const;
+
+    //! deepSleeps is the number of times the MCU has been in deep sleep
+    uint32_t deepSleeps() const { return m_deepSleeps; }
+
+    //! earlyWakes is the number of deep sleeps ended by something other than the alarm
+    uint32_t earlyWakes() const { return m_earlyWakes; }
+
+private:
+    MyTimers *m_timer;
+    InterruptIn m_alarm;            ///< INTA of the DS1337
+    volatile bool m_alarmFired;     ///< set by \a onAlarm
+
+    // the deep sleep in progress
+    uint32_t m_startMs;         ///< time base when the DS1337 was read before it
+    time_t   m_startRtc;        ///< what the DS1337 read then
+    uint16_t m_startPhase;      ///< ms past \a m_startRtc that the read was, known or guessed
+    time_t   m_alarmRtc;        ///< when the alarm was set for
+
+    bool     m_anchored;        ///< \a m_anchorMs is known
+    uint32_t m_anchorMs;        ///< a tick of the time base that fell on a second boundary of the DS1337
+    time_t   m_anchorRtc;       ///< the second that started then
+
+    // accounting
+    const char *m_names[POWER_MAX_SLOTS];
+    uint64_t m_awakeUs[POWER_MAX_SLOTS];    ///< charged to each slot
+    uint8_t  m_numSlots;
+    uint64_t m_sleepUs;         ///< waiting for an interrupt, clocks running
+    uint64_t m_deepSleepUs;     ///< in deep sleep, as the time base was moved on by
+    uint32_t m_deepSleeps;
+    uint32_t m_earlyWakes;
+    uint32_t m_startedMs;       ///< time base when accounting started
+
+    void onAlarm();             // called from the INTA interrupt
+};
+
+#endif // __POWER_H__
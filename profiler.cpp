@@ -0,0 +1,132 @@
+#include "profiler.h"
+
+#define PROFILER_LINES_PER_SLOT (2u + PROFILER_MAX_MODES)   // summary, histogram, then one per mode
+
+Profiler::Profiler()
+{
+    m_numSlots = 0;
+    reset();
+}
+
+int8_t Profiler::addSlot(const char *name)
+{
+    if (m_numSlots >= PROFILER_MAX_SLOTS) {
+        return -1;
+    }
+    m_slots[m_numSlots].name = name;
+    return (int8_t)m_numSlots++;
+}
+
+void Profiler::record(int8_t slot, uint8_t mode, uint32_t elapsed)
+{
+    if ((slot < 0) || (slot >= m_numSlots)) {
+        return;
+    }
+    if (mode >= PROFILER_MAX_MODES) {
+        mode = PROFILER_MAX_MODES - 1;
+    }
+
+    Slot &s = m_slots[slot];
+    s.count++;
+    s.total += elapsed;
+    if (elapsed > s.max) {
+        s.max = elapsed;
+    }
+    s.buckets[bucketOf(elapsed)]++;
+
+    s.modeCount[mode]++;
+    if (elapsed > s.modeMax[mode]) {
+        s.modeMax[mode] = elapsed;
+    }
+}
+
+void Profiler::reset()
+{
+    for (unsigned int i = 0; i < PROFILER_MAX_SLOTS; i++) {
+        const char *name = m_slots[i].name;
+        memset(&m_slots[i], 0, sizeof(Slot));
+        m_slots[i].name = (i < m_numSlots) ? name : NULL;
+    }
+}
+
+uint32_t Profiler::count(int8_t slot) const
+{
+    return ((slot >= 0) && (slot < m_numSlots)) ? m_slots[slot].count : 0;
+}
+
+uint32_t Profiler::max(int8_t slot) const
+{
+    return ((slot >= 0) && (slot < m_numSlots)) ? m_slots[slot].max : 0;
+}
+
+uint32_t Profiler::percentile(int8_t slot, uint8_t pct) const
+{
+    if ((slot < 0) || (slot >= m_numSlots) || (m_slots[slot].count == 0)) {
+        return 0;
+    }
+    const Slot &s = m_slots[slot];
+
+    // the number of runs at or below the percentile, rounded up
+    uint32_t target = (uint32_t)(((uint64_t)s.count * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (unsigned int b = 0; b < PROFILER_BUCKETS - 1; b++) {
+        seen += s.buckets[b];
+        if (seen >= target) {
+            uint32_t upper = (2u << b) - 1;
+            return (upper < s.max) ? upper : s.max;
+        }
+    }
+    return s.max;   // in the open ended bucket
+}
+
+int Profiler::formatLine(uint16_t *cursor, char *s, int len) const
+{
+    while (*cursor < m_numSlots * PROFILER_LINES_PER_SLOT) {
+        uint8_t index = *cursor / PROFILER_LINES_PER_SLOT;
+        uint8_t line  = *cursor % PROFILER_LINES_PER_SLOT;
+        const Slot &slot = m_slots[index];
+        (*cursor)++;
+
+        if (line == 0) {
+            // summary
+            unsigned long mean = slot.count ? (unsigned long)(slot.total / slot.count) : 0;
+            return snprintf(s, len, "prof %s n=%lu mean=%lu p50=%lu p99=%lu max=%lu us", slot.name,
+                            (unsigned long)slot.count, mean,
+                            (unsigned long)percentile(index, 50),
+                            (unsigned long)percentile(index, 99),
+                            (unsigned long)slot.max);
+        }
+
+        if (line == 1) {
+            // histogram, up to the last bucket with anything in it
+            int last = PROFILER_BUCKETS - 1;
+            while ((last > 0) && (slot.buckets[last] == 0)) {
+                last--;
+            }
+            int n = snprintf(s, len, "prof %s hist", slot.name);
+            for (int b = 0; (b <= last) && (n < len); b++) {
+                n += snprintf(s + n, len - n, "%c%lu", (b == 0) ? ' ' : ',', (unsigned long)slot.buckets[b]);
+            }
+            return (n < len) ? n : len - 1;
+        }
+
+        // modes, skipping those that have not run
+        uint8_t mode = line - 2;
+        if (slot.modeCount[mode]) {
+            return snprintf(s, len, "prof %s mode %d n=%lu max=%lu us", slot.name, mode,
+                            (unsigned long)slot.modeCount[mode],
+                            (unsigned long)slot.modeMax[mode]);
+        }
+    }
+    return 0;
+}
+
+uint8_t Profiler::bucketOf(uint32_t elapsed)
+{
+    // the position of the highest set bit, without a count leading zeros instruction on the M0
+    uint8_t b = 0;
+    while ((elapsed >>= 1) && (b < PROFILER_BUCKETS - 1)) {
+        b++;
+    }
+    return b;
+}
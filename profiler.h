@@ -0,0 +1,96 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "mbed.h"
+
+#define PROFILER_MAX_SLOTS      7u      // handlers that can be profiled, plus the scheduler loop
+#define PROFILER_MAX_MODES      16u     // modes tracked per slot, any higher mode is counted in the last one
+#define PROFILER_BUCKETS        16u     // log2 buckets, the last one holds everything from 2^15 ticks up
+#define PROFILER_LINE_MAX       128u    // longest line \sa formatLine writes, including the terminator
+
+// free-running tick source, in us on the target. The host simulation build provides its own.
+#ifndef PROFILER_TICKS
+#define PROFILER_TICKS()        us_ticker_read()
+#endif
+
+/*!
+ * \brief The Profiler class records how long each handler's run function takes
+ *
+ * Each slot (a handler, or the scheduler loop) keeps a histogram of its run times in log2 buckets: bucket 0 counts
+ * runs of 0 or 1 tick, bucket b counts runs of 2^b to 2^(b+1)-1 ticks. Alongside it are the count, total and
+ * maximum, and the count and maximum for each state machine mode, so a slow state can be picked out.
+ * Percentiles are read off the histogram, so they are the upper bound of the bucket they fall in.
+ *
+ * Recording is a few adds and a shift loop, so it can be left on. The results are read out a line at a time with
+ * \sa formatLine, so they can be fed into a small buffer as it empties.
+ */
+class Profiler
+{
+public:
+    Profiler();
+
+    //! ticks is the current value of the free-running tick source
+    static uint32_t ticks() { return PROFILER_TICKS(); }
+
+    /*!
+     * \brief addSlot starts profiling something new
+     * \param name is printed in the report. It is not copied, so must be a string literal
+     * \return the slot to pass to \sa record, or -1 if \a PROFILER_MAX_SLOTS are in use
+     */
+    int8_t addSlot(const char *name);
+
+    /*!
+     * \brief record adds one run to a slot's statistics
+     * \param slot is the slot returned by \sa addSlot
+     * \param mode is the state machine mode the run started in
+     * \param elapsed is how long the run took, in ticks
+     */
+    void record(int8_t slot, uint8_t mode, uint32_t elapsed);
+
+    //! reset clears the statistics of every slot, but keeps the slots
+    void reset();
+
+    //! count is the number of runs recorded in \a slot
+    uint32_t count(int8_t slot) const;
+
+    //! max is the longest run recorded in \a slot, in ticks
+    uint32_t max(int8_t slot) const;
+
+    /*!
+     * \brief percentile reads a percentile off the histogram of \a slot
+     * \param pct is the percentile, 1 to 100
+     * \return the upper bound of the bucket the percentile falls in, no more than \sa max
+     */
+    uint32_t percentile(int8_t slot, uint8_t pct) const;
+
+    /*!
+     * \brief formatLine writes the next line of the report. For each slot there is a summary line, a line with the
+     * histogram, and a line for each mode that has been recorded.
+     * \param cursor is where the report is up to. Start it at 0, it is moved on past the line written
+     * \param s is where the line is written, without a line ending
+     * \param len is the size of \a s, which should be \a PROFILER_LINE_MAX
+     * \return the length of the line, or 0 when the report is complete
+     */
+    int formatLine(uint16_t *cursor, char *s, int len) const;
+
+private:
+    /*!
+     * \brief The Slot struct is the statistics for one profiled handler
+     */
+    struct Slot {
+        const char *name;                       ///< printed in the report
+        uint32_t count;                         ///< runs recorded
+        uint64_t total;                         ///< sum of all runs, for the mean
+        uint32_t max;                           ///< longest run
+        uint32_t buckets[PROFILER_BUCKETS];     ///< log2 histogram of runs
+        uint32_t modeCount[PROFILER_MAX_MODES]; ///< runs recorded in each mode
+        uint32_t modeMax[PROFILER_MAX_MODES];   ///< longest run in each mode
+    };
+
+    Slot m_slots[PROFILER_MAX_SLOTS];
+    uint8_t m_numSlots;
+
+    static uint8_t bucketOf(uint32_t elapsed);  // log2 bucket that \a elapsed is counted in
+};
+
+#endif // __PROFILER_H__
@@ -1,60 +1,318 @@
-#include "rtc.h"
-#include "DS1337.h"
-
-// declare reference to interface to the hardware real time clock
-extern DS1337* RTC_DS1337;
-
-// RTC enabled flag
-static int _rtcEnabled;
-
-time_t my_rtc_read()
-{
-    time_t  retval = 0;     // time since start of epoch
-    tm      _time_tm;
-
-    RTC_DS1337->readTime();
-
-    // extract values from RTC to tm struct
-    _time_tm.tm_year = ((int)RTC_DS1337->getYears()) - 1900;       // struct tm stores (year - 1900)
-    _time_tm.tm_mon  = (int)RTC_DS1337->getMonths() - 1;         // struct tm stores months 0 - 11, DS1337 stores 1-12
-    _time_tm.tm_mday = (int)RTC_DS1337->getDays();
-    _time_tm.tm_hour = (int)RTC_DS1337->getHours();
-    _time_tm.tm_min  = (int)RTC_DS1337->getMinutes();
-    _time_tm.tm_sec  = (int)RTC_DS1337->getSeconds();
-
-    // convert to time_t    
-    retval = mktime(&_time_tm);
-    if (retval == (time_t) -1)
-        return (time_t)1;               // error
-    else
-        return retval;
-}
-
-
-//https://developer.mbed.org/teams/Seeed/code/Seeed_Arch_GPRS_V2_RTC_HelloWorld/file/6db7dfbab0f1/main.cpp
-void my_rtc_write(time_t _time)
-{
-    // extract time_t to time info struct
-    tm * timeinfo = localtime(&_time);
-
-    RTC_DS1337->setSeconds   (timeinfo->tm_sec);
-    RTC_DS1337->setMinutes   (timeinfo->tm_min);
-    RTC_DS1337->setHours     (timeinfo->tm_hour);
-    RTC_DS1337->setDays      (timeinfo->tm_mday);           // day of month
-    RTC_DS1337->setDayOfWeek (timeinfo->tm_wday);
-    RTC_DS1337->setMonths    (timeinfo->tm_mon + 1);        // struct tm stores months 0 - 11, DS1337 stores 1-12
-    RTC_DS1337->setYears     (timeinfo->tm_year + 1900);    // struct tm subtracts 1900 from year
-
-    RTC_DS1337->setTime();
-}
-
-void my_rtc_init()
-{
-    RTC_DS1337->start();
-    _rtcEnabled = 1;
-}
-
-int my_rtc_enabled()
-{
-    return _rtcEnabled;
-}
+#include "rtc.h"
+#include "DS1337.h"
+#include "timers.h"
+
+// declare reference to interface to the hardware real time clock
+extern DS1337* RTC_DS1337;
+
+// the time base the clock runs from between reads of the DS1337
+extern MyTimers *mytimer;
+
+// the bus the DS1337 library uses, for the alarm registers it has no functions for
+extern I2C i2c;
+
+#define DS1337_ADDRESS      0xD0    // 8 bit I2C address
+#define DS1337_REG_ALARM1   0x07    // seconds, minutes, hours, day/date of alarm 1, then alarm 2, control and status
+#define DS1337_REG_CONTROL  0x0E
+#define DS1337_ALARM_MASK   0x80    // A1Mx/A2Mx: leave this field out of the match
+#define DS1337_CTRL_INTCN   0x04    // alarms on INTA, rather than a square wave
+#define DS1337_CTRL_A1IE    0x01    // alarm 1 asserts INTA
+
+#define RTC_EDGE_EARLY_MS   250     // how long before the time base says the second starts that a resync starts looking, at most
+#define RTC_EDGE_GUARD_MS   10      // and at least
+#define RTC_EDGE_SLACK_MS   4       // longest gap between reads that an edge corrects the rate from
+#define RTC_FIRST_PHASE_MS  500     // where in its second the DS1337 is taken to be, until an edge has been seen
+#define RTC_RATE_ONE        (1L << 24)  // the time base's rate correction is in these parts, about 0.06 ppm each
+
+// RTC enabled flag
+static int _rtcEnabled;
+
+// the cached clock. At tick _syncMs of the time base, the DS1337 was _syncPhase ms into second _syncRtc, and since
+// then each ms of the time base has been 1 + _rate / RTC_RATE_ONE ms of the DS1337
+static bool     _synced;
+static bool     _edgeSeen;      // false while the clock is only matched to the second, by one read
+static time_t   _syncRtc;
+static uint32_t _syncMs;
+static int32_t  _syncPhase;
+static int32_t  _rate;
+static int32_t  _early = RTC_EDGE_EARLY_MS;    // how long before the second the next resync starts looking
+
+// the resync in progress: the second the DS1337 was in at its first read, when that was, and when the last read was
+static bool     _polling;
+static time_t   _pollRtc;
+static uint32_t _pollStartMs;
+static uint32_t _pollLastMs;
+
+// the last time given out, so it never goes backwards
+static time_t   _lastRtc;
+static uint16_t _lastMs;
+
+static RtcClockStats _stats;
+
+// ms of the DS1337 past the start of second _syncRtc, at tick \a t of the time base
+static int32_t sinceSync(uint32_t t)
+{
+    int32_t elapsed = (int32_t)(t - _syncMs);
+    return elapsed + (int32_t)(((int64_t)elapsed * _rate) / RTC_RATE_ONE) + _syncPhase;
+}
+
+// match the clock to second \a rtc of the DS1337, read at tick \a t, without knowing where in the second it was
+static void syncToRead(time_t rtc, uint32_t t)
+{
+    _syncRtc   = rtc;
+    _syncMs    = t;
+    _syncPhase = RTC_FIRST_PHASE_MS;
+    _synced    = true;
+    _edgeSeen  = false;
+}
+
+// match the clock to the start of second \a rtc of the DS1337, seen at tick \a t. \a exact if the read before was
+// close enough to it that it corrects the rate
+static void syncToEdge(time_t rtc, uint32_t t, bool exact)
+{
+    _stats.resyncs++;
+    if (_edgeSeen) {
+        // how far out the time base has got, and so how far out its rate is. 64 bits, in case the DS1337 has been set
+        int64_t offset = ((int64_t)(rtc - _syncRtc) * 1000) - sinceSync(t);
+        uint32_t interval = t - _syncMs;
+        if (exact) {
+            if ((offset > -1000) && (offset < 1000)) {
+                _rate += (int32_t)((offset * RTC_RATE_ONE) / (int64_t)interval);
+            }
+
+            // with the rate corrected, the next resync should be out by less than this one was
+            int64_t out = (offset < 0) ? -offset : offset;
+            _early = ((2 * out) + RTC_EDGE_GUARD_MS < RTC_EDGE_EARLY_MS) ? (int32_t)(2 * out) + RTC_EDGE_GUARD_MS : RTC_EDGE_EARLY_MS;
+        }
+        _stats.lastCorrectionMs = (int32_t)offset;
+        _stats.netCorrectionMs += (int32_t)offset;
+    }
+
+    _syncRtc   = rtc;
+    _syncMs    = t;
+    _syncPhase = 0;
+    _synced    = true;
+    _edgeSeen  = true;
+}
+
+uint32_t my_rtc_resync_start()
+{
+    if (!_synced || !_edgeSeen) {
+        return mytimer->now();      // as soon as possible
+    }
+
+    // the time base's phase in the DS1337's second when the resync is due, and how long after that to start looking
+    uint32_t due   = _syncMs + RTC_RESYNC_MS;
+    int32_t  phase = sinceSync(due) % 1000;
+    return (phase < (1000 - _early)) ? due + (uint32_t)(1000 - _early - phase) : due;
+}
+
+bool my_rtc_resync_poll()
+{
+    uint32_t t = mytimer->now();
+    if (!_polling) {
+        // the clock may have been set, or matched to an alarm, since the resync was started
+        if (_synced && ((int32_t)(my_rtc_resync_start() - t) > 0)) {
+            return true;
+        }
+        _pollRtc = my_rtc_read_ds1337();
+        t = mytimer->now();
+        if (!_synced) {
+            syncToRead(_pollRtc, t);
+        }
+        _polling     = true;
+        _pollStartMs = t;
+        _pollLastMs  = t;
+        return false;
+    }
+
+    time_t rtc = my_rtc_read_ds1337();
+    t = mytimer->now();
+    uint32_t gap = t - _pollLastMs;
+    _pollLastMs = t;
+    if (rtc != _pollRtc) {
+        _polling = false;
+        syncToEdge(rtc, t, gap <= RTC_EDGE_SLACK_MS);
+        return true;
+    }
+    if ((t - _pollStartMs) < RTC_EDGE_WAIT_MS) {
+        return false;
+    }
+
+    // the DS1337 is not counting, so carry on from the time base alone, and look again at the next resync
+    _polling = false;
+    _stats.resyncs++;
+    int32_t since = sinceSync(t);
+    _syncRtc  += since / 1000;
+    _syncPhase = since % 1000;
+    _syncMs    = t;
+    _edgeSeen  = true;
+    _early     = RTC_EDGE_EARLY_MS;
+    return true;
+}
+
+time_t my_rtc_read()
+{
+    uint16_t ms;
+    return my_rtc_time(&ms);
+}
+
+time_t my_rtc_time(uint16_t *ms)
+{
+    if (mytimer == NULL) {
+        *ms = 0;
+        return my_rtc_read_ds1337();    // no time base yet
+    }
+
+    if (!_synced) {
+        // the first time, to the second. ClockHandler finds where in the second it is
+        time_t rtc = my_rtc_read_ds1337();
+        syncToRead(rtc, mytimer->now());
+    }
+    else {
+        _stats.saved++;
+    }
+
+    int32_t  since = sinceSync(mytimer->now());
+    time_t   rtc   = _syncRtc + (time_t)(since / 1000);
+    uint16_t part  = (uint16_t)(since % 1000);
+    if ((rtc < _lastRtc) || ((rtc == _lastRtc) && (part < _lastMs))) {
+        rtc  = _lastRtc;                // corrected back, so stand still until it catches up
+        part = _lastMs;
+    }
+    _lastRtc = rtc;
+    _lastMs  = part;
+    *ms = part;
+    return rtc;
+}
+
+void my_rtc_second_started(time_t rtc, uint32_t ms)
+{
+    _stats.edges++;
+    _syncRtc   = rtc;
+    _syncMs    = ms;
+    _syncPhase = 0;
+    _synced    = true;
+    _edgeSeen  = true;
+    _polling   = false;
+}
+
+const RtcClockStats &my_rtc_stats()
+{
+    return _stats;
+}
+
+int32_t my_rtc_drift_ppb()
+{
+    return (int32_t)(((int64_t)_rate * 1000000000) / RTC_RATE_ONE);
+}
+
+int my_rtc_format_stats(char *s, int len)
+{
+    int32_t ppb = my_rtc_drift_ppb();
+    uint32_t mag = (ppb < 0) ? (uint32_t)-ppb : (uint32_t)ppb;
+    return snprintf(s, len, "clock: %lu DS1337 reads, %lu saved, %lu resyncs, %lu edges, last out %+ld ms, %+ld in all, rate %c%lu.%02lu ppm",
+                    (unsigned long)_stats.reads, (unsigned long)_stats.saved, (unsigned long)_stats.resyncs,
+                    (unsigned long)_stats.edges, (long)_stats.lastCorrectionMs, (long)_stats.netCorrectionMs,
+                    (ppb < 0) ? '-' : '+', (unsigned long)(mag / 1000), (unsigned long)((mag % 1000) / 10));
+}
+
+time_t my_rtc_read_ds1337()
+{
+    time_t  retval = 0;     // time since start of epoch
+    tm      _time_tm;
+
+    _stats.reads++;
+    RTC_DS1337->readTime();
+
+    // extract values from RTC to tm struct
+    _time_tm.tm_year = ((int)RTC_DS1337->getYears()) - 1900;       // struct tm stores (year - 1900)
+    _time_tm.tm_mon  = (int)RTC_DS1337->getMonths() - 1;         // struct tm stores months 0 - 11, DS1337 stores 1-12
+    _time_tm.tm_mday = (int)RTC_DS1337->getDays();
+    _time_tm.tm_hour = (int)RTC_DS1337->getHours();
+    _time_tm.tm_min  = (int)RTC_DS1337->getMinutes();
+    _time_tm.tm_sec  = (int)RTC_DS1337->getSeconds();
+    _time_tm.tm_isdst = 0;                                      // the DS1337 keeps UTC, there is no daylight saving
+
+    // convert to time_t    
+    retval = mktime(&_time_tm);
+    if (retval == (time_t) -1)
+        return (time_t)1;               // error
+    else
+        return retval;
+}
+
+
+//https://developer.mbed.org/teams/Seeed/code/Seeed_Arch_GPRS_V2_RTC_HelloWorld/file/6db7dfbab0f1/main.cpp
+void my_rtc_write(time_t _time)
+{
+    // extract time_t to time info struct
+    tm * timeinfo = localtime(&_time);
+
+    RTC_DS1337->setSeconds   (timeinfo->tm_sec);
+    RTC_DS1337->setMinutes   (timeinfo->tm_min);
+    RTC_DS1337->setHours     (timeinfo->tm_hour);
+    RTC_DS1337->setDays      (timeinfo->tm_mday);           // day of month
+    RTC_DS1337->setDayOfWeek (timeinfo->tm_wday);
+    RTC_DS1337->setMonths    (timeinfo->tm_mon + 1);        // struct tm stores months 0 - 11, DS1337 stores 1-12
+    RTC_DS1337->setYears     (timeinfo->tm_year + 1900);    // struct tm subtracts 1900 from year
+
+    RTC_DS1337->setTime();
+
+    // writing the seconds restarts the DS1337's countdown to the next one, so where it is in the second is known
+    if (mytimer != NULL) {
+        _syncRtc   = _time;
+        _syncMs    = mytimer->now();
+        _syncPhase = 0;
+        _synced   = true;
+        _edgeSeen = true;
+        _polling  = false;
+        _lastRtc  = 0;  // it may have been set back
+        _lastMs  = 0;
+    }
+}
+
+void my_rtc_init()
+{
+    RTC_DS1337->start();
+    _rtcEnabled = 1;
+}
+
+int my_rtc_enabled()
+{
+    return _rtcEnabled;
+}
+
+static char toBcd(int v)
+{
+    return (char)(((v / 10) << 4) | (v % 10));
+}
+
+void my_rtc_set_alarm(time_t _time)
+{
+    tm * timeinfo = localtime(&_time);
+
+    // alarm 1 on seconds, minutes and hours, alarm 2 off, then control and status, which clears the alarm flags
+    char regs[10];
+    regs[0]  = DS1337_REG_ALARM1;
+    regs[1]  = toBcd(timeinfo->tm_sec);
+    regs[2]  = toBcd(timeinfo->tm_min);
+    regs[3]  = toBcd(timeinfo->tm_hour);
+    regs[4]  = DS1337_ALARM_MASK;
+    regs[5]  = DS1337_ALARM_MASK;
+    regs[6]  = DS1337_ALARM_MASK;
+    regs[7]  = DS1337_ALARM_MASK;
+    regs[8]  = DS1337_CTRL_INTCN | DS1337_CTRL_A1IE;
+    regs[9]  = 0;
+    i2c.write(DS1337_ADDRESS, regs, 10);
+}
+
+void my_rtc_clear_alarm()
+{
+    // control, then status
+    char regs[3];
+    regs[0] = DS1337_REG_CONTROL;
+    regs[1] = DS1337_CTRL_INTCN;
+    regs[2] = 0;
+    i2c.write(DS1337_ADDRESS, regs, 3);
+}
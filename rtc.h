@@ -1,50 +1,157 @@
-#ifndef __RTC_H__
-#define __RTC_H__
-
-#include "mbed.h"
-
-//! The functions needed to configure time in the micro, used in \sa attach_rtc, using the on board DS_1337
-/*!
-  As there is no on-chip RTC, connecting the time functionality to the DS_1337 enables more convenient use of time
-
-  The function which is called to configure is as such:
-  void attach_rtc(time_t (*read_rtc)(void), void (*write_rtc)(time_t), void (*init_rtc)(void), int (*isenabled_rtc)(void))
-
- read_rtc is assigned \sa my_rtc_read
-
- write_rtc is assigned \sa my_rtc_write
-
- init_rtc is assigned \sa my_rtc_init
-
- isenabled_rtc is assigned \sa my_rtc_enabled
- */
-
-
-/*!
- * \brief my_rtc_read Interfaces to the on board RTC DS1337 and converts read values to time_t
- * \return the value read from the on board RTC converted to system struct time_t
- */
-time_t my_rtc_read();
-
-
-/*!
- * \brief my_rtc_write Interfaces to the on board RTC DS1337 and converts and writes the time given as time_t
- * \param _time is the time in system time_t format which will be written to DS1337
- */
-void my_rtc_write(time_t _time);
-
-
-/*!
- * \brief my_rtc_init Initialises the RTC DS1337
- */
-void my_rtc_init();
-
-
-/*!
- * \brief my_rtc_enabled Checks if RTC DS1337 is enabled
- * \return 1 if enabled, 0 if not enabled (i.e. \sa my_rtc_init never called)
- */
-int my_rtc_enabled();
-
-
-#endif // __RTC_H__
+#ifndef __RTC_H__
+#define __RTC_H__
+
+#include "mbed.h"
+#include "config.h"
+
+#define RTC_LINE_MAX    128u    // longest line \sa my_rtc_format_stats writes, including the terminator
+#define RTC_EDGE_POLL_MS    1u      // how often a resync reads the DS1337, looking for the seconds ticking over
+#define RTC_EDGE_WAIT_MS    1100u   // and for how long, a little over a second
+
+//! The functions needed to configure time in the micro, used in \sa attach_rtc, using the on board DS_1337
+/*!
+  As there is no on-chip RTC, connecting the time functionality to the DS_1337 enables more convenient use of time
+
+  The function which is called to configure is as such:
+  void attach_rtc(time_t (*read_rtc)(void), void (*write_rtc)(time_t), void (*init_rtc)(void), int (*isenabled_rtc)(void))
+
+ read_rtc is assigned \sa my_rtc_read
+
+ write_rtc is assigned \sa my_rtc_write
+
+ init_rtc is assigned \sa my_rtc_init
+
+ isenabled_rtc is assigned \sa my_rtc_enabled
+ */
+
+
+/*!
+ * \brief The RtcClockStats struct counts what the cached clock behind \sa my_rtc_read has done
+ */
+struct RtcClockStats {
+    uint32_t reads;             ///< DS1337 readTime transactions, including those of \sa my_rtc_read_ds1337
+    uint32_t saved;             ///< calls answered from the time base, without a transaction
+    uint32_t resyncs;           ///< times the clock has been matched to the DS1337 by reading it
+    uint32_t edges;             ///< times it has been matched by \sa my_rtc_second_started, without reading it
+    int32_t  lastCorrectionMs;  ///< how far out the clock was at the last resync, positive if it was behind
+    int32_t  netCorrectionMs;   ///< all the corrections added up
+};
+
+
+/*!
+ * \brief my_rtc_read is the wall clock, without reading the DS1337 each time
+ *
+ * The DS1337 is read once when the clock is first used, which gives the second but not where in it the DS1337 is, so
+ * it is taken as half way through. From then on the time is worked out from the ms time base of \a MyTimers, which
+ * carries on through deep sleep. This never waits: finding the start of a second is left to \a ClockHandler, which
+ * does it as soon as it first runs, and then every RTC_RESYNC_MS, with \sa my_rtc_resync_start and
+ * \sa my_rtc_resync_poll. How far out the clock was then corrects the rate of the time base as well as the time, so
+ * the two crystals drift apart by less each time. Setting the time restarts the DS1337's second, so that is a resync
+ * without looking for it.
+ *
+ * The clock never goes backwards, other than when it is set: after a correction back it stands still until it has
+ * caught up.
+ * \return the seconds since 1970
+ */
+time_t my_rtc_read();
+
+
+/*!
+ * \brief my_rtc_time is \sa my_rtc_read to the ms
+ * \param ms is set to the ms past the second returned
+ * \return the seconds since 1970
+ */
+time_t my_rtc_time(uint16_t *ms);
+
+
+/*!
+ * \brief my_rtc_read_ds1337 Interfaces to the on board RTC DS1337 and converts read values to time_t. Always a
+ * transaction, for when the time base cannot be trusted, as it does not count time in deep sleep until it is told
+ * \return the value read from the on board RTC converted to system struct time_t
+ */
+time_t my_rtc_read_ds1337();
+
+
+/*!
+ * \brief my_rtc_stats is what the cached clock has done
+ */
+const RtcClockStats &my_rtc_stats();
+
+
+/*!
+ * \brief my_rtc_resync_start is when the next resync should start reading the DS1337: RTC_RESYNC_MS after the last one,
+ * and just before the time base says the DS1337's next second starts then. How long before is a little more than
+ * the last resync found the clock out by
+ * \return the tick of the time base, which has passed already if a resync is due, or the clock has not been matched to
+ * the start of a second yet
+ */
+uint32_t my_rtc_resync_start();
+
+
+/*!
+ * \brief my_rtc_resync_poll reads the DS1337 once, looking for its seconds ticking over. Called RTC_EDGE_POLL_MS apart
+ * from when \sa my_rtc_resync_start has passed, until it returns true. The clock is matched to the start of the
+ * second it sees, and the rate of the time base corrected, unless the read before it was too long before to say when
+ * the second started to a few ms
+ * \return true when the resync is over: the seconds ticked over, or did not for RTC_EDGE_WAIT_MS, so the DS1337 is
+ * not counting, or a resync was not due after all
+ */
+bool my_rtc_resync_poll();
+
+
+/*!
+ * \brief my_rtc_second_started matches the clock to a second boundary of the DS1337 that is known without reading it,
+ * such as when its alarm goes off. It is a resync, without reading it, but the rate is not corrected from it
+ * \param rtc is the second that started
+ * \param ms is the tick of the time base it started at
+ */
+void my_rtc_second_started(time_t rtc, uint32_t ms);
+
+
+/*!
+ * \brief my_rtc_drift_ppb is the rate correction of the time base, in parts per billion, positive if it runs slow
+ */
+int32_t my_rtc_drift_ppb();
+
+
+/*!
+ * \brief my_rtc_format_stats writes \sa my_rtc_stats as a line of text, without a line ending
+ * \return the length of the line
+ */
+int my_rtc_format_stats(char *s, int len);
+
+
+/*!
+ * \brief my_rtc_write Interfaces to the on board RTC DS1337 and converts and writes the time given as time_t
+ * \param _time is the time in system time_t format which will be written to DS1337
+ */
+void my_rtc_write(time_t _time);
+
+
+/*!
+ * \brief my_rtc_init Initialises the RTC DS1337
+ */
+void my_rtc_init();
+
+
+/*!
+ * \brief my_rtc_enabled Checks if RTC DS1337 is enabled
+ * \return 1 if enabled, 0 if not enabled (i.e. \sa my_rtc_init never called)
+ */
+int my_rtc_enabled();
+
+
+/*!
+ * \brief my_rtc_set_alarm programs alarm 1 of the DS1337 to pull INTA low, and turns alarm 2 off
+ * \param _time is when, to the second. The alarm matches the time of day, so it must be less than a day away
+ */
+void my_rtc_set_alarm(time_t _time);
+
+
+/*!
+ * \brief my_rtc_clear_alarm turns alarm 1 off, and clears its flag so INTA is released
+ */
+void my_rtc_clear_alarm();
+
+
+#endif // __RTC_H__
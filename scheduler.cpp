@@ -0,0 +1,124 @@
+#include "scheduler.h"
+#ifdef ENABLE_LOW_POWER
+#include "power.h"
+#endif
+
+SchedulerBase::SchedulerBase(MyTimers *_timer) : m_timer(_timer)
+{
+    m_numHandlers = 0;
+    m_passes      = 0;
+    m_sleeps      = 0;
+    m_handlerRuns = 0;
+
+#ifdef ENABLE_PROFILING
+    m_profiler  = NULL;
+    m_loopSlot  = -1;
+#endif
+#ifdef ENABLE_LOW_POWER
+    m_power      = NULL;
+#endif
+}
+
+void SchedulerBase::add(AbstractHandler *handler)
+{
+    // the Scheduler has no more slots than this, so it is never full
+    m_handlers[m_numHandlers++] = handler;
+}
+
+#ifdef ENABLE_PROFILING
+void SchedulerBase::setProfiler(Profiler *profiler, const char * const *names)
+{
+    m_profiler = profiler;
+    for (int i = 0; i < m_numHandlers; i++) {
+        m_profSlots[i] = m_profiler->addSlot(names[i]);
+    }
+    m_loopSlot = m_profiler->addSlot("loop");
+}
+
+void SchedulerBase::endPass(const RunStart &start)
+{
+    if (m_profiler) {
+        m_profiler->record(m_loopSlot, 0, Profiler::ticks() - start.ticks);
+    }
+}
+#endif
+
+#ifdef ENABLE_LOW_POWER
+void SchedulerBase::setPowerManager(PowerManager *power, const char * const *names)
+{
+    m_power = power;
+    for (int i = 0; i < m_numHandlers; i++) {
+        m_powerSlots[i] = m_power->addSlot(names[i]);
+    }
+}
+#endif
+
+#if defined(ENABLE_PROFILING) || defined(ENABLE_LOW_POWER)
+void SchedulerBase::account(uint8_t slot, const RunStart &start)
+{
+#ifdef ENABLE_LOW_POWER
+    if (m_power) {
+        m_power->charge(m_powerSlots[slot], us_ticker_read() - start.awake);
+    }
+#endif
+#ifdef ENABLE_PROFILING
+    if (m_profiler) {
+        m_profiler->record(m_profSlots[slot], start.mode, Profiler::ticks() - start.ticks);
+    }
+#endif
+}
+#endif
+
+void SchedulerBase::idle(bool deepOk)
+{
+    // a timer may have elapsed while the handlers were running
+    for (int i = 0; i < m_numHandlers; i++) {
+        if (m_handlers[i]->runnable()) {
+            return;
+        }
+    }
+
+    // program the compare interrupt for the earliest deadline. This is done before interrupts are disabled,
+    // as programming a Timeout enables them again
+    uint32_t deadline;
+    bool timerArmed = m_timer->nextExpiry(&deadline);
+
+#ifdef ENABLE_LOW_POWER
+    // the DS1337's alarm is set over I2C, so this is done before interrupts are disabled as well. If a handler is
+    // woken in the meantime, the alarm goes off to no effect, and is set again the next time
+    bool deep = false;
+    if (m_power && timerArmed) {
+        deep = deepOk && m_power->prepareDeepSleep(deadline);
+    }
+#endif
+
+    // with interrupts disabled, anything that wakes a handler from now on stays pending and makes WFI return
+    // straight away, so there is no window where a wake up can be missed
+    __disable_irq();
+    bool sleep = !timerArmed || m_timer->wakeArmed();
+    for (int i = 0; sleep && (i < m_numHandlers); i++) {
+        if (m_handlers[i]->pending()) {
+            sleep = false;
+        }
+    }
+    if (sleep) {
+        m_sleeps++;
+#ifdef ENABLE_LOW_POWER
+        if (deep) {
+            m_power->deepSleep();
+        }
+        else if (m_power) {
+            m_power->sleep();
+        }
+        else
+#endif
+        __WFI();
+    }
+    __enable_irq();
+
+#ifdef ENABLE_LOW_POWER
+    if (sleep && deep) {
+        m_power->resume();      // needs I2C, so with interrupts enabled
+    }
+#endif
+}
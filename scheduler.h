@@ -0,0 +1,304 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include "mbed.h"
+#include "config.h"
+#include "timers.h"
+#include "Handlers/AbstractHandler.h"
+#ifdef ENABLE_PROFILING
+#include "profiler.h"
+#endif
+
+#define SCHEDULER_MAX_HANDLERS  6u      // handlers in a Scheduler's list
+
+class PowerManager;
+
+/*!
+ * \brief The NoHandler class fills the slots of a \a Scheduler's list after the last handler
+ */
+class NoHandler
+{
+public:
+    //! none is what is passed for a slot with no handler, which is the default
+    static NoHandler &none() { static NoHandler s_none; return s_none; }
+};
+
+/*!
+ * \brief The SchedulerBase class is the part of the \a Scheduler that does not depend on the handlers' classes: the
+ * sleeping, the counts and the accounting. A function that does not need to run the handlers takes one of these.
+ *
+ * If no handler ran on a pass, the MCU waits for an interrupt: the timer compare for the earliest deadline in
+ * \a MyTimers, or whatever interrupt calls \a AbstractHandler::wake (USB, UART, etc).
+ *
+ * With ENABLE_PROFILING, each run is timed into a \a Profiler slot for its handler, by the mode it started in,
+ * and each pass that ran something into a "loop" slot. The loop time is the longest an event can wait to be handled.
+ *
+ * With ENABLE_LOW_POWER, each run's time is charged to its handler's slot in a \a PowerManager, and when the earliest
+ * deadline is far enough off and every handler \a canDeepSleep, the MCU deep-sleeps until it instead.
+ */
+class SchedulerBase
+{
+public:
+    //! passes is the number of times \a run has been called
+    uint32_t passes() const { return m_passes; }
+
+    //! sleeps is the number of times the MCU has been put to sleep (and so woken up again)
+    uint32_t sleeps() const { return m_sleeps; }
+
+    //! handlerRuns is the number of times a handler's run function has been called
+    uint32_t handlerRuns() const { return m_handlerRuns; }
+
+protected:
+    /*!
+     * \brief The RunStart struct is what is noted before a handler runs, or a pass starts, to account for it after
+     */
+    struct RunStart {
+#ifdef ENABLE_PROFILING
+        uint8_t  mode;          ///< the handler's, when it started
+        uint32_t ticks;         ///< \a Profiler::ticks
+#endif
+#ifdef ENABLE_LOW_POWER
+        uint32_t awake;         ///< us_ticker
+#endif
+    };
+
+    //! \param _timer is used to program the wake up for the earliest deadline
+    SchedulerBase(MyTimers *_timer);
+
+    //! add puts a handler in the next slot
+    void add(AbstractHandler *handler);
+
+    //! handler is the one in \a slot
+    AbstractHandler *handler(uint8_t slot) const { return m_handlers[slot]; }
+
+    //! startPass counts a pass, and notes when it started
+    void startPass(RunStart *start)
+    {
+        m_passes++;
+        note(start, 0);
+    }
+
+    /*!
+     * \brief runHandler calls \a run on a handler if it is runnable, and accounts for the run
+     * \param slot is the handler's slot, in the order they were added
+     * \return true if \a run was called
+     */
+    template <class H>
+    bool runHandler(uint8_t slot, H &handler)
+    {
+        if (!handler.startRun()) {
+            return false;
+        }
+        RunStart start;
+        note(&start, handler.currentMode());
+        handler.run();
+        m_handlerRuns++;
+#if defined(ENABLE_PROFILING) || defined(ENABLE_LOW_POWER)
+        account(slot, start);
+#endif
+        return true;
+    }
+
+#ifdef ENABLE_PROFILING
+    //! setProfiler adds a slot to \a profiler for each handler, by the names in \a names, and the loop
+    void setProfiler(Profiler *profiler, const char * const *names);
+
+    //! endPass times a pass that ran a handler
+    void endPass(const RunStart &start);
+#endif
+
+#ifdef ENABLE_LOW_POWER
+    //! setPowerManager adds a slot to \a power for each handler, by the names in \a names
+    void setPowerManager(PowerManager *power, const char * const *names);
+#endif
+
+    //! idle sleeps until the next interrupt, unless something became runnable. \a deepOk if every handler canDeepSleep
+    void idle(bool deepOk);
+
+private:
+    MyTimers *m_timer;
+    AbstractHandler *m_handlers[SCHEDULER_MAX_HANDLERS];    ///< for whether any is runnable, or pending
+    uint8_t m_numHandlers;
+
+    uint32_t m_passes;
+    uint32_t m_sleeps;
+    uint32_t m_handlerRuns;
+
+#if defined(ENABLE_PROFILING) || defined(ENABLE_LOW_POWER)
+    void account(uint8_t slot, const RunStart &start);     // charge a run to the handler's slots
+#endif
+
+#ifdef ENABLE_PROFILING
+    Profiler *m_profiler;       ///< times the handlers, if set
+    int8_t m_profSlots[SCHEDULER_MAX_HANDLERS];     ///< profiler slot of each handler
+    int8_t m_loopSlot;          ///< profiler slot of a whole pass
+#endif
+
+#ifdef ENABLE_LOW_POWER
+    PowerManager *m_power;      ///< sleeps the MCU and accounts for its time, if set
+    int8_t m_powerSlots[SCHEDULER_MAX_HANDLERS];    ///< power slot of each handler
+#endif
+
+    void note(RunStart *start, uint8_t mode)
+    {
+#ifdef ENABLE_PROFILING
+        start->mode  = mode;
+        start->ticks = Profiler::ticks();
+#endif
+#ifdef ENABLE_LOW_POWER
+        start->awake = us_ticker_read();
+#endif
+    }
+};
+
+/*!
+ * \brief The SameClass struct's value is 1 if \a A and \a B are the same class, for the checks of a \a Scheduler's list
+ */
+template <class A, class B> struct SameClass { enum { value = 0 }; };
+template <class A> struct SameClass<A, A> { enum { value = 1 }; };
+
+/*!
+ * \brief The Scheduler class runs the handlers from the main loop, and sleeps when none of them has anything to do
+ *
+ * The handlers are a list of classes, fixed at compile time. Each pass of \a run calls \a run on each of them that is
+ * runnable, in list order, through its own class, so each is a direct call the compiler can inline, and no handler
+ * has a vtable. The slots after the last handler are \a NoHandler, and cost no code or RAM. A list that has a class
+ * twice, or a gap before the last handler, does not compile, nor does leaving out the object for a class in the list.
+ *
+ * \tparam H1 to H6 are the handlers' classes, which inherit \a AbstractHandler
+ */
+template <class H1, class H2 = NoHandler, class H3 = NoHandler, class H4 = NoHandler, class H5 = NoHandler,
+          class H6 = NoHandler>
+class Scheduler : public SchedulerBase
+{
+public:
+    /*!
+     * \param _timer is used to program the wake up for the earliest deadline
+     * \param h1 to h6 are the handlers, of the classes in the list, which have to last as long as the scheduler
+     */
+    Scheduler(MyTimers *_timer, H1 &h1, H2 &h2 = NoHandler::none(), H3 &h3 = NoHandler::none(),
+              H4 &h4 = NoHandler::none(), H5 &h5 = NoHandler::none(), H6 &h6 = NoHandler::none())
+        : SchedulerBase(_timer)
+    {
+        add(h1);
+        add(h2);
+        add(h3);
+        add(h4);
+        add(h5);
+        add(h6);
+    }
+
+#ifdef ENABLE_PROFILING
+    //! setProfiler adds a slot to \a profiler for each handler and the loop, and starts timing them
+    void setProfiler(Profiler *profiler)
+    {
+        const char *names[SCHEDULER_MAX_HANDLERS];
+        handlerNames(names);
+        SchedulerBase::setProfiler(profiler, names);
+    }
+#endif
+
+#ifdef ENABLE_LOW_POWER
+    //! setPowerManager adds a slot to \a power for each handler, and lets it deep-sleep the MCU
+    void setPowerManager(PowerManager *power)
+    {
+        const char *names[SCHEDULER_MAX_HANDLERS];
+        handlerNames(names);
+        SchedulerBase::setPowerManager(power, names);
+    }
+#endif
+
+    /*!
+     * \brief The Has struct's value is 1 if \a H is in the list, so that a build can check it has all it needs
+     */
+    template <class H>
+    struct Has {
+        enum { value = SameClass<H, H1>::value || SameClass<H, H2>::value || SameClass<H, H3>::value ||
+                       SameClass<H, H4>::value || SameClass<H, H5>::value || SameClass<H, H6>::value };
+    };
+
+    //! run makes one pass over the handlers, and sleeps if none of them were runnable
+    void run()
+    {
+        RunStart pass;
+        startPass(&pass);
+
+        // perform run functions for all runnable handlers, one after the other
+        bool ran = false;
+        ran |= runSlot(0, (H1 *)0);
+        ran |= runSlot(1, (H2 *)0);
+        ran |= runSlot(2, (H3 *)0);
+        ran |= runSlot(3, (H4 *)0);
+        ran |= runSlot(4, (H5 *)0);
+        ran |= runSlot(5, (H6 *)0);
+
+        if (!ran) {
+            idle(canDeepSleep());
+        }
+#ifdef ENABLE_PROFILING
+        else {
+            endPass(pass);
+        }
+#endif
+    }
+
+private:
+    // an array of negative size, if a class is in the list twice
+    template <class A, class B>
+    struct Distinct {
+        enum { value = !SameClass<A, B>::value || SameClass<A, NoHandler>::value };
+    };
+    typedef char NoClassTwice[(Distinct<H1, H2>::value && Distinct<H1, H3>::value && Distinct<H1, H4>::value &&
+                               Distinct<H1, H5>::value && Distinct<H1, H6>::value && Distinct<H2, H3>::value &&
+                               Distinct<H2, H4>::value && Distinct<H2, H5>::value && Distinct<H2, H6>::value &&
+                               Distinct<H3, H4>::value && Distinct<H3, H5>::value && Distinct<H3, H6>::value &&
+                               Distinct<H4, H5>::value && Distinct<H4, H6>::value && Distinct<H5, H6>::value) ? 1 : -1];
+
+    // and if there is a handler after a NoHandler, which is a handler missing from the list
+    template <class A, class B>
+    struct InOrder {
+        enum { value = !SameClass<A, NoHandler>::value || SameClass<B, NoHandler>::value };
+    };
+    typedef char NoGaps[(!SameClass<H1, NoHandler>::value && InOrder<H1, H2>::value && InOrder<H2, H3>::value &&
+                         InOrder<H3, H4>::value && InOrder<H4, H5>::value && InOrder<H5, H6>::value) ? 1 : -1];
+
+    // the handlers are kept by SchedulerBase, in list order, and a slot is given its class back by the type of a null
+    // pointer, which C++03 allows where it does not allow a member template to be specialised for NoHandler
+    template <class H>
+    void add(H &handler) { SchedulerBase::add(&handler); }
+    void add(NoHandler &handler) {}
+
+    template <class H>
+    bool runSlot(uint8_t slot, H *) { return runHandler(slot, *static_cast<H *>(handler(slot))); }
+    bool runSlot(uint8_t slot, NoHandler *) { return false; }
+
+    // the names are only needed while the slots are added, so are not kept
+    void handlerNames(const char **names)
+    {
+        names[0] = name(0, (H1 *)0);
+        names[1] = name(1, (H2 *)0);
+        names[2] = name(2, (H3 *)0);
+        names[3] = name(3, (H4 *)0);
+        names[4] = name(4, (H5 *)0);
+        names[5] = name(5, (H6 *)0);
+    }
+    template <class H>
+    const char *name(uint8_t slot, H *) { return static_cast<H *>(handler(slot))->name(); }
+    const char *name(uint8_t slot, NoHandler *) { return NULL; }
+
+    //! canDeepSleep is true if every handler \a canDeepSleep
+    bool canDeepSleep()
+    {
+#ifdef ENABLE_LOW_POWER
+        return canDeepSleep(0, (H1 *)0) && canDeepSleep(1, (H2 *)0) && canDeepSleep(2, (H3 *)0) &&
+               canDeepSleep(3, (H4 *)0) && canDeepSleep(4, (H5 *)0) && canDeepSleep(5, (H6 *)0);
+#else
+        return false;
+#endif
+    }
+    template <class H>
+    bool canDeepSleep(uint8_t slot, H *) { return static_cast<H *>(handler(slot))->canDeepSleep(); }
+    bool canDeepSleep(uint8_t slot, NoHandler *) { return true; }
+};
+
+#endif // __SCHEDULER_H__
@@ -0,0 +1,20 @@
+#include "sensor.h"
+
+#include <stddef.h>
+
+static const SensorQuantity s_dht22[] = {
+    { "Temperature", "degC" },
+    { "Humidity",    "pc" },
+    { "Dew point",   "" }
+};
+
+const SensorQuantity *sensorQuantities(uint8_t kind, uint8_t *count)
+{
+    switch (kind) {
+    case sensor_Dht22:
+        *count = sizeof(s_dht22) / sizeof(s_dht22[0]);
+        return s_dht22;
+    }
+    *count = 0;
+    return NULL;
+}
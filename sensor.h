@@ -0,0 +1,82 @@
+#ifndef __SENSOR_H__
+#define __SENSOR_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define SENSOR_MAX_VALUES   3u      // most values a sensor gives in one reading
+
+/*!
+ * \brief The sensor_kind_t enum is what kind of sensor a \a Measurement came from, which says what its values are
+ */
+enum sensor_kind_t {
+    sensor_Dht22 = 1        ///< temperature (hundredths of a degC), humidity (hundredths of a pc), dewpoint (hundredths of a degC)
+};
+
+/*!
+ * \brief The Measurement struct is a reading from any of the sensors, tagged with the sensor it came from
+ *
+ * It is what goes from \a SensorSampler to \a MeasurementHandler, and on to the SD card and USB.
+ */
+struct Measurement {
+    time_t  time;           ///< when the reading was taken
+    uint16_t ms;            ///< ms past \a time
+    uint8_t sensor;         ///< index of the sensor in the \a SensorSampler, 0 for the first
+    uint8_t kind;           ///< \a sensor_kind_t
+    int16_t value[SENSOR_MAX_VALUES];   ///< in hundredths of a unit, in the order given by \a kind
+};
+
+/*!
+ * \brief The SensorError struct is a failed reading from one of the sensors
+ */
+struct SensorError {
+    uint8_t sensor;         ///< index of the sensor in the \a SensorSampler
+    int8_t  error;          ///< the eError
+};
+
+/*!
+ * \brief The SensorQuantity struct describes one of the values of a kind of sensor, for printing it
+ */
+struct SensorQuantity {
+    const char *name;       ///< e.g. "Temperature"
+    const char *unit;       ///< e.g. "degC"
+};
+
+/*!
+ * \brief sensorQuantities describes the values of a kind of sensor
+ * \param kind is the \a sensor_kind_t
+ * \param count is set to the number of values, 0 for an unknown kind
+ * \return a table of \a count quantities, in the order of \a Measurement::value
+ */
+const SensorQuantity *sensorQuantities(uint8_t kind, uint8_t *count);
+
+/*!
+ * \brief The Sensor class is the interface \a SensorSampler reads a sensor through
+ *
+ * A reading does not block: \sa start begins it and says how long it takes, and \sa collect is called once that
+ * long has passed, to end it and get the values. \a SensorSampler only has one reading going at a time, so a sensor
+ * can assume it has the CPU's interrupts to itself while its reading is going.
+ */
+class Sensor
+{
+public:
+    virtual ~Sensor() {}
+
+    //! kind is the \a sensor_kind_t of the sensor's readings
+    virtual uint8_t kind() const = 0;
+
+    /*!
+     * \brief start begins a reading
+     * \return the ms until \sa collect can be called
+     */
+    virtual uint16_t start() = 0;
+
+    /*!
+     * \brief collect ends the reading begun by \sa start
+     * \param value is set to the values of the reading, as many as \a sensorQuantities gives for \sa kind
+     * \return ERROR_NONE (0) if the reading was good, otherwise why not, as an eError
+     */
+    virtual int collect(int16_t *value) = 0;
+};
+
+#endif // __SENSOR_H__
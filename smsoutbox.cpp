@@ -0,0 +1,551 @@
+#include "mbed.h"
+#include "smsoutbox.h"
+#include "crc16.h"
+
+#include <string.h>
+
+#define OUTBOX_MAGIC        0x4F53u     // "SO"
+#define OUTBOX_VERSION      1u
+#define OUTBOX_HEADER_LEN   9u
+#define OUTBOX_NO_WAIT      0xFFFFFFFFu
+
+#define HELD_NUMBER         0x01u       // Entry::held, already counted as held back by its number's limit
+#define HELD_GLOBAL         0x02u       // and by the overall limit
+
+void TokenBucket::refill(uint8_t burst, uint32_t periodMs, uint32_t now)
+{
+    if (tokens >= burst) {
+        refilledAt = now;
+        return;
+    }
+    uint32_t add = (now - refilledAt) / periodMs;
+    if (add == 0) {
+        return;
+    }
+    if (tokens + add >= burst) {
+        tokens = burst;
+        refilledAt = now;
+    }
+    else {
+        tokens += (uint8_t)add;
+        refilledAt += add * periodMs;
+    }
+}
+
+uint32_t TokenBucket::wait(uint32_t periodMs, uint32_t now) const
+{
+    if (tokens) {
+        return 0;
+    }
+    uint32_t elapsed = now - refilledAt;
+    return (elapsed < periodMs) ? (periodMs - elapsed) : 0;
+}
+
+// copy the next number in a comma separated list into dst, without the spaces around it
+static bool nextNumber(const char **list, char *dst, bool *tooLong)
+{
+    const char *p = *list;
+    while ((*p == ' ') || (*p == ',')) {
+        p++;
+    }
+    if (*p == 0) {
+        *list = p;
+        return false;
+    }
+
+    const char *end = p;
+    while ((*end != 0) && (*end != ',')) {
+        end++;
+    }
+    *list = end;
+    while ((end > p) && (end[-1] == ' ')) {
+        end--;
+    }
+
+    uint16_t len = (uint16_t)(end - p);
+    *tooLong = (len >= SMS_NUMBER_MAXLEN);
+    if (!*tooLong) {
+        memcpy(dst, p, len);
+        dst[len] = 0;
+    }
+    return true;
+}
+
+SmsOutbox::SmsOutbox()
+{
+    clear();
+    memset(m_limits, 0, sizeof(m_limits));
+    m_global.reset(SMS_RATE_GLOBAL_BURST, 0);
+    m_generation = 0;
+    m_dirty = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void SmsOutbox::clear()
+{
+    memset(m_messages, 0, sizeof(m_messages));
+    memset(m_entries, 0, sizeof(m_entries));
+    m_seq = 0;
+}
+
+bool SmsOutbox::post(const char *text, const char *numbers, uint32_t now)
+{
+    char number[SMS_NUMBER_MAXLEN];
+    bool tooLong;
+
+    // count the numbers first, so nothing is queued unless all of them fit
+    uint8_t needed = 0;
+    for (const char *p = numbers; nextNumber(&p, number, &tooLong); ) {
+        if (!tooLong) {
+            needed++;
+        }
+    }
+    uint8_t freeEntries = SMS_OUTBOX_ENTRIES - waiting();
+
+    // the same text may already be waiting, e.g. an alert that is still true
+    int8_t msg = -1;
+    for (uint8_t i = 0; (i < SMS_OUTBOX_MESSAGES) && (msg < 0); i++) {
+        if (m_messages[i].users && (strncmp(m_messages[i].text, text, SMS_TEXT_MAXLEN) == 0)) {
+            msg = i;
+        }
+    }
+    for (uint8_t i = 0; (i < SMS_OUTBOX_MESSAGES) && (msg < 0); i++) {
+        if (m_messages[i].users == 0) {
+            msg = i;
+            strncpy(m_messages[i].text, text, SMS_TEXT_MAXLEN);
+            m_messages[i].text[SMS_TEXT_MAXLEN] = 0;
+        }
+    }
+    if ((needed == 0) || (needed > freeEntries) || (msg < 0)) {
+        m_stats.refused++;
+        return false;
+    }
+
+    uint8_t queued = 0;
+    for (const char *p = numbers; nextNumber(&p, number, &tooLong); ) {
+        if (tooLong) {
+            continue;
+        }
+
+        // the number may be in the list twice, or already waiting for this text
+        bool dup = false;
+        int8_t slot = -1;
+        for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+            Entry &e = m_entries[i];
+            if (e.state == entry_Free) {
+                if (slot < 0) {
+                    slot = i;
+                }
+            }
+            else if ((e.message == msg) && (strcmp(e.number, number) == 0)) {
+                dup = true;
+                break;
+            }
+        }
+        if (dup || (slot < 0)) {
+            continue;
+        }
+
+        Entry &e = m_entries[slot];
+        strcpy(e.number, number);
+        e.state     = entry_Waiting;
+        e.message   = (uint8_t)msg;
+        e.attempts  = 0;
+        e.held      = 0;
+        e.seq       = m_seq++;
+        e.notBefore = now;
+        m_messages[msg].users++;
+        queued++;
+    }
+
+    m_stats.posted += queued;
+    uint8_t n = waiting();
+    if (n > m_stats.highWater) {
+        m_stats.highWater = n;
+    }
+    if (queued) {
+        m_dirty = true;
+    }
+    return true;
+}
+
+bool SmsOutbox::begin(uint32_t now, SmsOutboxItem *item, uint32_t *waitMs)
+{
+    int8_t best = -1;
+    uint32_t wait = OUTBOX_NO_WAIT;
+
+    // the oldest entry that is not waiting to retry, and whose number has a token
+    for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+        Entry &e = m_entries[i];
+        if (e.state != entry_Waiting) {
+            continue;
+        }
+        if ((best >= 0) && ((int16_t)(e.seq - m_entries[best].seq) > 0)) {
+            continue;
+        }
+        if ((int32_t)(e.notBefore - now) > 0) {
+            if (e.notBefore - now < wait) {
+                wait = e.notBefore - now;
+            }
+            continue;
+        }
+        uint32_t w = limitFor(e.number, now)->bucket.wait(SMS_RATE_NUMBER_MS, now);
+        if (w) {
+            if (!(e.held & HELD_NUMBER)) {
+                e.held |= HELD_NUMBER;
+                m_stats.numberLimited++;
+            }
+            if (w < wait) {
+                wait = w;
+            }
+            continue;
+        }
+        best = i;
+    }
+
+    if (best < 0) {
+        *waitMs = wait;
+        return false;
+    }
+
+    Entry &e = m_entries[best];
+    m_global.refill(SMS_RATE_GLOBAL_BURST, SMS_RATE_GLOBAL_MS, now);
+    uint32_t w = m_global.wait(SMS_RATE_GLOBAL_MS, now);
+    if (w) {
+        if (!(e.held & HELD_GLOBAL)) {
+            e.held |= HELD_GLOBAL;
+            m_stats.globalLimited++;
+        }
+        *waitMs = w;
+        return false;
+    }
+
+    limitFor(e.number, now)->bucket.tokens--;
+    m_global.tokens--;
+    e.state = entry_InFlight;
+
+    item->id     = (uint8_t)best;
+    item->number = e.number;
+    item->text   = m_messages[e.message].text;
+    return true;
+}
+
+void SmsOutbox::sent(uint8_t id)
+{
+    m_stats.sent++;
+    release(id);
+}
+
+void SmsOutbox::failed(uint8_t id, uint32_t now)
+{
+    Entry &e = m_entries[id];
+    m_stats.failures++;
+    e.attempts++;
+    if (e.attempts >= SMS_MAX_ATTEMPTS) {
+        m_stats.givenUp++;
+        release(id);
+        return;
+    }
+
+    uint32_t backoff = SMS_RETRY_BASE_MS << (e.attempts - 1);
+    if (backoff > SMS_RETRY_MAX_MS) {
+        backoff = SMS_RETRY_MAX_MS;
+    }
+    e.notBefore = now + backoff;
+    e.state = entry_Waiting;
+    m_dirty = true;
+}
+
+void SmsOutbox::abort(uint8_t id)
+{
+    if (m_entries[id].state == entry_InFlight) {
+        m_entries[id].state = entry_Waiting;
+    }
+}
+
+uint8_t SmsOutbox::waiting() const
+{
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+        if (m_entries[i].state != entry_Free) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void SmsOutbox::release(uint8_t id)
+{
+    Entry &e = m_entries[id];
+    if (e.state == entry_Free) {
+        return;
+    }
+    e.state = entry_Free;
+    m_messages[e.message].users--;
+    m_dirty = true;
+}
+
+SmsOutbox::NumberLimit *SmsOutbox::limitFor(const char *number, uint32_t now)
+{
+    uint32_t h = hash(number);
+
+    // a bucket that has refilled knows nothing a fresh one does not, so its slot can be reused. Failing that, the
+    // one with the most tokens left, and of those the one that has been refilling the longest, is closest to full,
+    // so forgetting it lets the fewest extra SMS through
+    NumberLimit *spare   = NULL;
+    NumberLimit *closest = NULL;
+    for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+        NumberLimit &l = m_limits[i];
+        if (l.hash == 0) {
+            spare = spare ? spare : &l;
+            continue;
+        }
+        l.bucket.refill(SMS_RATE_NUMBER_BURST, SMS_RATE_NUMBER_MS, now);
+        if (l.hash == h) {
+            return &l;
+        }
+        if (l.bucket.tokens >= SMS_RATE_NUMBER_BURST) {
+            spare = spare ? spare : &l;
+        }
+        else if ((closest == NULL) || (l.bucket.tokens > closest->bucket.tokens) ||
+                 ((l.bucket.tokens == closest->bucket.tokens) &&
+                  ((int32_t)(l.bucket.refilledAt - closest->bucket.refilledAt) < 0))) {
+            closest = &l;
+        }
+    }
+
+    NumberLimit *l = spare ? spare : closest;
+    l->hash = h;
+    l->bucket.reset(SMS_RATE_NUMBER_BURST, now);
+    return l;
+}
+
+uint32_t SmsOutbox::hash(const char *number)
+{
+    // FNV-1a. 0 marks a free slot, so is never used
+    uint32_t h = 2166136261u;
+    while (*number) {
+        h ^= (unsigned char)*number++;
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+
+/*
+ * Each copy is written and read a field at a time through stdio, keeping the CRC as it goes, so no RAM is needed
+ * for an image of the whole outbox
+ */
+namespace {
+
+class ImageWriter {
+public:
+    ImageWriter(FILE *fp) : m_fp(fp), m_crc(CRC16_INIT), m_ok(true) {}
+
+    void put(const void *data, uint16_t len)
+    {
+        m_crc = crc16((const unsigned char*)data, len, m_crc);
+        m_ok = m_ok && (fwrite(data, 1, len, m_fp) == len);
+    }
+    void put8(uint8_t v) { put(&v, 1); }
+    void put16(uint16_t v) { put8((uint8_t)v); put8((uint8_t)(v >> 8)); }
+    void put32(uint32_t v) { put16((uint16_t)v); put16((uint16_t)(v >> 16)); }
+    void putString(const char *s) { uint8_t len = (uint8_t)strlen(s); put8(len); put(s, len); }
+
+    bool finish() { put16(m_crc); return m_ok; }
+
+private:
+    FILE    *m_fp;
+    uint16_t m_crc;
+    bool     m_ok;
+};
+
+class ImageReader {
+public:
+    ImageReader(FILE *fp) : m_fp(fp), m_crc(CRC16_INIT), m_ok(true) {}
+
+    void get(void *data, uint16_t len)
+    {
+        m_ok = m_ok && (fread(data, 1, len, m_fp) == len);
+        if (m_ok) {
+            m_crc = crc16((const unsigned char*)data, len, m_crc);
+        }
+    }
+    uint8_t  get8() { uint8_t v = 0; get(&v, 1); return v; }
+    uint16_t get16() { uint16_t v = get8(); return v | ((uint16_t)get8() << 8); }
+    uint32_t get32() { uint32_t v = get16(); return v | ((uint32_t)get16() << 16); }
+    bool getString(char *dst, uint16_t size)
+    {
+        uint8_t len = get8();
+        if (len >= size) {
+            m_ok = false;
+            return false;
+        }
+        get(dst, len);
+        dst[len] = 0;
+        return m_ok;
+    }
+
+    bool finish() { uint16_t crc = m_crc; return (get16() == crc) && m_ok; }
+    bool ok() const { return m_ok; }
+
+private:
+    FILE    *m_fp;
+    uint16_t m_crc;
+    bool     m_ok;
+};
+
+} // namespace
+
+bool SmsOutbox::save(const char *path)
+{
+    FILE *fp = fopen(path, "r+b");
+    if (fp == NULL) {
+        fp = fopen(path, "w+b");
+    }
+    if (fp == NULL) {
+        m_stats.saveErrors++;
+        return false;
+    }
+
+    // write over the older copy, so the newer one is still there if this is cut short
+    uint32_t generation = m_generation + 1;
+    bool ok = (fseek(fp, (generation & 1) * SMS_OUTBOX_IMAGE_MAX, SEEK_SET) == 0);
+
+    uint8_t messages = 0;
+    for (uint8_t i = 0; i < SMS_OUTBOX_MESSAGES; i++) {
+        messages += m_messages[i].users ? 1 : 0;
+    }
+
+    ImageWriter w(fp);
+    w.put16(OUTBOX_MAGIC);
+    w.put8(OUTBOX_VERSION);
+    w.put32(generation);
+    w.put8(messages);
+    w.put8(waiting());
+    for (uint8_t i = 0; i < SMS_OUTBOX_MESSAGES; i++) {
+        if (m_messages[i].users) {
+            w.put8(i);
+            w.putString(m_messages[i].text);
+        }
+    }
+    for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+        const Entry &e = m_entries[i];
+        if (e.state != entry_Free) {
+            w.put8(e.message);
+            w.put8(e.attempts);
+            w.put16(e.seq);
+            w.putString(e.number);
+        }
+    }
+    ok = w.finish() && ok;
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok) {
+        m_stats.saveErrors++;
+        return false;
+    }
+    m_generation = generation;
+    m_dirty = false;
+    m_stats.saves++;
+    return true;
+}
+
+bool SmsOutbox::load(const char *path, uint32_t now)
+{
+    clear();
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    // find which copies look like copies, and try the newest first
+    bool     valid[2];
+    uint32_t generation[2];
+    for (uint8_t c = 0; c < 2; c++) {
+        unsigned char h[OUTBOX_HEADER_LEN];
+        valid[c] = (fseek(fp, c * SMS_OUTBOX_IMAGE_MAX, SEEK_SET) == 0) && (fread(h, 1, sizeof(h), fp) == sizeof(h)) &&
+                   ((h[0] | (h[1] << 8)) == OUTBOX_MAGIC) && (h[2] == OUTBOX_VERSION);
+        generation[c] = h[3] | ((uint32_t)h[4] << 8) | ((uint32_t)h[5] << 16) | ((uint32_t)h[6] << 24);
+    }
+    uint8_t first = (valid[0] && valid[1]) ? (((int32_t)(generation[1] - generation[0]) > 0) ? 1 : 0) : (valid[1] ? 1 : 0);
+
+    bool ok = false;
+    for (uint8_t n = 0; (n < 2) && !ok; n++) {
+        uint8_t c = n ? (1 - first) : first;
+        if (valid[c]) {
+            ok = loadCopy(fp, c * SMS_OUTBOX_IMAGE_MAX);
+            if (!ok) {
+                clear();
+            }
+        }
+    }
+    fclose(fp);
+
+    if (ok) {
+        for (uint8_t i = 0; i < SMS_OUTBOX_ENTRIES; i++) {
+            if (m_entries[i].state != entry_Free) {
+                m_entries[i].notBefore = now;
+                m_stats.restored++;
+            }
+        }
+        if (waiting() > m_stats.highWater) {
+            m_stats.highWater = waiting();
+        }
+    }
+    m_dirty = false;
+    return ok;
+}
+
+bool SmsOutbox::loadCopy(FILE *fp, uint32_t offset)
+{
+    if (fseek(fp, offset, SEEK_SET) != 0) {
+        return false;
+    }
+
+    ImageReader r(fp);
+    if ((r.get16() != OUTBOX_MAGIC) || (r.get8() != OUTBOX_VERSION)) {
+        return false;
+    }
+    uint32_t generation = r.get32();
+    uint8_t messages = r.get8();
+    uint8_t entries  = r.get8();
+    if ((messages > SMS_OUTBOX_MESSAGES) || (entries > SMS_OUTBOX_ENTRIES)) {
+        return false;
+    }
+
+    bool present[SMS_OUTBOX_MESSAGES] = { false };
+    for (uint8_t i = 0; (i < messages) && r.ok(); i++) {
+        uint8_t slot = r.get8();
+        if ((slot >= SMS_OUTBOX_MESSAGES) || !r.getString(m_messages[slot].text, sizeof(m_messages[slot].text))) {
+            return false;
+        }
+        present[slot] = true;
+    }
+
+    bool first = true;
+    for (uint8_t i = 0; (i < entries) && r.ok(); i++) {
+        Entry &e = m_entries[i];
+        e.message  = r.get8();
+        e.attempts = r.get8();
+        e.seq      = r.get16();
+        if ((e.message >= SMS_OUTBOX_MESSAGES) || !present[e.message] || !r.getString(e.number, sizeof(e.number))) {
+            return false;
+        }
+        e.state = entry_Waiting;
+        e.held  = 0;
+        m_messages[e.message].users++;
+
+        // carry on the sequence after the newest entry
+        if (first || ((int16_t)(e.seq - m_seq) >= 0)) {
+            m_seq = e.seq + 1;
+            first = false;
+        }
+    }
+
+    if (!r.finish()) {
+        return false;
+    }
+    m_generation = generation;
+    return true;
+}
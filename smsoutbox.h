@@ -0,0 +1,189 @@
+#ifndef __SMS_OUTBOX_H__
+#define __SMS_OUTBOX_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SMS_TEXT_MAXLEN             160u        // characters in one SMS
+#define SMS_NUMBER_MAXLEN           20u         // a phone number, with its terminator
+#define SMS_OUTBOX_MESSAGES         4u          // different texts waiting at once
+#define SMS_OUTBOX_ENTRIES          12u         // sends of a text to one number waiting at once
+
+#define SMS_RATE_NUMBER_BURST       3u          // SMS a number can be sent back to back
+#define SMS_RATE_NUMBER_MS          300000u     // then one every five minutes
+#define SMS_RATE_GLOBAL_BURST       12u         // SMS that can be sent back to back in all
+#define SMS_RATE_GLOBAL_MS          20000u      // then one every 20 s
+
+#define SMS_RETRY_BASE_MS           5000u       // wait after the first failure, doubled after each one after it
+#define SMS_RETRY_MAX_MS            600000u     // longest wait between attempts
+#define SMS_MAX_ATTEMPTS            6u          // attempts before an SMS is given up on
+
+#define SMS_OUTBOX_IMAGE_MAX        1024u       // room for each of the two copies in the file
+
+/*!
+ * \brief The TokenBucket struct limits how often something can happen: up to \a burst times back to back, and then
+ * once per period as the bucket refills
+ *
+ * Times are \a MyTimers::now ticks. A full bucket keeps its refill time up to date, so only a bucket that is
+ * refilling measures a period of time, and that is never long enough for the ticks to wrap.
+ */
+struct TokenBucket {
+    uint8_t  tokens;
+    uint32_t refilledAt;    ///< when the last token was added, or when it was last seen full
+
+    void reset(uint8_t burst, uint32_t now) { tokens = burst; refilledAt = now; }
+
+    //! refill adds a token for every \a periodMs since the last one
+    void refill(uint8_t burst, uint32_t periodMs, uint32_t now);
+
+    //! wait is how long until a token is available, 0 if there is one now. Call \a refill first
+    uint32_t wait(uint32_t periodMs, uint32_t now) const;
+};
+
+/*!
+ * \brief The SmsOutboxItem struct is an SMS that is due to be sent, from \sa SmsOutbox::begin
+ *
+ * \a number and \a text point into the outbox, and stay valid until the item is given back with \sa SmsOutbox::sent,
+ * \sa SmsOutbox::failed or \sa SmsOutbox::abort.
+ */
+struct SmsOutboxItem {
+    uint8_t     id;
+    const char *number;
+    const char *text;
+};
+
+/*!
+ * \brief The SmsOutboxStats struct counts what has happened to the SMS posted to an \a SmsOutbox
+ */
+struct SmsOutboxStats {
+    uint32_t posted;            ///< sends queued, one for each number a text was posted to
+    uint32_t refused;           ///< posts refused because there was no room for all of their numbers
+    uint32_t sent;
+    uint32_t failures;          ///< attempts that failed, and were tried again or given up on
+    uint32_t givenUp;           ///< sends that failed SMS_MAX_ATTEMPTS times
+    uint32_t numberLimited;     ///< times the next send was held back by its number's rate limit
+    uint32_t globalLimited;     ///< times the next send was held back by the overall rate limit
+    uint32_t saves;
+    uint32_t saveErrors;
+    uint32_t restored;          ///< sends restored from the file at startup
+    uint8_t  highWater;         ///< most sends waiting at once
+};
+
+/*!
+ * \brief The SmsOutbox class holds the SMS waiting to be sent, in RAM, mirrored to a file so they survive a restart
+ *
+ * \sa post queues a text to a list of numbers. The text is kept once, and each number gets an entry of its own that
+ * refers to it, so the entries are sent, retried and given up on separately.
+ *
+ * \sa begin hands out the oldest entry that is allowed to go now. An entry is held back while:
+ *  - it is waiting to be retried. Each failure doubles the wait, from SMS_RETRY_BASE_MS up to SMS_RETRY_MAX_MS,
+ *    and after SMS_MAX_ATTEMPTS it is given up on
+ *  - its number has had SMS_RATE_NUMBER_BURST SMS recently (a \a TokenBucket per number)
+ *  - SMS_RATE_GLOBAL_BURST SMS in all have gone recently (one more \a TokenBucket)
+ * Entries behind one that is held back are not held up by it, so one busy number does not stop the others.
+ *
+ * The file has two copies of the outbox, written in turn, each with a generation number and a CRC-16, so a copy
+ * cut short by a restart leaves the one before it to load. A copy is:
+ *
+ *   header:   magic "SO" (2), version (1), generation (4), messages (1), entries (1)
+ *   message:  slot (1), length (1), text
+ *   entry:    message slot (1), attempts (1), sequence (2), length (1), number
+ *   trailer:  CRC-16 of everything before it (2)
+ *
+ * Rate limits and retry waits are not saved, so after a restart everything waiting is due straight away.
+ */
+class SmsOutbox
+{
+public:
+    SmsOutbox();
+
+    /*!
+     * \brief post queues \a text to each of \a numbers
+     * \param numbers is a comma separated list. Spaces around the numbers and repeated numbers are ignored
+     * \param now is \a MyTimers::now
+     * \return false if there is not room for all of them, in which case none are queued. A number that is already
+     * waiting for the same text is not queued again
+     */
+    bool post(const char *text, const char *numbers, uint32_t now);
+
+    /*!
+     * \brief begin takes the next entry that is allowed to go now, and uses up a token from each rate limit for it
+     * \param item is set to the entry, if there is one
+     * \param waitMs is set to how long until one is allowed, if there is none now. 0xFFFFFFFF if nothing is waiting
+     * \return true if \a item was set
+     */
+    bool begin(uint32_t now, SmsOutboxItem *item, uint32_t *waitMs);
+
+    //! sent removes an entry that has been sent
+    void sent(uint8_t id);
+
+    //! failed counts a failed attempt, and either waits to retry the entry or gives up on it
+    void failed(uint8_t id, uint32_t now);
+
+    //! abort puts an entry back, without counting an attempt, e.g. when the modem is restarted under it
+    void abort(uint8_t id);
+
+    //! waiting is the number of entries not yet sent
+    uint8_t waiting() const;
+
+    //! dirty is true if the outbox has changed since it was last saved
+    bool dirty() const { return m_dirty; }
+
+    /*!
+     * \brief save writes the outbox over the older of the two copies in \a path
+     * \return false if it could not be written, in which case it is still \a dirty
+     */
+    bool save(const char *path);
+
+    /*!
+     * \brief load replaces the outbox with the newest good copy in \a path
+     * \return false if there is no good copy, in which case the outbox is left empty
+     */
+    bool load(const char *path, uint32_t now);
+
+    const SmsOutboxStats &stats() const { return m_stats; }
+
+private:
+    enum entry_state_t {
+        entry_Free,
+        entry_Waiting,          ///< waiting to be sent, from \a notBefore
+        entry_InFlight          ///< handed out by \a begin
+    };
+
+    struct Message {
+        char    text[SMS_TEXT_MAXLEN + 1];
+        uint8_t users;          ///< entries that refer to it. Free when 0
+    };
+
+    struct Entry {
+        char     number[SMS_NUMBER_MAXLEN];
+        uint8_t  state;         ///< \a entry_state_t
+        uint8_t  message;       ///< index into \a m_messages
+        uint8_t  attempts;      ///< failed so far
+        uint8_t  held;          ///< rate limits it has been counted as held back by
+        uint16_t seq;           ///< order posted in, so the oldest goes first
+        uint32_t notBefore;     ///< \a MyTimers::now when it may be tried again
+    };
+
+    struct NumberLimit {
+        uint32_t    hash;       ///< of the number, 0 if the slot is free
+        TokenBucket bucket;
+    };
+
+    Message     m_messages[SMS_OUTBOX_MESSAGES];
+    Entry       m_entries[SMS_OUTBOX_ENTRIES];
+    NumberLimit m_limits[SMS_OUTBOX_ENTRIES];   ///< one for each number waiting is enough
+    TokenBucket m_global;
+    uint16_t    m_seq;          ///< sequence number of the next entry posted
+    uint32_t    m_generation;   ///< of the last copy saved or loaded
+    bool        m_dirty;
+    SmsOutboxStats m_stats;
+
+    void clear();
+    void release(uint8_t id);   // free an entry, and its message if nothing else uses it
+    NumberLimit *limitFor(const char *number, uint32_t now);
+    bool loadCopy(FILE *fp, uint32_t offset);
+    static uint32_t hash(const char *number);
+};
+
+#endif // __SMS_OUTBOX_H__
@@ -0,0 +1,169 @@
+#include "telemetry.h"
+#include "crc16.h"
+#include "byteorder.h"
+
+#include <string.h>
+
+#define TELEMETRY_HEADER_LEN    6u      // type, sequence, time
+#define TELEMETRY_SAMPLE_LEN    (TELEMETRY_HEADER_LEN + 2u + (SENSOR_MAX_VALUES * 2u) + 2u)
+
+uint16_t cobsEncode(const unsigned char *src, uint16_t len, unsigned char *dst)
+{
+    // each run of non-zero bytes is preceded by its length plus one, in place of the 0 after it
+    uint16_t code = 0;      // where the length of the current run goes
+    uint16_t out  = 1;
+    for (uint16_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[code] = (unsigned char)(out - code);
+            code = out++;
+        }
+        else {
+            dst[out++] = src[i];
+            if ((out - code) == 0xFF) {
+                // a run of 254 bytes is not followed by a 0
+                dst[code] = 0xFF;
+                code = out++;
+            }
+        }
+    }
+    dst[code] = (unsigned char)(out - code);
+    return out;
+}
+
+int cobsDecode(const unsigned char *src, uint16_t len, unsigned char *dst)
+{
+    uint16_t in = 0, out = 0;
+    while (in < len) {
+        uint8_t code = src[in++];
+        if ((code == 0) || ((uint16_t)(in + code - 1) > len)) {
+            return -1;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            if (src[in] == 0) {
+                return -1;
+            }
+            dst[out++] = src[in++];
+        }
+        // a run shorter than 254 stood for a 0, except at the very end
+        if ((code != 0xFF) && (in < len)) {
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
+
+uint8_t TelemetryEncoder::sample(unsigned char *frame, const Measurement &m)
+{
+    unsigned char record[TELEMETRY_RECORD_MAX];
+    record[0] = tlm_Sample;
+    put32(record + 2, (uint32_t)m.time);
+    record[6] = m.sensor;
+    record[7] = m.kind;
+    for (uint8_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+        put16(record + 8 + (i * 2), (uint16_t)m.value[i]);
+    }
+    put16(record + 8 + (SENSOR_MAX_VALUES * 2), m.ms);
+    return seal(frame, record, TELEMETRY_SAMPLE_LEN);
+}
+
+uint8_t TelemetryEncoder::error(unsigned char *frame, uint32_t time, uint8_t sensor, int8_t error)
+{
+    unsigned char record[TELEMETRY_RECORD_MAX];
+    record[0] = tlm_Error;
+    put32(record + 2, time);
+    record[6] = sensor;
+    record[7] = (unsigned char)error;
+    return seal(frame, record, TELEMETRY_HEADER_LEN + 2);
+}
+
+uint8_t TelemetryEncoder::counters(unsigned char *frame, uint32_t time, const TelemetryCounters &counters)
+{
+    unsigned char record[TELEMETRY_RECORD_MAX];
+    record[0] = tlm_Counters;
+    put32(record + 2,  time);
+    put32(record + 6,  counters.results);
+    put32(record + 10, counters.errors);
+    put32(record + 14, counters.resultDrops);
+    put32(record + 18, counters.errorDrops);
+    put32(record + 22, counters.usbDrops);
+    return seal(frame, record, TELEMETRY_HEADER_LEN + 20);
+}
+
+uint8_t TelemetryEncoder::text(unsigned char *frame, uint32_t time, const char *s, uint16_t len)
+{
+    unsigned char record[TELEMETRY_RECORD_MAX];
+    if (len > TELEMETRY_TEXT_MAX) {
+        len = TELEMETRY_TEXT_MAX;
+    }
+    record[0] = tlm_Text;
+    put32(record + 2, time);
+    memcpy(record + TELEMETRY_HEADER_LEN, s, len);
+    return seal(frame, record, TELEMETRY_HEADER_LEN + len);
+}
+
+uint8_t TelemetryEncoder::seal(unsigned char *frame, unsigned char *record, uint8_t len)
+{
+    record[1] = m_sequence++;
+    put16(record + len, crc16(record, len));
+    uint16_t frameLen = cobsEncode(record, len + 2, frame);
+    frame[frameLen++] = 0;
+    return (uint8_t)frameLen;
+}
+
+bool telemetryDecode(unsigned char *frame, uint16_t len, TelemetryRecord *record)
+{
+    int recordLen = cobsDecode(frame, len, frame);
+    if ((recordLen < (int)(TELEMETRY_HEADER_LEN + 2)) ||
+        (crc16(frame, recordLen - 2) != get16(frame + recordLen - 2))) {
+        return false;
+    }
+
+    uint16_t bodyLen = recordLen - TELEMETRY_HEADER_LEN - 2;
+    const unsigned char *body = frame + TELEMETRY_HEADER_LEN;
+    memset(record, 0, sizeof(*record));
+    record->type     = frame[0];
+    record->sequence = frame[1];
+    record->time     = get32(frame + 2);
+
+    switch (record->type) {
+    case tlm_Sample:
+        if (recordLen != (int)(TELEMETRY_SAMPLE_LEN + 2)) {
+            return false;
+        }
+        record->sensor = body[0];
+        record->kind   = body[1];
+        for (uint8_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+            record->value[i] = (int16_t)get16(body + 2 + (i * 2));
+        }
+        record->ms = get16(body + 2 + (SENSOR_MAX_VALUES * 2));
+        return true;
+
+    case tlm_Error:
+        if (bodyLen != 2) {
+            return false;
+        }
+        record->sensor = body[0];
+        record->error  = (int8_t)body[1];
+        return true;
+
+    case tlm_Counters:
+        if (bodyLen != 20) {
+            return false;
+        }
+        record->counters.results     = get32(body);
+        record->counters.errors      = get32(body + 4);
+        record->counters.resultDrops = get32(body + 8);
+        record->counters.errorDrops  = get32(body + 12);
+        record->counters.usbDrops    = get32(body + 16);
+        return true;
+
+    case tlm_Text:
+        if (bodyLen > TELEMETRY_TEXT_MAX) {
+            return false;
+        }
+        memcpy(record->text, body, bodyLen);
+        record->text[bodyLen] = 0;
+        return true;
+    }
+    return false;
+}
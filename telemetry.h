@@ -0,0 +1,101 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+#include "sensor.h"
+
+#define TELEMETRY_TEXT_MAX      64u         // longest text in a text record
+#define TELEMETRY_RECORD_MAX    (2u + 4u + TELEMETRY_TEXT_MAX + 2u)     // type, sequence, time, text, CRC
+#define TELEMETRY_FRAME_MAX     (TELEMETRY_RECORD_MAX + 2u)     // COBS adds a byte per 254, and the 0 delimiter
+
+/*!
+ * \brief The telemetry_record_t enum is the type of a record, its first byte
+ */
+enum telemetry_record_t {
+    tlm_Sample   = 's',     ///< a \a Measurement. Body: sensor (1), kind (1), SENSOR_MAX_VALUES values (2 each), ms (2)
+    tlm_Error    = 'e',     ///< a failed measurement. Body: sensor (1), eError (1)
+    tlm_Counters = 'c',     ///< \a TelemetryCounters, each 4 bytes in the order they are declared
+    tlm_Text     = 't'      ///< terminal output. Body: the text, without a line ending. Longer text is cut short
+};
+
+/*!
+ * \brief The TelemetryCounters struct is what a counters record reports, all of them counts since the start
+ */
+struct TelemetryCounters {
+    uint32_t results;       ///< measurements posted
+    uint32_t errors;        ///< failed measurements posted
+    uint32_t resultDrops;   ///< measurements lost because MeasurementHandler's queue was full
+    uint32_t errorDrops;    ///< errors lost the same way
+    uint32_t usbDrops;      ///< messages and records lost because the USB buffer was full
+};
+
+/*!
+ * \brief The TelemetryRecord struct is a decoded record
+ */
+struct TelemetryRecord {
+    uint8_t  type;          ///< \a telemetry_record_t
+    uint8_t  sequence;
+    uint32_t time;          ///< seconds since 1970, 0 if the record has no time
+    uint16_t ms;            ///< \a tlm_Sample, ms past \a time
+    uint8_t  sensor;        ///< \a tlm_Sample and \a tlm_Error
+    uint8_t  kind;          ///< \a tlm_Sample, the \a sensor_kind_t
+    int16_t  value[SENSOR_MAX_VALUES];  ///< \a tlm_Sample, in hundredths
+    int8_t   error;         ///< \a tlm_Error
+    TelemetryCounters counters;     ///< \a tlm_Counters
+    char     text[TELEMETRY_TEXT_MAX + 1];  ///< \a tlm_Text, NULL terminated
+};
+
+/*!
+ * \brief The TelemetryEncoder class makes the frames of the live telemetry stream
+ *
+ * A record is, little endian:
+ *
+ *   type (1), sequence (1), time (4), body, CRC-16 of everything before it (2)
+ *
+ * and goes out COBS encoded, followed by a 0 byte. COBS leaves no 0 bytes in the frame, so a decoder can always find
+ * the start of the next frame after a lost or damaged one, whatever was in the records. The sequence number goes up
+ * by one with every record made, including any that could not be sent, so the decoder can count what was lost.
+ *
+ * Each function writes a whole frame, delimiter included, to \a frame, which needs room for TELEMETRY_FRAME_MAX
+ * bytes, and returns its length.
+ */
+class TelemetryEncoder
+{
+public:
+    TelemetryEncoder() : m_sequence(0) {}
+
+    uint8_t sample(unsigned char *frame, const Measurement &m);
+    uint8_t error(unsigned char *frame, uint32_t time, uint8_t sensor, int8_t error);
+    uint8_t counters(unsigned char *frame, uint32_t time, const TelemetryCounters &counters);
+    uint8_t text(unsigned char *frame, uint32_t time, const char *s, uint16_t len);
+
+private:
+    uint8_t m_sequence;     ///< of the next record
+
+    uint8_t seal(unsigned char *frame, unsigned char *record, uint8_t len);
+};
+
+/*!
+ * \brief cobsEncode encodes \a len bytes with Consistent Overhead Byte Stuffing, so there are no 0 bytes in the result
+ * \param dst needs room for \a len + 1 + \a len / 254 bytes. The 0 delimiter is not added
+ * \return the number of bytes written to \a dst
+ */
+uint16_t cobsEncode(const unsigned char *src, uint16_t len, unsigned char *dst);
+
+/*!
+ * \brief cobsDecode undoes \sa cobsEncode. \a dst can be \a src, as the result is never longer
+ * \param src is the frame, without its 0 delimiter
+ * \return the number of bytes written to \a dst, or -1 if \a src is not a valid encoding
+ */
+int cobsDecode(const unsigned char *src, uint16_t len, unsigned char *dst);
+
+/*!
+ * \brief telemetryDecode decodes a frame of the telemetry stream
+ * \param frame is the frame, without its 0 delimiter. It is decoded in place
+ * \param len is the number of bytes in \a frame
+ * \param record is filled in with the record
+ * \return true if it is a valid record, false if it is damaged or not a record
+ */
+bool telemetryDecode(unsigned char *frame, uint16_t len, TelemetryRecord *record);
+
+#endif // __TELEMETRY_H__
@@ -1,74 +1,178 @@
-#include "timers.h"
-
-MyTimers::MyTimers()
-{
-    // initialise timers
-    groveMeasureTimer = 0;
-    gprsPowerTimer    = 0;
-    gprsRxTxTimer     = 0;
-    sdWaitErrorTimer  = 0;
-    measFlashTimer    = 0;
-
-    m_tick = new Ticker();
-    // configure the ticker object to run every 1ms, and to call \sa run when it does so.
-    m_tick->attach(this, &MyTimers::run, 0.001);
-}
-
-MyTimers::~MyTimers()
-{
-    delete m_tick;
-}
-
-void MyTimers::run()
-{
-    // decrement each timer in the class
-    if (groveMeasureTimer) groveMeasureTimer--;
-    if (gprsPowerTimer   ) gprsPowerTimer--;
-    if (gprsRxTxTimer    ) gprsRxTxTimer--;
-    if (sdWaitErrorTimer ) sdWaitErrorTimer--;
-    if (measFlashTimer   ) measFlashTimer--;
-}
-
-
-void MyTimers::SetTimer(eTimerType timertype, unsigned long time_ms)
-{
-    // see which timer we have to set, and set it
-    switch(timertype)
-    {
-    case tmr_GroveMeasure:
-        groveMeasureTimer = time_ms;
-        break;
-    case tmr_GprsPower:
-        gprsPowerTimer = time_ms;
-        break;
-    case tmr_GprsRxTx:
-        gprsRxTxTimer = time_ms;
-        break;
-    case tmr_SdWaitError:
-        sdWaitErrorTimer = time_ms;
-        break;
-    case tmr_MeasFlash:
-        measFlashTimer = time_ms;
-        break;
-    }
-}
-
-unsigned long MyTimers::GetTimer(eTimerType timertype)
-{
-    // see which timer we have to get, and return it.
-    switch(timertype)
-    {
-    case tmr_GroveMeasure:
-        return groveMeasureTimer;
-    case tmr_GprsPower:
-        return gprsPowerTimer;
-    case tmr_GprsRxTx:
-        return gprsRxTxTimer;
-    case tmr_SdWaitError:
-        return sdWaitErrorTimer;
-    case tmr_MeasFlash:
-        return measFlashTimer;
-    }
-    return 0;
-}
-
+#include "timers.h"
+
+MyTimers::MyTimers()
+{
+    // initialise timers
+    for (int i = 0; i < MYTIMERS_MAX; i++) {
+        m_deadline[i] = 0;
+        m_next[i] = tmr_Invalid;
+    }
+    m_armed = 0;
+    m_head  = tmr_Invalid;
+    m_count = 0;
+
+    // initialise the time base
+    m_ms          = 0;
+    m_lastUs      = us_ticker_read();
+    m_usRemainder = 0;
+
+    m_isrCount  = 0;
+    m_wakeArmed = false;
+}
+
+MyTimers::timerid_t MyTimers::registerTimer()
+{
+    if (m_count >= MYTIMERS_MAX) {
+        return tmr_Invalid;
+    }
+    return (timerid_t)m_count++;
+}
+
+uint32_t MyTimers::now()
+{
+    // count the us elapsed since last time into whole ms. Unsigned subtraction copes with us_ticker wrapping.
+    uint32_t us = us_ticker_read();
+    m_usRemainder += us - m_lastUs;
+    m_lastUs = us;
+
+    m_ms += m_usRemainder / 1000;
+    m_usRemainder %= 1000;
+    return m_ms;
+}
+
+void MyTimers::skip(uint32_t time_ms)
+{
+    // count what the ticker did see first, so the remainder is not lost
+    now();
+    m_ms += time_ms;
+    armWake();
+}
+
+void MyTimers::SetTimer(timerid_t timertype, unsigned long time_ms)
+{
+    SetDeadline(timertype, now() + time_ms);
+}
+
+void MyTimers::SetDeadline(timerid_t timertype, uint32_t deadline)
+{
+    if ((timertype < 0) || (timertype >= m_count)) {
+        return;
+    }
+
+    timerid_t oldHead = m_head;
+    unlink(timertype);
+    m_deadline[timertype] = deadline;
+    link(timertype);
+
+    if (m_head != oldHead || m_head == timertype) {
+        armWake();
+    }
+}
+
+unsigned long MyTimers::GetTimer(timerid_t timertype)
+{
+    if ((timertype < 0) || (timertype >= m_count) || !(m_armed & (1u << timertype))) {
+        return 0;
+    }
+
+    int32_t remaining = (int32_t)(m_deadline[timertype] - now());
+    if (remaining > 0) {
+        return (unsigned long)remaining;
+    }
+
+    // the deadline has passed. Take it out of the list, and if it was the earliest, wait for the next one instead.
+    bool wasHead = (m_head == timertype);
+    unlink(timertype);
+    if (wasHead) {
+        armWake();
+    }
+    return 0;
+}
+
+bool MyTimers::nextExpiry(uint32_t *deadline)
+{
+    // timers that have passed without being checked are already elapsed as far as GetTimer is concerned,
+    // so drop them rather than report a deadline that is in the past
+    uint32_t t = now();
+    bool popped = false;
+    while ((m_head != tmr_Invalid) && ((int32_t)(m_deadline[m_head] - t) <= 0)) {
+        unlink(m_head);
+        popped = true;
+    }
+
+    if (m_head == tmr_Invalid) {
+        return false;
+    }
+
+    // make sure the interrupt is programmed, it may have fired early to refresh the time base
+    if (popped || !m_wakeArmed) {
+        armWake();
+    }
+    *deadline = m_deadline[m_head];
+    return true;
+}
+
+void MyTimers::link(timerid_t id)
+{
+    // walk to the first timer due after this one, so that timers with equal deadlines stay in the order they were set
+    timerid_t prev = tmr_Invalid;
+    timerid_t cur  = m_head;
+    while ((cur != tmr_Invalid) && ((int32_t)(m_deadline[cur] - m_deadline[id]) <= 0)) {
+        prev = cur;
+        cur  = m_next[cur];
+    }
+
+    m_next[id] = cur;
+    if (prev == tmr_Invalid) {
+        m_head = id;
+    } else {
+        m_next[prev] = id;
+    }
+    m_armed |= (1u << id);
+}
+
+void MyTimers::unlink(timerid_t id)
+{
+    if (!(m_armed & (1u << id))) {
+        return;
+    }
+
+    if (m_head == id) {
+        m_head = m_next[id];
+    } else {
+        timerid_t prev = m_head;
+        while (m_next[prev] != id) {
+            prev = m_next[prev];
+        }
+        m_next[prev] = m_next[id];
+    }
+    m_next[id] = tmr_Invalid;
+    m_armed &= ~(1u << id);
+}
+
+void MyTimers::armWake()
+{
+    if (m_head == tmr_Invalid) {
+        m_wake.detach();
+        m_wakeArmed = false;
+        return;
+    }
+
+    // time until the head deadline, measured from the exact us the time base was last updated
+    int32_t remaining = (int32_t)(m_deadline[m_head] - now());
+    if (remaining <= 0) {
+        return;     // already due, whoever is waiting on it will see that without an interrupt
+    }
+    if ((uint32_t)remaining > MYTIMERS_MAX_WAKE_MS) {
+        remaining = MYTIMERS_MAX_WAKE_MS;
+    }
+    m_wakeArmed = true;
+    m_wake.attach_us(this, &MyTimers::wake, (uint32_t)remaining * 1000 - m_usRemainder);
+}
+
+void MyTimers::wake()
+{
+    // nothing to do other than wake the main loop, the deadline is seen the next time the timer is checked
+    m_isrCount++;
+    m_wakeArmed = false;
+}
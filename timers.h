@@ -1,57 +1,102 @@
-#ifndef __TIMERS_H__
-#define __TIMERS_H__
-
-#include "mbed.h"
-
-/*!
- * \brief The MyTimers class creates a Ticker and decrements a collection of unsigned longs that act as timers across the program
- *
- *  \sa eTimerType is used to link external callers with a collection of unsigned longs which are decremented
- *  each ms by \sa run().
- *  This acts as a collection of timers.
- *  This collection can be set by \sa SetTimer and retrieved by \sa GetTimer.
- */
-class MyTimers
-{
-public:
-    MyTimers();
-    ~MyTimers();
-
-    ///< eTimerType identifies each of the timers in program, and is used to set and get a timer
-    typedef enum
-    {
-        tmr_GroveMeasure,       ///< Used in GroveDht22 handler
-        tmr_GprsPower,          ///< Used to power the SIM900 on and off
-        tmr_GprsRxTx,           ///< Timeout waiting for a response from the SIM900 over the serial line
-        tmr_SdWaitError,        ///< Sd card has hit an error, wait before retrying
-        tmr_MeasFlash           ///< Flash once every 2 seconds for heartbeat
-    } eTimerType;
-
-    //! run is called each time Ticker fires, which is every 1ms, and decrements all timers if necessary
-    void run();
-
-    /*!
-     * \brief SetTimer sets the value of the timer
-     * \param timertype identifies the timer whose value we want to set
-     * \param time_ms is the value the timer will be set to, to start counting down from, in ms
-     */
-    void SetTimer(eTimerType timertype, unsigned long time_ms);
-
-    /*!
-     * \brief GetTimer gets the value of a timer
-     * \param timertype identifies the timer whose value we want to get
-     * \return the value of the timer
-     */
-    unsigned long GetTimer(eTimerType timertype);
-
-private:
-    unsigned long groveMeasureTimer;    ///< current value of timer for \sa tmr_GroveMeasure
-    unsigned long gprsPowerTimer;       ///< current value of timer for \sa tmr_GprsPower
-    unsigned long gprsRxTxTimer;        ///< current value of timer for \sa tmr_GprsRxTx
-    unsigned long sdWaitErrorTimer;     ///< current value of timer for \sa tmr_SdWaitError
-    unsigned long measFlashTimer;       ///< current value of timer for \sa tmr_MeasFlash
-
-    Ticker *m_tick;        ///< Used to call \a run a function periodically
-};
-
-#endif
+#ifndef __TIMERS_H__
+#define __TIMERS_H__
+
+#include "mbed.h"
+
+#define MYTIMERS_MAX            16          // maximum number of timers that can be registered
+#define MYTIMERS_MAX_WAKE_MS    60000u      // longest single compare interrupt, so the time base is refreshed before us_ticker wraps
+
+/*!
+ * \brief The MyTimers class keeps a monotonic millisecond time base and a collection of deadline timers used across the program
+ *
+ * A handler registers each timer it needs with \sa registerTimer, usually in its constructor, and keeps the returned id.
+ * \sa SetTimer (relative) or \sa SetDeadline (absolute) store a deadline against the id, and \sa GetTimer returns how
+ * long is left until it, or 0 once it has passed. Nothing is decremented, so nothing needs to run while no timer is due.
+ *
+ * Armed timers are kept in a list sorted by deadline, so the earliest deadline is always at the head and
+ * \sa nextExpiry is O(1). A single Timeout is programmed for that head whenever it changes, which is the only
+ * interrupt the timers need.
+ */
+class MyTimers
+{
+public:
+    MyTimers();
+
+    typedef int8_t timerid_t;               ///< identifies a registered timer
+    static const timerid_t tmr_Invalid = -1;    ///< returned when no more timers can be registered
+
+    /*!
+     * \brief registerTimer allocates a new timer, which starts off elapsed
+     * \return the id to pass to the other functions, or \a tmr_Invalid if \a MYTIMERS_MAX timers are already registered
+     */
+    timerid_t registerTimer();
+
+    /*!
+     * \brief now is the monotonic time base
+     * \return the number of ms since construction. Wraps after ~49 days, so compare ticks by signed difference
+     */
+    uint32_t now();
+
+    /*!
+     * \brief SetTimer sets the timer to elapse \a time_ms from now
+     * \param timertype identifies the timer whose value we want to set
+     * \param time_ms is how long until the timer elapses, in ms. 0 elapses it straight away
+     */
+    void SetTimer(timerid_t timertype, unsigned long time_ms);
+
+    /*!
+     * \brief SetDeadline sets the timer to elapse at an absolute tick of \sa now
+     * \param timertype identifies the timer whose value we want to set
+     * \param deadline is the value of \sa now at which the timer elapses
+     */
+    void SetDeadline(timerid_t timertype, uint32_t deadline);
+
+    /*!
+     * \brief GetTimer gets the time left on a timer
+     * \param timertype identifies the timer whose value we want to get
+     * \return the number of ms until the deadline, or 0 if it has passed (an invalid id is always 0)
+     */
+    unsigned long GetTimer(timerid_t timertype);
+
+    /*!
+     * \brief nextExpiry gets the earliest deadline of all armed timers, in (amortised) O(1), and makes sure the interrupt is programmed for it
+     * \param deadline is set to the earliest deadline, as a tick of \sa now
+     * \return true if a timer is armed, false if there is nothing to wait for
+     */
+    bool nextExpiry(uint32_t *deadline);
+
+    /*!
+     * \brief skip moves the time base on by time the us ticker did not count, as it is stopped in deep sleep, and
+     * programs the interrupt for what is left of the earliest deadline
+     * \param time_ms is how long the ticker was stopped for
+     */
+    void skip(uint32_t time_ms);
+
+    //! wakeArmed is true while the compare interrupt is programmed and has not fired yet
+    bool wakeArmed() const { return m_wakeArmed; }
+
+    //! isrCount is the number of timer interrupts taken since construction
+    uint32_t isrCount() const { return m_isrCount; }
+
+private:
+    uint32_t  m_deadline[MYTIMERS_MAX];     ///< deadline of each timer, as a tick of \sa now
+    timerid_t m_next[MYTIMERS_MAX];         ///< next timer in the sorted armed list
+    uint16_t  m_armed;                      ///< bit set for each timer in the armed list
+    timerid_t m_head;                       ///< armed timer with the earliest deadline
+    uint8_t   m_count;                      ///< number of registered timers
+
+    uint32_t m_ms;          ///< current value of the time base
+    uint32_t m_lastUs;      ///< us_ticker value when the time base was last updated
+    uint32_t m_usRemainder; ///< us not yet counted into \a m_ms
+
+    Timeout m_wake;                 ///< compare interrupt for the head of the armed list
+    volatile uint32_t m_isrCount;   ///< incremented by \a wake
+    volatile bool m_wakeArmed;      ///< true while \a m_wake is programmed and has not fired yet
+
+    void link(timerid_t id);        // insert into the armed list in deadline order
+    void unlink(timerid_t id);      // remove from the armed list
+    void armWake();                 // program \a m_wake for the current head
+    void wake();                    // called by \a m_wake
+};
+
+#endif